@@ -0,0 +1,772 @@
+#include "broker.h"
+#include "core/config.h"
+#include "core/logger.h"
+#include "core/realtime.h"
+#include "qos/buffer_segments.h"
+#include "stats/clock_offset.h"
+#include "utils/time_utils.h"
+#include <inttypes.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The producers (realmq_client) send to the broker as they would send to a server, and every consumer (realmq_server)
+ * receives from the broker as it would receive from a client. The broker does not decode the messages: the ingress
+ * thread reads only the topic and the message ID at the start of the frame, copies the frame once in a
+ * reference-counted buffer of the frame pool and hands it to the shard of its topic (topic ID % shards, so the frames
+ * of a topic stay in order). Every shard is a thread, pinned to its own CPU, with its own transport to every consumer:
+ * it sends the same buffer to all the consumers of the topic, with one batch per consumer on the backends that support
+ * it (a single copy into the kernel) or with zero-copy sends on the others (no copy at all, the backend releases its
+ * reference when done).
+ * The ACKs are hop by hop: the broker acknowledges a frame to the producers as soon as it has been queued (the
+ * producer side of the QoS is unchanged), and keeps it in the pending table of its shard until all its consumers
+ * acknowledged it. The shards ask the ACKs with a heartbeat (the consumers answer as they answer a client) and resend
+ * the frames still pending after resend_ms. The consumers prefix their ACKs with their index in the consumers list
+ * (server.subscriber_id), so a single ACK transport serves all of them.
+ * The broker stops after the STOP of the configured number of producers (identified by the first message ID they
+ * carry in the STOP): the shards forward the queued frames, wait for the last ACKs and send STOP to the consumers.
+ */
+
+#define BROKER_IDLE_SPINS 1000          // Empty polls of a shard before it starts sleeping
+#define BROKER_IDLE_SLEEP_US 50
+#define BROKER_DRAIN_RESENDS 5          // Resends allowed to the pending frames after the last STOP
+#define BROKER_STOP_REPEAT 3            // STOP messages sent to the consumers (they can be lost)
+#define BROKER_RELEASE_WAIT_MS 1000     // Time given to the backends to release the zero-copy frames
+
+/**
+ * @brief Initialize the broker (the transports are opened by start_broker).
+ * @param broker
+ * @param options
+ * @return 0 on success, -1 on error
+ */
+int init_broker(Broker *broker, const BrokerOptions *options) {
+    memset(broker, 0, sizeof(Broker));
+    broker->options = *options;
+    BrokerOptions *opts = &broker->options;
+
+    if (opts->protocol == NULL || opts->ingress_address == NULL) {
+        logger(LOG_LEVEL_ERROR, "The broker needs a protocol and an ingress address");
+        return -1;
+    }
+    if (opts->shards < 1) opts->shards = 1;
+    if (opts->shards > BROKER_MAX_SHARDS) opts->shards = BROKER_MAX_SHARDS;
+    if (opts->heartbeat_ms <= 0) opts->heartbeat_ms = 100;
+    if (opts->resend_ms <= 0) opts->resend_ms = 1000;
+    broker->acks = opts->producer_ack_address != NULL && opts->consumer_ack_address != NULL;
+
+    // Enough frames for full queues and full pending tables, so that the pool only runs out when a consumer is stuck
+    if (opts->pool_frames == 0) {
+        opts->pool_frames = (size_t) opts->shards * (BROKER_QUEUE_SIZE + (broker->acks ? BROKER_PENDING_SLOTS : 0)) +
+                            BROKER_BATCH_SIZE;
+    }
+    if (init_frame_pool(&broker->pool, opts->pool_frames, BROKER_FRAME_SIZE) != 0) {
+        return -1;
+    }
+
+    broker->shards = calloc((size_t) opts->shards, sizeof(BrokerShard));
+    if (broker->shards == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the broker shards");
+        release_frame_pool(&broker->pool);
+        return -1;
+    }
+    for (int i = 0; i < opts->shards; i++) {
+        BrokerShard *shard = &broker->shards[i];
+        shard->broker = broker;
+        shard->index = i;
+        pthread_mutex_init(&shard->pending_mutex, NULL);
+        init_realtime_mutex(&shard->pending_mutex);
+        if (broker->acks) {
+            shard->pending = calloc(BROKER_PENDING_SLOTS, sizeof(BrokerPending));
+            if (shard->pending == NULL) {
+                logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the pending frames");
+                return -1;
+            }
+            prefault_memory(shard->pending, BROKER_PENDING_SLOTS * sizeof(BrokerPending));
+        }
+    }
+
+    init_dynamic_array(&broker->accepted, 1024, sizeof(uint64_t));
+    return 0;
+}
+
+/**
+ * @brief Add a consumer.
+ * @param broker
+ * @param address Full address of the consumer (<protocol>://<ip>:<port>)
+ * @param topics Comma separated topics forwarded to the consumer ("*" or NULL for all)
+ * @return The index of the consumer (its subscriber ID in the ACKs), or -1 on error
+ */
+int broker_add_consumer(Broker *broker, const char *address, const char *topics) {
+    if (broker->num_consumers == BROKER_MAX_CONSUMERS) {
+        logger(LOG_LEVEL_ERROR, "Too many consumers (max %d)", BROKER_MAX_CONSUMERS);
+        return -1;
+    }
+
+    uint64_t mask = 0;
+    if (topics == NULL || strcmp(topics, "*") == 0) {
+        for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+            if (g_topics[i].registered) mask |= 1ULL << i;
+        }
+    } else {
+        char *list = strdup(topics);
+        if (list == NULL) {
+            logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the topics of a consumer");
+            return -1;
+        }
+        char *rest = list;
+        char *token;
+        while ((token = strtok_r(rest, ",", &rest))) {
+            while (*token == ' ') token++;
+            size_t len = strlen(token);
+            while (len > 0 && token[len - 1] == ' ') token[--len] = '\0';
+            int topic_id = find_topic(token);
+            if (topic_id < TOPIC_FIRST_USER) {
+                logger(LOG_LEVEL_WARN, "Unknown topic %s for consumer %s", token, address);
+                continue;
+            }
+            mask |= 1ULL << topic_id;
+        }
+        free(list);
+    }
+
+    int index = broker->num_consumers++;
+    BrokerConsumer *consumer = &broker->consumers[index];
+    strncpy(consumer->address, address, TRANSPORT_ADDRESS_SIZE - 1);
+    consumer->topics = mask;
+    for (int i = 0; i < MAX_TOPICS; i++) {
+        if (mask & (1ULL << i)) broker->topic_consumers[i] |= 1ULL << index;
+    }
+    return index;
+}
+
+/**
+ * @brief Add the consumers of a list.
+ * @param broker
+ * @param list <ip>:<port>=<topic>,<topic>;<ip>:<port>=* (the protocol is the one of the broker)
+ * @return The number of consumers, or -1 on error
+ */
+int broker_add_consumers(Broker *broker, const char *list) {
+    if (list == NULL || *list == '\0') {
+        return broker->num_consumers;
+    }
+
+    char *copy = strdup(list);
+    if (copy == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the consumers list");
+        return -1;
+    }
+
+    char separator[2] = {BROKER_CONSUMER_SEPARATOR, '\0'};
+    char *rest = copy;
+    char *item;
+    int rc = 0;
+    while ((item = strtok_r(rest, separator, &rest))) {
+        while (*item == ' ') item++;
+        if (*item == '\0') {
+            continue;
+        }
+        char *topics = strchr(item, '=');
+        if (topics != NULL) {
+            *topics++ = '\0';
+        }
+
+        char address[TRANSPORT_ADDRESS_SIZE];
+        snprintf(address, sizeof(address), "%s://%s", broker->options.protocol, item);
+        if (broker_add_consumer(broker, address, topics) == -1) {
+            rc = -1;
+            break;
+        }
+    }
+    free(copy);
+    return rc == -1 ? -1 : broker->num_consumers;
+}
+
+// ================================================= Ingress ==========================================================
+
+/**
+ * @brief Send the IDs of the accepted frames to the producers (same ACK format of the server).
+ * @param broker
+ */
+static void send_producer_acks(Broker *broker) {
+    BufferSegmentArray segments_array = marshal_and_split(&broker->accepted);
+    char ack[MAX_SEGMENT_SIZE + 16];
+
+    for (size_t i = 0; i < segments_array.count; i++) {
+        int len = snprintf(ack, sizeof(ack), "%d%c%s", broker->options.broker_id, ACK_SUBSCRIBER_SEPARATOR,
+                           segments_array.segments[i].data);
+        transport_send(broker->producer_ack, get_group(RESPONDER_GROUP), ack, (size_t) len, 0);
+    }
+    if (segments_array.count == 0) {
+        int len = snprintf(ack, sizeof(ack), "%d%cWAKEUP", broker->options.broker_id, ACK_SUBSCRIBER_SEPARATOR);
+        transport_send(broker->producer_ack, get_group(RESPONDER_GROUP), ack, (size_t) len, 0);
+    }
+
+    free_segment_array(&segments_array);
+    clean_all_elements(&broker->accepted);
+}
+
+/**
+ * @brief Record the STOP of a producer.
+ * @param broker
+ * @param payload First message ID of the producer (it identifies the producer, that sends STOP more than once)
+ * @return true when all the expected producers stopped
+ */
+static bool producer_stopped(Broker *broker, const char *payload) {
+    if (broker->acks) {
+        send_producer_acks(broker);     // Last IDs
+    }
+    if (broker->options.producers <= 0) {
+        return false;
+    }
+
+    uint64_t producer = strtoull(payload, NULL, 10);
+    for (int i = 0; i < broker->num_stopped_producers; i++) {
+        if (broker->stopped_producers[i] == producer) {
+            return false;
+        }
+    }
+    if (broker->num_stopped_producers < BROKER_MAX_PRODUCERS) {
+        broker->stopped_producers[broker->num_stopped_producers++] = producer;
+    }
+    logger(LOG_LEVEL_INFO, "Received STOP of producer %" PRIu64 " (%d/%d)", producer, broker->num_stopped_producers,
+           broker->options.producers);
+    return broker->num_stopped_producers >= broker->options.producers;
+}
+
+/**
+ * @brief Queue a frame to a shard, waiting while the queue is full (backpressure on the ingress).
+ * @param broker
+ * @param shard
+ * @param frame
+ * @return false if the broker is stopping
+ */
+static bool shard_push(Broker *broker, BrokerShard *shard, FrameBuffer *frame) {
+    uint64_t tail = atomic_load_explicit(&shard->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&shard->head, memory_order_acquire) == BROKER_QUEUE_SIZE) {
+        if (atomic_load(&broker->stopping)) {
+            return false;
+        }
+        sched_yield();
+    }
+    shard->queue[tail & (BROKER_QUEUE_SIZE - 1)] = frame;
+    atomic_store_explicit(&shard->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Handle a frame received from a producer.
+ * @param broker
+ * @param data Frame as received (not null terminated)
+ * @param size
+ * @return true when all the expected producers stopped
+ */
+static bool handle_ingress_frame(Broker *broker, const char *data, size_t size) {
+    // The topic and the message ID are read from a bounded copy of the start of the frame
+    char header[32];
+    size_t header_size = size < sizeof(header) - 1 ? size : sizeof(header) - 1;
+    memcpy(header, data, header_size);
+    header[header_size] = '\0';
+
+    uint16_t topic_id;
+    const char *payload = parse_topic(header, &topic_id);
+    if (topic_id == TOPIC_STOP) {
+        return producer_stopped(broker, payload);
+    }
+    if (topic_id == TOPIC_HEARTBEAT) {
+        if (broker->acks) send_producer_acks(broker);
+        return false;
+    }
+
+    char *end;
+    uint64_t msg_id = strtoull(payload, &end, 10);
+    if (*end != '|') {
+        msg_id = 0;     // Not a message of RealMQ: forwarded, but it cannot be acknowledged
+    }
+    atomic_fetch_add_explicit(&broker->received, 1, memory_order_relaxed);
+    topic_stat_add(topic_id, TOPIC_STAT_RECEIVED, 1);
+    topic_stat_add(topic_id, TOPIC_STAT_BYTES_RECEIVED, size);
+
+    if (broker->topic_consumers[topic_id] == 0) {
+        atomic_fetch_add_explicit(&broker->no_consumers, 1, memory_order_relaxed);
+    } else {
+        FrameBuffer *frame = frame_acquire(&broker->pool, data, size);
+        if (frame == NULL) {
+            // Not acknowledged: the producer resends it
+            atomic_fetch_add_explicit(&broker->dropped, 1, memory_order_relaxed);
+            return false;
+        }
+        frame->topic_id = topic_id;
+        frame->msg_id = msg_id;
+        frame->receive_ns = get_monotonic_time_nanos();
+
+        BrokerShard *shard = &broker->shards[topic_id % broker->options.shards];
+        if (!shard_push(broker, shard, frame)) {
+            frame_release(frame);
+            return false;
+        }
+    }
+
+    if (broker->acks && msg_id != 0) {
+        add_to_dynamic_array(&broker->accepted, &msg_id);
+    }
+    return false;
+}
+
+static void *ingress_thread(void *arg) {
+    Broker *broker = (Broker *) arg;
+    apply_thread_realtime_profile(THREAD_ROLE_RECEIVER);
+
+    TransportMessage messages[BROKER_BATCH_SIZE];
+    bool producers_done = false;
+    while (!producers_done && !atomic_load(&broker->stopping)) {
+        int count = transport_recv_batch(broker->ingress, messages, BROKER_BATCH_SIZE, 0);
+        for (int i = 0; i < count && !producers_done; i++) {
+            producers_done = handle_ingress_frame(broker, messages[i].data, messages[i].size);
+        }
+    }
+
+    if (broker->acks) {
+        send_producer_acks(broker);
+        // The responder thread of the producers stops on STOP, as with a server
+        transport_send(broker->producer_ack, get_group(RESPONDER_GROUP), "STOP", strlen("STOP"), 0);
+    }
+
+    uint64_t drain_ns = (uint64_t) BROKER_DRAIN_RESENDS * (uint64_t) broker->options.resend_ms * 1000000ULL;
+    atomic_store(&broker->drain_deadline_ns, get_monotonic_time_nanos() + drain_ns);
+    atomic_store(&broker->ingress_done, true);
+    logger(LOG_LEVEL_DEBUG, "***Exiting broker ingress thread.");
+    return NULL;
+}
+
+// ================================================== Shards ==========================================================
+
+static size_t shard_pop(BrokerShard *shard, FrameBuffer **frames, size_t max_count) {
+    uint64_t head = atomic_load_explicit(&shard->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&shard->tail, memory_order_acquire);
+    size_t count = (size_t) (tail - head) < max_count ? (size_t) (tail - head) : max_count;
+    for (size_t i = 0; i < count; i++) {
+        frames[i] = shard->queue[(head + i) & (BROKER_QUEUE_SIZE - 1)];
+    }
+    atomic_store_explicit(&shard->head, head + count, memory_order_release);
+    return count;
+}
+
+/**
+ * @brief Keep a forwarded frame until all its consumers acknowledge it.
+ * @param shard
+ * @param frame
+ * @param now
+ */
+static void track_pending(BrokerShard *shard, FrameBuffer *frame, uint64_t now) {
+    uint64_t mask = shard->broker->topic_consumers[frame->topic_id];
+    if (mask == 0 || frame->msg_id == 0) {
+        return;
+    }
+
+    frame_retain(frame, 1);
+    pthread_mutex_lock(&shard->pending_mutex);
+    BrokerPending *slot = &shard->pending[frame->msg_id & (BROKER_PENDING_SLOTS - 1)];
+    if (slot->frame != NULL) {
+        if (slot->msg_id != frame->msg_id) {
+            // Window full: the old frame is not resent anymore
+            atomic_fetch_add_explicit(&shard->overwritten, 1, memory_order_relaxed);
+        }
+        frame_release(slot->frame);
+        shard->pending_count--;
+    }
+    slot->msg_id = frame->msg_id;
+    slot->frame = frame;
+    slot->pending_mask = mask;
+    slot->sent_ns = now;
+    shard->pending_count++;
+    pthread_mutex_unlock(&shard->pending_mutex);
+}
+
+/**
+ * @brief Send a batch of frames to the consumers of their topics.
+ * @param shard
+ * @param frames
+ * @param count
+ */
+static void forward_frames(BrokerShard *shard, FrameBuffer **frames, size_t count) {
+    Broker *broker = shard->broker;
+    const char *group = get_group(MAIN_GROUP);
+    const char *data[BROKER_BATCH_SIZE];
+    size_t sizes[BROKER_BATCH_SIZE];
+    uint64_t sends = 0;
+
+    for (int c = 0; c < broker->num_consumers; c++) {
+        uint64_t consumer_bit = 1ULL << c;
+        Transport *radio = shard->radios[c];
+
+        if (transport_supports_batch(radio)) {
+            // One syscall for the whole batch, the backend copies the frames in the kernel
+            size_t n = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (broker->topic_consumers[frames[i]->topic_id] & consumer_bit) {
+                    topic_stat_add(frames[i]->topic_id, TOPIC_STAT_SENT, 1);
+                    data[n] = frames[i]->data;
+                    sizes[n] = frames[i]->size;
+                    n++;
+                }
+            }
+            if (n > 0) {
+                int sent = transport_send_batch(radio, group, data, sizes, n);
+                if (sent > 0) sends += (uint64_t) sent;
+            }
+            continue;
+        }
+
+        // The same buffer goes to every consumer, the backend releases its reference when done
+        for (size_t i = 0; i < count; i++) {
+            FrameBuffer *frame = frames[i];
+            if (!(broker->topic_consumers[frame->topic_id] & consumer_bit)) {
+                continue;
+            }
+            frame_retain(frame, 1);
+            topic_stat_add(frame->topic_id, TOPIC_STAT_SENT, 1);
+            if (transport_send_zero_copy(radio, group, frame->data, frame->size, frame_release_fn, frame) >= 0) {
+                sends++;
+            }
+        }
+    }
+
+    uint64_t now = get_monotonic_time_nanos();
+    for (size_t i = 0; i < count; i++) {
+        if (broker->acks) {
+            track_pending(shard, frames[i], now);
+        }
+        frame_release(frames[i]);
+    }
+    atomic_fetch_add_explicit(&shard->forwarded, count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->sends, sends, memory_order_relaxed);
+}
+
+/**
+ * @brief Resend the frames not acknowledged within resend_ms.
+ * @param shard
+ * @param now
+ * @return The number of pending frames
+ */
+static size_t resend_pending(BrokerShard *shard, uint64_t now) {
+    Broker *broker = shard->broker;
+    uint64_t resend_ns = (uint64_t) broker->options.resend_ms * 1000000ULL;
+    const char *group = get_group(MAIN_GROUP);
+
+    pthread_mutex_lock(&shard->pending_mutex);
+    size_t pending_count = shard->pending_count;
+    for (size_t i = 0; i < BROKER_PENDING_SLOTS && pending_count > 0; i++) {
+        BrokerPending *slot = &shard->pending[i];
+        if (slot->frame == NULL || now - slot->sent_ns < resend_ns) {
+            continue;
+        }
+        for (int c = 0; c < broker->num_consumers; c++) {
+            if (slot->pending_mask & (1ULL << c)) {
+                transport_send(shard->radios[c], group, slot->frame->data, slot->frame->size, 0);
+                atomic_fetch_add_explicit(&shard->resent, 1, memory_order_relaxed);
+                topic_stat_add(slot->frame->topic_id, TOPIC_STAT_RESENT, 1);
+            }
+        }
+        slot->sent_ns = now;
+    }
+    pthread_mutex_unlock(&shard->pending_mutex);
+    return pending_count;
+}
+
+/**
+ * @brief Ask the ACKs of the consumers with a heartbeat (they answer with the IDs received since the last one).
+ * @param shard
+ */
+static void request_consumer_acks(BrokerShard *shard) {
+    const char *heartbeat = control_frame(TOPIC_HEARTBEAT);
+    for (int c = 0; c < shard->broker->num_consumers; c++) {
+        transport_send(shard->radios[c], get_group(MAIN_GROUP), heartbeat, strlen(heartbeat), 0);
+    }
+}
+
+static size_t shard_pending_count(BrokerShard *shard) {
+    pthread_mutex_lock(&shard->pending_mutex);
+    size_t count = shard->pending_count;
+    pthread_mutex_unlock(&shard->pending_mutex);
+    return count;
+}
+
+static void *shard_thread(void *arg) {
+    BrokerShard *shard = (BrokerShard *) arg;
+    Broker *broker = shard->broker;
+
+    apply_thread_realtime_profile(THREAD_ROLE_SENDER);
+    if (broker->options.first_cpu >= 0) {
+        int cpu = broker->options.first_cpu + shard->index;
+        int rc = pin_thread_to_cpu(cpu);
+        if (rc != 0) {
+            logger(LOG_LEVEL_WARN, "Failed to pin broker shard %d to CPU %d: %s", shard->index, cpu, strerror(rc));
+        }
+    }
+
+    FrameBuffer *frames[BROKER_BATCH_SIZE];
+    uint64_t heartbeat_ns = (uint64_t) broker->options.heartbeat_ms * 1000000ULL;
+    unsigned int idle = 0;
+
+    while (true) {
+        size_t count = shard_pop(shard, frames, BROKER_BATCH_SIZE);
+        if (count > 0) {
+            forward_frames(shard, frames, count);
+            idle = 0;
+        }
+
+        uint64_t now = get_monotonic_time_nanos();
+        if (broker->acks && now - shard->last_heartbeat_ns >= heartbeat_ns) {
+            if (resend_pending(shard, now) > 0) {
+                request_consumer_acks(shard);
+            }
+            shard->last_heartbeat_ns = now;
+        }
+        if (count > 0) {
+            continue;
+        }
+
+        if (atomic_load(&broker->stopping)) {
+            break;
+        }
+        if (atomic_load(&broker->ingress_done) &&
+            atomic_load(&shard->head) == atomic_load(&shard->tail) &&
+            (!broker->acks || shard_pending_count(shard) == 0 || now >= atomic_load(&broker->drain_deadline_ns))) {
+            break;
+        }
+
+        if (++idle > BROKER_IDLE_SPINS) {
+            usleep(BROKER_IDLE_SLEEP_US);
+        }
+    }
+
+    // Frames left in the queue by a forced stop
+    size_t count;
+    while ((count = shard_pop(shard, frames, BROKER_BATCH_SIZE)) > 0) {
+        forward_frames(shard, frames, count);
+    }
+
+    // The last shard stops the consumers (the others may still be forwarding before)
+    if (atomic_fetch_sub(&broker->running_shards, 1) == 1) {
+        const char *stop = control_frame(TOPIC_STOP);
+        for (int i = 0; i < BROKER_STOP_REPEAT; i++) {
+            for (int c = 0; c < broker->num_consumers; c++) {
+                transport_send(shard->radios[c], get_group(MAIN_GROUP), stop, strlen(stop), 0);
+            }
+            usleep(100000);
+        }
+        logger(LOG_LEVEL_INFO, "Sent STOP to %d consumers", broker->num_consumers);
+    }
+    logger(LOG_LEVEL_DEBUG, "***Exiting broker shard %d.", shard->index);
+    return NULL;
+}
+
+// =================================================== ACKs ===========================================================
+
+/**
+ * @brief Release the frames acknowledged by a consumer.
+ * @param broker
+ * @param consumer Index of the consumer
+ * @param acked IDs of the frames
+ */
+static void consumer_acked(Broker *broker, int consumer, DynamicArray *acked) {
+    uint64_t consumer_bit = 1ULL << consumer;
+    for (int s = 0; s < broker->options.shards; s++) {
+        BrokerShard *shard = &broker->shards[s];
+        pthread_mutex_lock(&shard->pending_mutex);
+        for (size_t i = 0; i < acked->size && shard->pending_count > 0; i++) {
+            uint64_t msg_id = *(uint64_t *) acked->data[i];
+            BrokerPending *slot = &shard->pending[msg_id & (BROKER_PENDING_SLOTS - 1)];
+            if (slot->frame == NULL || slot->msg_id != msg_id) {
+                continue;
+            }
+            slot->pending_mask &= ~consumer_bit;
+            if (slot->pending_mask == 0) {
+                frame_release(slot->frame);
+                slot->frame = NULL;
+                shard->pending_count--;
+            }
+        }
+        pthread_mutex_unlock(&shard->pending_mutex);
+    }
+}
+
+static void *ack_thread(void *arg) {
+    Broker *broker = (Broker *) arg;
+    apply_thread_realtime_profile(THREAD_ROLE_RESPONDER);
+
+    char buffer[2048];
+    while (atomic_load(&broker->running_shards) > 0) {
+        if (transport_recv(broker->consumer_ack, buffer, sizeof(buffer), 0) == -1) {
+            continue;
+        }
+
+        // <consumer>#<id>|<id>|... (the consumer is its subscriber ID)
+        int consumer;
+        const char *ids = parse_ack_header(buffer, &consumer);
+        if (consumer < 0 || consumer >= broker->num_consumers) {
+            logger(LOG_LEVEL_WARN, "ACK of unknown consumer %d", consumer);
+            continue;
+        }
+        if (strncmp(ids, CLOCK_SYNC_PREFIX, strlen(CLOCK_SYNC_PREFIX)) == 0) {
+            continue;   // Clock offset probe of a consumer: the clocks are synchronized only without a broker
+        }
+        DynamicArray *acked = unmarshal_uint64_array(ids);
+        if (acked == NULL) {
+            continue;
+        }
+        consumer_acked(broker, consumer, acked);
+        atomic_fetch_add_explicit(&broker->consumer_acks, 1, memory_order_relaxed);
+
+        release_dynamic_array(acked);
+        free(acked);
+    }
+    logger(LOG_LEVEL_DEBUG, "***Exiting broker ACK thread.");
+    return NULL;
+}
+
+// ================================================= Lifecycle ========================================================
+
+/**
+ * @brief Open the transports and start the threads.
+ * @param broker
+ * @return 0 on success, -1 on error (release_broker closes what has been opened)
+ */
+int start_broker(Broker *broker) {
+    BrokerOptions *opts = &broker->options;
+    if (broker->num_consumers == 0) {
+        logger(LOG_LEVEL_WARN, "Broker started without consumers");
+    }
+
+    // The shards connect to the consumers first, the producers are accepted once the fan-out is ready
+    for (int s = 0; s < opts->shards; s++) {
+        for (int c = 0; c < broker->num_consumers; c++) {
+            broker->shards[s].radios[c] = transport_open(opts->protocol, opts->context, TRANSPORT_SENDER,
+                                                         broker->consumers[c].address, NULL, opts->timeout);
+            if (broker->shards[s].radios[c] == NULL) {
+                logger(LOG_LEVEL_ERROR, "Failed to open the transport to consumer %s",
+                       broker->consumers[c].address);
+                return -1;
+            }
+        }
+    }
+
+    if (broker->acks) {
+        broker->producer_ack = transport_open(opts->protocol, opts->context, TRANSPORT_SENDER,
+                                              opts->producer_ack_address, NULL, opts->timeout);
+        broker->consumer_ack = transport_open(opts->protocol, opts->context, TRANSPORT_RECEIVER,
+                                              opts->consumer_ack_address, get_group(RESPONDER_GROUP), opts->timeout);
+        if (broker->producer_ack == NULL || broker->consumer_ack == NULL) {
+            logger(LOG_LEVEL_ERROR, "Failed to open the ACK transports of the broker");
+            return -1;
+        }
+    }
+
+    broker->ingress = transport_open(opts->protocol, opts->context, TRANSPORT_RECEIVER, opts->ingress_address,
+                                     get_group(MAIN_GROUP), opts->timeout);
+    if (broker->ingress == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the ingress transport of the broker");
+        return -1;
+    }
+
+    atomic_store(&broker->running_shards, opts->shards);
+    for (int s = 0; s < opts->shards; s++) {
+        pthread_create(&broker->shards[s].thread, NULL, shard_thread, &broker->shards[s]);
+    }
+    if (broker->acks) {
+        pthread_create(&broker->ack_thread, NULL, ack_thread, broker);
+    }
+    pthread_create(&broker->ingress_thread, NULL, ingress_thread, broker);
+    broker->started = true;
+
+    logger(LOG_LEVEL_INFO, "Broker started on %s: %d consumers, %d shards, ACKs %s", opts->ingress_address,
+           broker->num_consumers, opts->shards, broker->acks ? "enabled" : "disabled");
+    return 0;
+}
+
+/**
+ * @brief Wait for the threads of the broker.
+ * @param broker
+ */
+void wait_broker(Broker *broker) {
+    if (!broker->started) {
+        return;
+    }
+    pthread_join(broker->ingress_thread, NULL);
+    for (int s = 0; s < broker->options.shards; s++) {
+        pthread_join(broker->shards[s].thread, NULL);
+    }
+    if (broker->acks) {
+        pthread_join(broker->ack_thread, NULL);
+    }
+    broker->started = false;
+}
+
+/**
+ * @brief Stop the broker without waiting for the STOP of the producers.
+ * @param broker
+ */
+void stop_broker(Broker *broker) {
+    atomic_store(&broker->stopping, true);
+    wait_broker(broker);
+}
+
+void report_broker(Broker *broker) {
+    logger(LOG_LEVEL_INFO2, "[broker] received %" PRIu64 ", without consumers %" PRIu64 ", dropped %" PRIu64
+                            ", consumer ACKs %" PRIu64 ", free frames %zu/%zu",
+           atomic_load(&broker->received), atomic_load(&broker->no_consumers), atomic_load(&broker->dropped),
+           atomic_load(&broker->consumer_acks), frame_pool_available(&broker->pool), broker->pool.count);
+    for (int s = 0; s < broker->options.shards; s++) {
+        BrokerShard *shard = &broker->shards[s];
+        logger(LOG_LEVEL_INFO2, "[broker] shard %d: forwarded %" PRIu64 ", sends %" PRIu64 ", resent %" PRIu64
+                                ", overwritten %" PRIu64,
+               s, atomic_load(&shard->forwarded), atomic_load(&shard->sends), atomic_load(&shard->resent),
+               atomic_load(&shard->overwritten));
+    }
+}
+
+/**
+ * @brief Close the transports and release the memory of the broker.
+ * @param broker
+ */
+void release_broker(Broker *broker) {
+    if (broker->shards != NULL) {
+        for (int s = 0; s < broker->options.shards; s++) {
+            BrokerShard *shard = &broker->shards[s];
+            for (int c = 0; c < broker->num_consumers; c++) {
+                transport_close(shard->radios[c]);
+                shard->radios[c] = NULL;
+            }
+            if (shard->pending != NULL) {
+                for (size_t i = 0; i < BROKER_PENDING_SLOTS; i++) {
+                    frame_release(shard->pending[i].frame);
+                }
+                free(shard->pending);
+            }
+            pthread_mutex_destroy(&shard->pending_mutex);
+        }
+        free(broker->shards);
+        broker->shards = NULL;
+    }
+
+    transport_close(broker->ingress);
+    transport_close(broker->producer_ack);
+    transport_close(broker->consumer_ack);
+    broker->ingress = broker->producer_ack = broker->consumer_ack = NULL;
+    release_dynamic_array(&broker->accepted);
+
+    // The zero-copy sends still queued in the backends give their frames back asynchronously
+    for (int i = 0; i < BROKER_RELEASE_WAIT_MS && frame_pool_available(&broker->pool) != broker->pool.count; i++) {
+        usleep(1000);
+    }
+    if (frame_pool_available(&broker->pool) != broker->pool.count) {
+        // Freeing it would let the backends write into released memory
+        logger(LOG_LEVEL_WARN, "Frames still used by the transports, the frame pool is not released");
+        return;
+    }
+    release_frame_pool(&broker->pool);
+}
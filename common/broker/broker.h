@@ -0,0 +1,142 @@
+//  =====================================================================
+//  broker.h
+//
+//  Broker: fan-out of the producer frames to the consumers of their
+//  topics (per-core forwarding shards, hop-by-hop ACKs)
+//  =====================================================================
+
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "broker/frame_pool.h"
+#include "core/topics.h"
+#include "qos/dynamic_array.h"
+#include "qos/subscribers.h"
+#include "transport/transport.h"
+
+#define BROKER_MAX_CONSUMERS MAX_SUBSCRIBERS    // The index of a consumer is its subscriber ID in the ACKs
+#define BROKER_MAX_SHARDS 64
+#define BROKER_MAX_PRODUCERS 64
+#define BROKER_QUEUE_SIZE 1024                  // Frames between the ingress thread and a shard (power of 2)
+#define BROKER_PENDING_SLOTS 4096               // Frames waiting for the consumer ACKs, per shard (power of 2)
+#define BROKER_BATCH_SIZE 32                    // Frames received/forwarded with a single batch
+#define BROKER_FRAME_SIZE 2048                  // Max size of a forwarded frame
+#define BROKER_CONSUMER_SEPARATOR ';'           // Consumers list: <ip>:<port>=<topic>,<topic>;<ip>:<port>=*
+
+typedef struct {
+    char address[TRANSPORT_ADDRESS_SIZE];       // <protocol>://<ip>:<port>
+    uint64_t topics;                            // Mask of the topic IDs forwarded to the consumer
+} BrokerConsumer;
+
+// Frame forwarded to some consumers and not acknowledged by all of them yet
+typedef struct {
+    uint64_t msg_id;
+    FrameBuffer *frame;                         // One reference held by the slot
+    uint64_t pending_mask;                      // Consumers that did not ACK the frame yet
+    uint64_t sent_ns;                           // Last (re)send
+} BrokerPending;
+
+typedef struct Broker Broker;
+
+typedef struct {
+    // Single producer (ingress thread), single consumer (shard thread), on different cache lines
+    _Alignas(64) _Atomic uint64_t tail;
+    _Alignas(64) _Atomic uint64_t head;
+    FrameBuffer *queue[BROKER_QUEUE_SIZE];
+
+    Broker *broker;
+    int index;
+    pthread_t thread;
+    Transport *radios[BROKER_MAX_CONSUMERS];    // Own transport to every consumer (no lock on the send path)
+
+    pthread_mutex_t pending_mutex;              // Shared with the ACK thread
+    BrokerPending *pending;
+    size_t pending_count;
+    uint64_t last_heartbeat_ns;
+
+    _Atomic uint64_t forwarded;                 // Frames taken from the queue
+    _Atomic uint64_t sends;                     // Frames sent to a consumer (fan-out included)
+    _Atomic uint64_t resent;
+    _Atomic uint64_t overwritten;               // Pending frames evicted before all the ACKs
+} BrokerShard;
+
+// The addresses must stay valid until the broker is released
+typedef struct {
+    const char *protocol;
+    void *context;                              // ZMQ context (NULL for the other backends)
+    const char *ingress_address;                // Full address where the producers send
+    const char *producer_ack_address;           // Full address of the ACKs to the producers (NULL: no ACKs)
+    const char *consumer_ack_address;           // Full address where the consumers send their ACKs (NULL: no ACKs)
+    int broker_id;                              // Subscriber ID of the broker in the ACKs to the producers
+    int shards;                                 // Forwarding threads
+    int first_cpu;                              // CPU of shard 0, shard i on first_cpu + i (-1: no pinning)
+    int producers;                              // Stop after the STOP of this number of producers (0: never)
+    int heartbeat_ms;                           // Interval of the ACK requests to the consumers
+    int resend_ms;                              // Frames not acknowledged after this time are resent
+    int timeout;                                // Receive timeout of the transports
+    size_t pool_frames;                         // Frame buffers (0: enough for the queues and the pending tables)
+} BrokerOptions;
+
+struct Broker {
+    BrokerOptions options;
+    bool acks;                                  // Hop-by-hop ACKs (producer -> broker -> consumers)
+
+    BrokerConsumer consumers[BROKER_MAX_CONSUMERS];
+    int num_consumers;
+    uint64_t topic_consumers[MAX_TOPICS];       // Consumers of every topic
+
+    BrokerShard *shards;
+    FramePool pool;
+
+    Transport *ingress;
+    Transport *producer_ack;
+    Transport *consumer_ack;
+    pthread_t ingress_thread;
+    pthread_t ack_thread;
+    bool started;
+
+    DynamicArray accepted;                      // IDs to acknowledge to the producers (ingress thread only)
+    uint64_t stopped_producers[BROKER_MAX_PRODUCERS];
+    int num_stopped_producers;
+
+    _Atomic bool stopping;                      // Forced stop
+    _Atomic bool ingress_done;                  // All the producers stopped, the shards drain their frames
+    _Atomic uint64_t drain_deadline_ns;
+    _Atomic int running_shards;
+
+    _Atomic uint64_t received;
+    _Atomic uint64_t no_consumers;              // Frames of topics without consumers
+    _Atomic uint64_t dropped;                   // Not accepted (pool empty), resent by the producer
+    _Atomic uint64_t consumer_acks;
+};
+
+// Initialize the broker (no transport is opened yet), return 0 on success
+int init_broker(Broker *broker, const BrokerOptions *options);
+
+// Add a consumer (full address) of the comma separated topics ("*" for all), return its index or -1
+int broker_add_consumer(Broker *broker, const char *address, const char *topics);
+
+// Add the consumers of a list (<ip>:<port>=<topics>;...), return the number of consumers or -1
+int broker_add_consumers(Broker *broker, const char *list);
+
+// Open the transports and start the ingress, shard and ACK threads
+int start_broker(Broker *broker);
+
+// Wait until the broker stops (STOP of all the producers) and the shards drained their frames
+void wait_broker(Broker *broker);
+
+// Stop the broker without waiting for the producers (the queued frames are still forwarded)
+void stop_broker(Broker *broker);
+
+// Log the statistics of the broker and of its shards
+void report_broker(Broker *broker);
+
+// Close the transports and release the frames
+void release_broker(Broker *broker);
+
+#endif //BROKER_H
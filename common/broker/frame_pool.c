@@ -0,0 +1,153 @@
+#include "frame_pool.h"
+#include "core/logger.h"
+#include "core/realtime.h"
+#include <stdlib.h>
+#include <string.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The broker copies every received frame once, into a buffer of this pool, and never serializes it again: the shards
+ * send the same buffer to all the consumers of its topic. Every user of the buffer holds a reference (the shard while
+ * it forwards it, every zero-copy send until the backend is done with it, the pending table until the consumers ACK
+ * it), the last release puts the buffer back on the free list.
+ * The buffers are allocated and prefaulted at startup (no malloc on the forwarding path), each one starts on its own
+ * cache line so that the refcounts of two frames never share a line.
+ */
+
+/**
+ * @brief Allocate the buffers of the pool.
+ * @param pool
+ * @param count Number of buffers
+ * @param frame_size Max size of a frame
+ * @return 0 on success, -1 on error
+ */
+int init_frame_pool(FramePool *pool, size_t count, size_t frame_size) {
+    memset(pool, 0, sizeof(FramePool));
+    if (count == 0 || frame_size == 0) {
+        logger(LOG_LEVEL_ERROR, "Invalid frame pool size");
+        return -1;
+    }
+
+    size_t stride = sizeof(FrameBuffer) + frame_size + 1;
+    stride = (stride + FRAME_POOL_CACHE_LINE - 1) / FRAME_POOL_CACHE_LINE * FRAME_POOL_CACHE_LINE;
+
+    if (posix_memalign((void **) &pool->memory, FRAME_POOL_CACHE_LINE, count * stride) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the frame pool");
+        pool->memory = NULL;
+        return -1;
+    }
+    prefault_memory(pool->memory, count * stride);
+
+    pool->count = count;
+    pool->frame_size = frame_size;
+    pool->stride = stride;
+    pthread_mutex_init(&pool->mutex, NULL);
+    init_realtime_mutex(&pool->mutex);
+
+    // Free list in memory order, so that the first frames reuse the same (hot) buffers
+    for (size_t i = count; i > 0; i--) {
+        FrameBuffer *frame = (FrameBuffer *) (pool->memory + (i - 1) * stride);
+        atomic_init(&frame->refcount, 0);
+        frame->pool = pool;
+        frame->next_free = pool->free_list;
+        pool->free_list = frame;
+    }
+    atomic_init(&pool->available, count);
+    return 0;
+}
+
+/**
+ * @brief Copy a frame into a free buffer.
+ * @param pool
+ * @param data
+ * @param size
+ * @return The frame with one reference, or NULL if the pool is empty or the frame too big
+ */
+FrameBuffer *frame_acquire(FramePool *pool, const char *data, size_t size) {
+    if (size > pool->frame_size) {
+        logger(LOG_LEVEL_WARN, "Frame of %zu bytes bigger than the pool buffers (%zu)", size, pool->frame_size);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    FrameBuffer *frame = pool->free_list;
+    if (frame != NULL) {
+        pool->free_list = frame->next_free;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    if (frame == NULL) {
+        return NULL;
+    }
+    atomic_fetch_sub_explicit(&pool->available, 1, memory_order_relaxed);
+
+    memcpy(frame->data, data, size);
+    frame->data[size] = '\0';
+    frame->size = size;
+    frame->topic_id = 0;
+    frame->msg_id = 0;
+    frame->receive_ns = 0;
+    frame->next_free = NULL;
+    atomic_store_explicit(&frame->refcount, 1, memory_order_relaxed);
+    return frame;
+}
+
+/**
+ * @brief Add references to a frame (the caller already holds one).
+ * @param frame
+ * @param count
+ */
+void frame_retain(FrameBuffer *frame, uint32_t count) {
+    atomic_fetch_add_explicit(&frame->refcount, count, memory_order_relaxed);
+}
+
+/**
+ * @brief Release a reference of a frame.
+ * @param frame
+ */
+void frame_release(FrameBuffer *frame) {
+    if (frame == NULL) {
+        return;
+    }
+    uint32_t previous = atomic_fetch_sub_explicit(&frame->refcount, 1, memory_order_acq_rel);
+    if (previous != 1) {
+        return;
+    }
+
+    FramePool *pool = frame->pool;
+    pthread_mutex_lock(&pool->mutex);
+    frame->next_free = pool->free_list;
+    pool->free_list = frame;
+    pthread_mutex_unlock(&pool->mutex);
+    atomic_fetch_add_explicit(&pool->available, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Release function of the zero-copy sends.
+ * @param data Unused (it points inside the frame)
+ * @param hint The frame
+ */
+void frame_release_fn(void *data, void *hint) {
+    (void) data;
+    frame_release((FrameBuffer *) hint);
+}
+
+size_t frame_pool_available(FramePool *pool) {
+    return atomic_load_explicit(&pool->available, memory_order_relaxed);
+}
+
+/**
+ * @brief Free the buffers of the pool (all the frames must have been released).
+ * @param pool
+ */
+void release_frame_pool(FramePool *pool) {
+    if (pool->memory == NULL) {
+        return;
+    }
+    if (frame_pool_available(pool) != pool->count) {
+        logger(LOG_LEVEL_WARN, "Releasing the frame pool with %zu frames still in use",
+               pool->count - frame_pool_available(pool));
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->memory);
+    memset(pool, 0, sizeof(FramePool));
+}
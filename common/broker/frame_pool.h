@@ -0,0 +1,65 @@
+//  =====================================================================
+//  frame_pool.h
+//
+//  Pool of reference-counted frame buffers (shared by the fan-out)
+//  =====================================================================
+
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define FRAME_POOL_CACHE_LINE 64
+
+typedef struct FramePool FramePool;
+
+/**
+ * A received frame, shared by every consumer it is forwarded to. The buffer goes back to its pool when the last
+ * reference is released (by a shard, by the ACK of the last consumer or by the backend of a zero-copy send).
+ */
+typedef struct FrameBuffer {
+    _Alignas(FRAME_POOL_CACHE_LINE) _Atomic uint32_t refcount;
+    uint16_t topic_id;
+    uint64_t msg_id;
+    uint64_t receive_ns;                // Arrival in the broker (CLOCK_MONOTONIC)
+    size_t size;
+    FramePool *pool;
+    struct FrameBuffer *next_free;
+    char data[];                        // Frame as received (null terminated), pool->frame_size bytes
+} FrameBuffer;
+
+struct FramePool {
+    char *memory;
+    size_t count;
+    size_t frame_size;                  // Max size of a frame
+    size_t stride;                      // Size of a FrameBuffer with its data (multiple of the cache line)
+    FrameBuffer *free_list;
+    pthread_mutex_t mutex;              // The buffers are released by several threads
+    _Atomic size_t available;
+};
+
+// Allocate count buffers of frame_size bytes (prefaulted), return 0 on success
+int init_frame_pool(FramePool *pool, size_t count, size_t frame_size);
+
+// Copy a frame into a free buffer (refcount 1), NULL when the pool is empty or the frame too big
+FrameBuffer *frame_acquire(FramePool *pool, const char *data, size_t size);
+
+// Add count references to a frame
+void frame_retain(FrameBuffer *frame, uint32_t count);
+
+// Release a reference, the last one gives the buffer back to its pool
+void frame_release(FrameBuffer *frame);
+
+// TransportFreeFn of the zero-copy sends (hint is the frame)
+void frame_release_fn(void *data, void *hint);
+
+// Number of free buffers
+size_t frame_pool_available(FramePool *pool);
+
+void release_frame_pool(FramePool *pool);
+
+#endif //FRAME_POOL_H
@@ -1,5 +1,7 @@
 #include "config.h"
 #include "logger.h"
+#include "transport/fragment.h"
+#include "core/trace.h"
 #include <signal.h> // for raise of SIGINT
 #include <zmq.h>
 
@@ -77,6 +79,14 @@ ProtocolType get_protocol_type(void) {
         return TCP;
     } else if (strcmp(config.protocol, "udp") == 0) {
         return UDP;
+    } else if (strcmp(config.protocol, "rawudp") == 0) {
+        return RAWUDP;
+    } else if (strcmp(config.protocol, "uring") == 0) {
+        return URING;
+    } else if (strcmp(config.protocol, "shm") == 0) {
+        return SHM;
+    } else if (strcmp(config.protocol, "inproc") == 0) {
+        return INPROC;
     } else {
         logger(LOG_LEVEL_ERROR, "Not handled protocol: %s", config.protocol);
         raise(SIGINT);
@@ -177,9 +187,31 @@ void assign_key_value(char *latest_section, char *key, char *value) {
         } else if (strcmp(key, "use_json") == 0) {
             config.use_json = strcmp(value, "true") == 0;
             return;
+        } else if (strcmp(key, "use_binary") == 0) {
+            config.use_binary = strcmp(value, "true") == 0;
+            return;
         } else if (strcmp(key, "save_interval_seconds") == 0) {
             config.save_interval_seconds = convert_string_to_int(value);
             return;
+        } else if (strcmp(key, "stats_capacity") == 0) {
+            config.stats_capacity = convert_string_to_int(value);
+            if (config.stats_capacity < 1) config.stats_capacity = 100000;
+            return;
+        } else if (strcmp(key, "stats_file_records") == 0) {
+            config.stats_file_records = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "stats_file_mb") == 0) {
+            config.stats_file_mb = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "histogram_bits") == 0) {
+            config.histogram_bits = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "histogram_file") == 0) {
+            config.histogram_file = strcmp(value, "true") == 0;
+            return;
+        } else if (strcmp(key, "trace_events") == 0) {
+            config.trace_events = convert_string_to_int(value);
+            return;
         } else if (strcmp(key, "stats_folder_path") == 0) {
             config.stats_folder_path = strdup(value);
             return;
@@ -198,18 +230,239 @@ void assign_key_value(char *latest_section, char *key, char *value) {
         } else if (strcmp(key, "signal_msg_timeout") == 0) {
             config.signal_msg_timeout = convert_string_to_int(value);
             return;
+        } else if (strcmp(key, "receive_strategy") == 0) {
+            int strategy = parse_receive_strategy(value);
+            if (strategy == -1) {
+                logger(LOG_LEVEL_ERROR, "Invalid receive strategy: %s (using block)", value);
+                strategy = RECEIVE_BLOCK;
+            }
+            config.receive_strategy = (ReceiveStrategy) strategy;
+            return;
+        } else if (strcmp(key, "spin_us") == 0) {
+            config.spin_us = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "send_batch_size") == 0) {
+            config.send_batch_size = convert_string_to_int(value);
+            if (config.send_batch_size < 1) config.send_batch_size = 1;
+            return;
+        } else if (strcmp(key, "timestamping") == 0) {
+            config.timestamping = strcmp(value, "true") == 0;
+            return;
+        } else if (strcmp(key, "topics") == 0) {
+            free(config.topics);
+            config.topics = strdup(value);
+            return;
+        } else if (strcmp(key, "reliable_topics") == 0) {
+            free(config.reliable_topics);
+            config.reliable_topics = strdup(value);
+            return;
         }
     }
     if (strcmp(latest_section, "client") == 0) {
         if (strcmp(key, "sleep_starting_time") == 0) {
             config.client_action->sleep_starting_time = convert_string_to_int(value);
             return;
+        } else if (strcmp(key, "num_subscribers") == 0) {
+            config.num_subscribers = convert_string_to_int(value);
+            if (config.num_subscribers < 1) config.num_subscribers = 1;
+            if (config.num_subscribers > 64) config.num_subscribers = 64;
+            return;
+        } else if (strcmp(key, "first_message_id") == 0) {
+            config.first_message_id = strtoull(value, NULL, 10);
+            return;
+        } else if (strcmp(key, "deadline_us") == 0) {
+            config.deadline_us = strtoll(value, NULL, 10);
+            if (config.deadline_us < 0) config.deadline_us = 0;
+            return;
+        } else if (strcmp(key, "topic_deadlines") == 0) {
+            free(config.topic_deadlines);
+            config.topic_deadlines = strdup(value);
+            return;
         }
     }
     if (strcmp(latest_section, "server") == 0) {
         if (strcmp(key, "sleep_starting_time") == 0) {
             config.server_action->sleep_starting_time = convert_string_to_int(value);
             return;
+        } else if (strcmp(key, "subscribe_topics") == 0) {
+            free(config.subscribe_topics);
+            config.subscribe_topics = strdup(value);
+            return;
+        } else if (strcmp(key, "subscriber_id") == 0) {
+            config.subscriber_id = convert_string_to_int(value);
+            if (config.subscriber_id < 0 || config.subscriber_id > 63) {
+                logger(LOG_LEVEL_ERROR, "Invalid subscriber ID: %s (using 0)", value);
+                config.subscriber_id = 0;
+            }
+            return;
+        } else if (strcmp(key, "clock_sync_interval_ms") == 0) {
+            config.clock_sync_interval_ms = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "replay_source") == 0) {
+            free(config.replay_source);
+            config.replay_source = strdup(value);
+            return;
+        } else if (strcmp(key, "replay_from") == 0) {
+            free(config.replay_from);
+            config.replay_from = strdup(value);
+            return;
+        }
+    }
+    if (strcmp(latest_section, "realtime") == 0) {
+        if (strcmp(key, "enabled") == 0) {
+            config.realtime.enabled = strcmp(value, "true") == 0;
+            return;
+        } else if (strcmp(key, "sender_cpu") == 0) {
+            config.realtime.sender_cpu = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "responder_cpu") == 0) {
+            config.realtime.responder_cpu = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "receiver_cpu") == 0) {
+            config.realtime.receiver_cpu = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "stats_cpu") == 0) {
+            config.realtime.stats_cpu = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "sched_fifo") == 0) {
+            config.realtime.sched_fifo = strcmp(value, "true") == 0;
+            return;
+        } else if (strcmp(key, "sender_priority") == 0) {
+            config.realtime.sender_priority = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "responder_priority") == 0) {
+            config.realtime.responder_priority = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "receiver_priority") == 0) {
+            config.realtime.receiver_priority = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "stats_priority") == 0) {
+            config.realtime.stats_priority = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "priority_inheritance") == 0) {
+            config.realtime.priority_inheritance = strcmp(value, "true") == 0;
+            return;
+        } else if (strcmp(key, "lock_memory") == 0) {
+            config.realtime.lock_memory = strcmp(value, "true") == 0;
+            return;
+        } else if (strcmp(key, "prefault_stack_kb") == 0) {
+            config.realtime.prefault_stack_kb = convert_string_to_int(value);
+            return;
+        }
+    }
+
+    if (strcmp(latest_section, "broker") == 0) {
+        if (strcmp(key, "consumers") == 0) {
+            free(config.broker.consumers);
+            config.broker.consumers = strdup(value);
+            return;
+        } else if (strcmp(key, "ack_address") == 0) {
+            free(config.broker.ack_address);
+            config.broker.ack_address = strdup(value);
+            return;
+        } else if (strcmp(key, "shards") == 0) {
+            config.broker.shards = convert_string_to_int(value);
+            if (config.broker.shards < 1) config.broker.shards = 1;
+            return;
+        } else if (strcmp(key, "first_cpu") == 0) {
+            config.broker.first_cpu = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "producers") == 0) {
+            config.broker.producers = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "heartbeat_ms") == 0) {
+            config.broker.heartbeat_ms = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "resend_ms") == 0) {
+            config.broker.resend_ms = convert_string_to_int(value);
+            return;
+        }
+    }
+
+    if (strcmp(latest_section, "message_log") == 0) {
+        if (strcmp(key, "directory") == 0) {
+            free(config.message_log.directory);
+            config.message_log.directory = strdup(value);
+            return;
+        } else if (strcmp(key, "segment_mb") == 0) {
+            config.message_log.segment_mb = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "index_interval_kb") == 0) {
+            config.message_log.index_interval_kb = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "flush_interval_ms") == 0) {
+            config.message_log.flush_interval_ms = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "flush_messages") == 0) {
+            config.message_log.flush_messages = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "queue_kb") == 0) {
+            config.message_log.queue_kb = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "writer_cpu") == 0) {
+            config.message_log.writer_cpu = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "replay_address") == 0) {
+            free(config.message_log.replay_address);
+            config.message_log.replay_address = strdup(value);
+            return;
+        } else if (strcmp(key, "replay_rate") == 0) {
+            config.message_log.replay_rate = convert_string_to_int(value);
+            return;
+        }
+    }
+
+    if (strcmp(latest_section, "fragmentation") == 0) {
+        if (strcmp(key, "size") == 0) {
+            config.fragmentation.size = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "max_message_kb") == 0) {
+            config.fragmentation.max_message_kb = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "pending") == 0) {
+            config.fragmentation.pending = convert_string_to_int(value);
+            if (config.fragmentation.pending < 1) config.fragmentation.pending = 1;
+            return;
+        } else if (strcmp(key, "timeout_ms") == 0) {
+            config.fragmentation.timeout_ms = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "nack_interval_ms") == 0) {
+            config.fragmentation.nack_interval_ms = convert_string_to_int(value);
+            return;
+        } else if (strcmp(key, "cache_messages") == 0) {
+            config.fragmentation.cache_messages = convert_string_to_int(value);
+            return;
+        }
+    }
+
+    if (strcmp(latest_section, "metrics") == 0) {
+        if (strcmp(key, "client_address") == 0) {
+            free(config.metrics.client_address);
+            config.metrics.client_address = strdup(value);
+            return;
+        } else if (strcmp(key, "server_address") == 0) {
+            free(config.metrics.server_address);
+            config.metrics.server_address = strdup(value);
+            return;
+        }
+    }
+    if (strcmp(latest_section, "echo") == 0) {
+        if (strcmp(key, "mode") == 0) {
+            int mode = parse_echo_mode(value);
+            if (mode == -1) {
+                logger(LOG_LEVEL_ERROR, "Invalid echo mode: %s (using off)", value);
+                mode = ECHO_OFF;
+            }
+            config.echo.mode = (EchoMode) mode;
+            return;
+        } else if (strcmp(key, "sample") == 0) {
+            config.echo.sample = convert_string_to_int(value);
+            if (config.echo.sample < 1) config.echo.sample = 1;
+            return;
+        } else if (strcmp(key, "payload_sizes") == 0) {
+            free(config.echo.payload_sizes);
+            config.echo.payload_sizes = strdup(value);
+            return;
         }
     }
 
@@ -249,6 +502,69 @@ int read_config(const char *filename) {
     // Default values
     config.client_action->name = strdup("CLIENT");
     config.server_action->name = strdup("SERVER");
+    config.receive_strategy = RECEIVE_BLOCK;
+    config.spin_us = 50;
+    config.send_batch_size = 1;
+    config.stats_capacity = 100000;
+    config.stats_file_records = 100000;
+    config.stats_file_mb = 0;
+    config.histogram_bits = 7;
+    config.histogram_file = true;
+    config.trace_events = 65536;
+    config.timestamping = false;
+    config.num_subscribers = 1;
+    config.subscriber_id = 0;
+    config.clock_sync_interval_ms = 1000;
+    config.first_message_id = 0;
+    config.deadline_us = 0;
+    config.broker.shards = 1;
+    config.broker.first_cpu = -1;
+    config.broker.producers = 0;
+    config.broker.heartbeat_ms = 100;
+    config.broker.resend_ms = 1000;
+    config.message_log = (MessageLogConfig) {
+            .directory = NULL,
+            .segment_mb = 64,
+            .index_interval_kb = 4,
+            .flush_interval_ms = 100,
+            .flush_messages = 1000,
+            .queue_kb = 4096,
+            .writer_cpu = -1,
+            .replay_address = NULL,
+            .replay_rate = 100000
+    };
+    config.fragmentation = (FragmentationConfig) {
+            .size = 0,
+            .max_message_kb = 4096,
+            .pending = 4,
+            .timeout_ms = 1000,
+            .nack_interval_ms = 20,
+            .cache_messages = 8
+    };
+    config.metrics = (MetricsConfig) {
+            .client_address = NULL,
+            .server_address = NULL
+    };
+    config.echo = (EchoConfig) {
+            .mode = ECHO_OFF,
+            .sample = 1,
+            .payload_sizes = NULL
+    };
+    config.realtime = (RealtimeConfig) {
+            .enabled = false,
+            .sender_cpu = -1,
+            .responder_cpu = -1,
+            .receiver_cpu = -1,
+            .stats_cpu = -1,
+            .sched_fifo = false,
+            .sender_priority = 80,
+            .responder_priority = 70,
+            .receiver_priority = 80,
+            .stats_priority = 10,
+            .priority_inheritance = false,
+            .lock_memory = false,
+            .prefault_stack_kb = 0
+    };
 
     char *latest_section = NULL;
 
@@ -315,6 +631,19 @@ void release_config() {
             (void **) &config.responder_address,
             (void **) &config.stats_folder_path,
             (void **) &config.protocol,
+            (void **) &config.topics,
+            (void **) &config.reliable_topics,
+            (void **) &config.topic_deadlines,
+            (void **) &config.subscribe_topics,
+            (void **) &config.broker.consumers,
+            (void **) &config.broker.ack_address,
+            (void **) &config.message_log.directory,
+            (void **) &config.message_log.replay_address,
+            (void **) &config.metrics.client_address,
+            (void **) &config.metrics.server_address,
+            (void **) &config.echo.payload_sizes,
+            (void **) &config.replay_source,
+            (void **) &config.replay_from,
             (void **) &config.client_action->name,
             (void **) &config.server_action->name,
             (void **) &config.client_action,
@@ -339,7 +668,7 @@ void release_config() {
 
 // Return a string representation of the configuration.
 void print_configuration() {
-    char *configuration = malloc(1024);
+    char *configuration = malloc(4096);
     if (configuration == NULL) {
         logger(LOG_LEVEL_ERROR, "Failed to allocate memory.");
         return;
@@ -352,6 +681,13 @@ void print_configuration() {
     snprintf(qos_flag, sizeof(qos_flag), "no");
 #endif
 
+    char trace_flag[4];
+#ifdef TRACE_ENABLE
+    snprintf(trace_flag, sizeof(trace_flag), "yes");
+#else
+    snprintf(trace_flag, sizeof(trace_flag), "no");
+#endif
+
     char *main_address = malloc(32);
     char *responder_address = malloc(32);
 
@@ -363,17 +699,30 @@ void print_configuration() {
     snprintf(main_address, 65, "%s", get_address(MAIN_ADDRESS));
     snprintf(responder_address, 64, "%s", get_address(RESPONDER_ADDRESS));
 
-    snprintf(configuration, 1024,
+    snprintf(configuration, 4096,
              "\n------------------------------------------------\nConfiguration:\n"
              "Address Main/Responder: %s, %s\n"
              "Number of threads: %d\n"
              "Number of messages (x thread): %d (size %d Bytes)\n"
              "Total messages: %d\n"
              "Use messages per minute: %s (%d msg/min)\n"
-             "Use JSON: %s\n"
-             "Save interval: %d s\n"
+             "Stats format: %s\n"
+             "Save interval: %d s (buffer of %d records, rotation after %d records or %d MB)\n"
+             "Latency histogram: %d bits of precision (interval file: %s)\n"
+             "Tracer: %s (%d events per thread)\n"
              "Stats filepath: %s\n"
              "Client/Server sleep starting time: %d/%d ms\n"
+             "Receive strategy: %s (spin: %d us)\n"
+             "Send batch size: %d (deadline: %lld us, topic deadlines: %s)\n"
+             "Kernel timestamps: %s\n"
+             "Subscribers: %d (server subscriber ID: %d, clock sync every %d ms)\n"
+             "Topics: %s (server joins: %s, reliable: %s)\n"
+             "Broker: %d shards, %d producers, consumers: %s\n"
+             "Message log: %s (segments of %d MB, flush every %d ms or %d messages)\n"
+             "Fragmentation: %s (fragments of %d Bytes, messages up to %d KB)\n"
+             "Metrics: client %s, server %s\n"
+             "Echo: %s (1 out of %d messages, payload sizes: %s)\n"
+             "Realtime profile: %s (sched_fifo: %s, lock_memory: %s)\n"
              "------------------------------------------------\n"
              "PROTOCOL: %s\n"
              "QOS: %s\n"
@@ -384,10 +733,37 @@ void print_configuration() {
              config.message_size,
              config.num_threads * config.num_messages,
              config.use_msg_per_minute ? "yes" : "no", config.msg_per_minute,
-             config.use_json ? "yes" : "no",
-             config.save_interval_seconds,
+             config.use_binary ? "binary" : config.use_json ? "json" : "csv",
+             config.save_interval_seconds, config.stats_capacity, config.stats_file_records, config.stats_file_mb,
+             config.histogram_bits, config.histogram_file ? "yes" : "no",
+             trace_flag, config.trace_events,
              config.stats_folder_path,
              config.client_action->sleep_starting_time, config.server_action->sleep_starting_time,
+             receive_strategy_name(config.receive_strategy), config.spin_us,
+             config.send_batch_size, config.deadline_us,
+             config.topic_deadlines != NULL && config.topic_deadlines[0] != '\0' ? config.topic_deadlines : "none",
+             config.timestamping ? "yes" : "no",
+             config.num_subscribers, config.subscriber_id, config.clock_sync_interval_ms,
+             config.topics != NULL ? config.topics : "default",
+             config.subscribe_topics != NULL ? config.subscribe_topics : "*",
+             config.reliable_topics != NULL ? config.reliable_topics : "*",
+             config.broker.shards, config.broker.producers,
+             config.broker.consumers != NULL ? config.broker.consumers : "none",
+             config.message_log.directory != NULL && config.message_log.directory[0] != '\0'
+             ? config.message_log.directory : "disabled",
+             config.message_log.segment_mb, config.message_log.flush_interval_ms, config.message_log.flush_messages,
+             config.fragmentation.size > 0 ? "yes" : "no", config.fragmentation.size,
+             config.fragmentation.max_message_kb,
+             config.metrics.client_address != NULL && config.metrics.client_address[0] != '\0'
+             ? config.metrics.client_address : "disabled",
+             config.metrics.server_address != NULL && config.metrics.server_address[0] != '\0'
+             ? config.metrics.server_address : "disabled",
+             echo_mode_name(config.echo.mode), config.echo.sample,
+             config.echo.payload_sizes != NULL && config.echo.payload_sizes[0] != '\0'
+             ? config.echo.payload_sizes : "message_size",
+             config.realtime.enabled ? "yes" : "no",
+             config.realtime.sched_fifo ? "yes" : "no",
+             config.realtime.lock_memory ? "yes" : "no",
              config.protocol,
              qos_flag
     );
@@ -398,6 +774,37 @@ void print_configuration() {
     free(configuration);
 }
 
+/**
+ * @brief Enable the fragmentation of a transport with the options of the fragmentation section.
+ * @param transport
+ * @return 0 on success (or if the fragmentation is disabled), -1 on error
+ */
+int enable_configured_fragmentation(Transport *transport) {
+    if (config.fragmentation.size <= 0 || transport == NULL) {
+        return 0;
+    }
+    FragmentOptions options = {
+            .fragment_size = (size_t) config.fragmentation.size,
+            .max_message_size = (size_t) config.fragmentation.max_message_kb * 1024,
+            .max_pending = config.fragmentation.pending,
+            .timeout_ms = config.fragmentation.timeout_ms,
+            .nack_interval_ms = config.fragmentation.nack_interval_ms,
+            .cache_messages = config.fragmentation.cache_messages
+    };
+    return transport_enable_fragmentation(transport, &options);
+}
+
+/**
+ * @brief Start the tracer with the events per thread of the configuration, its dumps go to the stats folder.
+ * @param role Part of the name of the dumps ("client", "server", ...)
+ * @return 0 on success, -1 on error
+ */
+int start_configured_tracer(const char *role) {
+    char prefix[256];
+    snprintf(prefix, sizeof(prefix), "%s/trace", config.stats_folder_path != NULL ? config.stats_folder_path : ".");
+    return start_tracer(config.trace_events > 0 ? (size_t) config.trace_events : TRACE_DEFAULT_EVENTS, prefix, role);
+}
+
 
 /**
  * Example usage of the configuration:
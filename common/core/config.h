@@ -9,18 +9,103 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <yaml.h>
 #include <errno.h>
 #include <stdlib.h>  // for strtol and free
 #include <string.h>
 #include <unistd.h> // for sleep function
 #include "core/zhelpers.h"
+#include "core/receive_strategy.h"
+#include "stats/echo.h"
 
 typedef struct ActionType {
     char *name;
     int sleep_starting_time;
 } ActionType;
 
+/**
+ * Real-time execution profile (CPU pinning, scheduling and memory locking).
+ * A CPU set to -1 means that the thread is not pinned.
+ */
+typedef struct RealtimeConfig {
+    bool enabled;
+    int sender_cpu;
+    int responder_cpu;
+    int receiver_cpu;
+    int stats_cpu;
+    bool sched_fifo;
+    int sender_priority;
+    int responder_priority;
+    int receiver_priority;
+    int stats_priority;
+    bool priority_inheritance;
+    bool lock_memory;
+    int prefault_stack_kb;
+} RealtimeConfig;
+
+/**
+ * Broker (realmq_broker): the producers send to main_address and get their ACKs on responder_address, the consumers
+ * receive on their own addresses and send their ACKs to ack_address.
+ */
+typedef struct BrokerConfig {
+    char *consumers;            // <ip>:<port>=<topic>,<topic>;<ip>:<port>=* (the index is the consumer subscriber_id)
+    char *ack_address;          // <ip>:<port> where the consumers send their ACKs
+    int shards;                 // Forwarding threads
+    int first_cpu;              // CPU of the first shard (-1 means no pinning)
+    int producers;              // Stop after the STOP of this number of producers (0 means never)
+    int heartbeat_ms;           // Interval of the ACK requests to the consumers
+    int resend_ms;              // Frames not acknowledged by a consumer after this time are resent
+} BrokerConfig;
+
+/**
+ * Message log of the server: the received frames are appended to preallocated segment files (directory NULL or empty
+ * means no log).
+ */
+typedef struct MessageLogConfig {
+    char *directory;            // Directory of the segment files
+    int segment_mb;             // Size of a segment, a new one is created when it is full
+    int index_interval_kb;      // Bytes of records between two entries of the sparse index
+    int flush_interval_ms;      // Sync to disk at least this often (0 means only by count)
+    int flush_messages;         // ... or every flush_messages records (0 means only by time)
+    int queue_kb;               // Ring between the receive thread and the writer thread
+    int writer_cpu;             // CPU of the writer thread (-1 means no pinning)
+    char *replay_address;       // <ip>:<port> of the replay requests of the late consumers (NULL or empty: no replay)
+    int replay_rate;            // Catch-up rate of a replay in messages per second (0 means as fast as possible)
+} MessageLogConfig;
+
+/**
+ * Fragmentation of the messages larger than a datagram (size 0 means disabled): the client splits them, the server
+ * reassembles them and asks the missing fragments again.
+ */
+typedef struct FragmentationConfig {
+    int size;                   // Max size of a datagram, fragment header included
+    int max_message_kb;         // Largest message that can be reassembled
+    int pending;                // Messages reassembled at the same time by a receiver
+    int timeout_ms;             // Incomplete messages are dropped after this time without fragments
+    int nack_interval_ms;       // Missing fragments are asked again after this time (0 means never)
+    int cache_messages;         // Last messages kept by a sender for the retransmissions
+} FragmentationConfig;
+
+/**
+ * Metrics endpoint (Prometheus text format) of the client and the server: "<ip>:<port>" or "unix:<path>", NULL or
+ * empty means no endpoint.
+ */
+typedef struct MetricsConfig {
+    char *client_address;
+    char *server_address;
+} MetricsConfig;
+
+/**
+ * Echo mode (QoS only): the server reflects the data frames on the responder channel, the client measures their round
+ * trip, with the messages cycling through the payload sizes.
+ */
+typedef struct EchoConfig {
+    EchoMode mode;
+    int sample;                 // One message out of sample is reflected in open loop (all of them in closed loop)
+    char *payload_sizes;        // Comma separated sizes in bytes (NULL or empty: message_size)
+} EchoConfig;
+
 /**
  * The configuration struct.
  */
@@ -31,14 +116,42 @@ typedef struct Config {
     int num_threads;
     int num_messages;
     bool use_json;
+    bool use_binary;            // Columnar binary stats (.rmqs), instead of CSV or JSON
     bool use_msg_per_minute;
     int msg_per_minute;
     int save_interval_seconds;
+    int stats_capacity;         // Latency records buffered between two saves (preallocated by the server)
+    int stats_file_records;     // Rotation of the stats file after this number of records (0 means no limit)
+    int stats_file_mb;          // ... or this size (0 means no limit)
+    int histogram_bits;         // Precision of the latency histogram (relative error below 2^-(bits-1))
+    bool histogram_file;        // Append the histogram of every stats interval to a .hist file
+    int trace_events;           // Events kept per thread by the tracer (built with TRACE_ENABLE)
     int message_size;
     char *stats_folder_path;
     int signal_msg_timeout;
+    ReceiveStrategy receive_strategy;
+    int spin_us;
+    int send_batch_size;
+    bool timestamping;          // Kernel timestamps (SO_TIMESTAMPING) on the raw socket transports
+    char *topics;               // Comma separated topics (their order gives the topic IDs, same on every node)
+    char *subscribe_topics;     // Topics joined by the server ("*" for all)
+    char *reliable_topics;      // Topics with reliable messages ("*" for all), the others are best-effort
+    int num_subscribers;        // Servers that receive the (multicast) stream of the client
+    int subscriber_id;          // ID of the server inside the ACKs (0..MAX_SUBSCRIBERS-1)
+    int clock_sync_interval_ms; // Clock offset probes of the server to the client (0: none, QoS only)
+    char *replay_source;        // Replay address of another server, asked for its log at startup (NULL: none)
+    char *replay_from;          // Start of that replay: "offset:<offset>" or "id:<message ID>"
+    uint64_t first_message_id;  // Start of the message IDs of the client (disjoint ranges for the producers of a broker)
+    long long deadline_us;      // Deadline of the messages after their creation (0: no deadline)
+    char *topic_deadlines;      // Deadlines of some topics (<topic>:<deadline_us>,...), the others use deadline_us
     ActionType *client_action;
     ActionType *server_action;
+    RealtimeConfig realtime;
+    BrokerConfig broker;
+    MessageLogConfig message_log;
+    FragmentationConfig fragmentation;
+    MetricsConfig metrics;
+    EchoConfig echo;
 } Config;
 
 typedef enum {
@@ -80,6 +193,12 @@ void release_config();
 
 void print_configuration();
 
+// Enable the fragmentation of a transport with the fragmentation section (nothing when size is 0), return -1 on error
+int enable_configured_fragmentation(Transport *transport);
+
+// Start the tracer with trace_events per thread, dumped on SIGUSR1 to <stats_folder_path>/trace_<role>_<n>.json
+int start_configured_tracer(const char *role);
+
 #endif //CONFIG_H
 
 
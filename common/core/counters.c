@@ -0,0 +1,117 @@
+#include "counters.h"
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * Every thread that updates a counter gets its own CounterSlot the first time it touches the counters. Updates are
+ * relaxed atomic adds on that slot only, so the hot path never takes a lock and never shares a cache line with another
+ * writer. Readers (stats or metrics threads) sum all the slots, the result is eventually consistent but never torn.
+ */
+
+static CounterSlot g_counter_slots[COUNTERS_MAX_SLOTS];
+static atomic_int g_next_counter_slot = 0;
+static _Thread_local int t_counter_slot = -1;
+
+static const char *COUNTER_NAMES[COUNTER_TYPE_COUNT] = {
+        [COUNTER_SENT] = "sent",
+        [COUNTER_RECEIVED] = "received",
+        [COUNTER_MISSED] = "missed",
+        [COUNTER_RESENT] = "resent",
+        [COUNTER_DUPLICATES] = "duplicates",
+        [COUNTER_BYTES_SENT] = "bytes_sent",
+        [COUNTER_BYTES_RECEIVED] = "bytes_received",
+        [COUNTER_DEADLINE_MISSED] = "deadline_missed",
+};
+
+/**
+ * @brief Get the slot of the calling thread, assigning a new one on the first call.
+ * @return
+ */
+static inline CounterSlot *get_thread_slot(void) {
+    if (t_counter_slot < 0) {
+        int slot = atomic_fetch_add_explicit(&g_next_counter_slot, 1, memory_order_relaxed);
+        // Threads beyond the limit share the last slot (still correct, since the add is atomic)
+        t_counter_slot = slot < COUNTERS_MAX_SLOTS ? slot : COUNTERS_MAX_SLOTS - 1;
+    }
+    return &g_counter_slots[t_counter_slot];
+}
+
+/**
+ * @brief Add a value to the counter of the calling thread.
+ * @param type
+ * @param value
+ */
+void counter_add(CounterType type, uint64_t value) {
+    atomic_fetch_add_explicit(&get_thread_slot()->values[type], value, memory_order_relaxed);
+}
+
+/**
+ * @brief Increment by one the counter of the calling thread.
+ * @param type
+ */
+void counter_inc(CounterType type) {
+    counter_add(type, 1);
+}
+
+/**
+ * @brief Read the aggregate value of a counter, it can be called at any time from any thread.
+ * @param type
+ * @return The sum of the counter over all the slots in use
+ */
+uint64_t counter_get(CounterType type) {
+    int used = atomic_load_explicit(&g_next_counter_slot, memory_order_relaxed);
+    if (used > COUNTERS_MAX_SLOTS) used = COUNTERS_MAX_SLOTS;
+
+    uint64_t total = 0;
+    for (int i = 0; i < used; i++) {
+        total += atomic_load_explicit(&g_counter_slots[i].values[type], memory_order_relaxed);
+    }
+    return total;
+}
+
+/**
+ * @brief Read the aggregate value of all the counters.
+ * @param snapshot
+ */
+void counters_snapshot(CountersSnapshot *snapshot) {
+    for (int type = 0; type < COUNTER_TYPE_COUNT; type++) {
+        snapshot->values[type] = counter_get((CounterType) type);
+    }
+}
+
+/**
+ * @brief Get the name of a counter.
+ * @param type
+ * @return
+ */
+const char *counter_name(CounterType type) {
+    if (type < 0 || type >= COUNTER_TYPE_COUNT) {
+        return "unknown";
+    }
+    return COUNTER_NAMES[type];
+}
+
+/**
+ * @brief Reset all the counters to zero. Slots already assigned to threads are kept.
+ */
+void counters_reset(void) {
+    for (int i = 0; i < COUNTERS_MAX_SLOTS; i++) {
+        for (int type = 0; type < COUNTER_TYPE_COUNT; type++) {
+            atomic_store_explicit(&g_counter_slots[i].values[type], 0, memory_order_relaxed);
+        }
+    }
+}
+
+
+/**
+ * Example of usage:
+    - Hot path (any thread):
+
+    counter_inc(COUNTER_SENT);
+    counter_add(COUNTER_BYTES_SENT, msg_len);
+
+    - Stats thread:
+
+    CountersSnapshot snapshot;
+    counters_snapshot(&snapshot);
+    logger(LOG_LEVEL_INFO, "Sent: %" PRIu64, snapshot.values[COUNTER_SENT]);
+*/
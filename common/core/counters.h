@@ -0,0 +1,59 @@
+//  =====================================================================
+//  counters.h
+//
+//  Per-thread sharded message counters
+//  =====================================================================
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define COUNTERS_CACHE_LINE_SIZE 64
+#define COUNTERS_MAX_SLOTS 64   // Threads beyond this number share the last slot
+
+typedef enum {
+    COUNTER_SENT,
+    COUNTER_RECEIVED,
+    COUNTER_MISSED,
+    COUNTER_RESENT,
+    COUNTER_DUPLICATES,
+    COUNTER_BYTES_SENT,
+    COUNTER_BYTES_RECEIVED,
+    COUNTER_DEADLINE_MISSED,    // Dropped past their deadline (not resent by the client, discarded by the server)
+    COUNTER_TYPE_COUNT      // Number of counters (keep it last)
+} CounterType;
+
+/**
+ * One slot per thread. Each slot is aligned (and therefore padded) to a cache line so two threads never write to the
+ * same line, the hot path only does a relaxed atomic add on its own slot.
+ */
+typedef struct {
+    _Alignas(COUNTERS_CACHE_LINE_SIZE) _Atomic uint64_t values[COUNTER_TYPE_COUNT];
+} CounterSlot;
+
+// Snapshot of all the counters, aggregated over every slot
+typedef struct {
+    uint64_t values[COUNTER_TYPE_COUNT];
+} CountersSnapshot;
+
+// Add a value to the counter of the calling thread
+void counter_add(CounterType type, uint64_t value);
+
+// Increment by one the counter of the calling thread
+void counter_inc(CounterType type);
+
+// Read the aggregate value of a single counter (sum over all the slots)
+uint64_t counter_get(CounterType type);
+
+// Read the aggregate value of all the counters
+void counters_snapshot(CountersSnapshot *snapshot);
+
+// Get the name of a counter (used for logging and exporting)
+const char *counter_name(CounterType type);
+
+// Reset all the counters (not safe while other threads are updating them, used for tests and between runs)
+void counters_reset(void);
+
+#endif //COUNTERS_H
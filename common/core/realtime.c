@@ -0,0 +1,249 @@
+#define _GNU_SOURCE     // Needed for pthread_setaffinity_np and CPU_SET
+
+#include "realtime.h"
+#include "core/config.h"
+#include "core/logger.h"
+#include "core/trace.h"
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <alloca.h>
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+#include <malloc.h>
+
+#endif
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The profile is configured in the "realtime" section of the configuration file. At startup the process locks all its
+ * memory (current and future) and disables the trimming of the heap, so that pages are never given back to the kernel.
+ * Every thread then pins itself to its configured CPU, switches to SCHED_FIFO (if enabled) and touches its stack.
+ * If a permission is missing (e.g. no CAP_SYS_NICE or a low RLIMIT_MEMLOCK) a warning is logged and the thread keeps
+ * running with the normal scheduling.
+ */
+
+#define MAX_PREFAULT_STACK_KB 4096  // Never touch more than 4 MB of stack (the default thread stack is 8 MB)
+
+/**
+ * @brief Get the name of a thread role.
+ * @param role
+ * @return
+ */
+const char *thread_role_name(ThreadRole role) {
+    switch (role) {
+        case THREAD_ROLE_SENDER:
+            return "sender";
+        case THREAD_ROLE_RESPONDER:
+            return "responder";
+        case THREAD_ROLE_RECEIVER:
+            return "receiver";
+        case THREAD_ROLE_STATS:
+            return "stats";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * @brief Get the configured CPU and priority of a thread role.
+ * @param role
+ * @param cpu
+ * @param priority
+ */
+static void get_role_settings(ThreadRole role, int *cpu, int *priority) {
+    switch (role) {
+        case THREAD_ROLE_SENDER:
+            *cpu = config.realtime.sender_cpu;
+            *priority = config.realtime.sender_priority;
+            break;
+        case THREAD_ROLE_RESPONDER:
+            *cpu = config.realtime.responder_cpu;
+            *priority = config.realtime.responder_priority;
+            break;
+        case THREAD_ROLE_RECEIVER:
+            *cpu = config.realtime.receiver_cpu;
+            *priority = config.realtime.receiver_priority;
+            break;
+        case THREAD_ROLE_STATS:
+            *cpu = config.realtime.stats_cpu;
+            *priority = config.realtime.stats_priority;
+            break;
+        default:
+            *cpu = -1;
+            *priority = 0;
+            break;
+    }
+}
+
+/**
+ * @brief Touch every page of a memory area.
+ * @param ptr
+ * @param size
+ */
+void prefault_memory(void *ptr, size_t size) {
+    if (ptr == NULL || size == 0) {
+        return;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0) page_size = 4096;
+
+    // Read and write back the same value, so the content of the area is preserved
+    volatile unsigned char *bytes = (volatile unsigned char *) ptr;
+    for (size_t i = 0; i < size; i += (size_t) page_size) {
+        bytes[i] = bytes[i];
+    }
+    bytes[size - 1] = bytes[size - 1];
+}
+
+/**
+ * @brief Touch the stack of the calling thread, up to size_kb kilobytes.
+ * @param size_kb
+ */
+static void prefault_stack(int size_kb) {
+    if (size_kb <= 0) {
+        return;
+    }
+    if (size_kb > MAX_PREFAULT_STACK_KB) {
+        logger(LOG_LEVEL_WARN, "Prefault stack size limited to %d KB", MAX_PREFAULT_STACK_KB);
+        size_kb = MAX_PREFAULT_STACK_KB;
+    }
+
+    size_t size = (size_t) size_kb * 1024;
+    unsigned char *stack = alloca(size);
+    memset(stack, 0, size);
+    // Prevent the compiler from removing the memset
+    __asm__ __volatile__("" : : "r"(stack) : "memory");
+}
+
+/**
+ * @brief Apply the process-wide part of the real-time profile.
+ * @return true if the whole profile has been applied, false if it has been degraded
+ */
+bool apply_process_realtime_profile(void) {
+    if (!config.realtime.enabled || !config.realtime.lock_memory) {
+        return true;
+    }
+
+#ifdef __linux__
+    // Never give back memory to the kernel and never use mmap for big allocations (avoid page faults later)
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        logger(LOG_LEVEL_WARN, "Failed to lock memory (mlockall: %s), page faults may happen on the hot path",
+               strerror(errno));
+        return false;
+    }
+
+    logger(LOG_LEVEL_INFO, "Locked process memory (mlockall)");
+    return true;
+#else
+    logger(LOG_LEVEL_WARN, "Memory locking is not supported on this platform");
+    return false;
+#endif
+}
+
+/**
+ * @brief Pin the calling thread to a CPU (independently of the real-time profile, e.g. the shards of the broker).
+ * @param cpu
+ * @return 0 on success, an error number otherwise
+ */
+int pin_thread_to_cpu(int cpu) {
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#else
+    (void) cpu;
+    return ENOTSUP;
+#endif
+}
+
+/**
+ * @brief Apply the per-thread part of the real-time profile to the calling thread.
+ * @param role
+ * @return true if the whole profile has been applied, false if it has been degraded
+ */
+bool apply_thread_realtime_profile(ThreadRole role) {
+    TRACE_THREAD_NAME(thread_role_name(role));  // Every thread of a role starts here
+    if (!config.realtime.enabled) {
+        return true;
+    }
+
+    bool applied = true;
+    int cpu, priority;
+    get_role_settings(role, &cpu, &priority);
+
+#ifdef __linux__
+    // 1. CPU pinning
+    if (cpu >= 0) {
+        int rc = pin_thread_to_cpu(cpu);
+        if (rc != 0) {
+            logger(LOG_LEVEL_WARN, "Failed to pin %s thread to CPU %d: %s", thread_role_name(role), cpu,
+                   strerror(rc));
+            applied = false;
+        }
+    }
+
+    // 2. SCHED_FIFO
+    if (config.realtime.sched_fifo) {
+        struct sched_param param = {0};
+        int min_priority = sched_get_priority_min(SCHED_FIFO);
+        int max_priority = sched_get_priority_max(SCHED_FIFO);
+        param.sched_priority = priority < min_priority ? min_priority :
+                               priority > max_priority ? max_priority : priority;
+
+        int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (rc != 0) {
+            logger(LOG_LEVEL_WARN, "Failed to set SCHED_FIFO for %s thread (%s), using normal scheduling",
+                   thread_role_name(role), strerror(rc));
+            applied = false;
+        }
+    }
+#else
+    if (cpu >= 0 || config.realtime.sched_fifo) {
+        logger(LOG_LEVEL_WARN, "CPU pinning and SCHED_FIFO are not supported on this platform");
+        applied = false;
+    }
+#endif
+
+    // 3. Stack prefaulting
+    prefault_stack(config.realtime.prefault_stack_kb);
+
+    if (applied) {
+        logger(LOG_LEVEL_INFO, "Real-time profile applied to %s thread (CPU: %d, priority: %d)",
+               thread_role_name(role), cpu, config.realtime.sched_fifo ? priority : 0);
+    }
+    return applied;
+}
+
+/**
+ * @brief Re-initialize a mutex with the priority inheritance protocol (only if enabled in the configuration).
+ * The mutex must not be locked nor used by other threads while it is re-initialized.
+ * @param mutex
+ */
+void init_realtime_mutex(pthread_mutex_t *mutex) {
+    if (!config.realtime.enabled || !config.realtime.priority_inheritance) {
+        return;
+    }
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+
+    int rc = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    if (rc != 0) {
+        logger(LOG_LEVEL_WARN, "Priority inheritance mutexes are not supported: %s", strerror(rc));
+        pthread_mutexattr_destroy(&attr);
+        return;
+    }
+
+    pthread_mutex_destroy(mutex);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
@@ -0,0 +1,40 @@
+//  =====================================================================
+//  realtime.h
+//
+//  Real-time execution profile: CPU pinning, SCHED_FIFO, mlockall and
+//  prefaulting
+//  =====================================================================
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef enum {
+    THREAD_ROLE_SENDER,
+    THREAD_ROLE_RESPONDER,
+    THREAD_ROLE_RECEIVER,
+    THREAD_ROLE_STATS
+} ThreadRole;
+
+// Apply the process-wide part of the profile (mlockall and malloc tuning), call it once at startup
+bool apply_process_realtime_profile(void);
+
+// Apply the per-thread part of the profile (CPU pinning, SCHED_FIFO and stack prefaulting) to the calling thread
+bool apply_thread_realtime_profile(ThreadRole role);
+
+// Pin the calling thread to a CPU, return 0 or an error number
+int pin_thread_to_cpu(int cpu);
+
+// Re-initialize a mutex with priority inheritance (when enabled), call it before the threads are started
+void init_realtime_mutex(pthread_mutex_t *mutex);
+
+// Touch every page of a memory area, so that page faults happen at startup and not on the hot path
+void prefault_memory(void *ptr, size_t size);
+
+// Get the name of a thread role (used for logging)
+const char *thread_role_name(ThreadRole role);
+
+#endif //REALTIME_H
@@ -0,0 +1,172 @@
+#include "receive_strategy.h"
+#include "transport/transport.h"
+#include "core/logger.h"
+#include "utils/time_utils.h"
+#include <stdbool.h>
+#include <string.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * - block:      the thread sleeps in transport_recv until a message arrives or the socket timeout expires. It uses no
+ *               CPU while idle, but every message pays the wakeup latency of the scheduler.
+ * - busy_poll:  the thread spins on transport_recv with TRANSPORT_DONTWAIT. It burns a whole core, but a message is
+ *               picked up as soon as it is available. The call returns after poll_timeout_ms so the loop can check for
+ *               interrupts.
+ * - adaptive:   the thread spins for spin_us microseconds, then it falls back to a blocking transport_recv. Bursts are
+ *               picked up while spinning, idle periods are spent sleeping.
+ * The report logged at the end of the loop shows the CPU utilisation of the thread next to the latency, so that the
+ * strategy can be chosen per deployment.
+ */
+
+// CPU time of the thread between two readings of CLOCK_THREAD_CPUTIME_ID
+static long long elapsed_us(const struct timespec *start, const struct timespec *end) {
+    return (long long) (end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/**
+ * @brief Parse a receive strategy from its name.
+ * @param name
+ * @return The receive strategy, or -1 if the name is not valid
+ */
+int parse_receive_strategy(const char *name) {
+    if (name == NULL) {
+        return -1;
+    }
+    if (strcmp(name, "block") == 0) {
+        return RECEIVE_BLOCK;
+    } else if (strcmp(name, "busy_poll") == 0) {
+        return RECEIVE_BUSY_POLL;
+    } else if (strcmp(name, "adaptive") == 0) {
+        return RECEIVE_ADAPTIVE;
+    }
+    return -1;
+}
+
+/**
+ * @brief Get the name of a receive strategy.
+ * @param strategy
+ * @return
+ */
+const char *receive_strategy_name(ReceiveStrategy strategy) {
+    switch (strategy) {
+        case RECEIVE_BLOCK:
+            return "block";
+        case RECEIVE_BUSY_POLL:
+            return "busy_poll";
+        case RECEIVE_ADAPTIVE:
+            return "adaptive";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * @brief Initialize a receive context.
+ * @param ctx
+ * @param strategy
+ * @param spin_us
+ * @param poll_timeout_ms
+ */
+void init_receive_context(ReceiveContext *ctx, ReceiveStrategy strategy, int spin_us, int poll_timeout_ms) {
+    memset(ctx, 0, sizeof(ReceiveContext));
+    ctx->strategy = strategy;
+    ctx->spin_us = spin_us > 0 ? spin_us : 0;
+    ctx->poll_timeout_ms = poll_timeout_ms > 0 ? poll_timeout_ms : 100;
+    ctx->wall_start_ns = get_monotonic_time_nanos();
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ctx->cpu_start);
+}
+
+/**
+ * @brief Spin on the transport with TRANSPORT_DONTWAIT until a message arrives or max_us microseconds are elapsed.
+ * @return The size of the message, or -1 if nothing was received
+ */
+static int spin_receive(ReceiveContext *ctx, Transport *transport, char *buffer, size_t buffer_size, long long max_us) {
+    uint64_t start_ns = get_monotonic_time_nanos();
+
+    while (true) {
+        int rc = transport_recv(transport, buffer, buffer_size, TRANSPORT_DONTWAIT);
+        if (rc >= 0) {
+            return rc;
+        }
+        ctx->empty_polls++;
+
+        if ((long long) (get_monotonic_time_nanos() - start_ns) / 1000 >= max_us) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Receive a message using the strategy of the context.
+ * @param ctx
+ * @param transport
+ * @param buffer
+ * @param buffer_size
+ * @return The size of the message, or -1 if nothing was received (timeout)
+ */
+int receive_with_strategy(ReceiveContext *ctx, Transport *transport, char *buffer, size_t buffer_size) {
+    int rc = -1;
+
+    switch (ctx->strategy) {
+        case RECEIVE_BUSY_POLL:
+            rc = spin_receive(ctx, transport, buffer, buffer_size, (long long) ctx->poll_timeout_ms * 1000);
+            if (rc >= 0) ctx->spin_hits++;
+            break;
+
+        case RECEIVE_ADAPTIVE:
+            rc = spin_receive(ctx, transport, buffer, buffer_size, ctx->spin_us);
+            if (rc >= 0) {
+                ctx->spin_hits++;
+                break;
+            }
+            // Nothing arrived while spinning, fall back to blocking
+            rc = transport_recv(transport, buffer, buffer_size, 0);
+            if (rc >= 0) ctx->block_hits++;
+            break;
+
+        case RECEIVE_BLOCK:
+        default:
+            rc = transport_recv(transport, buffer, buffer_size, 0);
+            if (rc >= 0) ctx->block_hits++;
+            break;
+    }
+
+    if (rc >= 0) ctx->received++;
+    return rc;
+}
+
+/**
+ * @brief Add the latency of a received message to the context.
+ * @param ctx
+ * @param latency_us
+ */
+void receive_context_add_latency(ReceiveContext *ctx, long long latency_us) {
+    ctx->latency_sum_us += latency_us;
+    ctx->latency_count++;
+    if (latency_us > ctx->latency_max_us) {
+        ctx->latency_max_us = latency_us;
+    }
+}
+
+/**
+ * @brief Log the CPU time versus latency report of the context.
+ * @param ctx
+ * @param name
+ */
+void report_receive_context(const ReceiveContext *ctx, const char *name) {
+    struct timespec cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+
+    long long wall_us = (long long) (get_monotonic_time_nanos() - ctx->wall_start_ns) / 1000;
+    long long cpu_us = elapsed_us(&ctx->cpu_start, &cpu_end);
+    double cpu_percent = wall_us > 0 ? 100.0 * (double) cpu_us / (double) wall_us : 0.0;
+    double avg_latency_us = ctx->latency_count > 0 ? (double) ctx->latency_sum_us / (double) ctx->latency_count : 0.0;
+
+    logger(LOG_LEVEL_INFO2,
+           "[%s] Receive strategy: %s | CPU time: %.3f ms / wall: %.3f ms (%.1f%% CPU) | "
+           "received: %lu (spin: %lu, block: %lu, empty polls: %lu) | latency avg: %.1f us, max: %lld us",
+           name, receive_strategy_name(ctx->strategy),
+           (double) cpu_us / 1000.0, (double) wall_us / 1000.0, cpu_percent,
+           (unsigned long) ctx->received, (unsigned long) ctx->spin_hits, (unsigned long) ctx->block_hits,
+           (unsigned long) ctx->empty_polls, avg_latency_us, ctx->latency_max_us);
+}
@@ -0,0 +1,57 @@
+//  =====================================================================
+//  receive_strategy.h
+//
+//  Receive strategies for the receive loops (block, busy-poll, adaptive)
+//  =====================================================================
+
+#ifndef RECEIVE_STRATEGY_H
+#define RECEIVE_STRATEGY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "transport/transport.h"
+
+typedef enum {
+    RECEIVE_BLOCK,          // Always block in transport_recv (with the socket timeout)
+    RECEIVE_BUSY_POLL,      // Spin with TRANSPORT_DONTWAIT, never block
+    RECEIVE_ADAPTIVE        // Spin with TRANSPORT_DONTWAIT for spin_us microseconds, then block
+} ReceiveStrategy;
+
+/**
+ * Per-thread receive context: the strategy in use and the numbers needed for comparing CPU time and latency.
+ */
+typedef struct {
+    ReceiveStrategy strategy;
+    int spin_us;                // Spin time before blocking (only for RECEIVE_ADAPTIVE)
+    int poll_timeout_ms;        // Max time spent in a single busy-poll call (only for RECEIVE_BUSY_POLL)
+    uint64_t received;          // Messages received
+    uint64_t spin_hits;         // Messages received while spinning
+    uint64_t block_hits;        // Messages received while blocking
+    uint64_t empty_polls;       // TRANSPORT_DONTWAIT calls that returned without a message
+    long long latency_sum_us;   // Sum of the latencies added with receive_context_add_latency
+    long long latency_max_us;   // Max latency added with receive_context_add_latency
+    uint64_t latency_count;     // Number of latencies added
+    uint64_t wall_start_ns;     // Wall clock at init (get_monotonic_time_nanos)
+    struct timespec cpu_start;  // Thread CPU time at init (CLOCK_THREAD_CPUTIME_ID)
+} ReceiveContext;
+
+// Parse a receive strategy from its name ("block", "busy_poll" or "adaptive"), return -1 if invalid
+int parse_receive_strategy(const char *name);
+
+// Get the name of a receive strategy
+const char *receive_strategy_name(ReceiveStrategy strategy);
+
+// Initialize a receive context, it must be called from the thread that will use it
+void init_receive_context(ReceiveContext *ctx, ReceiveStrategy strategy, int spin_us, int poll_timeout_ms);
+
+// Receive a message with the strategy of the context, return the size of the message or -1 if nothing was received
+int receive_with_strategy(ReceiveContext *ctx, Transport *transport, char *buffer, size_t buffer_size);
+
+// Add the latency of a received message to the context
+void receive_context_add_latency(ReceiveContext *ctx, long long latency_us);
+
+// Log the CPU time versus latency report of the context, it must be called from the thread that used it
+void report_receive_context(const ReceiveContext *ctx, const char *name);
+
+#endif //RECEIVE_STRATEGY_H
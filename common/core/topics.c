@@ -0,0 +1,403 @@
+#include "topics.h"
+#include "core/logger.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * Every frame of the main channel starts with the compact ID of its topic (<topic_id>:<payload>), the transport group
+ * only selects the channel. The IDs come from the order of the topics in the configuration (general.topics), that is
+ * the same file for the client and the server, so the names never travel with the messages. The first IDs are reserved
+ * to the control messages (STOP, heartbeat), so they are dispatched like any other topic.
+ * The server joins a set of topics (server.subscribe_topics) and registers one handler per topic: dispatch_topic reads
+ * the ID and calls the handler from the table, with no string comparison. The frames of the topics not joined go to
+ * the filtered handler (the server still acknowledges them, the client must not resend them forever).
+ * The statistics (sent, received, missed, resent, latency) are kept per topic, so a hot topic does not hide the losses
+ * or the latency of a quiet one.
+ * Every topic has a QoS class (general.reliable_topics). The class travels with each frame, as the separator after the
+ * topic ID (':' reliable, ';' best-effort), so the server knows which frames to acknowledge without any configuration.
+ * The best-effort messages (e.g. telemetry that tolerates losses) are never tracked nor acknowledged.
+ * Every topic has a deadline too (client.topic_deadlines, client.deadline_us for the others): a quote must arrive
+ * within 500 us or not at all, an order can wait for 20 ms. The resends of all the topics go in one batch sorted
+ * earliest-deadline-first, so the tight topics go first.
+ */
+
+Topic g_topics[MAX_TOPICS];
+static TopicHandler g_filtered_handler = NULL;
+
+static const char *g_control_frames[TOPIC_FIRST_USER] = {"0:", "1:"};
+static const char *g_control_names[TOPIC_FIRST_USER] = {"stop", "heartbeat"};
+
+/**
+ * @brief Register a topic with a given ID.
+ * @param topic_id
+ * @param name
+ */
+static void register_topic_id(uint16_t topic_id, const char *name) {
+    Topic *topic = &g_topics[topic_id];
+    memset(topic, 0, sizeof(Topic));
+    strncpy(topic->name, name, TOPIC_NAME_SIZE - 1);
+    topic->registered = true;
+}
+
+/**
+ * @brief Check if a name is in a comma separated list.
+ * @param list
+ * @param name
+ * @return
+ */
+static bool in_list(const char *list, const char *name) {
+    size_t len = strlen(name);
+    const char *start = list;
+    while (start != NULL && *start != '\0') {
+        while (*start == ' ') start++;
+        const char *end = strchr(start, ',');
+        size_t item_len = end != NULL ? (size_t) (end - start) : strlen(start);
+        while (item_len > 0 && start[item_len - 1] == ' ') item_len--;
+        if (item_len == len && strncmp(start, name, len) == 0) {
+            return true;
+        }
+        start = end != NULL ? end + 1 : NULL;
+    }
+    return false;
+}
+
+/**
+ * @brief Register the control topics and the configured ones, and join the subscribed topics.
+ * @param topics Comma separated names (NULL or empty for a single "default" topic)
+ * @param subscribed Comma separated names of the topics to join ("*" or NULL for all)
+ * @return The number of configured topics, or -1 on error
+ */
+int init_topics(const char *topics, const char *subscribed) {
+    release_topics();
+
+    for (uint16_t i = 0; i < TOPIC_FIRST_USER; i++) {
+        register_topic_id(i, g_control_names[i]);
+        g_topics[i].joined = true;
+    }
+
+    if (topics == NULL || *topics == '\0') {
+        topics = "default";
+    }
+
+    char *list = strdup(topics);
+    if (list == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the topics");
+        return -1;
+    }
+
+    char *rest = list;
+    char *token;
+    while ((token = strtok_r(rest, ",", &rest))) {
+        while (*token == ' ') token++;
+        size_t len = strlen(token);
+        while (len > 0 && token[len - 1] == ' ') token[--len] = '\0';
+        if (len == 0) {
+            continue;
+        }
+        if (register_topic(token) == -1) {
+            free(list);
+            return -1;
+        }
+    }
+    free(list);
+
+    bool join_all = subscribed == NULL || strcmp(subscribed, "*") == 0;
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        if (g_topics[i].registered && (join_all || in_list(subscribed, g_topics[i].name))) {
+            g_topics[i].joined = true;
+        }
+    }
+    return user_topic_count();
+}
+
+/**
+ * @brief Set the QoS class of the configured topics.
+ * @param reliable Comma separated names of the reliable topics ("*" or NULL for all), the others are best-effort
+ */
+void init_topic_qos(const char *reliable) {
+    bool all_reliable = reliable == NULL || strcmp(reliable, "*") == 0;
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        if (g_topics[i].registered) {
+            g_topics[i].qos = all_reliable || in_list(reliable, g_topics[i].name) ? QOS_RELIABLE : QOS_BEST_EFFORT;
+        }
+    }
+}
+
+QosClass topic_qos(uint16_t topic_id) {
+    return topic_id < MAX_TOPICS ? g_topics[topic_id].qos : QOS_RELIABLE;
+}
+
+/**
+ * @brief Set the deadline of the configured topics.
+ * @param deadlines Comma separated <topic>:<deadline_us> (e.g. "quotes:500,orders:20000"), NULL or empty for none
+ * @param default_us Deadline of the topics not in the list (0: no deadline)
+ * @return 0 on success, -1 if an entry is not valid or its topic is not registered (the valid entries are set)
+ */
+int init_topic_deadlines(const char *deadlines, long long default_us) {
+    // Also the topics not registered, like TOPIC_DEFAULT of the messages created when no topic is configured
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        g_topics[i].deadline_us = default_us;
+    }
+    if (deadlines == NULL || deadlines[0] == '\0') {
+        return 0;
+    }
+
+    char *list = strdup(deadlines);
+    if (list == NULL) {
+        return -1;
+    }
+    int rc = 0;
+    char *save_ptr = NULL;
+    for (char *item = strtok_r(list, ",", &save_ptr); item != NULL; item = strtok_r(NULL, ",", &save_ptr)) {
+        while (*item == ' ') item++;
+        char *separator = strrchr(item, ':');
+        char *end = NULL;
+        long long deadline_us = separator != NULL ? strtoll(separator + 1, &end, 10) : -1;
+        if (separator == NULL || end == separator + 1 || deadline_us < 0) {
+            logger(LOG_LEVEL_WARN, "Invalid topic deadline: %s", item);
+            rc = -1;
+            continue;
+        }
+        *separator = '\0';
+        size_t len = strlen(item);
+        while (len > 0 && item[len - 1] == ' ') item[--len] = '\0';
+
+        int topic_id = find_topic(item);
+        if (topic_id < TOPIC_FIRST_USER) {
+            logger(LOG_LEVEL_WARN, "Deadline of an unknown topic: %s", item);
+            rc = -1;
+            continue;
+        }
+        g_topics[topic_id].deadline_us = deadline_us;
+    }
+    free(list);
+    return rc;
+}
+
+long long topic_deadline_us(uint16_t topic_id) {
+    return topic_id < MAX_TOPICS ? g_topics[topic_id].deadline_us : 0;
+}
+
+/**
+ * @brief Register a topic.
+ * @param name
+ * @return The ID of the topic (the existing one if already registered), or -1 if the registry is full
+ */
+int register_topic(const char *name) {
+    int existing = find_topic(name);
+    if (existing != -1) {
+        return existing;
+    }
+
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        if (!g_topics[i].registered) {
+            register_topic_id((uint16_t) i, name);
+            return i;
+        }
+    }
+    logger(LOG_LEVEL_ERROR, "Too many topics (max %d), %s not registered", MAX_TOPICS - TOPIC_FIRST_USER, name);
+    return -1;
+}
+
+/**
+ * @brief Find a topic by name.
+ * @param name
+ * @return The ID of the topic, or -1 if not registered
+ */
+int find_topic(const char *name) {
+    for (int i = 0; i < MAX_TOPICS; i++) {
+        if (g_topics[i].registered && strncmp(g_topics[i].name, name, TOPIC_NAME_SIZE - 1) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Join a topic.
+ * @param topic_id
+ * @return 0 on success, -1 if the topic is not registered
+ */
+int join_topic(uint16_t topic_id) {
+    if (topic_id >= MAX_TOPICS || !g_topics[topic_id].registered) {
+        return -1;
+    }
+    g_topics[topic_id].joined = true;
+    return 0;
+}
+
+/**
+ * @brief Set the handler of the frames of a topic.
+ * @param topic_id
+ * @param handler
+ * @return 0 on success, -1 if the topic is not registered
+ */
+int set_topic_handler(uint16_t topic_id, TopicHandler handler) {
+    if (topic_id >= MAX_TOPICS || !g_topics[topic_id].registered) {
+        return -1;
+    }
+    g_topics[topic_id].handler = handler;
+    return 0;
+}
+
+/**
+ * @brief Set the handler of the frames of the registered topics that are not joined.
+ * @param handler NULL to drop them
+ */
+void set_filtered_topic_handler(TopicHandler handler) {
+    g_filtered_handler = handler;
+}
+
+/**
+ * @brief Read the topic and the QoS class of a frame.
+ * @param frame <topic_id>:<payload> (reliable) or <topic_id>;<payload> (best-effort)
+ * @param topic_id
+ * @param qos
+ * @return Pointer to the payload inside frame (the whole frame when it has no topic, on TOPIC_DEFAULT and reliable)
+ */
+const char *parse_topic_qos(const char *frame, uint16_t *topic_id, QosClass *qos) {
+    unsigned int id = 0;
+    const char *ptr = frame;
+    while (*ptr >= '0' && *ptr <= '9' && ptr - frame < 5) {
+        id = id * 10 + (unsigned int) (*ptr - '0');
+        ptr++;
+    }
+    if (ptr == frame || (*ptr != TOPIC_SEPARATOR && *ptr != TOPIC_SEPARATOR_BEST_EFFORT) || id >= MAX_TOPICS) {
+        *topic_id = TOPIC_DEFAULT;
+        *qos = QOS_RELIABLE;
+        return frame;
+    }
+    *topic_id = (uint16_t) id;
+    *qos = *ptr == TOPIC_SEPARATOR_BEST_EFFORT ? QOS_BEST_EFFORT : QOS_RELIABLE;
+    return ptr + 1;
+}
+
+/**
+ * @brief Read the topic of a frame.
+ * @param frame <topic_id>:<payload>
+ * @param topic_id
+ * @return Pointer to the payload inside frame (the whole frame when it has no topic, on TOPIC_DEFAULT)
+ */
+const char *parse_topic(const char *frame, uint16_t *topic_id) {
+    QosClass qos;
+    return parse_topic_qos(frame, topic_id, &qos);
+}
+
+char topic_separator(QosClass qos) {
+    return qos == QOS_BEST_EFFORT ? TOPIC_SEPARATOR_BEST_EFFORT : TOPIC_SEPARATOR;
+}
+
+/**
+ * @brief Dispatch a frame to the handler of its topic.
+ * @param frame
+ * @param size
+ * @param arg Passed to the handler
+ * @return The result of the handler (TOPIC_CONTINUE for frames without handler), -1 for unknown topics
+ */
+int dispatch_topic(const char *frame, size_t size, void *arg) {
+    uint16_t topic_id;
+    parse_topic(frame, &topic_id);
+
+    Topic *topic = &g_topics[topic_id];
+    if (!topic->registered) {
+        logger(LOG_LEVEL_WARN, "Frame of unknown topic %u", topic_id);
+        return -1;
+    }
+    if (!topic->joined) {
+        topic_stat_add(topic_id, TOPIC_STAT_FILTERED, 1);
+        return g_filtered_handler != NULL ? g_filtered_handler(topic_id, frame, size, arg) : TOPIC_CONTINUE;
+    }
+    return topic->handler != NULL ? topic->handler(topic_id, frame, size, arg) : TOPIC_CONTINUE;
+}
+
+/**
+ * @brief Get the frame of a control topic.
+ * @param topic_id TOPIC_STOP or TOPIC_HEARTBEAT
+ * @return The frame (no payload), or NULL if it is not a control topic
+ */
+const char *control_frame(uint16_t topic_id) {
+    return topic_id < TOPIC_FIRST_USER ? g_control_frames[topic_id] : NULL;
+}
+
+/**
+ * @brief Count the configured topics.
+ * @return
+ */
+int user_topic_count(void) {
+    int count = 0;
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        if (g_topics[i].registered) count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Topic of the messages of a sender thread.
+ * @param thread_num
+ * @return The ID of the topic (TOPIC_DEFAULT when no topic is configured)
+ */
+uint16_t topic_for_thread(int thread_num) {
+    int count = user_topic_count();
+    if (count == 0) {
+        return TOPIC_DEFAULT;
+    }
+    return (uint16_t) (TOPIC_FIRST_USER + thread_num % count);
+}
+
+void topic_stat_add(uint16_t topic_id, TopicStat stat, uint64_t value) {
+    if (topic_id < MAX_TOPICS) {
+        __atomic_fetch_add(&g_topics[topic_id].stats[stat], value, __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t topic_stat_get(uint16_t topic_id, TopicStat stat) {
+    return topic_id < MAX_TOPICS ? __atomic_load_n(&g_topics[topic_id].stats[stat], __ATOMIC_RELAXED) : 0;
+}
+
+/**
+ * @brief Add the latency of a received message to the statistics of its topic (single receiver thread).
+ * @param topic_id
+ * @param latency_us
+ */
+void topic_add_latency(uint16_t topic_id, long long latency_us) {
+    if (topic_id >= MAX_TOPICS || latency_us < 0) {
+        return;
+    }
+    Topic *topic = &g_topics[topic_id];
+    topic->latency_sum_us += (uint64_t) latency_us;
+    if ((uint64_t) latency_us > topic->latency_max_us) {
+        topic->latency_max_us = (uint64_t) latency_us;
+    }
+}
+
+/**
+ * @brief Log the statistics of the configured topics.
+ * @param role
+ */
+void report_topics(const char *role) {
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        Topic *topic = &g_topics[i];
+        if (!topic->registered) {
+            continue;
+        }
+        uint64_t received = topic_stat_get((uint16_t) i, TOPIC_STAT_RECEIVED);
+        logger(LOG_LEVEL_INFO2,
+               "[%s] topic %s (%d): sent %" PRIu64 ", received %" PRIu64 ", missed %" PRIu64 ", resent %" PRIu64
+               ", filtered %" PRIu64 ", expired %" PRIu64 ", latency avg %.1f us max %" PRIu64 " us",
+               role, topic->name, i,
+               topic_stat_get((uint16_t) i, TOPIC_STAT_SENT), received,
+               topic_stat_get((uint16_t) i, TOPIC_STAT_MISSED), topic_stat_get((uint16_t) i, TOPIC_STAT_RESENT),
+               topic_stat_get((uint16_t) i, TOPIC_STAT_FILTERED), topic_stat_get((uint16_t) i, TOPIC_STAT_EXPIRED),
+               received > 0 ? (double) topic->latency_sum_us / (double) received : 0.0, topic->latency_max_us);
+    }
+}
+
+/**
+ * @brief Unregister all the topics.
+ */
+void release_topics(void) {
+    memset(g_topics, 0, sizeof(g_topics));
+    g_filtered_handler = NULL;
+}
@@ -0,0 +1,125 @@
+//  =====================================================================
+//  topics.h
+//
+//  Topic registry (compact topic IDs, per-topic handlers and statistics)
+//  =====================================================================
+
+#ifndef TOPICS_H
+#define TOPICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MAX_TOPICS 64
+#define TOPIC_NAME_SIZE 32
+#define TOPIC_SEPARATOR ':'             // Frame format: <topic_id>:<payload>
+#define TOPIC_SEPARATOR_BEST_EFFORT ';' // Frame of a best-effort message: <topic_id>;<payload>
+
+// Reserved topics (control messages of the main channel)
+#define TOPIC_STOP 0                    // The client finished sending
+#define TOPIC_HEARTBEAT 1               // Heartbeat of the client (the server answers with the ACKs)
+#define TOPIC_FIRST_USER 2              // ID of the first configured topic
+#define TOPIC_DEFAULT TOPIC_FIRST_USER  // Topic of the messages created without one
+
+// QoS class of the messages of a topic, carried by every frame (its topic separator)
+typedef enum {
+    QOS_RELIABLE,                       // Tracked until acknowledged, resent when missed
+    QOS_BEST_EFFORT,                    // Sent once: no tracking, no heartbeat, no ACK
+    QOS_CLASS_COUNT
+} QosClass;
+
+// Return values of the handlers
+#define TOPIC_CONTINUE 0
+#define TOPIC_STOP_RECEIVING 1
+
+typedef enum {
+    TOPIC_STAT_SENT,
+    TOPIC_STAT_RECEIVED,
+    TOPIC_STAT_BYTES_RECEIVED,
+    TOPIC_STAT_MISSED,
+    TOPIC_STAT_RESENT,
+    TOPIC_STAT_FILTERED,                // Received on a topic not joined by the server
+    TOPIC_STAT_EXPIRED,                 // Dropped past its deadline
+    TOPIC_STAT_COUNT
+} TopicStat;
+
+// Handler of the frames of a topic (frame is the whole frame, topic prefix included)
+typedef int (*TopicHandler)(uint16_t topic_id, const char *frame, size_t size, void *arg);
+
+typedef struct {
+    bool registered;
+    bool joined;                        // Frames of the topics not joined go to the filtered handler
+    QosClass qos;                       // Class of the messages published on the topic
+    long long deadline_us;              // Deadline of the messages after their creation (0: no deadline)
+    char name[TOPIC_NAME_SIZE];
+    TopicHandler handler;
+    uint64_t stats[TOPIC_STAT_COUNT];   // Updated atomically (many sender threads)
+    uint64_t latency_sum_us;
+    uint64_t latency_max_us;
+} Topic;
+
+extern Topic g_topics[MAX_TOPICS];
+
+// Register the control topics and the comma separated topics (IDs in order), join the subscribed ones ("*" for all)
+int init_topics(const char *topics, const char *subscribed);
+
+// Set the QoS class of the topics: the comma separated ones are reliable ("*" or NULL for all), the others best-effort
+void init_topic_qos(const char *reliable);
+
+// QoS class of a topic (QOS_RELIABLE for the control topics and the unknown ones)
+QosClass topic_qos(uint16_t topic_id);
+
+// Set the deadline of the topics: comma separated <topic>:<deadline_us> (NULL for none), the others get default_us
+int init_topic_deadlines(const char *deadlines, long long default_us);
+
+// Deadline of the messages of a topic after their creation in microseconds (0: no deadline)
+long long topic_deadline_us(uint16_t topic_id);
+
+// Register a topic, return its ID (the existing one if already registered) or -1 if the registry is full
+int register_topic(const char *name);
+
+// Find a topic by name, return its ID or -1
+int find_topic(const char *name);
+
+// Join a topic (its frames are dispatched to its handler)
+int join_topic(uint16_t topic_id);
+
+int set_topic_handler(uint16_t topic_id, TopicHandler handler);
+
+// Handler of the frames of registered topics that are not joined (NULL to drop them)
+void set_filtered_topic_handler(TopicHandler handler);
+
+// Dispatch a frame to the handler of its topic, return the handler result or -1 for unknown topics
+int dispatch_topic(const char *frame, size_t size, void *arg);
+
+// Read the topic ID of a frame, return a pointer to the payload (frames without topic are on TOPIC_DEFAULT)
+const char *parse_topic(const char *frame, uint16_t *topic_id);
+
+// Like parse_topic, also read the QoS class of the frame (frames without topic are reliable)
+const char *parse_topic_qos(const char *frame, uint16_t *topic_id, QosClass *qos);
+
+// Separator between the topic and the payload of a frame of the given class
+char topic_separator(QosClass qos);
+
+// Frame of a control topic (e.g. TOPIC_STOP), NULL for the other topics
+const char *control_frame(uint16_t topic_id);
+
+// Number of configured (user) topics
+int user_topic_count(void);
+
+// Topic on which a sender thread publishes (round robin over the configured topics)
+uint16_t topic_for_thread(int thread_num);
+
+void topic_stat_add(uint16_t topic_id, TopicStat stat, uint64_t value);
+
+void topic_add_latency(uint16_t topic_id, long long latency_us);
+
+uint64_t topic_stat_get(uint16_t topic_id, TopicStat stat);
+
+// Log the statistics of every topic
+void report_topics(const char *role);
+
+void release_topics(void);
+
+#endif //TOPICS_H
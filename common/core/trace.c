@@ -0,0 +1,310 @@
+#include "trace.h"
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * A latency spike could come from the marshalling, the wait for the lock of a retransmission store, the send, the
+ * heartbeat or the ACK reconciliation, and the logs are far too slow to tell. With TRACE_ENABLE the hot paths mark
+ * these steps with TRACE_BEGIN/TRACE_END/TRACE_INSTANT, which append a 24 bytes event (ticks, event, phase, arg) to a
+ * ring of the calling thread:
+ * - the ring is allocated on the first event of the thread, then an event is a counter read and four stores (a few
+ *   ns): no lock, no system call, no shared cache line
+ * - the ring keeps the last events_per_thread events (flight recorder), the oldest are overwritten
+ * - on SIGUSR1 (kill -USR1 <pid>) the handler only wakes the dump thread through a pipe, which copies every ring and
+ *   writes them as Chrome trace JSON; the events overwritten while a ring was copied are left out, never torn
+ * The ticks (TSC on x86) are converted to microseconds only by the dump, from two readings of CLOCK_MONOTONIC.
+ */
+
+static const char *TRACE_EVENT_NAMES[TRACE_EVENT_COUNT] = {
+        [TRACE_CREATE] = "create",
+        [TRACE_MARSHAL] = "marshal",
+        [TRACE_SEND] = "send",
+        [TRACE_ARRAY_LOCK] = "array_lock",
+        [TRACE_HEARTBEAT] = "heartbeat",
+        [TRACE_ACK_DECODE] = "ack_decode",
+        [TRACE_ACK_DIFF] = "ack_diff",
+        [TRACE_RESEND] = "resend",
+        [TRACE_RECEIVE] = "receive",
+        [TRACE_UNMARSHAL] = "unmarshal",
+        [TRACE_STATS] = "stats",
+        [TRACE_ACK_ENCODE] = "ack_encode",
+};
+
+_Thread_local TraceRing *t_trace_ring = NULL;
+static _Thread_local char t_trace_name[TRACE_THREAD_NAME_SIZE] = "";
+
+typedef struct {
+    _Atomic bool started;
+    size_t capacity;                            // Events per ring (power of two)
+    TraceRing *_Atomic rings[TRACE_MAX_THREADS];
+    atomic_int next_ring;
+    uint64_t start_ticks;                       // Reference of the conversion of the ticks
+    uint64_t start_ns;
+
+    // Dumps on demand
+    char path_prefix[256];
+    char role[32];
+    int dumps;
+    int pipe_fds[2];
+    pthread_t dump_thread;
+    bool dump_thread_started;
+    _Atomic bool stopping;
+    struct sigaction previous_action;
+} Tracer;
+
+static Tracer g_tracer = {.pipe_fds = {-1, -1}};
+
+const char *trace_event_name(TraceEventId event) {
+    if (event < 0 || event >= TRACE_EVENT_COUNT) {
+        return "unknown";
+    }
+    return TRACE_EVENT_NAMES[event];
+}
+
+void trace_set_thread_name(const char *name) {
+    snprintf(t_trace_name, sizeof(t_trace_name), "%s", name);
+    if (t_trace_ring != NULL) {
+        snprintf(t_trace_ring->name, sizeof(t_trace_ring->name), "%s", name);
+    }
+}
+
+/**
+ * @brief Allocate the ring of the calling thread (slow path of the first event).
+ * @return The ring, NULL if the tracer is not started or all the rings are taken
+ */
+TraceRing *trace_register_thread(void) {
+    if (!atomic_load_explicit(&g_tracer.started, memory_order_acquire)) {
+        return NULL;
+    }
+    if (atomic_load_explicit(&g_tracer.next_ring, memory_order_relaxed) >= TRACE_MAX_THREADS) {
+        return NULL;
+    }
+    int index = atomic_fetch_add(&g_tracer.next_ring, 1);
+    if (index >= TRACE_MAX_THREADS) {
+        return NULL;
+    }
+
+    TraceRing *ring = calloc(1, sizeof(TraceRing) + g_tracer.capacity * sizeof(TraceEvent));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->mask = g_tracer.capacity - 1;
+    ring->tid = (int) syscall(SYS_gettid);
+    if (t_trace_name[0] != '\0') {
+        snprintf(ring->name, sizeof(ring->name), "%s", t_trace_name);
+    } else {
+        snprintf(ring->name, sizeof(ring->name), "thread-%u", (unsigned) (uint8_t) index);
+    }
+    atomic_store_explicit(&g_tracer.rings[index], ring, memory_order_release);
+    t_trace_ring = ring;
+    return ring;
+}
+
+/**
+ * @brief Write the events of a ring still present in it (the ones overwritten during the copy are left out).
+ * @param file
+ * @param ring
+ * @param copy Buffer of the capacity of a ring
+ * @param pid
+ * @param ns_per_tick
+ * @param first Whether nothing was written before in the array of the events
+ * @return The number of events written
+ */
+static long dump_ring(FILE *file, TraceRing *ring, TraceEvent *copy, int pid, double ns_per_tick, bool *first) {
+    uint64_t capacity = ring->mask + 1;
+    uint64_t end = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t begin = end > capacity ? end - capacity : 0;
+    for (uint64_t i = begin; i < end; i++) {
+        copy[i - begin] = ring->events[i & ring->mask];
+    }
+
+    // The slot of index head - capacity may be the one being written: only later events are consistent
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t valid = head >= capacity ? head - capacity + 1 : 0;
+
+    fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            *first ? "" : ",", pid, ring->tid, ring->name);
+    *first = false;
+
+    long written = 0;
+    int depth = 0;
+    for (uint64_t i = begin > valid ? begin : valid; i < end; i++) {
+        const TraceEvent *event = &copy[i - begin];
+        if (event->phase == TRACE_PHASE_END && depth == 0) {
+            continue;   // Its begin was overwritten: it would close an unrelated span
+        }
+        depth += event->phase == TRACE_PHASE_BEGIN ? 1 : event->phase == TRACE_PHASE_END ? -1 : 0;
+
+        double ts_us = ((double) g_tracer.start_ns +
+                        (double) (int64_t) (event->ticks - g_tracer.start_ticks) * ns_per_tick) / 1000.0;
+        const char *phase = event->phase == TRACE_PHASE_BEGIN ? "B" : event->phase == TRACE_PHASE_END ? "E" : "i";
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"realmq\",\"ph\":\"%s\",%s\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+                      "\"args\":{\"arg\":%llu}}", trace_event_name((TraceEventId) event->event), phase,
+                event->phase == TRACE_PHASE_INSTANT ? "\"s\":\"t\"," : "", ts_us, pid, ring->tid,
+                (unsigned long long) event->arg);
+        written++;
+    }
+    return written;
+}
+
+/**
+ * @brief Write the events of all the threads as Chrome trace JSON (chrome://tracing or ui.perfetto.dev).
+ * @param path
+ * @return The number of events written, -1 on error
+ */
+long trace_dump(const char *path) {
+    if (!atomic_load(&g_tracer.started)) {
+        return -1;
+    }
+    FILE *file = fopen(path, "w");
+    TraceEvent *copy = malloc(g_tracer.capacity * sizeof(TraceEvent));
+    if (file == NULL || copy == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to dump the trace to %s: %s", path, strerror(errno));
+        if (file != NULL) fclose(file);
+        free(copy);
+        return -1;
+    }
+
+    // Ticks to ns, measured over the whole run
+    uint64_t now_ticks = trace_ticks();
+    uint64_t now_ns = get_monotonic_time_nanos();
+    double ns_per_tick = now_ticks > g_tracer.start_ticks
+                         ? (double) (now_ns - g_tracer.start_ns) / (double) (now_ticks - g_tracer.start_ticks) : 1.0;
+
+    int pid = (int) getpid();
+    bool first = true;
+    long events = 0;
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+    int rings = atomic_load(&g_tracer.next_ring);
+    for (int i = 0; i < rings && i < TRACE_MAX_THREADS; i++) {
+        TraceRing *ring = atomic_load_explicit(&g_tracer.rings[i], memory_order_acquire);
+        if (ring != NULL) {
+            events += dump_ring(file, ring, copy, pid, ns_per_tick, &first);
+        }
+    }
+    fputs("\n]}\n", file);
+
+    free(copy);
+    if (fclose(file) != 0) {
+        return -1;
+    }
+    logger(LOG_LEVEL_INFO, "Trace of %ld events written to %s", events, path);
+    return events;
+}
+
+static void dump_next(void) {
+    char path[sizeof(g_tracer.path_prefix) + 64];
+    snprintf(path, sizeof(path), "%s_%s_%d.json", g_tracer.path_prefix, g_tracer.role, g_tracer.dumps++);
+    trace_dump(path);
+}
+
+static void handle_dump_signal(int sig) {
+    (void) sig;
+    int saved_errno = errno;
+    if (write(g_tracer.pipe_fds[1], "d", 1) < 0) {
+        // Pipe full: a dump is already pending
+    }
+    errno = saved_errno;
+}
+
+static void *dump_thread(void *arg) {
+    (void) arg;
+    char byte;
+    while (true) {
+        ssize_t len = read(g_tracer.pipe_fds[0], &byte, 1);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0 || atomic_load(&g_tracer.stopping)) {
+            break;
+        }
+        dump_next();
+    }
+    return NULL;
+}
+
+/**
+ * @brief Start the tracer: every thread gets a ring on its first event. With a path prefix, SIGUSR1 dumps the rings to
+ * <path_prefix>_<role>_<n>.json and stop_tracer writes a last dump.
+ * @param events_per_thread Rounded up to a power of two
+ * @param path_prefix NULL or empty for no dump on demand (trace_dump only)
+ * @param role Part of the name of the dumps ("client", "server", ...)
+ * @return 0 on success, -1 on error
+ */
+int start_tracer(size_t events_per_thread, const char *path_prefix, const char *role) {
+    if (atomic_load(&g_tracer.started)) {
+        return -1;
+    }
+    size_t capacity = 1;
+    while (capacity < events_per_thread) {
+        capacity <<= 1;
+    }
+    g_tracer.capacity = capacity;
+    atomic_store(&g_tracer.next_ring, 0);
+    g_tracer.dumps = 0;
+    g_tracer.dump_thread_started = false;
+    atomic_store(&g_tracer.stopping, false);
+    g_tracer.start_ticks = trace_ticks();
+    g_tracer.start_ns = get_monotonic_time_nanos();
+    snprintf(g_tracer.path_prefix, sizeof(g_tracer.path_prefix), "%s", path_prefix != NULL ? path_prefix : "");
+    snprintf(g_tracer.role, sizeof(g_tracer.role), "%s", role != NULL ? role : "trace");
+    atomic_store_explicit(&g_tracer.started, true, memory_order_release);
+
+    if (g_tracer.path_prefix[0] == '\0') {
+        return 0;
+    }
+    if (pipe(g_tracer.pipe_fds) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to create the pipe of the trace dumps: %s", strerror(errno));
+        return -1;
+    }
+    fcntl(g_tracer.pipe_fds[1], F_SETFL, O_NONBLOCK);
+    if (pthread_create(&g_tracer.dump_thread, NULL, dump_thread, NULL) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to start the trace dump thread");
+        return -1;
+    }
+    g_tracer.dump_thread_started = true;
+
+    struct sigaction action = {.sa_handler = handle_dump_signal, .sa_flags = SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, &g_tracer.previous_action);
+    logger(LOG_LEVEL_INFO, "Tracing %zu events per thread, kill -USR1 %d dumps them to %s_%s_<n>.json", capacity,
+           (int) getpid(), g_tracer.path_prefix, g_tracer.role);
+    return 0;
+}
+
+void stop_tracer(void) {
+    if (!atomic_load(&g_tracer.started)) {
+        return;
+    }
+    if (g_tracer.dump_thread_started) {
+        sigaction(SIGUSR1, &g_tracer.previous_action, NULL);
+        atomic_store(&g_tracer.stopping, true);
+        if (write(g_tracer.pipe_fds[1], "s", 1) < 0) {
+            close(g_tracer.pipe_fds[1]);    // The reader gets EOF instead
+            g_tracer.pipe_fds[1] = -1;
+        }
+        pthread_join(g_tracer.dump_thread, NULL);
+        dump_next();
+        g_tracer.dump_thread_started = false;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (g_tracer.pipe_fds[i] >= 0) close(g_tracer.pipe_fds[i]);
+        g_tracer.pipe_fds[i] = -1;
+    }
+
+    atomic_store(&g_tracer.started, false);
+    for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+        free(atomic_exchange(&g_tracer.rings[i], NULL));
+    }
+    t_trace_ring = NULL;
+}
@@ -0,0 +1,123 @@
+//  =====================================================================
+//  trace.h
+//
+//  Per-thread event tracer (compile with TRACE_ENABLE), dumped to the
+//  Chrome trace JSON format (chrome://tracing, Perfetto)
+//  =====================================================================
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "utils/time_utils.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define TRACE_MAX_THREADS 64                    // Threads beyond this number are not traced
+#define TRACE_DEFAULT_EVENTS 65536              // Events kept per thread (rounded up to a power of two)
+#define TRACE_THREAD_NAME_SIZE 16
+
+typedef enum {
+    TRACE_CREATE,                               // Creation of a message (client)
+    TRACE_MARSHAL,
+    TRACE_SEND,                                 // Send of a batch (arg: messages)
+    TRACE_ARRAY_LOCK,                           // Wait for the lock of a retransmission store
+    TRACE_HEARTBEAT,
+    TRACE_ACK_DECODE,                           // Unmarshal of an ACK (client)
+    TRACE_ACK_DIFF,                             // Reconciliation of an ACK with the sent messages (client)
+    TRACE_RESEND,                               // Resend of the missed messages (arg: messages)
+    TRACE_RECEIVE,                              // Frame received (server, arg: size)
+    TRACE_UNMARSHAL,
+    TRACE_STATS,                                // Latency record of a message (server)
+    TRACE_ACK_ENCODE,                           // Marshal and send of the ACKs (server)
+    TRACE_EVENT_COUNT                           // Number of events (keep it last)
+} TraceEventId;
+
+typedef enum {
+    TRACE_PHASE_BEGIN,
+    TRACE_PHASE_END,
+    TRACE_PHASE_INSTANT
+} TracePhase;
+
+// Fixed-size binary event, the ticks are converted to time only by the dump
+typedef struct {
+    uint64_t ticks;
+    uint64_t arg;
+    uint32_t event;
+    uint32_t phase;
+} TraceEvent;
+
+// Ring of a thread: written only by its thread, the oldest events are overwritten
+typedef struct {
+    _Atomic uint64_t head;                      // Events written since the start (next index)
+    uint64_t mask;
+    int tid;
+    char name[TRACE_THREAD_NAME_SIZE];
+    TraceEvent events[];
+} TraceRing;
+
+extern _Thread_local TraceRing *t_trace_ring;
+
+// Ticks of the clock of the events: TSC on x86, virtual counter on ARM64, monotonic ns elsewhere
+static inline uint64_t trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return get_monotonic_time_nanos();
+#endif
+}
+
+// Ring of the calling thread, allocated on its first event (NULL if the tracer is not started or full)
+TraceRing *trace_register_thread(void);
+
+// Add an event to the ring of the calling thread (lock-free, no system call)
+static inline void trace_event(TraceEventId event, TracePhase phase, uint64_t arg) {
+    TraceRing *ring = t_trace_ring;
+    if (ring == NULL && (ring = trace_register_thread()) == NULL) {
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    TraceEvent *slot = &ring->events[head & ring->mask];
+    slot->ticks = trace_ticks();
+    slot->arg = arg;
+    slot->event = (uint32_t) event;
+    slot->phase = (uint32_t) phase;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Name of the calling thread in the dumps (before its first event)
+void trace_set_thread_name(const char *name);
+
+// Get the name of an event
+const char *trace_event_name(TraceEventId event);
+
+// Allocate the rings on demand (events per thread), dump them on SIGUSR1 to <path_prefix>_<role>_<n>.json
+int start_tracer(size_t events_per_thread, const char *path_prefix, const char *role);
+
+// Write the events of all the threads as Chrome trace JSON, return the number of events or -1 on error
+long trace_dump(const char *path);
+
+// Dump a last time, then stop the dump thread and release the rings (no thread may trace anymore)
+void stop_tracer(void);
+
+#ifdef TRACE_ENABLE
+#define TRACE_BEGIN(event, arg) trace_event((event), TRACE_PHASE_BEGIN, (uint64_t) (arg))
+#define TRACE_END(event, arg) trace_event((event), TRACE_PHASE_END, (uint64_t) (arg))
+#define TRACE_INSTANT(event, arg) trace_event((event), TRACE_PHASE_INSTANT, (uint64_t) (arg))
+#define TRACE_THREAD_NAME(name) trace_set_thread_name(name)
+#else
+#define TRACE_BEGIN(event, arg) ((void) 0)
+#define TRACE_END(event, arg) ((void) 0)
+#define TRACE_INSTANT(event, arg) ((void) 0)
+#define TRACE_THREAD_NAME(name) ((void) 0)
+#endif
+
+#endif //TRACE_H
@@ -59,17 +59,6 @@ void *create_context() {
     return context;
 }
 
-ProtocolType get_protocol_type_from_socket_type(int socket_type) {
-    if ((socket_type >= 0) && (socket_type <= 11)) {    // 0 <= TCP <= 11
-        return TCP;
-    } else if ((socket_type >= 12) && (socket_type <= 20)) {  // 12<= UDP <= 20
-        return UDP;
-    } else {
-        printf("Invalid socket type\n");
-        return -1;
-    }
-}
-
 int g_linger_timeout = 30000;   // 30 seconds
 
 void set_socket_options(void *socket, int timeout) {
@@ -113,68 +102,86 @@ void *create_socket(void *context, int socket_type, const char *connection, int
      * this means that there will be a bind operation
      */
 
-    switch (get_protocol_type_from_socket_type(socket_type)) {
-        case TCP:
-            if (socket_type == get_zmq_type(CLIENT)) {
-                // 2. Bind is used for sending messages
-                rc = zmq_bind(socket, connection);
+    switch (socket_type) {
+        case ZMQ_PUB:
+            // 2. Bind is used for sending messages
+            rc = zmq_bind(socket, connection);
+            if (rc != 0) {
+                logger(LOG_LEVEL_ERROR, "Failed to [BIND] %s", common_msg);
+                assert(rc == 0);
+            }
 
-                if (rc != 0) {
-                    logger(LOG_LEVEL_ERROR, "Failed to [BIND] %s", common_msg);
-                    assert(rc == 0);
-                }
+            // 3. Add timeout and linger options to the socket
+            set_socket_options(socket, timeout);
+            break;
 
-            } else if (socket_type == get_zmq_type(SERVER)) {
-                // 2. Connect is used for receiving messages
-                rc = zmq_connect(socket, connection);
-                if (rc != 0) {
-                    logger(LOG_LEVEL_ERROR, "Failed to [CONNECT] %s", common_msg);
-                    assert(rc == 0);
-                }
-                // 3. Add option
-                zmq_setsockopt(socket, ZMQ_SUBSCRIBE, "", 0);
+        case ZMQ_SUB:
+            // 2. Connect is used for receiving messages
+            rc = zmq_connect(socket, connection);
+            if (rc != 0) {
+                logger(LOG_LEVEL_ERROR, "Failed to [CONNECT] %s", common_msg);
+                assert(rc == 0);
+            }
+            // 3. Add option
+            zmq_setsockopt(socket, ZMQ_SUBSCRIBE, "", 0);
+
+            // 3. Add timeout and linger options to the socket
+            set_socket_options(socket, timeout);
+            break;
 
-            } else {
-                logger(LOG_LEVEL_ERROR, "Not implemented for socket type [%d]", socket_type);
-                return NULL;
+        case ZMQ_PUSH:
+            // 2. Connect is used for sending messages (many senders, one receiver)
+            rc = zmq_connect(socket, connection);
+            if (rc != 0) {
+                logger(LOG_LEVEL_ERROR, "Failed to [CONNECT] %s", common_msg);
+                assert(rc == 0);
             }
 
             // 3. Add timeout and linger options to the socket
             set_socket_options(socket, timeout);
             break;
 
+        case ZMQ_PULL:
+            // 2. Bind is used for receiving messages
+            rc = zmq_bind(socket, connection);
+            if (rc != 0) {
+                logger(LOG_LEVEL_ERROR, "Failed to [BIND] %s", common_msg);
+                assert(rc == 0);
+            }
 
-        case UDP:
-            if (socket_group == NULL) {
-                // 2. Connect is used for sending messages
-                rc = zmq_connect(socket, connection);
+            // 3. Add timeout and linger options to the socket
+            set_socket_options(socket, timeout);
+            break;
 
-                int connect_tries = 5;
-                for (int i = 0; i < connect_tries; i++) {
-                    if (rc == 0) {
-                        break;
-                    }
-                    logger(LOG_LEVEL_WARN, "Failed to [CONNECT], tries left: %d", connect_tries - i);
-                    rc = zmq_connect(socket, connection);
-                    sleep(1);
-                }
+#ifdef ZMQ_BUILD_DRAFT_API
+        case ZMQ_RADIO:
+            // 2. Connect is used for sending messages
+            rc = zmq_connect(socket, connection);
 
-//                if (rc != 0) {
-//                    logger(LOG_LEVEL_ERROR, "Failed to [CONNECT] %s", common_msg);
-//                    assert(rc == 0);
-//                }
-            } else {
-                // 2. Bind is used for receiving messages, so we also need to join the group (after the setsockopt)
-                rc = zmq_bind(socket, connection);
-                if (rc != 0) {
-                    logger(LOG_LEVEL_ERROR, "Failed to [BIND] %s", common_msg);
-                    assert(rc == 0);
+            int connect_tries = 5;
+            for (int i = 0; i < connect_tries; i++) {
+                if (rc == 0) {
+                    break;
                 }
+                logger(LOG_LEVEL_WARN, "Failed to [CONNECT], tries left: %d", connect_tries - i);
+                rc = zmq_connect(socket, connection);
+                sleep(1);
             }
 
             // 3. Add timeout and linger options to the socket
             set_socket_options(socket, timeout);
+            break;
+
+        case ZMQ_DISH:
+            // 2. Bind is used for receiving messages, so we also need to join the group (after the setsockopt)
+            rc = zmq_bind(socket, connection);
+            if (rc != 0) {
+                logger(LOG_LEVEL_ERROR, "Failed to [BIND] %s", common_msg);
+                assert(rc == 0);
+            }
 
+            // 3. Add timeout and linger options to the socket
+            set_socket_options(socket, timeout);
 
             // 4. Join the group
             if (socket_group != NULL) {
@@ -184,10 +191,12 @@ void *create_socket(void *context, int socket_type, const char *connection, int
                     assert(rc == 0);
                 }
             }
-
             break;
+#endif
+
         default:
-            logger(LOG_LEVEL_ERROR, "Invalid protocol type [%d]", get_protocol_type_from_socket_type(socket_type));
+            logger(LOG_LEVEL_ERROR, "Not implemented for socket type [%d]", socket_type);
+            zmq_close(socket);
             return NULL;
     }
 
@@ -222,10 +231,14 @@ int zmq_send_group(void *socket, const char *group, const char *msg, int flags)
 
 int zmq_receive(void *socket, char *buffer, size_t buffer_size, int flags) {
     int rc = zmq_recv(socket, buffer, buffer_size - 1, flags);
-    if (rc == -1 && errno == EAGAIN) {
-        // Timeout occurred
+    if (rc == -1) {
+        // Timeout occurred (EAGAIN) or the socket is closing
         return -1;
     }
+    // zmq_recv returns the original size of the message even if it was truncated
+    if ((size_t) rc > buffer_size - 1) {
+        rc = (int) buffer_size - 1;
+    }
     buffer[rc] = '\0'; // Null-terminate the string
     return rc;
 }
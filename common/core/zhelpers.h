@@ -46,7 +46,11 @@
 
 typedef enum {
     TCP,
-    UDP
+    UDP,
+    RAWUDP,
+    URING,
+    SHM,
+    INPROC
 } ProtocolType;
 
 extern int g_linger_timeout;
@@ -54,8 +58,6 @@ extern int g_linger_timeout;
 // Function declarations
 void *create_context();
 
-ProtocolType get_protocol_type_from_socket_type(int socket_type);
-
 void *create_socket(void *context, int socket_type, const char *connection, int timeout, const char *socket_group);
 
 int zmq_send_group(void *socket, const char *group, const char *msg, int flags);
@@ -1,8 +1,11 @@
 #include "accrual_detector.h"
 #include "core/logger.h"
 #include <zmq.h>
+#include <errno.h>
+#include <string.h>
 #include "core/config.h"
-#include "core/zhelpers.h"
+#include "core/topics.h"
+#include "stats/metrics.h"
 #include "qos/accrual_detector/phi_accrual_failure_detector.h"
 
 // =====================================================================================================================
@@ -19,17 +22,18 @@ bool log_heartbeat = false;  // Set to true to log the heartbeat messages
 /**
  * Function that sends a heartbeat message to the server and updates the
  * Phi Accrual Failure Detector parameters.
- * @param socket The socket to use for sending the message
+ * @param transport The transport to use for sending the message
  */
-bool send_heartbeat(void *socket, const char *group, bool force_send) {
-    char heartbeat_message[] = "HB";
+bool send_heartbeat(Transport *transport, const char *group, bool force_send) {
+    // Control topic of the main channel, dispatched by the server as the data topics
+    const char *heartbeat_message = control_frame(TOPIC_HEARTBEAT);
 
     if (force_send) {
         // Send the first heartbeat
         if (g_detector->state->timestamp != 0) {
             // Case for sending a heartbeat message before disconnecting
             // (so that the server can detect the latest messages sent)
-            if (socket != NULL) zmq_send_group(socket, group, heartbeat_message, 0);
+            if (transport != NULL) transport_send(transport, group, heartbeat_message, strlen(heartbeat_message), 0);
             return true;
         }
         heartbeat(g_detector);
@@ -43,8 +47,8 @@ bool send_heartbeat(void *socket, const char *group, bool force_send) {
         heartbeat(g_detector);
 
         // Send the heartbeat message
-        if (socket != NULL) {
-            if (zmq_send_group(socket, group, heartbeat_message, 0) < 0) {
+        if (transport != NULL) {
+            if (transport_send(transport, group, heartbeat_message, strlen(heartbeat_message), 0) < 0) {
                 logger(LOG_LEVEL_ERROR, "Failed to send heartbeat: %s", zmq_strerror(errno));
             } else {
                 if (log_heartbeat) logger(LOG_LEVEL_INFO2, "Heartbeat sent");
@@ -55,47 +59,12 @@ bool send_heartbeat(void *socket, const char *group, bool force_send) {
 
     // Update the parameters of the Phi Accrual Failure Detector
     float phi = get_phi(g_detector, 0); // for all messages this is called
+    gauge_set(GAUGE_PHI, phi);
+    if (g_detector->state->history != NULL) {
+        gauge_set(GAUGE_DETECTOR_MEAN_MS, mean(g_detector->state->history));
+        gauge_set(GAUGE_DETECTOR_STD_DEV_MS, std_dev(g_detector->state->history));
+    }
     if (log_heartbeat)
         logger(LOG_LEVEL_INFO2, "Phi: %8.4lf, Plater: %8.4lf, Mean: %8.4lf, Variance: %8.4lf", phi, 0, 0, 0);
     return is_sent;
 }
-
-
-/**
- * Function to handle reconnection of the socket in case of disconnection.
- * This function is used by the client only for TCP connections.
- * @param context
- * @param socket
- * @param connection_string
- * @param socket_type
- */
-void try_reconnect(void *context, void **socket, const char *connection_string, int socket_type) {
-    // Check the status of the socket
-    int socket_status;
-    size_t socket_status_size = sizeof(socket_status);
-    zmq_getsockopt(*socket, ZMQ_EVENT_DISCONNECTED, &socket_status, &socket_status_size);
-
-    // If the socket is disconnected, attempt to reconnect
-    if (socket_status == ZMQ_EVENT_DISCONNECTED) {
-        logger(LOG_LEVEL_WARN, "Connection lost, attempting to reconnect...");
-
-        // Close the current socket
-        zmq_close(*socket);
-
-        // Create a new socket
-        *socket = zmq_socket(context, socket_type);
-
-        // Attempt to reconnect the socket
-        if (zmq_connect(*socket, connection_string) == 0) {
-            logger(LOG_LEVEL_INFO, "Reconnected successfully");
-            // Set a timeout for receive operations
-            zmq_setsockopt(socket, ZMQ_RCVTIMEO, &config.signal_msg_timeout, sizeof(config.signal_msg_timeout));
-
-        } else {
-            logger(LOG_LEVEL_ERROR, "Failed to reconnect: %s", zmq_strerror(errno));
-        }
-    } else {
-        // Connection is OK
-//        logger(LOG_LEVEL_DEBUG, "Connection is active, no action needed");
-    }
-}
@@ -10,12 +10,11 @@
 #include <zmq.h>
 #include <stdbool.h>
 #include <time.h>
+#include "transport/transport.h"
 
 void update_phi_detector(size_t missed_count);
 
-bool send_heartbeat(void *socket, const char *group, bool force_send);
-
-void try_reconnect(void *context, void **socket, const char *connection_string, int socket_type);
+bool send_heartbeat(Transport *transport, const char *group, bool force_send);
 
 
 #endif // ACCRUAL_DETECTOR
@@ -1,9 +1,14 @@
 #include "dynamic_array.h"
 #include "core/logger.h"
 #include "qos/interpolation_search.h"
-#include "core/zhelpers.h"
 #include "utils/time_utils.h"
+#include "core/counters.h"
+#include "core/topics.h"
+#include "stats/metrics.h"
+#include "core/trace.h"
 #include <inttypes.h>
+#include <limits.h>
+#include <string.h>
 
 // Atomic for thread-safe unique message ID generation
 volatile uint64_t atomic_msg_id = 0;
@@ -162,6 +167,11 @@ void *create_element(const char *content) {
     msg->content[content_length] = '\0'; // Ensure null termination
 
     msg->timestamp = get_current_time_microseconds();    // Set the timestamp to the current time
+    msg->topic_id = TOPIC_DEFAULT;
+    msg->qos = QOS_RELIABLE;
+    msg->deadline = 0;
+    msg->ack_mask = 0;
+    msg->resend_time = 0;
 
     return msg;
 }
@@ -354,19 +364,42 @@ const char *marshal_message(const Message *msg) {
         return NULL;
     }
 
-    // Estimate buffer size needed, including the timestamp
-    size_t buffer_size = snprintf(NULL, 0, "%" PRIu64 "|%" PRIu64 "|%s", msg->id, msg->timestamp, msg->content) + 1;
+    // The deadline follows the timestamp (<timestamp>@<deadline>), only for the messages that have one
+    char deadline[24] = "";
+    if (msg->deadline != 0) {
+        snprintf(deadline, sizeof(deadline), "%c%lld", DEADLINE_SEPARATOR, msg->deadline);
+    }
+
+    // Estimate buffer size needed, including the topic and the timestamp
+    char separator = topic_separator(msg->qos);
+    size_t buffer_size = snprintf(NULL, 0, "%u%c%" PRIu64 "|%lld%s|%s", msg->topic_id, separator, msg->id,
+                                  msg->timestamp, deadline, msg->content) + 1;
     char *buffer = malloc(buffer_size);
     if (buffer == NULL) {
         return NULL;
     }
 
-    // Format the message including the timestamp
-    snprintf(buffer, buffer_size, "%" PRIu64 "|%" PRIu64 "|%s", msg->id, msg->timestamp, msg->content);
+    // Format the message including the topic and the timestamp
+    snprintf(buffer, buffer_size, "%u%c%" PRIu64 "|%lld%s|%s", msg->topic_id, separator, msg->id,
+             msg->timestamp, deadline, msg->content);
     return buffer;
 }
 
 
+/**
+ * @brief Read the timestamp field of a frame, and the deadline that may follow it.
+ * @param field <timestamp> or <timestamp>@<deadline>
+ * @param msg
+ */
+static void parse_timestamp(const char *field, Message *msg) {
+    char *end;
+    msg->timestamp = strtoll(field, &end, 10);
+    if (*end == DEADLINE_SEPARATOR) {
+        msg->deadline = strtoll(end + 1, NULL, 10);
+    }
+}
+
+
 /**
  * @brief Unmarshal a message from a buffer.
  * @param buffer The buffer to unmarshal
@@ -381,6 +414,13 @@ Message *unmarshal_message(const char *buffer) {
     if (msg == NULL) {
         return NULL;
     }
+    msg->ack_mask = 0;
+    msg->resend_time = 0;
+    msg->deadline = 0;
+
+    // Frames of the main channel start with the topic (<topic_id>: or <topic_id>; for the best-effort messages), older
+    // ones are reliable messages of the default topic
+    buffer = parse_topic_qos(buffer, &msg->topic_id, &msg->qos);
 
     char *content = strdup(buffer);
     char *firstSeparator = strchr(content, '|');
@@ -390,11 +430,11 @@ Message *unmarshal_message(const char *buffer) {
         char *secondSeparator = strchr(firstSeparator + 1, '|');
         if (secondSeparator != NULL) {
             *secondSeparator = '\0';
-            msg->timestamp = strtoll(firstSeparator + 1, NULL, 10);
+            parse_timestamp(firstSeparator + 1, msg);
             msg->content = strdup(secondSeparator + 1);
         } else {
             // If there is no second separator, assume it's just id and timestamp
-            msg->timestamp = strtoll(firstSeparator + 1, NULL, 10);
+            parse_timestamp(firstSeparator + 1, msg);
             msg->content = NULL; // Indicate that there's no content
         }
     } else {
@@ -503,7 +543,7 @@ void print_array2(DynamicArray *array, bool print_content) {
 
 /**
  * @brief Check if a message is timed out based on the current time and the timestamp of the message, with a default
- * timeout of 1 second if not specified.
+ * timeout of ACK_TIMEOUT_MS if not specified.
  * @param array
  * @param index
  * @param timeout
@@ -511,88 +551,247 @@ void print_array2(DynamicArray *array, bool print_content) {
  */
 bool check_message_timeout(DynamicArray *array, uint64_t index, long long timeout) {
     if (timeout == 0) {
-        timeout = 2000;
+        timeout = ACK_TIMEOUT_MS;
     }
     return (get_current_time_microseconds() - ((Message *) (array->data[index]))->timestamp) / 1000 > timeout;
 }
 
 
 /**
- * @brief This function is used to get the difference between two arrays. It returns the number of missed messages.
- * @param first_array The array of the messages sent from the client to the server.
- * @param second_array The array of the messages received from the server.
- * @return The number of missed messages.
+ * @brief Check if a message can no longer meet its deadline.
+ * @param msg
+ * @param now Current time in microseconds (get_current_time_microseconds)
+ * @return true if the deadline is past, false if it is not or the message has none
+ */
+bool message_expired(const Message *msg, long long now) {
+    return msg->deadline != 0 && now > msg->deadline;
+}
+
+/**
+ * @brief Drop a message that missed its deadline from the array of the messages awaiting ACK.
+ * @param array
+ * @param msg Released with the element
+ */
+static void drop_expired_message(DynamicArray *array, const Message *msg) {
+    counter_inc(COUNTER_DEADLINE_MISSED);
+    topic_stat_add(msg->topic_id, TOPIC_STAT_EXPIRED, 1);
+    remove_element_by_id(array, msg->id, true, true);
+}
+
+typedef struct {
+    long long deadline;
+    size_t index;           // Position in the batch, it keeps the sort stable
+} DeadlineSlot;
+
+static int compare_deadline_slots(const void *a, const void *b) {
+    const DeadlineSlot *first = a;
+    const DeadlineSlot *second = b;
+    if (first->deadline != second->deadline) {
+        return first->deadline < second->deadline ? -1 : 1;
+    }
+    return first->index < second->index ? -1 : (first->index > second->index);
+}
+
+/**
+ * @brief Sort a batch of marshaled messages earliest-deadline-first. The sort is stable, and the messages without
+ * deadline go last, so a batch without deadlines keeps its order.
+ * @param buffers
+ * @param sizes
+ * @param deadlines 0 for the messages without deadline
+ * @param count
+ */
+void sort_by_deadline(const char **buffers, size_t *sizes, long long *deadlines, size_t count) {
+    bool has_deadlines = false;
+    for (size_t i = 0; i < count && !has_deadlines; i++) {
+        has_deadlines = deadlines[i] != 0;
+    }
+    if (count < 2 || !has_deadlines) {
+        return;
+    }
+
+    DeadlineSlot *slots = malloc(count * sizeof(DeadlineSlot));
+    const char **sorted_buffers = malloc(count * sizeof(char *));
+    size_t *sorted_sizes = malloc(count * sizeof(size_t));
+    if (slots == NULL || sorted_buffers == NULL || sorted_sizes == NULL) {
+        logger(LOG_LEVEL_WARN, "Failed to allocate memory for the EDF sort, the batch is sent in order");
+        free(slots);
+        free(sorted_buffers);
+        free(sorted_sizes);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        slots[i].deadline = deadlines[i] != 0 ? deadlines[i] : LLONG_MAX;
+        slots[i].index = i;
+    }
+    qsort(slots, count, sizeof(DeadlineSlot), compare_deadline_slots);
+
+    for (size_t i = 0; i < count; i++) {
+        sorted_buffers[i] = buffers[slots[i].index];
+        sorted_sizes[i] = sizes[slots[i].index];
+    }
+    for (size_t i = 0; i < count; i++) {
+        buffers[i] = sorted_buffers[i];
+        sizes[i] = sorted_sizes[i];
+        deadlines[i] = slots[i].deadline != LLONG_MAX ? slots[i].deadline : 0;
+    }
+
+    free(slots);
+    free(sorted_buffers);
+    free(sorted_sizes);
+}
+
+
+/**
+ * @brief Add a marshaled message to a resend batch, the batch grows as needed.
+ * @param batch
+ * @param buffer Released by send_resend_batch
+ * @param deadline 0 for none
  */
-int diff_from_arrays(DynamicArray *first_array, DynamicArray *second_array, void *radio) {
-    // printf("Start diff_from_arrays\n");
-    // print_array2(first_array, false);
+static void add_to_resend_batch(ResendBatch *batch, const char *buffer, long long deadline) {
+    if (batch->count == batch->capacity) {
+        size_t capacity = batch->capacity > 0 ? batch->capacity * 2 : 64;
+        const char **buffers = realloc(batch->buffers, capacity * sizeof(char *));
+        if (buffers != NULL) batch->buffers = buffers;
+        size_t *sizes = realloc(batch->sizes, capacity * sizeof(size_t));
+        if (sizes != NULL) batch->sizes = sizes;
+        long long *deadlines = realloc(batch->deadlines, capacity * sizeof(long long));
+        if (deadlines != NULL) batch->deadlines = deadlines;
+        if (buffers == NULL || sizes == NULL || deadlines == NULL) {
+            logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the resend batch");
+            exit(EXIT_FAILURE);
+        }
+        batch->capacity = capacity;
+    }
+    batch->buffers[batch->count] = buffer;
+    batch->sizes[batch->count] = strlen(buffer);
+    batch->deadlines[batch->count] = deadline;
+    batch->count++;
+}
 
+/**
+ * @brief Resend a batch of marshaled messages with a single submission, earliest-deadline-first, and release their
+ * buffers. The batch is emptied and can be reused.
+ * @param radio
+ * @param batch
+ */
+void send_resend_batch(Transport *radio, ResendBatch *batch) {
+    sort_by_deadline(batch->buffers, batch->sizes, batch->deadlines, batch->count);
+    if (batch->count > 0) {
+        TRACE_BEGIN(TRACE_RESEND, batch->count);
+        int rc = transport_send_batch(radio, "GRP", batch->buffers, batch->sizes, batch->count);
+        TRACE_END(TRACE_RESEND, rc);
+        if (rc != (int) batch->count) {
+            logger(LOG_LEVEL_ERROR, "Error in RESEND of %zu messages (sent: %d)", batch->count, rc);
+            exit(EXIT_FAILURE);
+        }
+        counter_add(COUNTER_RESENT, batch->count);
+    }
+    for (size_t i = 0; i < batch->count; i++) {
+        free((void *) batch->buffers[i]);
+    }
+    batch->count = 0;
+}
+
+void release_resend_batch(ResendBatch *batch) {
+    for (size_t i = 0; i < batch->count; i++) {
+        free((void *) batch->buffers[i]);
+    }
+    free(batch->buffers);
+    free(batch->sizes);
+    free(batch->deadlines);
+    memset(batch, 0, sizeof(ResendBatch));
+}
+
+/**
+ * @brief This function aggregates the ACKs of many subscribers (multicast): each message keeps the bits of the
+ * subscribers that acknowledged it, and it is released only when all the live subscribers acknowledged it. The
+ * messages not acknowledged by the subscriber within the timeout are resent to the whole group (the other subscribers
+ * drop the duplicates), and kept until they are acknowledged or past their deadline.
+ * @param first_array The array of the messages sent from the client to the subscribers.
+ * @param acked The array of the messages received by the subscriber.
+ * @param subscriber_id The ID of the subscriber that sent the ACKs.
+ * @param live_mask The mask of the live subscribers (see live_subscribers_mask).
+ * @param resends Batch that receives the missed messages, to resend with send_resend_batch (NULL for not resending
+ * them). Several arrays can fill the same batch, so that it goes earliest-deadline-first across all of them.
+ * @return The number of messages missed by the subscriber.
+ */
+int diff_from_subscriber(DynamicArray *first_array, DynamicArray *acked, int subscriber_id, uint64_t live_mask,
+                         ResendBatch *resends) {
+    uint64_t subscriber_bit = 1ULL << subscriber_id;
+    long long now = get_current_time_microseconds();
     int missed_count = 0;
+    long long ack_round_us = -1;    // Oldest message acknowledged by this ACK
 
     // Iterate backwards to avoid issues when removing elements from the same array
     for (long long i = (long long) first_array->size - 1; i >= 0; i--) {
+        Message *msg = (Message *) first_array->data[i];
 
-        uint64_t msg_id = ((Message *) (first_array->data[i]))->id;
-
-        // Case of Missing message (search for it, but not remove it, or I can't get it for the radio)
-        if (remove_element_by_id(second_array, msg_id, true, false) == -1) {
-            // Check for timeouts
-            if (!check_message_timeout(first_array, i, 0))
-                continue;
-
-            missed_count++;
-
-            // get message element
-            // printf("Missing message with ID: %" PRIu64 " and Index: %zu\n", msg_id, i);
-
-            // ---------------------------------------------------------------------------------------------------------
-            // In this case I have to resend the message (I do not remove the message if I can't send it)
-            if (radio != NULL && i < first_array->size) {
-                Message *msg = ((Message *) (first_array->data[i]));
-                logger(LOG_LEVEL_INFO, "Resending message with ID: %"
-                                       PRIu64
-                                       " and Index: %zu", msg_id, i);
-                const char *msg_buffer = marshal_message(msg);
-                if (msg_buffer != NULL) {
-                    int rc = zmq_send_group(radio, "GRP", msg_buffer, 0);
-                    if (rc == -1) {
-                        logger(LOG_LEVEL_ERROR, "Error in RESEND of message with ID: %"
-                                                PRIu64
-                                                " and Index: %zu",
-                               msg_id, i);
-                        exit(EXIT_FAILURE);
-                    }
-                    free((void *) msg_buffer);
-                } else {
-                    free((void *) msg_buffer);
-                }
-
-                // Remove the element from the array
-                remove_element_by_id(first_array, msg_id, true, true);
-
-            } else if (i >= first_array->size) {
-                logger(LOG_LEVEL_ERROR, "Lost message with ID: %"
-                                        PRIu64
-                                        " and Index: %zu", msg_id, i);
+        if (remove_element_by_id(acked, msg->id, true, false) != -1) {
+            if (!(msg->ack_mask & subscriber_bit) && now - msg->timestamp > ack_round_us) {
+                ack_round_us = now - msg->timestamp;
             }
-            // ---------------------------------------------------------------------------------------------------------
+            msg->ack_mask |= subscriber_bit;
+        }
+        if ((msg->ack_mask & live_mask) == live_mask) {
+            // Acknowledged by every live subscriber
+            remove_element_by_id(first_array, msg->id, true, true);
+            continue;
+        }
+        if (msg->ack_mask & subscriber_bit) {
+            continue;   // Waiting for the other subscribers
+        }
 
-        } else {
-            // Case of Received message
-            // printf("Received message with ID: %" PRIu64 " and Index: %zu\n", msg_id, i);
-            // This is needed to clean the array of IDs from the client
-            remove_element_by_id(first_array, msg_id, true, true);
+        // Missed by this subscriber: wait for the timeout since the send (or since the last resend)
+        bool timed_out = msg->resend_time == 0 ? check_message_timeout(first_array, i, 0)
+                                               : (now - msg->resend_time) / 1000 > ACK_TIMEOUT_MS;
+        if (!timed_out) {
+            continue;
+        }
+        missed_count++;
+        topic_stat_add(msg->topic_id, TOPIC_STAT_MISSED, 1);
+
+        // Too late to be useful: dropped instead of resent (the resends of a saturated link go to the live messages)
+        if (message_expired(msg, now)) {
+            drop_expired_message(first_array, msg);
+            continue;
         }
 
-        // printf("Index: %zu\n", i);
-        // print_array2(first_array, false);
+        if (resends != NULL) {
+            const char *msg_buffer = marshal_message(msg);
+            if (msg_buffer != NULL) {
+                add_to_resend_batch(resends, msg_buffer, msg->deadline);
+                msg->resend_time = now;
+                topic_stat_add(msg->topic_id, TOPIC_STAT_RESENT, 1);
+            }
+        }
     }
 
-    // This is needed to clean the array of IDs from the client
-    // clean_all_elements(first_array);
+    if (ack_round_us >= 0) {
+        gauge_set(GAUGE_ACK_ROUND_US, (double) ack_round_us);
+    }
     return missed_count;
 }
 
+/**
+ * @brief Release the messages acknowledged by all the live subscribers. It is needed when a subscriber is declared
+ * dead, since its missing ACKs do not hold back the messages anymore.
+ * @param array The array of the messages sent from the client to the subscribers.
+ * @param live_mask The mask of the live subscribers.
+ * @return The number of released messages.
+ */
+int release_acked_messages(DynamicArray *array, uint64_t live_mask) {
+    int released = 0;
+    for (long long i = (long long) array->size - 1; i >= 0; i--) {
+        Message *msg = (Message *) array->data[i];
+        if ((msg->ack_mask & live_mask) == live_mask) {
+            remove_element_by_id(array, msg->id, true, true);
+            released++;
+        }
+    }
+    return released;
+}
+
 
 /*
  *   // Usage of the Marshal and Unmarshal functions
@@ -13,12 +13,22 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <time.h>
+#include "transport/transport.h"
+#include "core/topics.h"
+
+#define DEADLINE_SEPARATOR '@'  // Timestamp of a message with a deadline: <id>|<timestamp>@<deadline>|<content>
+#define ACK_TIMEOUT_MS 2000     // A message not acknowledged since its send (or its last resend) is resent
 
 // Message structure
 typedef struct {
     uint64_t id;
     char *content;
     long long timestamp;
+    uint16_t topic_id;          // Compact ID of the topic (see core/topics.h), marshaled as frame prefix
+    QosClass qos;               // Reliable (tracked until acknowledged) or best-effort, marshaled as topic separator
+    long long deadline;         // Absolute deadline in microseconds (clock of the timestamp), 0 for none
+    uint64_t ack_mask;          // Subscribers that acknowledged the message (client side only, not marshaled)
+    long long resend_time;      // Time of the last resend in microseconds, 0 if never resent (not marshaled)
 } Message;
 
 
@@ -36,6 +46,15 @@ typedef struct {
     size_t element_size;    // Size of each element in the array
 } DynamicArray;
 
+// Missed messages marshaled for a single resend submission (earliest-deadline-first)
+typedef struct {
+    const char **buffers;
+    size_t *sizes;
+    long long *deadlines;       // Absolute deadlines of the messages (0 for none)
+    size_t count;
+    size_t capacity;
+} ResendBatch;
+
 // Global dynamic array for storing message IDs awaiting ACK
 extern DynamicArray g_array;
 
@@ -81,6 +100,12 @@ void release_element(void *element, size_t element_size);
 // Free the dynamic array
 void release_dynamic_array(DynamicArray *array);
 
+// Check if a message can no longer meet its deadline (never for the messages without deadline)
+bool message_expired(const Message *msg, long long now);
+
+// Sort a batch of marshaled messages earliest-deadline-first (stable, the ones without deadline last)
+void sort_by_deadline(const char **buffers, size_t *sizes, long long *deadlines, size_t count);
+
 // Marshal a message into a buffer
 const char *marshal_message(const Message *msg);
 
@@ -93,7 +118,18 @@ char *marshal_uint64_array(DynamicArray *array);
 // Unmarshal an uint64_t array from a buffer
 DynamicArray *unmarshal_uint64_array(const char *buffer);
 
-// Diff between two arrays
-int diff_from_arrays(DynamicArray *first_array, DynamicArray *second_array, void* radio);
+// Aggregate the ACKs of one subscriber, a message is released when all the live subscribers acknowledged it, the
+// missed ones are added to resends (NULL for not resending them)
+int diff_from_subscriber(DynamicArray *first_array, DynamicArray *acked, int subscriber_id, uint64_t live_mask,
+                         ResendBatch *resends);
+
+// Resend the messages of a batch with a single submission, earliest-deadline-first (the batch is emptied)
+void send_resend_batch(Transport *radio, ResendBatch *batch);
+
+// Free a resend batch (and the messages not sent)
+void release_resend_batch(ResendBatch *batch);
+
+// Release the messages acknowledged by all the live subscribers (e.g. after a subscriber is declared dead)
+int release_acked_messages(DynamicArray *array, uint64_t live_mask);
 
 #endif //DYNAMIC_ARRAY_H
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "retransmit_store.h"
+#include "core/realtime.h"
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The client keeps the reliable messages it sent until every live subscriber acknowledged them, to resend the missed
+ * ones. Each reliable topic has its own store (array of the messages and lock): the sender threads of a topic only
+ * take the lock of its store, so a busy topic does not hold back the others, and the missed, resent and expired
+ * messages of a topic are counted apart from the others (see topic_stat_add).
+ * The ACKs of a subscriber carry the IDs of every topic, the responder thread applies them to the stores one at a time
+ * (each store under its own lock), so a sender thread waits at most for the reconciliation of its own topic. The IDs
+ * are unique across the topics (one generator), an acknowledged ID is found in one store only.
+ * The missed messages of every store go to a single resend batch, sent once all the locks are released: the batch is
+ * sorted earliest-deadline-first across the topics, so the messages of a topic with a short deadline (see
+ * init_topic_deadlines) are resent before the older ones of a topic that can wait.
+ */
+
+RetransmitStore g_retransmit_stores[MAX_TOPICS];
+
+/**
+ * @brief Create a store for each registered reliable topic, the initial capacity is shared by the stores.
+ */
+void init_retransmit_stores(void) {
+    release_retransmit_stores();
+
+    int reliable_count = 0;
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        if (g_topics[i].registered && g_topics[i].qos == QOS_RELIABLE) reliable_count++;
+    }
+    // The messages created without topic go to TOPIC_DEFAULT, that has a store even when no topic is configured
+    size_t capacity = RETRANSMIT_STORE_CAPACITY / (size_t) (reliable_count > 0 ? reliable_count : 1);
+    if (capacity < RETRANSMIT_STORE_MIN_CAPACITY) {
+        capacity = RETRANSMIT_STORE_MIN_CAPACITY;
+    }
+
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        bool reliable = g_topics[i].registered ? g_topics[i].qos == QOS_RELIABLE : i == TOPIC_DEFAULT;
+        if (!reliable) {
+            continue;
+        }
+        RetransmitStore *store = &g_retransmit_stores[i];
+        init_dynamic_array(&store->messages, capacity, sizeof(Message));
+        pthread_mutex_init(&store->mutex, NULL);
+        init_realtime_mutex(&store->mutex);
+        store->initialized = true;
+    }
+}
+
+RetransmitStore *retransmit_store(uint16_t topic_id) {
+    if (topic_id >= MAX_TOPICS || !g_retransmit_stores[topic_id].initialized) {
+        return NULL;
+    }
+    return &g_retransmit_stores[topic_id];
+}
+
+/**
+ * @brief Apply an ACK of a subscriber to every store (see diff_from_subscriber): the acknowledged messages are
+ * released, the missed ones are dropped past their deadline or resent with a single batch, earliest-deadline-first.
+ * @param acked IDs acknowledged by the subscriber, of every topic
+ * @param subscriber_id
+ * @param live_mask The mask of the live subscribers (see live_subscribers_mask)
+ * @param radio The transport used for resending the missed messages (NULL for not resending them)
+ * @return The number of messages missed by the subscriber
+ */
+int retransmit_stores_ack(DynamicArray *acked, int subscriber_id, uint64_t live_mask, Transport *radio) {
+    int missed_count = 0;
+    ResendBatch resends = {0};
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        RetransmitStore *store = &g_retransmit_stores[i];
+        if (!store->initialized) {
+            continue;
+        }
+        pthread_mutex_lock(&store->mutex);
+        if (store->messages.size > 0) {
+            missed_count += diff_from_subscriber(&store->messages, acked, subscriber_id, live_mask,
+                                                 radio != NULL ? &resends : NULL);
+        }
+        pthread_mutex_unlock(&store->mutex);
+    }
+
+    if (radio != NULL) {
+        send_resend_batch(radio, &resends);
+    }
+    release_resend_batch(&resends);
+    return missed_count;
+}
+
+/**
+ * @brief Release the messages acknowledged by all the live subscribers from every store (e.g. after a subscriber is
+ * declared dead).
+ * @param live_mask
+ * @return The number of released messages
+ */
+int retransmit_stores_release_acked(uint64_t live_mask) {
+    int released = 0;
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        RetransmitStore *store = &g_retransmit_stores[i];
+        if (!store->initialized) {
+            continue;
+        }
+        pthread_mutex_lock(&store->mutex);
+        released += release_acked_messages(&store->messages, live_mask);
+        pthread_mutex_unlock(&store->mutex);
+    }
+    return released;
+}
+
+size_t retransmit_stores_pending(void) {
+    size_t pending = 0;
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        RetransmitStore *store = &g_retransmit_stores[i];
+        if (!store->initialized) {
+            continue;
+        }
+        pthread_mutex_lock(&store->mutex);
+        pending += store->messages.size;
+        pthread_mutex_unlock(&store->mutex);
+    }
+    return pending;
+}
+
+void prefault_retransmit_stores(void) {
+    for (int i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        RetransmitStore *store = &g_retransmit_stores[i];
+        if (store->initialized) {
+            prefault_memory(store->messages.data, store->messages.capacity * store->messages.element_size);
+        }
+    }
+}
+
+void release_retransmit_stores(void) {
+    for (int i = 0; i < MAX_TOPICS; i++) {
+        RetransmitStore *store = &g_retransmit_stores[i];
+        if (!store->initialized) {
+            continue;
+        }
+        release_dynamic_array(&store->messages);
+        pthread_mutex_destroy(&store->mutex);
+        store->initialized = false;
+    }
+}
@@ -0,0 +1,50 @@
+//  =====================================================================
+//  retransmit_store.h
+//
+//  Per-topic retransmission stores (reliable messages awaiting ACK)
+//  =====================================================================
+
+#ifndef RETRANSMIT_STORE_H
+#define RETRANSMIT_STORE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "qos/dynamic_array.h"
+#include "transport/transport.h"
+#include "core/topics.h"
+
+#define RETRANSMIT_STORE_CAPACITY 100000    // Initial capacity shared by the stores of the reliable topics
+#define RETRANSMIT_STORE_MIN_CAPACITY 1024  // Initial capacity of a store at least
+
+// Messages of one topic awaiting the ACKs of the subscribers, with their own lock
+typedef struct {
+    bool initialized;
+    DynamicArray messages;              // Messages (Message) of the topic, in ID order
+    pthread_mutex_t mutex;              // Held by the sender threads of the topic and by the responder thread
+} RetransmitStore;
+
+extern RetransmitStore g_retransmit_stores[MAX_TOPICS];
+
+// Create a store for each registered reliable topic (call it after init_topics and init_topic_qos)
+void init_retransmit_stores(void);
+
+// Store of a topic, NULL if the topic has none (best-effort or not registered)
+RetransmitStore *retransmit_store(uint16_t topic_id);
+
+// Apply an ACK of a subscriber to every store, return the number of messages missed by the subscriber
+int retransmit_stores_ack(DynamicArray *acked, int subscriber_id, uint64_t live_mask, Transport *radio);
+
+// Release the messages acknowledged by all the live subscribers from every store, return their number
+int retransmit_stores_release_acked(uint64_t live_mask);
+
+// Number of messages awaiting ACK in every store
+size_t retransmit_stores_pending(void);
+
+// Touch the memory of every store (see prefault_memory)
+void prefault_retransmit_stores(void);
+
+void release_retransmit_stores(void);
+
+#endif //RETRANSMIT_STORE_H
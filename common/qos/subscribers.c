@@ -0,0 +1,144 @@
+#include "subscribers.h"
+#include "core/logger.h"
+#include "utils/time_utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * With a multicast main address, one send of the client reaches many servers (subscribers). Every server sends its
+ * ACKs on the responder channel prefixed with its subscriber ID (<subscriber_id>#<id>|<id>|...), and the client keeps
+ * one bit for each subscriber in the messages awaiting ACK (Message.ack_mask): a message is released only when every
+ * live subscriber acknowledged it (see diff_from_subscriber).
+ * The liveness of each subscriber comes from its own Phi Accrual Failure Detector, fed by the arrival of its ACKs
+ * (the servers answer every heartbeat of the client, also with an empty WAKEUP). A subscriber that stops answering is
+ * declared dead and no longer holds back the messages, it is revived by its next ACK.
+ * These functions are used only by the responder thread of the client.
+ */
+
+#define SUBSCRIBER_PHI_THRESHOLD 8.0f
+#define SUBSCRIBER_MAX_SAMPLE_SIZE 1000
+#define SUBSCRIBER_MIN_ACK_GAP_MS 10    // ACK segments closer than this are the same answer (one arrival)
+
+Subscriber g_subscribers[MAX_SUBSCRIBERS];
+static int g_ack_interval_ms = 1000;
+
+/**
+ * @brief Register a subscriber and start its failure detector (a subscriber that never answers is declared dead).
+ * @param subscriber_id
+ */
+static void register_subscriber(int subscriber_id) {
+    Subscriber *subscriber = &g_subscribers[subscriber_id];
+    subscriber->detector = new_phi_accrual_detector(
+            SUBSCRIBER_PHI_THRESHOLD,
+            SUBSCRIBER_MAX_SAMPLE_SIZE,
+            (float) g_ack_interval_ms,          // min std deviation: tolerate the jitter of the heartbeats
+            0.0f,
+            (float) g_ack_interval_ms,
+            NULL
+    );
+    if (subscriber->detector == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to create the failure detector of subscriber %d", subscriber_id);
+        exit(EXIT_FAILURE);
+    }
+    heartbeat(subscriber->detector);
+    subscriber->registered = true;
+    subscriber->alive = true;
+}
+
+/**
+ * @brief Register the subscribers expected from the start, so that the messages sent before their first ACK wait for
+ * them too.
+ * @param expected_count Number of subscribers (IDs from 0 to expected_count - 1)
+ * @param ack_interval_ms Expected time between two ACKs of a subscriber
+ */
+void init_subscribers(int expected_count, int ack_interval_ms) {
+    release_subscribers();
+    g_ack_interval_ms = ack_interval_ms > 0 ? ack_interval_ms : 1000;
+
+    if (expected_count > MAX_SUBSCRIBERS) {
+        logger(LOG_LEVEL_WARN, "Too many subscribers (%d), using %d", expected_count, MAX_SUBSCRIBERS);
+        expected_count = MAX_SUBSCRIBERS;
+    }
+    for (int i = 0; i < expected_count; i++) {
+        register_subscriber(i);
+    }
+}
+
+/**
+ * @brief Record the arrival of an ACK of a subscriber.
+ * @param subscriber_id
+ * @return 0 on success, -1 if the ID is not valid
+ */
+int subscriber_ack_received(int subscriber_id) {
+    if (subscriber_id < 0 || subscriber_id >= MAX_SUBSCRIBERS) {
+        logger(LOG_LEVEL_WARN, "Invalid subscriber ID: %d", subscriber_id);
+        return -1;
+    }
+
+    Subscriber *subscriber = &g_subscribers[subscriber_id];
+    if (!subscriber->registered) {
+        logger(LOG_LEVEL_INFO, "New subscriber: %d", subscriber_id);
+        register_subscriber(subscriber_id);
+        return 0;
+    }
+    if (!subscriber->alive) {
+        logger(LOG_LEVEL_INFO, "Subscriber %d is alive again", subscriber_id);
+        subscriber->alive = true;
+    }
+
+    if (get_current_timestamp() - subscriber->detector->state->timestamp >= SUBSCRIBER_MIN_ACK_GAP_MS) {
+        heartbeat(subscriber->detector);
+    }
+    return 0;
+}
+
+/**
+ * @brief Check the failure detectors of the subscribers.
+ * @param timestamp Current time in ms (0 for now)
+ * @return The mask of the live subscribers (bit i for subscriber i)
+ */
+uint64_t live_subscribers_mask(long long timestamp) {
+    uint64_t mask = 0;
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        Subscriber *subscriber = &g_subscribers[i];
+        if (!subscriber->registered) {
+            continue;
+        }
+
+        if (subscriber->alive && !is_available(subscriber->detector, timestamp)) {
+            logger(LOG_LEVEL_WARN, "Subscriber %d is dead (no ACK), its messages are not retained anymore", i);
+            subscriber->alive = false;
+        }
+        if (subscriber->alive) {
+            mask |= 1ULL << i;
+        }
+    }
+    return mask;
+}
+
+/**
+ * @brief Split an ACK into the subscriber ID and the IDs.
+ * @param buffer <subscriber_id>#<ids>, or only <ids> for the servers that do not send the ID
+ * @param subscriber_id
+ * @return Pointer to the IDs inside buffer
+ */
+const char *parse_ack_header(const char *buffer, int *subscriber_id) {
+    const char *separator = strchr(buffer, ACK_SUBSCRIBER_SEPARATOR);
+    if (separator == NULL) {
+        *subscriber_id = 0;
+        return buffer;
+    }
+    *subscriber_id = (int) strtol(buffer, NULL, 10);
+    return separator + 1;
+}
+
+/**
+ * @brief Release the failure detectors of the subscribers.
+ */
+void release_subscribers(void) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        delete_phi_accrual_detector(g_subscribers[i].detector);
+    }
+    memset(g_subscribers, 0, sizeof(g_subscribers));
+}
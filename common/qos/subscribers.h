@@ -0,0 +1,41 @@
+//  =====================================================================
+//  subscribers.h
+//
+//  Subscribers of a multicast stream (ACK aggregation and liveness)
+//  =====================================================================
+
+#ifndef SUBSCRIBERS_H
+#define SUBSCRIBERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "qos/accrual_detector/phi_accrual_failure_detector.h"
+
+#define MAX_SUBSCRIBERS 64              // One bit of Message.ack_mask for each subscriber
+#define ACK_SUBSCRIBER_SEPARATOR '#'    // ACK format: <subscriber_id>#<id>|<id>|...
+
+typedef struct {
+    bool registered;                    // Expected from the start (num_subscribers) or seen at least once
+    bool alive;
+    phi_accrual_detector *detector;     // Fed by the ACKs of the subscriber
+} Subscriber;
+
+extern Subscriber g_subscribers[MAX_SUBSCRIBERS];
+
+// Register the expected subscribers (IDs 0..expected_count-1), ack_interval_ms is the expected time between two ACKs
+void init_subscribers(int expected_count, int ack_interval_ms);
+
+// Record an ACK of a subscriber (it registers unknown subscribers and revives dead ones), -1 for an invalid ID
+int subscriber_ack_received(int subscriber_id);
+
+// Check the failure detectors and return the mask of the live subscribers (timestamp 0 for now, in ms)
+uint64_t live_subscribers_mask(long long timestamp);
+
+// Split an ACK into the subscriber ID and the IDs (ACKs without prefix come from subscriber 0)
+const char *parse_ack_header(const char *buffer, int *subscriber_id);
+
+// Release the failure detectors of the subscribers
+void release_subscribers(void);
+
+#endif //SUBSCRIBERS_H
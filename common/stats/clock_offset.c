@@ -0,0 +1,159 @@
+#include "clock_offset.h"
+#include <math.h>
+#include <string.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The one-way latency subtracts a send time read on the client from a receive time read on the server, so with two
+ * hosts it includes the offset of their clocks. The server measures that offset like NTP, on the channels it already
+ * has: it sends a probe with t1 on the responder channel, the client answers with a heartbeat carrying t1, t2 (probe
+ * received) and t3 (answer sent), received at t4. For each exchange:
+ *   offset = ((t2 - t1) + (t3 - t4)) / 2        delay = (t4 - t1) - (t3 - t2)
+ * The offset is exact when both directions take the same time, and wrong by at most delay / 2 otherwise. So:
+ * - min-RTT filter: of the last CLOCK_FILTER_SIZE exchanges, only the one with the smallest delay is used (the others
+ *   waited in a queue on one of the two ways), and only once (the estimate changes only when a newer exchange wins)
+ * - drift: a least squares line over filtered offsets taken every 2 s (once they cover 10 s) follows the slewing of
+ *   NTP and the frequency error of the oscillators, so the offset is extrapolated between the exchanges
+ * - uncertainty: delay / 2 of the chosen exchange, plus the RMS of the points around the line
+ */
+
+void init_clock_offset(ClockOffset *clock) {
+    memset(clock, 0, sizeof(ClockOffset));
+}
+
+/**
+ * @brief Use the offset of the best exchange, and fit the drift on the points once they cover 10 s.
+ * @param clock
+ * @param best The exchange with the smallest delay of the filter
+ */
+static void update_estimate(ClockOffset *clock, const ClockSample *best) {
+    size_t n = clock->points_count;
+    const ClockSample *points = clock->points;
+    long long first = points[0].time_us, last = points[0].time_us;
+    for (size_t i = 1; i < n; i++) {
+        first = points[i].time_us < first ? points[i].time_us : first;
+        last = points[i].time_us > last ? points[i].time_us : last;
+    }
+
+    clock->offset_us = best->offset_us;
+    clock->reference_us = best->time_us;
+    clock->drift = 0.0;
+    double residual_rms = 0.0;
+    if (n >= 3 && last - first >= CLOCK_DRIFT_MIN_SPAN_US) {
+        // Times relative to the first point, so the doubles keep their precision
+        double mean_x = 0.0, mean_y = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            mean_x += (double) (points[i].time_us - first);
+            mean_y += points[i].offset_us;
+        }
+        mean_x /= (double) n;
+        mean_y /= (double) n;
+
+        double sxx = 0.0, sxy = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            double dx = (double) (points[i].time_us - first) - mean_x;
+            sxx += dx * dx;
+            sxy += dx * (points[i].offset_us - mean_y);
+        }
+        double drift = sxy / sxx;
+        drift = fmax(-CLOCK_MAX_DRIFT, fmin(CLOCK_MAX_DRIFT, drift));
+
+        double residuals = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            double fitted = mean_y + drift * ((double) (points[i].time_us - first) - mean_x);
+            residuals += (points[i].offset_us - fitted) * (points[i].offset_us - fitted);
+        }
+        residual_rms = sqrt(residuals / (double) n);
+
+        clock->drift = drift;
+    }
+    clock->uncertainty_us = best->delay_us / 2.0 + residual_rms;
+    clock->valid = true;
+
+    atomic_store_explicit(&clock->published_offset_ns, (int64_t) llround(clock->offset_us * 1000.0),
+                          memory_order_relaxed);
+    atomic_store_explicit(&clock->published_uncertainty_ns, (int64_t) llround(clock->uncertainty_us * 1000.0),
+                          memory_order_relaxed);
+    atomic_store_explicit(&clock->published_drift_ppb, (int64_t) llround(clock->drift * 1e9), memory_order_relaxed);
+    atomic_store_explicit(&clock->published_valid, true, memory_order_release);
+}
+
+/**
+ * @brief Add the timestamps of an exchange.
+ * @param clock
+ * @param t1 Probe sent (local clock)
+ * @param t2 Probe received (remote clock)
+ * @param t3 Reply sent (remote clock)
+ * @param t4 Reply received (local clock)
+ * @return 1 if the estimate was updated, 0 if the exchange was filtered out, -1 if it is invalid
+ */
+int clock_offset_add_sample(ClockOffset *clock, long long t1, long long t2, long long t3, long long t4) {
+    double delay = (double) (t4 - t1) - (double) (t3 - t2);
+    if (t4 < t1 || t3 < t2 || delay < 0) {
+        // A clock stepped during the exchange (or a reply to an older probe arrived out of order)
+        clock->rejected++;
+        return -1;
+    }
+    ClockSample sample = {
+            .offset_us = ((double) (t2 - t1) + (double) (t3 - t4)) / 2.0,
+            .delay_us = delay,
+            .time_us = t4
+    };
+    clock->samples++;
+    atomic_store_explicit(&clock->published_samples, clock->samples, memory_order_relaxed);
+
+    clock->filter[clock->filter_next] = sample;
+    clock->filter_next = (clock->filter_next + 1) % CLOCK_FILTER_SIZE;
+    if (clock->filter_count < CLOCK_FILTER_SIZE) {
+        clock->filter_count++;
+    }
+
+    const ClockSample *best = &clock->filter[0];
+    for (size_t i = 1; i < clock->filter_count; i++) {
+        if (clock->filter[i].delay_us < best->delay_us) {
+            best = &clock->filter[i];
+        }
+    }
+    if (clock->valid && best->time_us <= clock->last_used_us) {
+        return 0;   // Already used: the winning exchanges are used once
+    }
+    clock->last_used_us = best->time_us;
+
+    if (clock->points_count == 0 || best->time_us - clock->last_point_us >= CLOCK_DRIFT_INTERVAL_US) {
+        clock->points[clock->points_next] = *best;
+        clock->points_next = (clock->points_next + 1) % CLOCK_DRIFT_POINTS;
+        if (clock->points_count < CLOCK_DRIFT_POINTS) {
+            clock->points_count++;
+        }
+        clock->last_point_us = best->time_us;
+    }
+    update_estimate(clock, best);
+    return 1;
+}
+
+double clock_offset_at(const ClockOffset *clock, long long now_us) {
+    if (!clock->valid) {
+        return 0.0;
+    }
+    return clock->offset_us + clock->drift * (double) (now_us - clock->reference_us);
+}
+
+bool clock_offset_snapshot(const ClockOffset *clock, double *offset_us, double *uncertainty_us, double *drift_ppm,
+                           uint64_t *samples) {
+    if (!atomic_load_explicit(&clock->published_valid, memory_order_acquire)) {
+        return false;
+    }
+    if (offset_us != NULL) {
+        *offset_us = (double) atomic_load_explicit(&clock->published_offset_ns, memory_order_relaxed) / 1000.0;
+    }
+    if (uncertainty_us != NULL) {
+        *uncertainty_us = (double) atomic_load_explicit(&clock->published_uncertainty_ns, memory_order_relaxed) / 1000.0;
+    }
+    if (drift_ppm != NULL) {
+        *drift_ppm = (double) atomic_load_explicit(&clock->published_drift_ppb, memory_order_relaxed) / 1000.0;
+    }
+    if (samples != NULL) {
+        *samples = atomic_load_explicit(&clock->published_samples, memory_order_relaxed);
+    }
+    return true;
+}
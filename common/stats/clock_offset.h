@@ -0,0 +1,69 @@
+//  =====================================================================
+//  clock_offset.h
+//
+//  NTP-style estimation of the offset and the drift of the clock of a
+//  client relative to the local clock (cross-host one-way latency)
+//  =====================================================================
+
+#ifndef CLOCK_OFFSET_H
+#define CLOCK_OFFSET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define CLOCK_SYNC_PREFIX "sync:"               // Probe: <subscriber_id>#sync:<t1>, reply: 1:sync:<id>|<t1>|<t2>|<t3>
+#define CLOCK_FILTER_SIZE 8                     // Last exchanges, the one with the smallest delay is used
+#define CLOCK_DRIFT_POINTS 16                   // Filtered offsets of the drift regression
+#define CLOCK_DRIFT_INTERVAL_US 2000000LL       // Min time between two points of the regression (16 points: 30 s)
+#define CLOCK_DRIFT_MIN_SPAN_US 10000000LL      // Time covered by the points before a drift is estimated
+#define CLOCK_MAX_DRIFT 500e-6                  // Drift beyond 500 ppm is a clock step, not a drift
+
+// One exchange: offset (remote - local) and round-trip delay without the processing of the remote
+typedef struct {
+    double offset_us;
+    double delay_us;
+    long long time_us;                          // Local time of the reply
+} ClockSample;
+
+typedef struct {
+    // Updated by a single thread (the one that receives the replies)
+    ClockSample filter[CLOCK_FILTER_SIZE];
+    size_t filter_count;
+    size_t filter_next;
+    ClockSample points[CLOCK_DRIFT_POINTS];
+    size_t points_count;
+    size_t points_next;
+    long long last_used_us;                     // Time of the last exchange used by the estimate
+    long long last_point_us;                    // Time of the last point of the regression
+    bool valid;
+    double offset_us;                           // At reference_us
+    double drift;                               // us of offset per us (1e-6 = 1 ppm)
+    long long reference_us;
+    double uncertainty_us;
+    uint64_t samples;
+    uint64_t rejected;
+
+    // Copies for the other threads (reports and metrics)
+    _Atomic int64_t published_offset_ns;
+    _Atomic int64_t published_uncertainty_ns;
+    _Atomic int64_t published_drift_ppb;
+    _Atomic uint64_t published_samples;
+    _Atomic bool published_valid;
+} ClockOffset;
+
+void init_clock_offset(ClockOffset *clock);
+
+// Add an exchange (t1 probe sent and t4 reply received: local clock, t2 probe received and t3 reply sent: remote
+// clock), return 1 if the estimate was updated, 0 if the sample was filtered out, -1 if it is invalid
+int clock_offset_add_sample(ClockOffset *clock, long long t1, long long t2, long long t3, long long t4);
+
+// Offset of the remote clock at a local time (0 before the first exchange), owner thread only
+double clock_offset_at(const ClockOffset *clock, long long now_us);
+
+// Latest estimate from any thread, return false before the first exchange
+bool clock_offset_snapshot(const ClockOffset *clock, double *offset_us, double *uncertainty_us, double *drift_ppm,
+                           uint64_t *samples);
+
+#endif //CLOCK_OFFSET_H
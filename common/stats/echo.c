@@ -0,0 +1,259 @@
+#include "echo.h"
+#include "core/logger.h"
+#include "core/topics.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The one-way latency needs the clocks of the two hosts in sync, the round trip does not: both of its ends are read on
+ * the client. In echo mode the server sends a data frame back as it is (<subscriber_id>#echo:<frame>) on the responder
+ * channel, right after its duplicate check, so the frame still carries the creation time of the client:
+ * - open loop: the client sends at its usual pace, the server reflects one message out of echo.sample
+ * - closed loop: every sending thread waits for the echo of its message before the next one (or for the timeout, if
+ *   the message or its echo was lost), so the queues never fill and the round trip is the one of an idle system
+ * The responder thread of the client records every round trip in a histogram, and in the one of its payload size (the
+ * configured size closest to the echoed content), so that a run cycling through the sizes compares them in one go.
+ */
+
+/**
+ * @brief Get the echo mode from its name.
+ * @param name "off", "open" or "closed"
+ * @return The echo mode, or -1 if the name is not valid
+ */
+int parse_echo_mode(const char *name) {
+    if (name == NULL) {
+        return -1;
+    }
+    if (strcmp(name, "off") == 0 || name[0] == '\0') {
+        return ECHO_OFF;
+    } else if (strcmp(name, "open") == 0) {
+        return ECHO_OPEN_LOOP;
+    } else if (strcmp(name, "closed") == 0) {
+        return ECHO_CLOSED_LOOP;
+    }
+    return -1;
+}
+
+/**
+ * @brief Get the name of an echo mode.
+ * @param mode
+ * @return
+ */
+const char *echo_mode_name(EchoMode mode) {
+    switch (mode) {
+        case ECHO_OFF:
+            return "off";
+        case ECHO_OPEN_LOOP:
+            return "open";
+        case ECHO_CLOSED_LOOP:
+            return "closed";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * @brief Parse the payload sizes of a run.
+ * @param list Comma separated sizes in bytes ("64,1024,65536"), NULL or empty for default_size only
+ * @param default_size
+ * @param sizes
+ * @param max_sizes
+ * @return The number of sizes (the invalid ones are skipped, default_size alone if none is valid)
+ */
+int parse_payload_sizes(const char *list, int default_size, int *sizes, int max_sizes) {
+    int count = 0;
+    const char *ptr = list != NULL ? list : "";
+    while (*ptr != '\0' && count < max_sizes) {
+        char *end;
+        errno = 0;
+        long size = strtol(ptr, &end, 10);
+        if (end == ptr) {
+            ptr++;      // Separator or garbage
+            continue;
+        }
+        if (errno == 0 && size > 0 && size <= INT32_MAX) {
+            sizes[count++] = (int) size;
+        } else {
+            logger(LOG_LEVEL_WARN, "Invalid payload size: %.*s", (int) (end - ptr), ptr);
+        }
+        ptr = end;
+    }
+    if (count == 0) {
+        sizes[count++] = default_size;
+    }
+    return count;
+}
+
+/**
+ * @brief Allocate the round trip histograms.
+ * @param echo
+ * @param sizes Payload sizes of the messages
+ * @param size_count
+ * @param sub_bucket_bits Precision of the histograms
+ * @param closed_loop Wake the senders waiting in echo_wait
+ * @return 0 on success, -1 on error
+ */
+int init_echo_stats(EchoStats *echo, const int *sizes, int size_count, int sub_bucket_bits, bool closed_loop) {
+    memset(echo, 0, sizeof(EchoStats));
+    if (size_count < 1 || size_count > ECHO_MAX_SIZES) {
+        return -1;
+    }
+    memcpy(echo->sizes, sizes, sizeof(int) * (size_t) size_count);
+    echo->closed_loop = closed_loop;
+    pthread_mutex_init(&echo->mutex, NULL);
+    pthread_cond_init(&echo->cond, NULL);
+    if (init_histogram(&echo->all, sub_bucket_bits) != 0) {
+        pthread_mutex_destroy(&echo->mutex);
+        pthread_cond_destroy(&echo->cond);
+        return -1;
+    }
+    for (int i = 0; i < size_count; i++) {
+        if (init_histogram(&echo->by_size[i], sub_bucket_bits) != 0) {
+            release_echo_stats(echo);
+            return -1;
+        }
+        echo->size_count++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Index of the configured payload size closest to a content length.
+ * @param echo
+ * @param length
+ * @return
+ */
+static int size_index(const EchoStats *echo, size_t length) {
+    int best = 0;
+    for (int i = 1; i < echo->size_count; i++) {
+        if (labs((long) echo->sizes[i] - (long) length) < labs((long) echo->sizes[best] - (long) length)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Record the round trip of a reflected frame, and wake the closed loop sender waiting for it.
+ * @param echo
+ * @param frame The data frame as sent by the client (<topic_id>:<id>|<timestamp>[@<deadline>]|<content>)
+ * @param now_us Receive time of the echo
+ * @return The round trip in us, -1 if the frame is malformed
+ */
+long long echo_record(EchoStats *echo, const char *frame, long long now_us) {
+    uint16_t topic_id;
+    const char *ptr = parse_topic(frame, &topic_id);
+
+    // Only the ID and the creation time are read, the content only for its length
+    char *end;
+    uint64_t id = strtoull(ptr, &end, 10);
+    if (*end != '|') {
+        atomic_fetch_add_explicit(&echo->malformed, 1, memory_order_relaxed);
+        return -1;
+    }
+    long long timestamp = strtoll(end + 1, &end, 10);
+    const char *content = strchr(end, '|');
+    if (content == NULL || timestamp > now_us) {
+        atomic_fetch_add_explicit(&echo->malformed, 1, memory_order_relaxed);
+        return -1;
+    }
+
+    long long rtt_us = now_us - timestamp;
+    histogram_record(&echo->all, (uint64_t) rtt_us);
+    histogram_record(&echo->by_size[size_index(echo, strlen(content + 1))], (uint64_t) rtt_us);
+
+    atomic_store_explicit(&echo->received[id % ECHO_WAIT_SLOTS], id, memory_order_release);
+    if (echo->closed_loop) {
+        pthread_mutex_lock(&echo->mutex);
+        pthread_cond_broadcast(&echo->cond);
+        pthread_mutex_unlock(&echo->mutex);
+    }
+    return rtt_us;
+}
+
+/**
+ * @brief Wait for the echo of a message (closed loop).
+ * @param echo
+ * @param id
+ * @param timeout_ms
+ * @return true if the echo came back, false after timeout_ms
+ */
+bool echo_wait(EchoStats *echo, uint64_t id, int timeout_ms) {
+    _Atomic uint64_t *slot = &echo->received[id % ECHO_WAIT_SLOTS];
+    if (atomic_load_explicit(slot, memory_order_acquire) == id) {
+        return true;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    bool received = true;
+    pthread_mutex_lock(&echo->mutex);
+    while (atomic_load_explicit(slot, memory_order_acquire) != id) {
+        if (pthread_cond_timedwait(&echo->cond, &echo->mutex, &deadline) == ETIMEDOUT) {
+            received = atomic_load_explicit(slot, memory_order_acquire) == id;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&echo->mutex);
+    if (!received) {
+        atomic_fetch_add_explicit(&echo->timeouts, 1, memory_order_relaxed);
+    }
+    return received;
+}
+
+static void log_round_trip(const char *name, const char *label, const LatencyHistogram *histogram) {
+    logger(LOG_LEVEL_INFO2, "[%s] Round trip %s (%" PRIu64 " echoes): p50 %" PRIu64 " us, p90 %" PRIu64 " us, p99 %"
+                            PRIu64 " us, p99.9 %" PRIu64 " us, max %" PRIu64 " us", name, label,
+           histogram_count(histogram), histogram_percentile(histogram, 50), histogram_percentile(histogram, 90),
+           histogram_percentile(histogram, 99), histogram_percentile(histogram, 99.9),
+           histogram_count(histogram) > 0 ? (uint64_t) histogram->max : 0);
+}
+
+/**
+ * @brief Log the round trip percentiles of the run, overall and per payload size (when there are several).
+ * @param echo
+ * @param name Prefix of the log lines
+ */
+void report_echo_stats(EchoStats *echo, const char *name) {
+    if (echo->all.counts == NULL) {
+        return;
+    }
+    log_round_trip(name, "all sizes", &echo->all);
+    for (int i = 0; echo->size_count > 1 && i < echo->size_count; i++) {
+        char label[32];
+        snprintf(label, sizeof(label), "%d B", echo->sizes[i]);
+        log_round_trip(name, label, &echo->by_size[i]);
+    }
+    uint64_t timeouts = atomic_load(&echo->timeouts), malformed = atomic_load(&echo->malformed);
+    if (timeouts > 0 || malformed > 0) {
+        logger(LOG_LEVEL_WARN, "[%s] Echoes lost: %" PRIu64 ", malformed: %" PRIu64, name, timeouts, malformed);
+    }
+}
+
+/**
+ * @brief Free the histograms.
+ * @param echo
+ */
+void release_echo_stats(EchoStats *echo) {
+    if (echo->all.counts == NULL) {
+        return;
+    }
+    release_histogram(&echo->all);
+    for (int i = 0; i < echo->size_count; i++) {
+        release_histogram(&echo->by_size[i]);
+    }
+    pthread_mutex_destroy(&echo->mutex);
+    pthread_cond_destroy(&echo->cond);
+    echo->size_count = 0;
+}
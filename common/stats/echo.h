@@ -0,0 +1,65 @@
+//  =====================================================================
+//  echo.h
+//
+//  Round-trip (echo) latency: the server reflects the data frames on
+//  the responder channel, the client measures their round trip time
+//  =====================================================================
+
+#ifndef ECHO_H
+#define ECHO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "stats/histogram.h"
+
+#define ECHO_PREFIX "echo:"                     // Reflected frame: <subscriber_id>#echo:<frame>
+#define ECHO_MAX_SIZES 16                       // Payload sizes of a run (the messages cycle through them)
+#define ECHO_WAIT_SLOTS 1024                    // Last echoed IDs, seen by the closed loop senders
+
+typedef enum {
+    ECHO_OFF,
+    ECHO_OPEN_LOOP,                             // The messages are sent at the usual pace, a sample is reflected
+    ECHO_CLOSED_LOOP                            // A message per thread in flight: the next one after its echo
+} EchoMode;
+
+// Round trip times of the echoed messages, overall and per payload size
+typedef struct {
+    int sizes[ECHO_MAX_SIZES];
+    int size_count;
+    bool closed_loop;
+    LatencyHistogram all;
+    LatencyHistogram by_size[ECHO_MAX_SIZES];
+    _Atomic uint64_t received[ECHO_WAIT_SLOTS]; // ID of the last echo of every slot (id % ECHO_WAIT_SLOTS)
+    _Atomic uint64_t malformed;
+    _Atomic uint64_t timeouts;                  // Closed loop waits without echo (message or echo lost)
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} EchoStats;
+
+// Get the echo mode from its name ("off", "open" or "closed"), return -1 if the name is not valid
+int parse_echo_mode(const char *name);
+
+// Get the name of an echo mode
+const char *echo_mode_name(EchoMode mode);
+
+// Parse comma separated payload sizes ("64,1024"), return their number (default_size alone for an empty list)
+int parse_payload_sizes(const char *list, int default_size, int *sizes, int max_sizes);
+
+// Allocate the histograms (sub_bucket_bits of precision) of the payload sizes, return 0 on success
+int init_echo_stats(EchoStats *echo, const int *sizes, int size_count, int sub_bucket_bits, bool closed_loop);
+
+// Record the round trip of a reflected frame (<topic_id>:<id>|<timestamp>|<content>), return it (us) or -1
+long long echo_record(EchoStats *echo, const char *frame, long long now_us);
+
+// Wait for the echo of a message (closed loop), return false if it did not come back within timeout_ms
+bool echo_wait(EchoStats *echo, uint64_t id, int timeout_ms);
+
+// Log the round trip percentiles, overall and per payload size
+void report_echo_stats(EchoStats *echo, const char *name);
+
+// Free the histograms
+void release_echo_stats(EchoStats *echo);
+
+#endif //ECHO_H
@@ -0,0 +1,392 @@
+#include "histogram.h"
+#include "core/logger.h"
+#include "stats/varint.h"
+#include <stdlib.h>
+#include <string.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The percentiles of the latency came from the CSV of every message, post-processed by latency_plot.py: memory and
+ * time grow with the run. The histogram is log-linear like HdrHistogram: the values below 2^bits have a bucket each,
+ * then every power of two [2^e, 2^(e+1)) is split into 2^(bits-1) buckets of the same width. So the relative error is
+ * below 2^-(bits-1) on the whole uint64 range with a fixed number of buckets (3776 with 7 bits, 30 KB), and a record
+ * is a clz, a shift and a relaxed atomic add (no lock with several receive threads).
+ * The stats thread never resets the live histogram: the interval stats are the difference with a copy of the
+ * previous tick (histogram_interval), so a record is never lost between two ticks.
+ * Encoding (little endian varints): "RMQH", version, bits, then start_us and end_us (zigzag), total, sum, min, max,
+ * the payload size and the counts up to the last bucket used, where a count is (count << 1) and a run of empty
+ * buckets is (run << 1) | 1. The encodings only add up, so decoding into the same histogram merges them: shards,
+ * intervals and runs are combined by concatenating their files.
+ */
+
+static size_t half_count(const LatencyHistogram *histogram) {
+    return (size_t) 1 << (histogram->sub_bucket_bits - 1);
+}
+
+static size_t bucket_index(const LatencyHistogram *histogram, uint64_t value) {
+    int bits = histogram->sub_bucket_bits;
+    if (value < ((uint64_t) 1 << bits)) {
+        return (size_t) value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - bits + 1;
+    size_t top = (size_t) (value >> shift);  // In [2^(bits-1), 2^bits)
+    return ((size_t) 1 << bits) + (size_t) (exponent - bits) * half_count(histogram) + (top - half_count(histogram));
+}
+
+static uint64_t bucket_lowest(const LatencyHistogram *histogram, size_t index, int *shift) {
+    int bits = histogram->sub_bucket_bits;
+    if (index < ((size_t) 1 << bits)) {
+        *shift = 0;
+        return (uint64_t) index;
+    }
+    size_t offset = index - ((size_t) 1 << bits);
+    *shift = (int) (offset / half_count(histogram)) + 1;
+    uint64_t top = (uint64_t) (offset % half_count(histogram) + half_count(histogram));
+    return top << *shift;
+}
+
+static uint64_t bucket_highest(const LatencyHistogram *histogram, size_t index) {
+    int shift;
+    uint64_t lowest = bucket_lowest(histogram, index, &shift);
+    return lowest + (((uint64_t) 1 << shift) - 1);
+}
+
+static void store_min(_Atomic uint64_t *min, uint64_t value) {
+    uint64_t current = atomic_load_explicit(min, memory_order_relaxed);
+    while (value < current &&
+           !atomic_compare_exchange_weak_explicit(min, &current, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static void store_max(_Atomic uint64_t *max, uint64_t value) {
+    uint64_t current = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > current &&
+           !atomic_compare_exchange_weak_explicit(max, &current, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/**
+ * @brief Allocate an empty histogram.
+ * @param histogram
+ * @param sub_bucket_bits Precision (HISTOGRAM_MIN_SUB_BUCKET_BITS - HISTOGRAM_MAX_SUB_BUCKET_BITS)
+ * @return 0 on success, -1 on error
+ */
+int init_histogram(LatencyHistogram *histogram, int sub_bucket_bits) {
+    memset(histogram, 0, sizeof(LatencyHistogram));
+    if (sub_bucket_bits < HISTOGRAM_MIN_SUB_BUCKET_BITS || sub_bucket_bits > HISTOGRAM_MAX_SUB_BUCKET_BITS) {
+        logger(LOG_LEVEL_ERROR, "Invalid precision of the histogram: %d bits", sub_bucket_bits);
+        return -1;
+    }
+    histogram->sub_bucket_bits = sub_bucket_bits;
+    histogram->counts_len = ((size_t) 1 << sub_bucket_bits) + (size_t) (64 - sub_bucket_bits) * half_count(histogram);
+    histogram->counts = calloc(histogram->counts_len, sizeof(*histogram->counts));
+    if (histogram->counts == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the histogram");
+        return -1;
+    }
+    atomic_store(&histogram->min, UINT64_MAX);
+    return 0;
+}
+
+void release_histogram(LatencyHistogram *histogram) {
+    free((void *) histogram->counts);
+    histogram->counts = NULL;
+    histogram->counts_len = 0;
+}
+
+void histogram_reset(LatencyHistogram *histogram) {
+    for (size_t i = 0; i < histogram->counts_len; i++) {
+        atomic_store_explicit(&histogram->counts[i], 0, memory_order_relaxed);
+    }
+    atomic_store(&histogram->total, 0);
+    atomic_store(&histogram->sum, 0);
+    atomic_store(&histogram->min, UINT64_MAX);
+    atomic_store(&histogram->max, 0);
+    histogram->start_us = 0;
+    histogram->end_us = 0;
+}
+
+/**
+ * @brief Add a value: O(1), without locks.
+ * @param histogram
+ * @param value
+ */
+void histogram_record(LatencyHistogram *histogram, uint64_t value) {
+    atomic_fetch_add_explicit(&histogram->counts[bucket_index(histogram, value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+    store_min(&histogram->min, value);
+    store_max(&histogram->max, value);
+}
+
+static void merge_range(LatencyHistogram *histogram, int64_t start_us, int64_t end_us) {
+    if (start_us != 0 && (histogram->start_us == 0 || start_us < histogram->start_us)) {
+        histogram->start_us = start_us;
+    }
+    if (end_us > histogram->end_us) {
+        histogram->end_us = end_us;
+    }
+}
+
+/**
+ * @brief Add the values of another histogram.
+ * @param histogram
+ * @param source Same precision
+ * @return 0 on success, -1 if the precisions differ
+ */
+int histogram_merge(LatencyHistogram *histogram, const LatencyHistogram *source) {
+    if (histogram->sub_bucket_bits != source->sub_bucket_bits) {
+        logger(LOG_LEVEL_ERROR, "Cannot merge histograms of %d and %d bits", histogram->sub_bucket_bits,
+               source->sub_bucket_bits);
+        return -1;
+    }
+    for (size_t i = 0; i < source->counts_len; i++) {
+        uint64_t count = atomic_load_explicit(&source->counts[i], memory_order_relaxed);
+        if (count > 0) {
+            atomic_fetch_add_explicit(&histogram->counts[i], count, memory_order_relaxed);
+        }
+    }
+    atomic_fetch_add(&histogram->total, atomic_load(&source->total));
+    atomic_fetch_add(&histogram->sum, atomic_load(&source->sum));
+    store_min(&histogram->min, atomic_load(&source->min));
+    store_max(&histogram->max, atomic_load(&source->max));
+    merge_range(histogram, source->start_us, source->end_us);
+    return 0;
+}
+
+/**
+ * @brief Stats of the last interval: the values added to current since the previous call, while other threads keep
+ * recording into current. The min and max of the interval are the bounds of its lowest and highest buckets.
+ * @param interval Overwritten
+ * @param current Live histogram (not modified)
+ * @param previous Copy of current at the previous call, updated
+ * @return 0 on success, -1 if the precisions differ
+ */
+int histogram_interval(LatencyHistogram *interval, const LatencyHistogram *current, LatencyHistogram *previous) {
+    if (interval->sub_bucket_bits != current->sub_bucket_bits ||
+        previous->sub_bucket_bits != current->sub_bucket_bits) {
+        return -1;
+    }
+    histogram_reset(interval);
+
+    uint64_t total = 0;
+    size_t lowest = SIZE_MAX, highest = 0;
+    for (size_t i = 0; i < current->counts_len; i++) {
+        uint64_t count = atomic_load_explicit(&current->counts[i], memory_order_relaxed);
+        uint64_t delta = count - atomic_load_explicit(&previous->counts[i], memory_order_relaxed);
+        atomic_store_explicit(&previous->counts[i], count, memory_order_relaxed);
+        atomic_store_explicit(&interval->counts[i], delta, memory_order_relaxed);
+        if (delta > 0) {
+            total += delta;
+            lowest = lowest == SIZE_MAX ? i : lowest;
+            highest = i;
+        }
+    }
+
+    // The sum may include a few records whose bucket was not counted yet: they are in the next interval
+    uint64_t sum = atomic_load(&current->sum);
+    atomic_store(&interval->total, total);
+    atomic_store(&interval->sum, sum - atomic_load(&previous->sum));
+    atomic_store(&previous->sum, sum);
+    atomic_store(&previous->total, atomic_load(&current->total));
+    if (total > 0) {
+        int shift;
+        uint64_t min = bucket_lowest(current, lowest, &shift), max = bucket_highest(current, highest);
+        uint64_t current_min = atomic_load(&current->min), current_max = atomic_load(&current->max);
+        atomic_store(&interval->min, min > current_min ? min : current_min);
+        atomic_store(&interval->max, max < current_max ? max : current_max);
+    }
+    return 0;
+}
+
+/**
+ * @brief Value at a percentile, with the precision of the histogram.
+ * @param histogram
+ * @param percentile From 0 to 100
+ * @return The highest value equivalent to the bucket of the percentile (at most the max), 0 when empty
+ */
+uint64_t histogram_percentile(const LatencyHistogram *histogram, double percentile) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < histogram->counts_len; i++) {
+        total += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    percentile = percentile < 0 ? 0 : percentile > 100 ? 100 : percentile;
+    uint64_t target = (uint64_t) (percentile / 100 * (double) total + 0.5);
+    target = target < 1 ? 1 : target > total ? total : target;
+
+    uint64_t max = atomic_load(&histogram->max);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < histogram->counts_len; i++) {
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (seen >= target) {
+            uint64_t value = bucket_highest(histogram, i);
+            return value < max ? value : max;
+        }
+    }
+    return max;
+}
+
+/**
+ * @brief Cumulative counts at some limits (the "le" buckets of a Prometheus histogram), in one pass.
+ * @param histogram
+ * @param limits Increasing
+ * @param limits_len
+ * @param counts One per limit
+ */
+void histogram_cumulative_counts(const LatencyHistogram *histogram, const uint64_t *limits, size_t limits_len,
+                                 uint64_t *counts) {
+    uint64_t seen = 0;
+    size_t limit = 0;
+    for (size_t i = 0; i < histogram->counts_len && limit < limits_len; i++) {
+        uint64_t highest = bucket_highest(histogram, i);
+        while (limit < limits_len && highest > limits[limit]) {
+            counts[limit++] = seen;
+        }
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    }
+    while (limit < limits_len) {
+        counts[limit++] = seen;
+    }
+}
+
+uint64_t histogram_count(const LatencyHistogram *histogram) {
+    return atomic_load(&histogram->total);
+}
+
+double histogram_mean(const LatencyHistogram *histogram) {
+    uint64_t total = atomic_load(&histogram->total);
+    return total > 0 ? (double) atomic_load(&histogram->sum) / (double) total : 0.0;
+}
+
+// ============================================= Encoding ==============================================================
+
+/**
+ * @brief Read the run-length counts of an encoding.
+ * @param histogram
+ * @param buffer
+ * @param offset Start of the counts
+ * @param end End of the counts
+ * @param add Add them to histogram, otherwise only check them
+ * @return 0 on success, -1 if invalid
+ */
+static int decode_counts(LatencyHistogram *histogram, const uint8_t *buffer, size_t offset, size_t end, bool add) {
+    size_t index = 0;
+    while (offset < end) {
+        uint64_t value;
+        if (get_varint(buffer, end, &offset, &value) != 0) {
+            return -1;
+        }
+        if (value & 1) {
+            if ((value >> 1) > histogram->counts_len - index) {
+                return -1;
+            }
+            index += value >> 1;
+            continue;
+        }
+        if (index >= histogram->counts_len) {
+            return -1;
+        }
+        if (add) {
+            atomic_fetch_add_explicit(&histogram->counts[index], value >> 1, memory_order_relaxed);
+        }
+        index++;
+    }
+    return 0;
+}
+
+size_t histogram_encoded_max_size(const LatencyHistogram *histogram) {
+    return HISTOGRAM_HEADER_MAX_SIZE + histogram->counts_len * VARINT_MAX_SIZE;
+}
+
+/**
+ * @brief Encode a histogram in its compact form (see the nutshell).
+ * @param histogram
+ * @param buffer
+ * @param size At least histogram_encoded_max_size bytes to never fail
+ * @return The size of the encoding, 0 if the buffer is too small
+ */
+size_t histogram_encode(const LatencyHistogram *histogram, uint8_t *buffer, size_t size) {
+    if (size < histogram_encoded_max_size(histogram)) {
+        return 0;
+    }
+
+    // The counts first, after the room of the header, then the header with their size before them
+    uint8_t *payload = buffer + HISTOGRAM_HEADER_MAX_SIZE;
+    size_t payload_size = 0;
+    uint64_t empty = 0;
+    for (size_t i = 0; i < histogram->counts_len; i++) {
+        uint64_t count = atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (count == 0) {
+            empty++;
+            continue;
+        }
+        if (empty > 0) {
+            payload_size += put_varint(payload + payload_size, (empty << 1) | 1);
+            empty = 0;
+        }
+        payload_size += put_varint(payload + payload_size, count << 1);
+    }
+
+    uint8_t header[HISTOGRAM_HEADER_MAX_SIZE];
+    size_t header_size = strlen(HISTOGRAM_MAGIC);
+    memcpy(header, HISTOGRAM_MAGIC, header_size);
+    header[header_size++] = HISTOGRAM_VERSION;
+    header[header_size++] = (uint8_t) histogram->sub_bucket_bits;
+    header_size += put_varint(header + header_size, zigzag_encode(histogram->start_us));
+    header_size += put_varint(header + header_size, zigzag_encode(histogram->end_us));
+    header_size += put_varint(header + header_size, atomic_load(&histogram->total));
+    header_size += put_varint(header + header_size, atomic_load(&histogram->sum));
+    header_size += put_varint(header + header_size, atomic_load(&histogram->min));
+    header_size += put_varint(header + header_size, atomic_load(&histogram->max));
+    header_size += put_varint(header + header_size, payload_size);
+
+    memmove(buffer + header_size, payload, payload_size);
+    memcpy(buffer, header, header_size);
+    return header_size + payload_size;
+}
+
+/**
+ * @brief Decode a histogram and add its values to histogram.
+ * @param histogram Initialized with the same precision (empty to just decode)
+ * @param buffer
+ * @param size
+ * @return The size of the encoding read (more can follow in the buffer), -1 if invalid
+ */
+long histogram_decode(LatencyHistogram *histogram, const uint8_t *buffer, size_t size) {
+    size_t offset = strlen(HISTOGRAM_MAGIC);
+    if (size < offset + 2 || memcmp(buffer, HISTOGRAM_MAGIC, offset) != 0 || buffer[offset] != HISTOGRAM_VERSION) {
+        return -1;
+    }
+    if (buffer[offset + 1] != histogram->sub_bucket_bits) {
+        logger(LOG_LEVEL_ERROR, "Cannot merge histograms of %d and %d bits", histogram->sub_bucket_bits,
+               buffer[offset + 1]);
+        return -1;
+    }
+    offset += 2;
+
+    uint64_t start_us, end_us, total, sum, min, max, payload_size;
+    if (get_varint(buffer, size, &offset, &start_us) != 0 || get_varint(buffer, size, &offset, &end_us) != 0 ||
+        get_varint(buffer, size, &offset, &total) != 0 || get_varint(buffer, size, &offset, &sum) != 0 ||
+        get_varint(buffer, size, &offset, &min) != 0 || get_varint(buffer, size, &offset, &max) != 0 ||
+        get_varint(buffer, size, &offset, &payload_size) != 0 || payload_size > size - offset) {
+        return -1;
+    }
+
+    // Checked before adding anything, an invalid encoding leaves the histogram unchanged
+    size_t end = offset + payload_size;
+    if (decode_counts(histogram, buffer, offset, end, false) != 0) {
+        return -1;
+    }
+    decode_counts(histogram, buffer, offset, end, true);
+
+    atomic_fetch_add(&histogram->total, total);
+    atomic_fetch_add(&histogram->sum, sum);
+    store_min(&histogram->min, min);
+    store_max(&histogram->max, max);
+    merge_range(histogram, zigzag_decode(start_us), zigzag_decode(end_us));
+    return (long) end;
+}
@@ -0,0 +1,72 @@
+//  =====================================================================
+//  histogram.h
+//
+//  HDR-style log-linear latency histogram: constant memory, O(1) record,
+//  percentiles and a compact mergeable encoding
+//  =====================================================================
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define HISTOGRAM_DEFAULT_SUB_BUCKET_BITS 7     // 128 linear sub-buckets per power of two: < 1% relative error
+#define HISTOGRAM_MIN_SUB_BUCKET_BITS 1
+#define HISTOGRAM_MAX_SUB_BUCKET_BITS 16
+#define HISTOGRAM_MAGIC "RMQH"
+#define HISTOGRAM_VERSION 1
+#define HISTOGRAM_HEADER_MAX_SIZE 64            // Magic, version, precision and the varints of the header
+
+typedef struct {
+    int sub_bucket_bits;                        // Precision: values up to 2^bits are exact
+    size_t counts_len;                          // Buckets covering the whole uint64 range
+    _Atomic uint64_t *counts;
+    _Atomic uint64_t total;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t min;                       // UINT64_MAX when empty
+    _Atomic uint64_t max;
+    int64_t start_us;                           // Time range of the values (encoded with them, 0 if unknown)
+    int64_t end_us;
+} LatencyHistogram;
+
+// Allocate an empty histogram with the given precision, return 0 on success
+int init_histogram(LatencyHistogram *histogram, int sub_bucket_bits);
+
+void release_histogram(LatencyHistogram *histogram);
+
+// Remove all the values
+void histogram_reset(LatencyHistogram *histogram);
+
+// Add a value (lock-free, any thread)
+void histogram_record(LatencyHistogram *histogram, uint64_t value);
+
+// Add the values of source to histogram (same precision), return 0 on success
+int histogram_merge(LatencyHistogram *histogram, const LatencyHistogram *source);
+
+// Values added to current since previous (the stats of the last interval) into interval, then previous = current
+int histogram_interval(LatencyHistogram *interval, const LatencyHistogram *current, LatencyHistogram *previous);
+
+// Value at a percentile (0-100): the highest value equivalent to the bucket of the percentile, 0 when empty
+uint64_t histogram_percentile(const LatencyHistogram *histogram, double percentile);
+
+// Number of values <= each limit (limits in increasing order, a bucket counts when its highest value is <= the limit)
+void histogram_cumulative_counts(const LatencyHistogram *histogram, const uint64_t *limits, size_t limits_len,
+                                 uint64_t *counts);
+
+uint64_t histogram_count(const LatencyHistogram *histogram);
+
+double histogram_mean(const LatencyHistogram *histogram);
+
+// Max size of the encoding of a histogram
+size_t histogram_encoded_max_size(const LatencyHistogram *histogram);
+
+// Encode a histogram (header and run-length of the counts), return its size or 0 if the buffer is too small
+size_t histogram_encode(const LatencyHistogram *histogram, uint8_t *buffer, size_t size);
+
+// Decode a histogram and add it to histogram (same precision), return the bytes read or -1 if invalid
+long histogram_decode(LatencyHistogram *histogram, const uint8_t *buffer, size_t size);
+
+#endif //HISTOGRAM_H
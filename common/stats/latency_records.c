@@ -0,0 +1,197 @@
+#include "latency_records.h"
+#include "core/logger.h"
+#include "core/realtime.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * Every received message used to cost a json-c object with its children (several mallocs and hash inserts) under a
+ * mutex shared with the stats thread, only to keep a few integers. Now the receive threads append a packed
+ * LatencyRecord to a ring allocated (and prefaulted) once, with capacity records.
+ * An append reserves an index with a CAS on head (only while the ring has room: head - tail < capacity), copies the
+ * record into its slot and publishes it by storing index + 1 in the committed word of the slot (release). So the
+ * appends of different threads never wait for each other, and a full ring drops the record (counted) instead of
+ * blocking the receive path.
+ * The exporter reads from the tail up to the first slot not yet published (latency_records_committed), formats the
+ * CSV or JSON only then, and gives the slots back with latency_records_release_until.
+ */
+
+/**
+ * @brief Allocate the ring.
+ * @param records
+ * @param capacity Max records not yet released by the exporter
+ * @return 0 on success, -1 on error
+ */
+int init_latency_records(LatencyRecords *records, size_t capacity) {
+    memset(records, 0, sizeof(LatencyRecords));
+    if (capacity == 0) {
+        logger(LOG_LEVEL_ERROR, "Invalid capacity of the latency records");
+        return -1;
+    }
+
+    records->records = malloc(capacity * sizeof(LatencyRecord));
+    records->committed = calloc(capacity, sizeof(*records->committed));
+    if (records->records == NULL || records->committed == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for %zu latency records", capacity);
+        release_latency_records(records);
+        return -1;
+    }
+    records->capacity = capacity;
+    // No page fault on the receive path
+    prefault_memory(records->records, capacity * sizeof(LatencyRecord));
+    return 0;
+}
+
+void release_latency_records(LatencyRecords *records) {
+    free(records->records);
+    free((void *) records->committed);
+    records->records = NULL;
+    records->committed = NULL;
+    records->capacity = 0;
+}
+
+/**
+ * @brief Append a record (lock-free, any number of threads).
+ * @param records
+ * @param record
+ * @return true if appended, false if the ring is full
+ */
+bool append_latency_record(LatencyRecords *records, const LatencyRecord *record) {
+    uint64_t index = atomic_load_explicit(&records->head, memory_order_relaxed);
+    do {
+        if (index - atomic_load_explicit(&records->tail, memory_order_acquire) >= records->capacity) {
+            atomic_fetch_add_explicit(&records->dropped, 1, memory_order_relaxed);
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&records->head, &index, index + 1, memory_order_relaxed,
+                                                    memory_order_relaxed));
+
+    size_t slot = (size_t) (index % records->capacity);
+    records->records[slot] = *record;
+    atomic_store_explicit(&records->committed[slot], index + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * @brief Find the end of the records fully written, from an index.
+ * @param records
+ * @param from
+ * @return The first index >= from whose record is not published yet
+ */
+uint64_t latency_records_committed(LatencyRecords *records, uint64_t from) {
+    uint64_t head = atomic_load_explicit(&records->head, memory_order_acquire);
+    uint64_t end = from;
+    while (end < head &&
+           atomic_load_explicit(&records->committed[end % records->capacity], memory_order_acquire) == end + 1) {
+        end++;
+    }
+    return end;
+}
+
+const LatencyRecord *latency_record_at(const LatencyRecords *records, uint64_t index) {
+    return &records->records[index % records->capacity];
+}
+
+void latency_records_release_until(LatencyRecords *records, uint64_t index) {
+    atomic_store_explicit(&records->tail, index, memory_order_release);
+}
+
+/**
+ * @brief Format a record as a CSV row: id, position in the file and latency in ms, then the components of the latency
+ * in ms (queue, wire and stack, empty when not measured) when components is true.
+ * @param record
+ * @param num Position of the record in its file (from 1)
+ * @param components
+ * @param buffer At least LATENCY_RECORD_MAX_TEXT bytes
+ * @param size
+ * @return The length of the row
+ */
+size_t format_latency_record_csv(const LatencyRecord *record, uint64_t num, bool components, char *buffer,
+                                 size_t size) {
+    double diff = (double) (record->recv_time - record->send_time) / 1000;
+    if (!components) {
+        return (size_t) snprintf(buffer, size, "%" PRIu64 ",%" PRIu64 ",%.4f\n", record->id, num, diff);
+    }
+
+    char queue[32] = "", wire[32] = "", stack[32] = "";
+    if (record->send_ns != 0) {
+        snprintf(queue, sizeof(queue), "%.6f", (double) (record->send_ns - record->send_time * 1000) / 1e6);
+    }
+    if (record->kernel_rx_ns != 0) {
+        snprintf(wire, sizeof(wire), "%.6f", (double) (record->kernel_rx_ns - record->send_ns) / 1e6);
+        snprintf(stack, sizeof(stack), "%.6f", (double) (record->recv_ns - record->kernel_rx_ns) / 1e6);
+    }
+    return (size_t) snprintf(buffer, size, "%" PRIu64 ",%" PRIu64 ",%.4f,%s,%s,%s\n", record->id, num, diff, queue,
+                             wire, stack);
+}
+
+/**
+ * @brief Format a record as a JSON object (one line), with the same keys of the json-c objects of the previous
+ * versions.
+ * @param record
+ * @param buffer At least LATENCY_RECORD_MAX_TEXT bytes
+ * @param size
+ * @return The length of the object
+ */
+size_t format_latency_record_json(const LatencyRecord *record, char *buffer, size_t size) {
+    int len = snprintf(buffer, size, "    {\"id\":%" PRIu64 ",\"send_time\":%" PRId64 ",\"recv_time\":%" PRId64,
+                       record->id, record->send_time, record->recv_time);
+    if (record->send_ns != 0) {
+        len += snprintf(buffer + len, size - (size_t) len,
+                        ",\"recv_ns\":%" PRId64 ",\"send_ns\":%" PRId64 ",\"queue_ns\":%" PRId64, record->recv_ns,
+                        record->send_ns, record->send_ns - record->send_time * 1000);
+    }
+    if (record->kernel_rx_ns != 0) {
+        len += snprintf(buffer + len, size - (size_t) len,
+                        ",\"kernel_rx_ns\":%" PRId64 ",\"wire_ns\":%" PRId64 ",\"stack_ns\":%" PRId64
+                        ",\"hardware\":%s", record->kernel_rx_ns, record->kernel_rx_ns - record->send_ns,
+                        record->recv_ns - record->kernel_rx_ns, record->hardware ? "true" : "false");
+    }
+    len += snprintf(buffer + len, size - (size_t) len, "}");
+    return (size_t) len;
+}
+
+/**
+ * @brief Write records as CSV rows, after the header.
+ * @param records
+ * @param from
+ * @param to
+ * @param components Add the queue, wire and stack columns
+ * @param file
+ * @return The number of records written
+ */
+size_t export_latency_records_csv(const LatencyRecords *records, uint64_t from, uint64_t to, bool components,
+                                  FILE *file) {
+    fputs(components ? LATENCY_CSV_HEADER_COMPONENTS : LATENCY_CSV_HEADER, file);
+
+    char row[LATENCY_RECORD_MAX_TEXT];
+    size_t written = 0;
+    for (uint64_t i = from; i < to; i++, written++) {
+        format_latency_record_csv(latency_record_at(records, i), written + 1, components, row, sizeof(row));
+        fputs(row, file);
+    }
+    return written;
+}
+
+/**
+ * @brief Write records as a JSON document.
+ * @param records
+ * @param from
+ * @param to
+ * @param file
+ * @return The number of records written
+ */
+size_t export_latency_records_json(const LatencyRecords *records, uint64_t from, uint64_t to, FILE *file) {
+    fputs(LATENCY_JSON_HEADER, file);
+
+    char object[LATENCY_RECORD_MAX_TEXT];
+    size_t written = 0;
+    for (uint64_t i = from; i < to; i++, written++) {
+        format_latency_record_json(latency_record_at(records, i), object, sizeof(object));
+        fprintf(file, "%s%s", written > 0 ? ",\n" : "", object);
+    }
+    fputs(LATENCY_JSON_FOOTER, file);
+    return written;
+}
@@ -0,0 +1,75 @@
+//  =====================================================================
+//  latency_records.h
+//
+//  Preallocated ring of packed latency records, appended lock-free by
+//  the receive threads and exported (CSV or JSON) by the stats thread
+//  =====================================================================
+
+#ifndef LATENCY_RECORDS_H
+#define LATENCY_RECORDS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define LATENCY_RECORDS_DEFAULT_CAPACITY 100000  // Records waiting for the exporter (appends fail when it is full)
+#define LATENCY_RECORD_MAX_TEXT 512               // Longest CSV row or JSON object of a record
+#define LATENCY_CSV_HEADER "id,num,diff\n"
+#define LATENCY_CSV_HEADER_COMPONENTS "id,num,diff,queue,wire,stack\n"
+#define LATENCY_JSON_HEADER "{\n  \"messages\":[\n"
+#define LATENCY_JSON_FOOTER "\n  ]\n}\n"
+
+// Latency of a received message: application timestamps in us, kernel timestamps in ns (0 when not measured)
+typedef struct {
+    uint64_t id;
+    int64_t send_time;                          // Creation of the message on the client (us)
+    int64_t recv_time;                          // Receive on the server (us)
+    int64_t send_ns;                            // Send call on the client
+    int64_t kernel_rx_ns;                       // Arrival in the kernel (or in the NIC, with hardware)
+    int64_t recv_ns;                            // Return of the receive call
+    bool hardware;
+} LatencyRecord;
+
+typedef struct {
+    LatencyRecord *records;
+    _Atomic uint64_t *committed;                // index + 1 once the record of the slot is written
+    size_t capacity;
+    _Atomic uint64_t head;                      // Next index to reserve
+    _Atomic uint64_t tail;                      // First record not released by the exporter
+    _Atomic uint64_t dropped;                   // Records lost because the ring was full
+} LatencyRecords;
+
+// Allocate (and prefault) a ring of capacity records, return 0 on success
+int init_latency_records(LatencyRecords *records, size_t capacity);
+
+void release_latency_records(LatencyRecords *records);
+
+// Append a record without locks (any thread), return false if the ring is full (the record is counted as dropped)
+bool append_latency_record(LatencyRecords *records, const LatencyRecord *record);
+
+// End of the records fully written from index from (the appends still in progress are excluded)
+uint64_t latency_records_committed(LatencyRecords *records, uint64_t from);
+
+// Record at index (between the tail and the committed end)
+const LatencyRecord *latency_record_at(const LatencyRecords *records, uint64_t index);
+
+// Give back the slots before index to the appends
+void latency_records_release_until(LatencyRecords *records, uint64_t index);
+
+// Format a record as a CSV row (num is its position in the file), return its length
+size_t format_latency_record_csv(const LatencyRecord *record, uint64_t num, bool components, char *buffer,
+                                 size_t size);
+
+// Format a record as a JSON object (without separator), return its length
+size_t format_latency_record_json(const LatencyRecord *record, char *buffer, size_t size);
+
+// Write the records [from, to) as CSV rows (with the header), return the number of records written
+size_t export_latency_records_csv(const LatencyRecords *records, uint64_t from, uint64_t to, bool components,
+                                  FILE *file);
+
+// Write the records [from, to) as a JSON document {"messages": [...]}, return the number of records written
+size_t export_latency_records_json(const LatencyRecords *records, uint64_t from, uint64_t to, FILE *file);
+
+#endif //LATENCY_RECORDS_H
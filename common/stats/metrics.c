@@ -0,0 +1,388 @@
+#include "metrics.h"
+#include "core/counters.h"
+#include "core/logger.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The only live view of a run were the logs and the stats files. The metrics thread answers every HTTP request (on a
+ * TCP port or a UNIX socket, e.g. curl --unix-socket) with the Prometheus text page, built at the scrape:
+ * - the counters: sum of the per-thread slots (counters_snapshot), relaxed loads only
+ * - the gauges: doubles stored as atomic words by their owner (gauge_set: the detector after a heartbeat, the
+ *   responder after an ACK) or computed at the scrape from atomics (gauge_source: the depth of the rings)
+ * - the latency histogram: its atomic buckets summed at fixed limits (1-2-5 series, us) and a few quantiles
+ * So a scrape never takes a lock of the hot path: at worst it sees a value a few updates old.
+ */
+
+typedef struct {
+    const char *name;
+    const char *help;
+} MetricInfo;
+
+static const MetricInfo COUNTER_INFO[COUNTER_TYPE_COUNT] = {
+        [COUNTER_SENT] = {"sent", "Messages sent"},
+        [COUNTER_RECEIVED] = {"received", "Messages received"},
+        [COUNTER_MISSED] = {"missed", "Messages not acknowledged in time"},
+        [COUNTER_RESENT] = {"resent", "Messages resent"},
+        [COUNTER_DUPLICATES] = {"duplicates", "Duplicated messages discarded"},
+        [COUNTER_BYTES_SENT] = {"bytes_sent", "Bytes of the messages sent"},
+        [COUNTER_BYTES_RECEIVED] = {"bytes_received", "Bytes of the messages received"},
+        [COUNTER_DEADLINE_MISSED] = {"deadline_missed", "Messages dropped past their deadline"},
+};
+
+static const MetricInfo GAUGE_INFO[GAUGE_TYPE_COUNT] = {
+        [GAUGE_PHI] = {"phi", "Phi of the failure detector"},
+        [GAUGE_DETECTOR_MEAN_MS] = {"detector_mean_ms", "Mean heartbeat interval of the failure detector"},
+        [GAUGE_DETECTOR_STD_DEV_MS] = {"detector_std_dev_ms", "Std deviation of the heartbeat intervals"},
+        [GAUGE_ACK_ROUND_US] = {"ack_round_us", "Send to ACK time of the oldest message of the last ACK"},
+        [GAUGE_RETRANSMIT_WINDOW] = {"retransmit_window", "Messages waiting for an ACK"},
+        [GAUGE_STATS_QUEUE] = {"stats_queue", "Latency records waiting for the stats writer"},
+        [GAUGE_LOG_QUEUE_BYTES] = {"log_queue_bytes", "Bytes of the message log ring not written yet"},
+        [GAUGE_CLOCK_OFFSET_US] = {"clock_offset_us", "Offset of the client clock (client minus server)"},
+        [GAUGE_CLOCK_UNCERTAINTY_US] = {"clock_uncertainty_us", "Uncertainty of the client clock offset"},
+};
+
+// Limits of the latency buckets (us)
+static const uint64_t LATENCY_BUCKETS_US[] = {
+        10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000,
+        2000000, 5000000, 10000000
+};
+#define LATENCY_BUCKETS_COUNT (sizeof(LATENCY_BUCKETS_US) / sizeof(LATENCY_BUCKETS_US[0]))
+
+static const double LATENCY_QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+static _Atomic uint64_t g_gauges[GAUGE_TYPE_COUNT];     // Bits of the doubles
+static _Atomic bool g_gauges_set[GAUGE_TYPE_COUNT];
+static GaugeReadFn g_gauge_sources[GAUGE_TYPE_COUNT];
+static void *g_gauge_source_args[GAUGE_TYPE_COUNT];
+static const LatencyHistogram *_Atomic g_histogram = NULL;
+
+void gauge_set(GaugeType type, double value) {
+    if (type < 0 || type >= GAUGE_TYPE_COUNT) {
+        return;
+    }
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    atomic_store_explicit(&g_gauges[type], bits, memory_order_relaxed);
+    atomic_store_explicit(&g_gauges_set[type], true, memory_order_relaxed);
+}
+
+double gauge_get(GaugeType type) {
+    if (type < 0 || type >= GAUGE_TYPE_COUNT) {
+        return 0.0;
+    }
+    if (g_gauge_sources[type] != NULL) {
+        return g_gauge_sources[type](g_gauge_source_args[type]);
+    }
+    uint64_t bits = atomic_load_explicit(&g_gauges[type], memory_order_relaxed);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Compute a gauge at every scrape. Set the sources before starting the metrics server.
+ * @param type
+ * @param read Lock-free function (NULL to remove the source)
+ * @param arg
+ */
+void gauge_source(GaugeType type, GaugeReadFn read, void *arg) {
+    if (type < 0 || type >= GAUGE_TYPE_COUNT) {
+        return;
+    }
+    g_gauge_source_args[type] = arg;
+    g_gauge_sources[type] = read;
+}
+
+const char *gauge_name(GaugeType type) {
+    if (type < 0 || type >= GAUGE_TYPE_COUNT) {
+        return "unknown";
+    }
+    return GAUGE_INFO[type].name;
+}
+
+void metrics_set_histogram(const LatencyHistogram *histogram) {
+    atomic_store(&g_histogram, histogram);
+}
+
+// ============================================= Rendering =============================================================
+
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t used;
+} MetricsPage;
+
+static void append(MetricsPage *page, const char *format, ...) {
+    if (page->used >= page->size) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(page->buffer + page->used, page->size - page->used, format, args);
+    va_end(args);
+    if (len > 0) {
+        page->used += (size_t) len;
+        page->used = page->used < page->size ? page->used : page->size;
+    }
+}
+
+static void append_header(MetricsPage *page, const char *name, const char *help, const char *type) {
+    append(page, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n", name, help, name, type);
+}
+
+static void render_histogram(MetricsPage *page, const LatencyHistogram *histogram, const char *role) {
+    uint64_t counts[LATENCY_BUCKETS_COUNT];
+    histogram_cumulative_counts(histogram, LATENCY_BUCKETS_US, LATENCY_BUCKETS_COUNT, counts);
+    uint64_t total = histogram_count(histogram);
+
+    append_header(page, "latency_us", "One-way latency of the messages (us)", "histogram");
+    for (size_t i = 0; i < LATENCY_BUCKETS_COUNT; i++) {
+        // The buckets are summed while the receive threads add, they can never exceed the count
+        uint64_t count = counts[i] < total ? counts[i] : total;
+        append(page, METRICS_PREFIX "latency_us_bucket{role=\"%s\",le=\"%llu\"} %llu\n", role,
+               (unsigned long long) LATENCY_BUCKETS_US[i], (unsigned long long) count);
+    }
+    append(page, METRICS_PREFIX "latency_us_bucket{role=\"%s\",le=\"+Inf\"} %llu\n", role,
+           (unsigned long long) total);
+    append(page, METRICS_PREFIX "latency_us_sum{role=\"%s\"} %llu\n", role,
+           (unsigned long long) atomic_load_explicit(&histogram->sum, memory_order_relaxed));
+    append(page, METRICS_PREFIX "latency_us_count{role=\"%s\"} %llu\n", role, (unsigned long long) total);
+
+    append_header(page, "latency_quantile_us", "Quantiles of the one-way latency over the run (us)", "gauge");
+    for (size_t i = 0; i < sizeof(LATENCY_QUANTILES) / sizeof(LATENCY_QUANTILES[0]); i++) {
+        append(page, METRICS_PREFIX "latency_quantile_us{role=\"%s\",quantile=\"%g\"} %llu\n", role,
+               LATENCY_QUANTILES[i], (unsigned long long) histogram_percentile(histogram, LATENCY_QUANTILES[i] * 100));
+    }
+}
+
+/**
+ * @brief Write the page of the metrics (Prometheus text exposition format 0.0.4).
+ * @param buffer
+ * @param size
+ * @param role Value of the role label of every sample
+ * @return The size of the page
+ */
+size_t render_metrics(char *buffer, size_t size, const char *role) {
+    MetricsPage page = {.buffer = buffer, .size = size, .used = 0};
+
+    CountersSnapshot snapshot;
+    counters_snapshot(&snapshot);
+    for (int type = 0; type < COUNTER_TYPE_COUNT; type++) {
+        char name[64];
+        snprintf(name, sizeof(name), "%s_total", COUNTER_INFO[type].name != NULL ? COUNTER_INFO[type].name
+                                                                                 : counter_name(type));
+        append_header(&page, name, COUNTER_INFO[type].help != NULL ? COUNTER_INFO[type].help : "Counter", "counter");
+        append(&page, METRICS_PREFIX "%s{role=\"%s\"} %llu\n", name, role,
+               (unsigned long long) snapshot.values[type]);
+    }
+
+    for (int type = 0; type < GAUGE_TYPE_COUNT; type++) {
+        if (g_gauge_sources[type] == NULL && !atomic_load_explicit(&g_gauges_set[type], memory_order_relaxed)) {
+            continue;
+        }
+        double value = gauge_get(type);
+        append_header(&page, GAUGE_INFO[type].name, GAUGE_INFO[type].help, "gauge");
+        if (isinf(value)) {
+            append(&page, METRICS_PREFIX "%s{role=\"%s\"} %s\n", GAUGE_INFO[type].name, role,
+                   value > 0 ? "+Inf" : "-Inf");
+        } else {
+            append(&page, METRICS_PREFIX "%s{role=\"%s\"} %.17g\n", GAUGE_INFO[type].name, role, value);
+        }
+    }
+
+    const LatencyHistogram *histogram = atomic_load(&g_histogram);
+    if (histogram != NULL) {
+        render_histogram(&page, histogram, role);
+    }
+    return page.used;
+}
+
+// ============================================= Server ================================================================
+
+/**
+ * @brief Open the listening socket of an address.
+ * @param server
+ * @param address "<ip>:<port>" ("*" or an empty ip for all the interfaces) or "unix:<path>"
+ * @return 0 on success, -1 on error
+ */
+static int listen_metrics(MetricsServer *server, const char *address) {
+    if (strncmp(address, METRICS_UNIX_PREFIX, strlen(METRICS_UNIX_PREFIX)) == 0) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        const char *path = address + strlen(METRICS_UNIX_PREFIX);
+        if (strlen(path) == 0 || strlen(path) >= sizeof(addr.sun_path)) {
+            logger(LOG_LEVEL_ERROR, "Invalid metrics socket path: %s", path);
+            return -1;
+        }
+        strcpy(addr.sun_path, path);
+        unlink(path);  // Left by a previous run
+        server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            logger(LOG_LEVEL_ERROR, "Failed to bind the metrics socket %s: %s", path, strerror(errno));
+            return -1;
+        }
+        server->unix_socket = true;
+        snprintf(server->path, sizeof(server->path), "%s", path);
+    } else {
+        const char *colon = strrchr(address, ':');
+        int port = colon != NULL ? atoi(colon + 1) : 0;
+        if (colon == NULL || port <= 0 || port > 65535) {
+            logger(LOG_LEVEL_ERROR, "Invalid metrics address: %s (expected <ip>:<port> or unix:<path>)", address);
+            return -1;
+        }
+        char host[INET_ADDRSTRLEN] = "";
+        snprintf(host, sizeof(host), "%.*s", (int) (colon - address), address);
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons((uint16_t) port)};
+        if (host[0] == '\0' || strcmp(host, "*") == 0) {
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        } else if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+            logger(LOG_LEVEL_ERROR, "Invalid metrics address: %s", address);
+            return -1;
+        }
+        server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        if (server->listen_fd >= 0) {
+            setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        }
+        if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            logger(LOG_LEVEL_ERROR, "Failed to bind the metrics address %s: %s", address, strerror(errno));
+            return -1;
+        }
+    }
+
+    if (listen(server->listen_fd, 8) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to listen on %s: %s", address, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return;
+        }
+        data += written;
+        size -= (size_t) written;
+    }
+}
+
+/**
+ * @brief Answer one request: the page of the metrics for a GET (whatever the path), 405 otherwise.
+ * @param server
+ * @param fd
+ */
+static void serve_request(MetricsServer *server, int fd) {
+    struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Only the request line matters, the rest of the request is read to avoid a reset of the connection
+    char request[2048];
+    size_t used = 0;
+    while (used < sizeof(request) - 1) {
+        ssize_t len = recv(fd, request + used, sizeof(request) - 1 - used, 0);
+        if (len <= 0) {
+            break;
+        }
+        used += (size_t) len;
+        request[used] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL) {
+            break;
+        }
+    }
+    request[used] = '\0';
+
+    char header[256];
+    if (strncmp(request, "GET ", 4) != 0) {
+        int len = snprintf(header, sizeof(header), "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\n"
+                                                   "Content-Length: 0\r\nConnection: close\r\n\r\n");
+        write_all(fd, header, (size_t) len);
+        return;
+    }
+
+    size_t size = render_metrics(server->buffer, METRICS_BUFFER_SIZE, server->role);
+    int len = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                               "Content-Length: %zu\r\nConnection: close\r\n\r\n", size);
+    write_all(fd, header, (size_t) len);
+    write_all(fd, server->buffer, size);
+    server->scrapes++;
+}
+
+static void *metrics_thread(void *arg) {
+    MetricsServer *server = (MetricsServer *) arg;
+    while (atomic_load(&server->running)) {
+        struct pollfd pfd = {.fd = server->listen_fd, .events = POLLIN};
+        if (poll(&pfd, 1, 200) <= 0) {
+            continue;  // Timeout (check running) or EINTR
+        }
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        serve_request(server, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Serve the metrics with a thread (no real-time profile: it is not on the message path).
+ * @param server
+ * @param address "<ip>:<port>" or "unix:<path>"
+ * @param role Label of the samples ("client", "server", ...)
+ * @return 0 on success, -1 on error
+ */
+int start_metrics_server(MetricsServer *server, const char *address, const char *role) {
+    memset(server, 0, sizeof(MetricsServer));
+    server->listen_fd = -1;
+    snprintf(server->role, sizeof(server->role), "%s", role);
+    server->buffer = malloc(METRICS_BUFFER_SIZE);
+    if (server->buffer == NULL || listen_metrics(server, address) != 0) {
+        stop_metrics_server(server);
+        return -1;
+    }
+
+    atomic_store(&server->running, true);
+    if (pthread_create(&server->thread, NULL, metrics_thread, server) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to start the metrics thread");
+        atomic_store(&server->running, false);
+        stop_metrics_server(server);
+        return -1;
+    }
+    logger(LOG_LEVEL_INFO, "Metrics of the %s on %s", role, address);
+    return 0;
+}
+
+void stop_metrics_server(MetricsServer *server) {
+    if (atomic_exchange(&server->running, false)) {
+        pthread_join(server->thread, NULL);
+        logger(LOG_LEVEL_DEBUG, "Metrics: %" PRIu64 " scrapes", server->scrapes);
+    }
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        server->listen_fd = -1;
+    }
+    if (server->unix_socket) {
+        unlink(server->path);
+        server->unix_socket = false;
+    }
+    free(server->buffer);
+    server->buffer = NULL;
+}
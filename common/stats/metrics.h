@@ -0,0 +1,72 @@
+//  =====================================================================
+//  metrics.h
+//
+//  Prometheus text endpoint (HTTP on a TCP port or a UNIX socket) with
+//  the counters, the gauges and the latency histogram, read lock-free
+//  =====================================================================
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "stats/histogram.h"
+
+#define METRICS_PREFIX "realmq_"
+#define METRICS_UNIX_PREFIX "unix:"             // Address of a UNIX socket: "unix:<path>"
+#define METRICS_BUFFER_SIZE (64 * 1024)
+#define METRICS_ROLE_SIZE 32
+
+typedef enum {
+    GAUGE_PHI,                                  // Phi of the failure detector (client)
+    GAUGE_DETECTOR_MEAN_MS,                     // Mean of the heartbeat intervals of the detector
+    GAUGE_DETECTOR_STD_DEV_MS,
+    GAUGE_ACK_ROUND_US,                         // Send to ACK of the oldest message covered by the last ACK (client)
+    GAUGE_RETRANSMIT_WINDOW,                    // Messages waiting for an ACK (client)
+    GAUGE_STATS_QUEUE,                          // Latency records waiting for the stats writer (server)
+    GAUGE_LOG_QUEUE_BYTES,                      // Bytes of the message log ring not written yet (server)
+    GAUGE_CLOCK_OFFSET_US,                      // Offset of the client clock, subtracted from the latency (server)
+    GAUGE_CLOCK_UNCERTAINTY_US,
+    GAUGE_TYPE_COUNT                            // Number of gauges (keep it last)
+} GaugeType;
+
+// Value of a gauge computed when it is scraped (must not block)
+typedef double (*GaugeReadFn)(void *arg);
+
+typedef struct {
+    int listen_fd;
+    bool unix_socket;
+    char path[108];                             // Of the UNIX socket, removed by the stop
+    char role[METRICS_ROLE_SIZE];               // Label of every sample
+    pthread_t thread;
+    _Atomic bool running;
+    char *buffer;                               // Page of the last scrape (server thread only)
+    uint64_t scrapes;
+} MetricsServer;
+
+// Set a gauge (lock-free, any thread), the gauges never set are not exported
+void gauge_set(GaugeType type, double value);
+
+double gauge_get(GaugeType type);
+
+// Compute a gauge at every scrape instead (NULL to remove)
+void gauge_source(GaugeType type, GaugeReadFn read, void *arg);
+
+// Get the name of a gauge (without the prefix)
+const char *gauge_name(GaugeType type);
+
+// Export a histogram (in us) as the latency buckets (NULL to remove)
+void metrics_set_histogram(const LatencyHistogram *histogram);
+
+// Write the metrics in the Prometheus text format, return their size (truncated to size)
+size_t render_metrics(char *buffer, size_t size, const char *role);
+
+// Serve the metrics on "<ip>:<port>" or "unix:<path>" with a thread, return 0 on success
+int start_metrics_server(MetricsServer *server, const char *address, const char *role);
+
+void stop_metrics_server(MetricsServer *server);
+
+#endif //METRICS_H
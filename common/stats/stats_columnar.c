@@ -0,0 +1,251 @@
+#include "stats_columnar.h"
+#include "core/logger.h"
+#include "stats/varint.h"
+#include "utils/time_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The CSV and JSON stats spend most of their size (and of the time to write and parse them) on the text of numbers
+ * that barely change from one record to the next. A columnar file starts with a StatsFileHeader and the metadata of
+ * the run ("key=value" lines: protocol, threads, messages, ...), then has blocks of up to STATS_BLOCK_RECORDS
+ * records. A block stores each field in its own column of zigzag varints:
+ * - id and send time: delta with the previous record of the block (1 byte for consecutive ids, 1-3 for the times)
+ * - receive time: the latency (receive - send)
+ * - with the components (timestamping): the send call, the kernel receive and the return of the receive call, each as
+ *   a delta with the previous timestamp of the message, + 1 so that 0 still means "not measured"; the hardware flag is
+ *   the low bit of the wire column.
+ * The column sizes are in the block header, and the blocks are padded to 8 bytes: the reader maps the file, walks the
+ * blocks without copies and can skip a column (or a block) without decoding it. A block cut by a crash is detected by
+ * its sizes and ends the file.
+ */
+
+static size_t align8(size_t size) {
+    return (size + 7) & ~(size_t) 7;
+}
+
+/**
+ * @brief Write the header of a columnar file.
+ * @param buffer
+ * @param size
+ * @param flags STATS_COLUMNAR_FLAG_*
+ * @param file_index Rotation counter of the file
+ * @param metadata "key=value\n" lines of the run (NULL for none, at most STATS_METADATA_MAX_SIZE bytes)
+ * @return The size of the header (offset of the first block), 0 if the buffer is too small
+ */
+size_t stats_columnar_header(uint8_t *buffer, size_t size, uint32_t flags, uint32_t file_index, const char *metadata) {
+    size_t metadata_size = metadata != NULL ? strnlen(metadata, STATS_METADATA_MAX_SIZE) : 0;
+    size_t header_size = align8(sizeof(StatsFileHeader) + metadata_size);
+    if (size < header_size) {
+        return 0;
+    }
+
+    StatsFileHeader header = {
+            .version = STATS_COLUMNAR_VERSION,
+            .header_size = (uint32_t) header_size,
+            .block_records = STATS_BLOCK_RECORDS,
+            .flags = flags,
+            .created_us = get_current_time_microseconds(),
+            .file_index = file_index,
+            .metadata_size = (uint32_t) metadata_size
+    };
+    memcpy(header.magic, STATS_COLUMNAR_MAGIC, sizeof(header.magic));
+    memset(buffer, 0, header_size);
+    memcpy(buffer, &header, sizeof(header));
+    if (metadata_size > 0) {
+        memcpy(buffer + sizeof(header), metadata, metadata_size);
+    }
+    return header_size;
+}
+
+size_t stats_block_max_size(size_t count, bool components) {
+    size_t columns = components ? STATS_COLUMN_COUNT : STATS_COLUMN_QUEUE;
+    return align8(sizeof(StatsBlockHeader) + count * columns * VARINT_MAX_SIZE);
+}
+
+// Value of the column of a record, see the nutshell
+static uint64_t column_value(StatsColumn column, const LatencyRecord *record, const LatencyRecord *previous) {
+    switch (column) {
+        case STATS_COLUMN_ID:
+            return zigzag_encode((int64_t) (record->id - (previous != NULL ? previous->id : 0)));
+        case STATS_COLUMN_SEND:
+            return zigzag_encode(record->send_time - (previous != NULL ? previous->send_time : 0));
+        case STATS_COLUMN_RECV:
+            return zigzag_encode(record->recv_time - record->send_time);
+        case STATS_COLUMN_QUEUE:
+            return record->send_ns == 0 ? 0 : zigzag_encode(record->send_ns - record->send_time * 1000) + 1;
+        case STATS_COLUMN_WIRE:
+            return record->kernel_rx_ns == 0 ? 0 : ((zigzag_encode(record->kernel_rx_ns - record->send_ns) << 1) |
+                                                    (record->hardware ? 1 : 0)) + 1;
+        case STATS_COLUMN_STACK: {
+            int64_t base = record->kernel_rx_ns != 0 ? record->kernel_rx_ns : record->recv_time * 1000;
+            return record->recv_ns == 0 ? 0 : zigzag_encode(record->recv_ns - base) + 1;
+        }
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Encode records as a block: header, then every column.
+ * @param records
+ * @param count At most STATS_BLOCK_RECORDS
+ * @param components Add the columns of the kernel timestamps
+ * @param buffer
+ * @param size At least stats_block_max_size(count, components) bytes to never fail
+ * @return The size of the block, 0 if the buffer is too small
+ */
+size_t encode_stats_block(const LatencyRecord *records, size_t count, bool components, uint8_t *buffer, size_t size) {
+    if (count == 0 || count > STATS_BLOCK_RECORDS || size < stats_block_max_size(count, components)) {
+        return 0;
+    }
+
+    StatsBlockHeader header = {.magic = STATS_BLOCK_MAGIC, .count = (uint32_t) count};
+    size_t offset = sizeof(header);
+    int columns = components ? STATS_COLUMN_COUNT : STATS_COLUMN_QUEUE;
+    for (int column = 0; column < columns; column++) {
+        size_t start = offset;
+        for (size_t i = 0; i < count; i++) {
+            offset += put_varint(buffer + offset, column_value(column, &records[i], i > 0 ? &records[i - 1] : NULL));
+        }
+        header.column_size[column] = (uint32_t) (offset - start);
+    }
+
+    size_t block_size = align8(offset);
+    memset(buffer + offset, 0, block_size - offset);
+    memcpy(buffer, &header, sizeof(header));
+    return block_size;
+}
+
+// ============================================= Reader ================================================================
+
+/**
+ * @brief Map a stats file and check its header.
+ * @param reader
+ * @param path
+ * @return 0 on success, -1 on error
+ */
+int open_stats_reader(StatsReader *reader, const char *path) {
+    memset(reader, 0, sizeof(StatsReader));
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the stats file %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(reader->fd, &st) != 0 || (size_t) st.st_size < sizeof(StatsFileHeader)) {
+        logger(LOG_LEVEL_ERROR, "Not a columnar stats file: %s", path);
+        close_stats_reader(reader);
+        return -1;
+    }
+    reader->size = (size_t) st.st_size;
+    void *data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+    if (data == MAP_FAILED) {
+        logger(LOG_LEVEL_ERROR, "Failed to map the stats file %s: %s", path, strerror(errno));
+        reader->size = 0;
+        close_stats_reader(reader);
+        return -1;
+    }
+    reader->data = data;
+    madvise(data, reader->size, MADV_SEQUENTIAL);
+
+    const StatsFileHeader *header = (const StatsFileHeader *) reader->data;
+    if (memcmp(header->magic, STATS_COLUMNAR_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != STATS_COLUMNAR_VERSION || header->header_size > reader->size ||
+        sizeof(StatsFileHeader) + header->metadata_size > header->header_size ||
+        header->block_records == 0 || header->block_records > STATS_BLOCK_RECORDS) {
+        logger(LOG_LEVEL_ERROR, "Not a columnar stats file (or unsupported version): %s", path);
+        close_stats_reader(reader);
+        return -1;
+    }
+    reader->header = header;
+    reader->metadata = (const char *) reader->data + sizeof(StatsFileHeader);
+    reader->offset = header->header_size;
+    return 0;
+}
+
+/**
+ * @brief Decode the next block of the file.
+ * @param reader
+ * @param records
+ * @param capacity At least header->block_records
+ * @return The number of records decoded, 0 at the end of the file, -1 if the block is corrupt or truncated
+ */
+long stats_reader_next_block(StatsReader *reader, LatencyRecord *records, size_t capacity) {
+    if (reader->offset + sizeof(StatsBlockHeader) > reader->size) {
+        return 0;
+    }
+    const StatsBlockHeader *header = (const StatsBlockHeader *) (reader->data + reader->offset);
+    bool components = (reader->header->flags & STATS_COLUMNAR_FLAG_COMPONENTS) != 0;
+    int columns = components ? STATS_COLUMN_COUNT : STATS_COLUMN_QUEUE;
+    size_t columns_size = 0;
+    for (int column = 0; column < columns; column++) {
+        columns_size += header->column_size[column];
+    }
+    if (header->magic != STATS_BLOCK_MAGIC || header->count == 0 || header->count > capacity ||
+        columns_size > reader->size - reader->offset - sizeof(StatsBlockHeader)) {
+        return -1;
+    }
+
+    memset(records, 0, header->count * sizeof(LatencyRecord));
+    const uint8_t *column_data = reader->data + reader->offset + sizeof(StatsBlockHeader);
+    for (int column = 0; column < columns; column++) {
+        size_t offset = 0;
+        for (uint32_t i = 0; i < header->count; i++) {
+            uint64_t value;
+            if (get_varint(column_data, header->column_size[column], &offset, &value) != 0) {
+                return -1;
+            }
+            LatencyRecord *record = &records[i];
+            const LatencyRecord *previous = i > 0 ? &records[i - 1] : NULL;
+            switch (column) {
+                case STATS_COLUMN_ID:
+                    record->id = (previous != NULL ? previous->id : 0) + (uint64_t) zigzag_decode(value);
+                    break;
+                case STATS_COLUMN_SEND:
+                    record->send_time = (previous != NULL ? previous->send_time : 0) + zigzag_decode(value);
+                    break;
+                case STATS_COLUMN_RECV:
+                    record->recv_time = record->send_time + zigzag_decode(value);
+                    break;
+                case STATS_COLUMN_QUEUE:
+                    record->send_ns = value == 0 ? 0 : record->send_time * 1000 + zigzag_decode(value - 1);
+                    break;
+                case STATS_COLUMN_WIRE:
+                    if (value != 0) {
+                        record->kernel_rx_ns = record->send_ns + zigzag_decode((value - 1) >> 1);
+                        record->hardware = ((value - 1) & 1) != 0;
+                    }
+                    break;
+                case STATS_COLUMN_STACK: {
+                    int64_t base = record->kernel_rx_ns != 0 ? record->kernel_rx_ns : record->recv_time * 1000;
+                    record->recv_ns = value == 0 ? 0 : base + zigzag_decode(value - 1);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        column_data += header->column_size[column];
+    }
+
+    reader->offset += align8(sizeof(StatsBlockHeader) + columns_size);
+    return (long) header->count;
+}
+
+void close_stats_reader(StatsReader *reader) {
+    if (reader->data != NULL) {
+        munmap((void *) reader->data, reader->size);
+    }
+    if (reader->fd >= 0) {
+        close(reader->fd);
+    }
+    memset(reader, 0, sizeof(StatsReader));
+    reader->fd = -1;
+}
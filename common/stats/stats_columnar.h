@@ -0,0 +1,81 @@
+//  =====================================================================
+//  stats_columnar.h
+//
+//  Columnar binary format of the stats files: a header with the run
+//  metadata, then blocks of delta-encoded columns, read through mmap
+//  =====================================================================
+
+#ifndef STATS_COLUMNAR_H
+#define STATS_COLUMNAR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "stats/latency_records.h"
+
+#define STATS_COLUMNAR_MAGIC "RMQSTATS"             // 8 bytes, without the terminator
+#define STATS_COLUMNAR_VERSION 1
+#define STATS_COLUMNAR_EXTENSION ".rmqs"
+#define STATS_COLUMNAR_FLAG_COMPONENTS 0x1          // The blocks have the columns of the kernel timestamps
+#define STATS_BLOCK_RECORDS 1024                    // Records of a full block (the last of a flush can be shorter)
+#define STATS_BLOCK_MAGIC 0x4B4C4252u               // "RBLK"
+#define STATS_METADATA_MAX_SIZE 4096
+
+// Columns of a block, in file order
+typedef enum {
+    STATS_COLUMN_ID,                                // Delta with the previous id
+    STATS_COLUMN_SEND,                              // Delta with the previous send time (us)
+    STATS_COLUMN_RECV,                              // Receive time - send time (us)
+    STATS_COLUMN_QUEUE,                             // Send call - send time (ns), with the components only
+    STATS_COLUMN_WIRE,                              // Kernel receive - send call (ns) and the hardware bit
+    STATS_COLUMN_STACK,                             // Return of the receive call - kernel receive (ns)
+    STATS_COLUMN_COUNT
+} StatsColumn;
+
+// Start of a file (host byte order, fixed size), followed by metadata_size bytes of "key=value\n" text
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;                           // Offset of the first block (header, metadata, padding to 8)
+    uint32_t block_records;
+    uint32_t flags;
+    int64_t created_us;
+    uint32_t file_index;                            // Rotation counter of the file in the run
+    uint32_t metadata_size;
+} StatsFileHeader;
+
+// Start of a block, followed by its columns (zigzag varints) and padded to 8 bytes
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t column_size[STATS_COLUMN_COUNT];
+} StatsBlockHeader;
+
+// A stats file mapped in memory
+typedef struct {
+    int fd;
+    const uint8_t *data;
+    size_t size;
+    const StatsFileHeader *header;
+    const char *metadata;                           // Not terminated: header->metadata_size bytes
+    size_t offset;                                  // Next block
+} StatsReader;
+
+// Write the header of a file, return its size or 0 if the buffer is too small
+size_t stats_columnar_header(uint8_t *buffer, size_t size, uint32_t flags, uint32_t file_index, const char *metadata);
+
+// Max size of an encoded block of count records
+size_t stats_block_max_size(size_t count, bool components);
+
+// Encode count records (at most STATS_BLOCK_RECORDS) as a block, return its size or 0 if the buffer is too small
+size_t encode_stats_block(const LatencyRecord *records, size_t count, bool components, uint8_t *buffer, size_t size);
+
+// Map a stats file and check its header, return 0 on success
+int open_stats_reader(StatsReader *reader, const char *path);
+
+// Decode the next block into records (room for header->block_records), return the records, 0 at the end, -1 if corrupt
+long stats_reader_next_block(StatsReader *reader, LatencyRecord *records, size_t capacity);
+
+void close_stats_reader(StatsReader *reader);
+
+#endif //STATS_COLUMNAR_H
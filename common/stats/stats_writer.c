@@ -0,0 +1,285 @@
+#include "stats_writer.h"
+#include "core/logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The stats files used to be rewritten from the first record at every interval ("w", all the records so far), so the
+ * total I/O of a run grew with the square of the records. The writer keeps its file open and appends: a flush takes
+ * the records committed in the ring of the receive threads since the previous flush, formats them into a staging
+ * buffer and writes the buffer when it is full (and at the end of the flush), then gives the slots of the ring back.
+ * So the ring is the first half of the staging (filled by the receive threads without locks, while the stats thread
+ * writes) and the text buffer the second one: the receive threads never wait on the file I/O.
+ * A file is rotated after max_file_records records or max_file_bytes bytes; a JSON file gets its header when it is
+ * created and its footer when it is rotated or closed.
+ * The records are released in the ring once they are staged: when a write fails, the part of the staging buffer not
+ * written yet stays there (and the file stays open), so it is written first by the next flush and nothing is lost.
+ * A columnar file gets its binary header when it is created, then the records are copied into a block that is encoded
+ * into the staging buffer when it has STATS_BLOCK_RECORDS records, at the end of a flush and before a rotation.
+ */
+
+/**
+ * @brief Write a whole buffer to the current file.
+ * @param writer
+ * @param data
+ * @param size
+ * @param written_total Bytes written, also on error
+ * @return 0 on success, -1 on error
+ */
+static int write_all(StatsWriter *writer, const char *data, size_t size, size_t *written_total) {
+    *written_total = 0;
+    while (size > 0) {
+        ssize_t written = write(writer->fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            logger(LOG_LEVEL_ERROR, "Failed to write the stats file: %s", strerror(errno));
+            return -1;
+        }
+        data += written;
+        size -= (size_t) written;
+        *written_total += (size_t) written;
+        writer->file_bytes += (size_t) written;
+        writer->bytes += (size_t) written;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write the staging buffer, keeping the part not written on error (for the next write).
+ * @param writer
+ * @return 0 on success, -1 on error
+ */
+static int write_staging(StatsWriter *writer) {
+    size_t written;
+    int rc = write_all(writer, writer->staging, writer->staging_used, &written);
+    memmove(writer->staging, writer->staging + written, writer->staging_used - written);
+    writer->staging_used -= written;
+    return rc;
+}
+
+static void stage(StatsWriter *writer, const char *text, size_t size) {
+    memcpy(writer->staging + writer->staging_used, text, size);
+    writer->staging_used += size;
+}
+
+/**
+ * @brief Encode the records of the current columnar block into the staging buffer (written first if full).
+ * @param writer
+ * @return 0 on success, -1 on error
+ */
+static int stage_block(StatsWriter *writer) {
+    if (writer->block_used == 0) {
+        return 0;
+    }
+    size_t max_size = stats_block_max_size(writer->block_used, writer->options.components);
+    if (writer->staging_used + max_size > STATS_WRITER_STAGING_SIZE && write_staging(writer) != 0) {
+        return -1;
+    }
+    writer->staging_used += encode_stats_block(writer->block, writer->block_used, writer->options.components,
+                                               (uint8_t *) writer->staging + writer->staging_used,
+                                               STATS_WRITER_STAGING_SIZE - writer->staging_used);
+    writer->block_used = 0;
+    return 0;
+}
+
+/**
+ * @brief Create the file of the current index, with its header.
+ * @param writer
+ * @return 0 on success, -1 on error
+ */
+static int open_stats_file(StatsWriter *writer) {
+    char *path = writer->options.path_fn(writer->index, writer->options.path_arg);
+    if (path == NULL) {
+        return -1;
+    }
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (writer->fd < 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the stats file %s: %s", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+    logger(LOG_LEVEL_DEBUG, "Saving statistics to file: %s", path);
+    free(path);
+
+    writer->file_records = 0;
+    writer->file_bytes = 0;
+    if (writer->options.format == STATS_FORMAT_COLUMNAR) {
+        uint32_t flags = writer->options.components ? STATS_COLUMNAR_FLAG_COMPONENTS : 0;
+        writer->staging_used += stats_columnar_header((uint8_t *) writer->staging + writer->staging_used,
+                                                      STATS_WRITER_STAGING_SIZE - writer->staging_used, flags,
+                                                      (uint32_t) writer->index, writer->options.metadata);
+        return 0;
+    }
+    const char *header = writer->options.format == STATS_FORMAT_JSON ? LATENCY_JSON_HEADER
+                         : writer->options.components ? LATENCY_CSV_HEADER_COMPONENTS
+                                                      : LATENCY_CSV_HEADER;
+    stage(writer, header, strlen(header));
+    return 0;
+}
+
+/**
+ * @brief Complete the current file (the staged text and the JSON footer) and close it.
+ * @param writer
+ * @return 0 on success, -1 on error (the file stays open with the rest of its text staged)
+ */
+static int close_stats_file(StatsWriter *writer) {
+    if (writer->fd < 0) {
+        return 0;
+    }
+    if (stage_block(writer) != 0) {
+        return -1;
+    }
+    if (writer->options.format == STATS_FORMAT_JSON && !writer->footer_staged) {
+        if (writer->staging_used + strlen(LATENCY_JSON_FOOTER) > STATS_WRITER_STAGING_SIZE &&
+            write_staging(writer) != 0) {
+            return -1;
+        }
+        stage(writer, LATENCY_JSON_FOOTER, strlen(LATENCY_JSON_FOOTER));
+        writer->footer_staged = true;
+    }
+    if (write_staging(writer) != 0) {
+        return -1;
+    }
+    close(writer->fd);
+    writer->fd = -1;
+    writer->footer_staged = false;
+    return 0;
+}
+
+/**
+ * @brief Whether the current file has reached max_file_records records or max_file_bytes bytes.
+ * @param writer
+ * @return
+ */
+static bool stats_file_full(const StatsWriter *writer) {
+    const StatsWriterOptions *options = &writer->options;
+    size_t file_bytes = writer->file_bytes + writer->staging_used;
+    return (options->max_file_records > 0 && writer->file_records >= options->max_file_records) ||
+           (options->max_file_bytes > 0 && file_bytes >= options->max_file_bytes);
+}
+
+/**
+ * @brief Close the current file, the next record goes to a new one.
+ * @param writer
+ * @return 0 on success, -1 on error (the file stays open, to be closed by the next flush)
+ */
+static int rotate_stats_file(StatsWriter *writer) {
+    if (close_stats_file(writer) != 0) {
+        return -1;
+    }
+    writer->index++;
+    writer->rotations++;
+    return 0;
+}
+
+/**
+ * @brief Initialize a writer.
+ * @param writer
+ * @param options
+ * @return 0 on success, -1 on error
+ */
+int open_stats_writer(StatsWriter *writer, const StatsWriterOptions *options) {
+    memset(writer, 0, sizeof(StatsWriter));
+    if (options->path_fn == NULL) {
+        logger(LOG_LEVEL_ERROR, "Missing path of the stats files");
+        return -1;
+    }
+    writer->staging = malloc(STATS_WRITER_STAGING_SIZE);
+    if (writer->staging == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the stats writer");
+        return -1;
+    }
+    if (options->format == STATS_FORMAT_COLUMNAR) {
+        writer->block = malloc(STATS_BLOCK_RECORDS * sizeof(LatencyRecord));
+        if (writer->block == NULL) {
+            logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the stats writer");
+            free(writer->staging);
+            return -1;
+        }
+    }
+    writer->options = *options;
+    writer->fd = -1;
+    return 0;
+}
+
+/**
+ * @brief Append the new records to the current file (a new file after max_file_records records or max_file_bytes
+ * bytes), then release them in the ring.
+ * @param writer
+ * @param records
+ * @return The number of records written, or -1 on error (the records not written yet stay in the ring or in the staging
+ * buffer, for the next flush)
+ */
+long long stats_writer_flush(StatsWriter *writer, LatencyRecords *records) {
+    uint64_t first = atomic_load(&records->tail);
+    uint64_t end = latency_records_committed(records, first);
+    char text[LATENCY_RECORD_MAX_TEXT + 2];
+
+    uint64_t index = first;
+    for (; index < end; index++) {
+        // A file whose rotation failed in a previous flush is completed first
+        if (writer->fd >= 0 && stats_file_full(writer) && rotate_stats_file(writer) != 0) {
+            break;
+        }
+        if (writer->fd < 0 && open_stats_file(writer) != 0) {
+            break;
+        }
+
+        const LatencyRecord *record = latency_record_at(records, index);
+        size_t size;
+        if (writer->options.format == STATS_FORMAT_COLUMNAR) {
+            writer->block[writer->block_used++] = *record;
+            if (writer->block_used == STATS_BLOCK_RECORDS && stage_block(writer) != 0) {
+                writer->block_used--;  // Still in the ring for the next flush
+                break;
+            }
+            size = 0;
+        } else if (writer->options.format == STATS_FORMAT_JSON) {
+            size_t separator = writer->file_records > 0 ? 2 : 0;
+            memcpy(text, ",\n", separator);
+            size = separator + format_latency_record_json(record, text + separator, sizeof(text) - separator);
+        } else {
+            size = format_latency_record_csv(record, writer->file_records + 1, writer->options.components, text,
+                                             sizeof(text));
+        }
+        if (size > 0 && writer->staging_used + size > STATS_WRITER_STAGING_SIZE && write_staging(writer) != 0) {
+            break;
+        }
+        stage(writer, text, size);
+        writer->file_records++;
+        writer->records++;
+
+        if (stats_file_full(writer) && rotate_stats_file(writer) != 0) {
+            index++;    // Staged
+            break;
+        }
+    }
+
+    int rc = 0;
+    if (writer->fd >= 0) {
+        rc = stage_block(writer);
+        rc |= write_staging(writer);
+    }
+    latency_records_release_until(records, index);
+    writer->flushes++;
+    if (rc != 0 || index < end) {
+        return -1;
+    }
+    return (long long) (end - first);
+}
+
+void close_stats_writer(StatsWriter *writer) {
+    if (close_stats_file(writer) != 0) {
+        logger(LOG_LEVEL_ERROR, "Stats lost: %zu bytes not written", writer->staging_used);
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    free(writer->staging);
+    free(writer->block);
+    writer->staging = NULL;
+    writer->block = NULL;
+}
@@ -0,0 +1,64 @@
+//  =====================================================================
+//  stats_writer.h
+//
+//  Append-only writer of the latency records: every flush writes only
+//  the records committed since the previous one, with file rotation
+//  =====================================================================
+
+#ifndef STATS_WRITER_H
+#define STATS_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "stats/latency_records.h"
+#include "stats/stats_columnar.h"
+
+#define STATS_WRITER_STAGING_SIZE (256 * 1024)  // Text formatted before a write (a flush may issue several)
+
+typedef enum {
+    STATS_FORMAT_CSV,
+    STATS_FORMAT_JSON,
+    STATS_FORMAT_COLUMNAR                       // Binary, see stats_columnar.h
+} StatsFormat;
+
+// Path of the file with the given index (malloc'd, freed by the writer)
+typedef char *(*StatsPathFn)(int index, void *arg);
+
+typedef struct {
+    StatsPathFn path_fn;
+    void *path_arg;
+    StatsFormat format;
+    bool components;                            // Columns of the kernel timestamps (queue, wire, stack), not in JSON
+    const char *metadata;                       // "key=value\n" lines of the columnar header (kept by the caller)
+    uint64_t max_file_records;                  // Rotation after this number of records (0: no limit)
+    size_t max_file_bytes;                      // ... or this size (0: no limit)
+} StatsWriterOptions;
+
+typedef struct {
+    StatsWriterOptions options;
+    int fd;                                     // Current file (-1: not opened yet)
+    int index;                                  // Index of the current file
+    uint64_t file_records;
+    size_t file_bytes;
+    char *staging;
+    size_t staging_used;                        // Not written yet (kept after a failed write)
+    bool footer_staged;                         // JSON footer of the current file already staged
+    LatencyRecord *block;                       // Records of the columnar block being filled
+    size_t block_used;
+    uint64_t records;                           // Written by all the flushes
+    uint64_t bytes;
+    uint64_t flushes;
+    uint64_t rotations;
+} StatsWriter;
+
+// Initialize a writer (the first file is created by the first flush with records), return 0 on success
+int open_stats_writer(StatsWriter *writer, const StatsWriterOptions *options);
+
+// Append the records committed since the previous flush and release them, return the number written or -1 on error
+long long stats_writer_flush(StatsWriter *writer, LatencyRecords *records);
+
+// Complete the current file (JSON footer) and release the writer
+void close_stats_writer(StatsWriter *writer);
+
+#endif //STATS_WRITER_H
@@ -0,0 +1,31 @@
+#include "varint.h"
+
+size_t put_varint(uint8_t *buffer, uint64_t value) {
+    size_t size = 0;
+    while (value >= 0x80) {
+        buffer[size++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    buffer[size++] = (uint8_t) value;
+    return size;
+}
+
+int get_varint(const uint8_t *buffer, size_t size, size_t *offset, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && *offset < size; shift += 7) {
+        uint8_t byte = buffer[(*offset)++];
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+int64_t zigzag_decode(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
@@ -0,0 +1,26 @@
+//  =====================================================================
+//  varint.h
+//
+//  LEB128 varints and zigzag encoding of the binary stats formats
+//  =====================================================================
+
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define VARINT_MAX_SIZE 10  // Bytes of a uint64
+
+// Write a varint (7 bits per byte, little endian), return its size
+size_t put_varint(uint8_t *buffer, uint64_t value);
+
+// Read a varint from buffer[*offset] (advanced), return 0 on success or -1 if truncated
+int get_varint(const uint8_t *buffer, size_t size, size_t *offset, uint64_t *value);
+
+// Map a signed value to an unsigned one with the small magnitudes first (0, -1, 1, -2, ...)
+uint64_t zigzag_encode(int64_t value);
+
+int64_t zigzag_decode(uint64_t value);
+
+#endif //VARINT_H
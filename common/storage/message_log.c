@@ -0,0 +1,849 @@
+#include "message_log.h"
+#include "core/logger.h"
+#include "core/realtime.h"
+#include "utils/time_utils.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The receive thread must not wait for the disk, so message_log_append only copies the frame (behind a small header
+ * with its offset, topic and message ID) into a ring of bytes in memory and moves on. The writer thread drains the
+ * ring into the active segment: a file preallocated at its full size and mapped in memory, so a record is written with
+ * a memcpy and no syscall. The records of the ring and of the segments have the same layout, 8 bytes aligned; the end
+ * of the written records is a header with size 0 (the preallocated file is zeroed).
+ * The writer syncs the segment (msync of the dirty pages, fdatasync at the roll) every flush_messages records or every
+ * flush_interval_ms, whichever comes first: the cost of a sync is shared by a whole batch of records. When a record
+ * does not fit in the active segment, a new one is created, named after the offset of its first record.
+ * Every segment has a sparse index (one entry every index_interval bytes, with the offset, the message ID and the
+ * position of a record): a reader looks up the closest entry and scans forward from there, so the index stays small
+ * enough to live in the page cache.
+ * At startup the last segment of a previous run is scanned up to its last complete record, and the log continues from
+ * the next offset in a new segment.
+ */
+
+#define LOG_IDLE_SLEEP_US 50            // Sleep of the writer thread when the ring is empty
+#define LOG_SYNC_SLEEP_US 100
+#define LOG_SEGMENT_NAME "%020" PRIu64
+
+static size_t record_stride(size_t size) {
+    size_t stride = sizeof(MessageLogRecord) + size;
+    return (stride + MESSAGE_LOG_ALIGN - 1) & ~((size_t) MESSAGE_LOG_ALIGN - 1);
+}
+
+static void segment_path(char *path, size_t path_size, const char *directory, uint64_t base_offset,
+                         const char *suffix) {
+    snprintf(path, path_size, "%s/" LOG_SEGMENT_NAME "%s", directory, base_offset, suffix);
+}
+
+static int compare_offsets(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief List the segments of a directory.
+ * @param directory
+ * @param count Number of segments found
+ * @return The sorted base offsets of the segments (to free), NULL if there is none
+ */
+static uint64_t *list_segments(const char *directory, size_t *count) {
+    *count = 0;
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    uint64_t *bases = NULL;
+    size_t capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char *end;
+        uint64_t base = strtoull(entry->d_name, &end, 10);
+        if (end == entry->d_name || strcmp(end, MESSAGE_LOG_SUFFIX) != 0) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            uint64_t *grown = realloc(bases, capacity * sizeof(uint64_t));
+            if (grown == NULL) {
+                break;
+            }
+            bases = grown;
+        }
+        bases[(*count)++] = base;
+    }
+    closedir(dir);
+
+    if (*count > 0) {
+        qsort(bases, *count, sizeof(uint64_t), compare_offsets);
+    }
+    return bases;
+}
+
+/**
+ * @brief Count the valid entries of an index (the unused tail of a preallocated index is zeroed).
+ * @param index
+ * @param capacity
+ * @param end Position of the end of the records
+ * @return
+ */
+static size_t count_index_entries(const MessageLogIndexEntry *index, size_t capacity, size_t end) {
+    size_t count = 0;
+    while (count < capacity && (count == 0 || index[count].position != 0) && index[count].position < end) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Create a segment file and its index, both preallocated and mapped.
+ * @param log
+ * @param segment
+ * @param base_offset Offset of the first record
+ * @param min_size Size of the first record (bigger than the segment size, for huge records)
+ * @return 0 on success, -1 on error
+ */
+static int create_segment(MessageLog *log, MessageLogSegment *segment, uint64_t base_offset, size_t min_size) {
+    memset(segment, 0, sizeof(MessageLogSegment));
+    segment->fd = segment->index_fd = -1;
+    segment->base_offset = base_offset;
+    segment->size = log->options.segment_size;
+    if (segment->size < min_size + sizeof(MessageLogRecord)) {
+        segment->size = min_size + sizeof(MessageLogRecord);     // Room for the end marker
+    }
+    segment->index_capacity = segment->size / log->options.index_interval + 2;
+
+    char path[PATH_MAX];
+    segment_path(path, sizeof(path), log->directory, base_offset, MESSAGE_LOG_SUFFIX);
+    segment->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    segment_path(path, sizeof(path), log->directory, base_offset, MESSAGE_LOG_INDEX_SUFFIX);
+    segment->index_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (segment->fd == -1 || segment->index_fd == -1) {
+        logger(LOG_LEVEL_ERROR, "Failed to create the log segment %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    // Preallocate the blocks, so that the writes never extend the file (no metadata update on every sync)
+    size_t index_size = segment->index_capacity * sizeof(MessageLogIndexEntry);
+    if (posix_fallocate(segment->fd, 0, (off_t) segment->size) != 0 ||
+        posix_fallocate(segment->index_fd, 0, (off_t) index_size) != 0) {
+        if (ftruncate(segment->fd, (off_t) segment->size) != 0 ||
+            ftruncate(segment->index_fd, (off_t) index_size) != 0) {
+            logger(LOG_LEVEL_ERROR, "Failed to preallocate the log segment: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;      // Map the pages now, not on the first write of every page
+#endif
+    segment->data = mmap(NULL, segment->size, PROT_READ | PROT_WRITE, flags, segment->fd, 0);
+    segment->index = mmap(NULL, index_size, PROT_READ | PROT_WRITE, flags, segment->index_fd, 0);
+    if (segment->data == MAP_FAILED || segment->index == MAP_FAILED) {
+        logger(LOG_LEVEL_ERROR, "Failed to map the log segment: %s", strerror(errno));
+        segment->data = segment->data == MAP_FAILED ? NULL : segment->data;
+        segment->index = segment->index == MAP_FAILED ? NULL : segment->index;
+        return -1;
+    }
+
+    atomic_fetch_add(&log->segments, 1);
+    return 0;
+}
+
+/**
+ * @brief Sync the records written since the last flush (and the index) to disk.
+ * @param segment
+ * @return
+ */
+static void flush_segment(MessageLogSegment *segment) {
+    if (segment->data == NULL || segment->position == segment->flushed) {
+        return;
+    }
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = segment->flushed & ~(page - 1);
+    msync(segment->data + start, segment->position - start, MS_SYNC);
+    msync(segment->index, segment->index_count * sizeof(MessageLogIndexEntry), MS_SYNC);
+    segment->flushed = segment->position;
+}
+
+/**
+ * @brief Sync and unmap a segment.
+ * @param segment
+ * @param truncate Cut the preallocated tail (only when no reader can have the segment mapped)
+ */
+static void close_segment(MessageLogSegment *segment, bool truncate) {
+    if (segment->data != NULL) {
+        flush_segment(segment);
+        munmap(segment->data, segment->size);
+    }
+    if (segment->index != NULL) {
+        munmap(segment->index, segment->index_capacity * sizeof(MessageLogIndexEntry));
+    }
+    if (segment->fd != -1) {
+        if (truncate && ftruncate(segment->fd, (off_t) segment->position) != 0) {
+            logger(LOG_LEVEL_WARN, "Failed to truncate the log segment: %s", strerror(errno));
+        }
+        fdatasync(segment->fd);
+        close(segment->fd);
+    }
+    if (segment->index_fd != -1) {
+        if (truncate && ftruncate(segment->index_fd, (off_t) (segment->index_count * sizeof(MessageLogIndexEntry)))) {
+            logger(LOG_LEVEL_WARN, "Failed to truncate the log index: %s", strerror(errno));
+        }
+        fdatasync(segment->index_fd);
+        close(segment->index_fd);
+    }
+    memset(segment, 0, sizeof(MessageLogSegment));
+    segment->fd = segment->index_fd = -1;
+}
+
+/**
+ * @brief Sync the active segment, the records committed so far become durable.
+ * @param log
+ */
+static void flush_log(MessageLog *log) {
+    if (log->unflushed > 0) {
+        flush_segment(&log->active);
+        atomic_fetch_add(&log->flushes, 1);
+    }
+    atomic_store_explicit(&log->durable_offset, atomic_load(&log->committed_offset), memory_order_release);
+    log->unflushed = 0;
+    log->last_flush_ns = get_monotonic_time_nanos();
+}
+
+/**
+ * @brief Copy a record of the ring into the active segment (rolling it if full).
+ * @param log
+ * @param record
+ * @param stride Size of the record with its padding
+ * @return 0 on success, -1 on error
+ */
+static int write_record(MessageLog *log, const MessageLogRecord *record, size_t stride) {
+    MessageLogSegment *segment = &log->active;
+
+    // Keep room for the end marker (a zeroed header)
+    if (segment->position + stride + sizeof(MessageLogRecord) > segment->size) {
+        flush_log(log);
+        close_segment(segment, false);      // Readers may still map the preallocated size
+        if (create_segment(log, segment, record->offset, stride) != 0) {
+            close_segment(segment, true);
+            return -1;
+        }
+    }
+
+    if (segment->index_count < segment->index_capacity &&
+        (segment->index_count == 0 ||
+         segment->position - segment->last_index_position >= log->options.index_interval)) {
+        segment->index[segment->index_count++] = (MessageLogIndexEntry) {
+                .offset = record->offset,
+                .msg_id = record->msg_id,
+                .position = segment->position
+        };
+        segment->last_index_position = segment->position;
+    }
+
+    memcpy(segment->data + segment->position, record, stride);
+    segment->position += stride;
+    return 0;
+}
+
+static void *writer_thread(void *arg) {
+    MessageLog *log = (MessageLog *) arg;
+    if (log->options.writer_cpu >= 0) {
+        pin_thread_to_cpu(log->options.writer_cpu);
+    }
+
+    uint64_t flush_interval_ns = (uint64_t) log->options.flush_interval_ms * 1000000ULL;
+    uint64_t head = atomic_load_explicit(&log->head, memory_order_relaxed);
+
+    while (true) {
+        uint64_t tail = atomic_load_explicit(&log->tail, memory_order_acquire);
+        if (head == tail) {
+            if (!atomic_load(&log->running)) {
+                break;
+            }
+            uint64_t now = get_monotonic_time_nanos();
+            if (atomic_load(&log->flush_requested) ||
+                (flush_interval_ns > 0 && log->unflushed > 0 && now - log->last_flush_ns >= flush_interval_ns)) {
+                atomic_store(&log->flush_requested, false);
+                flush_log(log);
+            }
+            usleep(LOG_IDLE_SLEEP_US);
+            continue;
+        }
+
+        uint64_t last_offset = 0;
+        size_t written = 0;
+        while (head != tail) {
+            size_t position = head & (log->ring_size - 1);
+            size_t remaining = log->ring_size - position;
+            const MessageLogRecord *record = (const MessageLogRecord *) (log->ring + position);
+            if (remaining < sizeof(MessageLogRecord) || record->size == MESSAGE_LOG_WRAP) {
+                head += remaining;
+                continue;
+            }
+
+            size_t stride = record_stride(record->size);
+            if (!atomic_load(&log->failed) && write_record(log, record, stride) != 0) {
+                logger(LOG_LEVEL_ERROR, "The message log stops writing at offset %" PRIu64, record->offset);
+                atomic_store(&log->failed, true);   // Keep draining the ring, the receive thread must not block
+            }
+            last_offset = record->offset;
+            head += stride;
+            written++;
+        }
+        atomic_store_explicit(&log->head, head, memory_order_release);
+
+        if (!atomic_load(&log->failed)) {
+            atomic_store_explicit(&log->committed_offset, last_offset + 1, memory_order_release);
+            log->unflushed += written;
+        }
+        if ((log->options.flush_messages > 0 && log->unflushed >= log->options.flush_messages) ||
+            (flush_interval_ns > 0 && get_monotonic_time_nanos() - log->last_flush_ns >= flush_interval_ns)) {
+            flush_log(log);
+        }
+    }
+
+    flush_log(log);
+    return NULL;
+}
+
+/**
+ * @brief Find the end of the last segment of a previous run, and cut its preallocated tail.
+ * @param log
+ * @param base_offset
+ * @return The offset of the next record
+ */
+static uint64_t recover_segment(MessageLog *log, uint64_t base_offset) {
+    char path[PATH_MAX];
+    segment_path(path, sizeof(path), log->directory, base_offset, MESSAGE_LOG_SUFFIX);
+    int fd = open(path, O_RDWR);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd != -1) close(fd);
+        return base_offset;
+    }
+
+    size_t size = (size_t) st.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return base_offset;
+    }
+
+    // Walk the records up to the end marker, or up to the first torn record
+    uint64_t next_offset = base_offset;
+    size_t position = 0;
+    while (position + sizeof(MessageLogRecord) <= size) {
+        const MessageLogRecord *record = (const MessageLogRecord *) (data + position);
+        size_t stride = record_stride(record->size);
+        if (record->size == 0 || record->offset != next_offset || position + stride > size) {
+            break;
+        }
+        position += stride;
+        next_offset++;
+    }
+    munmap(data, size);
+
+    if (ftruncate(fd, (off_t) position) != 0) {
+        logger(LOG_LEVEL_WARN, "Failed to truncate the log segment %s", path);
+    }
+    close(fd);
+
+    // Keep the entries of the index that point to complete records
+    segment_path(path, sizeof(path), log->directory, base_offset, MESSAGE_LOG_INDEX_SUFFIX);
+    fd = open(path, O_RDWR);
+    if (fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        size_t capacity = (size_t) st.st_size / sizeof(MessageLogIndexEntry);
+        MessageLogIndexEntry *index = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (index != MAP_FAILED) {
+            size_t count = count_index_entries(index, capacity, position);
+            munmap(index, (size_t) st.st_size);
+            if (ftruncate(fd, (off_t) (count * sizeof(MessageLogIndexEntry))) != 0) {
+                logger(LOG_LEVEL_WARN, "Failed to truncate the log index %s", path);
+            }
+        }
+    }
+    if (fd != -1) close(fd);
+
+    return next_offset;
+}
+
+/**
+ * @brief Open the log in a directory and start the writer thread.
+ * @param log
+ * @param options
+ * @return 0 on success, -1 on error
+ */
+int open_message_log(MessageLog *log, const MessageLogOptions *options) {
+    memset(log, 0, sizeof(MessageLog));
+    log->options = *options;
+    log->active.fd = log->active.index_fd = -1;
+    MessageLogOptions *opts = &log->options;
+
+    if (opts->directory == NULL || opts->directory[0] == '\0') {
+        logger(LOG_LEVEL_ERROR, "The message log needs a directory");
+        return -1;
+    }
+    snprintf(log->directory, sizeof(log->directory), "%s", opts->directory);
+    opts->directory = log->directory;
+    if (mkdir(log->directory, 0755) != 0 && errno != EEXIST) {
+        logger(LOG_LEVEL_ERROR, "Failed to create the log directory %s: %s", log->directory, strerror(errno));
+        return -1;
+    }
+
+    if (opts->segment_size < MESSAGE_LOG_MIN_SEGMENT) opts->segment_size = MESSAGE_LOG_MIN_SEGMENT;
+    if (opts->index_interval < MESSAGE_LOG_ALIGN) opts->index_interval = 4096;
+
+    // The ring size must be a power of 2 (positions are masked)
+    log->ring_size = 64 * 1024;
+    while (log->ring_size < opts->queue_size) {
+        log->ring_size <<= 1;
+    }
+    log->ring = aligned_alloc(64, log->ring_size);
+    if (log->ring == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the message log");
+        return -1;
+    }
+    prefault_memory(log->ring, log->ring_size);
+
+    // Continue after the records of a previous run
+    size_t count;
+    uint64_t *bases = list_segments(log->directory, &count);
+    if (count > 0) {
+        atomic_init(&log->first_offset, bases[0]);
+        log->next_offset = recover_segment(log, bases[count - 1]);
+    }
+    free(bases);
+
+    if (create_segment(log, &log->active, log->next_offset, 0) != 0) {
+        close_segment(&log->active, true);
+        free(log->ring);
+        log->ring = NULL;
+        return -1;
+    }
+    atomic_init(&log->committed_offset, log->next_offset);
+    atomic_init(&log->durable_offset, log->next_offset);
+    log->last_flush_ns = get_monotonic_time_nanos();
+
+    atomic_store(&log->running, true);
+    if (pthread_create(&log->writer, NULL, writer_thread, log) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to start the message log writer");
+        atomic_store(&log->running, false);
+        close_segment(&log->active, true);
+        free(log->ring);
+        log->ring = NULL;
+        return -1;
+    }
+
+    logger(LOG_LEVEL_INFO, "Message log %s: next offset %" PRIu64 ", segments of %zu bytes",
+           log->directory, log->next_offset, opts->segment_size);
+    return 0;
+}
+
+/**
+ * @brief Queue a frame for the writer thread (no syscall, it waits only when the ring is full).
+ * @param log
+ * @param topic_id
+ * @param msg_id
+ * @param data
+ * @param size
+ * @return 0 on success, -1 if the log is closed or the frame is too big
+ */
+int message_log_append(MessageLog *log, uint16_t topic_id, uint64_t msg_id, const char *data, size_t size) {
+    size_t stride = record_stride(size);
+    if (log->ring == NULL || stride > log->ring_size / 2) {
+        return -1;
+    }
+
+    uint64_t tail = atomic_load_explicit(&log->tail, memory_order_relaxed);
+    size_t position = tail & (log->ring_size - 1);
+    size_t remaining = log->ring_size - position;
+    size_t skip = remaining < stride ? remaining : 0;   // Records are contiguous in the ring
+
+    bool stalled = false;
+    while (tail + skip + stride - atomic_load_explicit(&log->head, memory_order_acquire) > log->ring_size) {
+        if (!atomic_load_explicit(&log->running, memory_order_relaxed)) {
+            return -1;
+        }
+        if (!stalled) {
+            atomic_fetch_add(&log->stalls, 1);
+            stalled = true;
+        }
+        sched_yield();
+    }
+
+    if (skip > 0) {
+        if (remaining >= sizeof(MessageLogRecord)) {
+            ((MessageLogRecord *) (log->ring + position))->size = MESSAGE_LOG_WRAP;
+        }
+        tail += skip;
+        position = 0;
+    }
+
+    MessageLogRecord *record = (MessageLogRecord *) (log->ring + position);
+    *record = (MessageLogRecord) {
+            .size = (uint32_t) size,
+            .topic_id = topic_id,
+            .offset = log->next_offset++,
+            .msg_id = msg_id,
+            .receive_ns = (uint64_t) get_current_time_nanos()
+    };
+    memcpy(record + 1, data, size);
+    memset((char *) (record + 1) + size, 0, stride - sizeof(MessageLogRecord) - size);
+    atomic_store_explicit(&log->tail, tail + stride, memory_order_release);
+
+    atomic_fetch_add_explicit(&log->appended, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&log->bytes, size, memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * @brief Wait until the records appended so far are on disk (call it from the appending thread, or after it stopped).
+ * @param log
+ */
+void message_log_sync(MessageLog *log) {
+    uint64_t target = log->next_offset;
+    while (atomic_load_explicit(&log->durable_offset, memory_order_acquire) < target &&
+           atomic_load(&log->running) && !atomic_load(&log->failed)) {
+        atomic_store(&log->flush_requested, true);
+        usleep(LOG_SYNC_SLEEP_US);
+    }
+}
+
+/**
+ * @brief Log the statistics of the log.
+ * @param log
+ */
+void report_message_log(MessageLog *log) {
+    logger(LOG_LEVEL_INFO, "Message log %s: %" PRIu64 " records (%" PRIu64 " bytes), offsets %" PRIu64 "-%" PRIu64
+                           " (durable up to %" PRIu64 "), %" PRIu64 " flushes, %" PRIu64 " segments, %" PRIu64
+                           " stalled appends",
+           log->directory, atomic_load(&log->appended), atomic_load(&log->bytes), atomic_load(&log->first_offset),
+           atomic_load(&log->committed_offset), atomic_load(&log->durable_offset), atomic_load(&log->flushes),
+           atomic_load(&log->segments), atomic_load(&log->stalls));
+}
+
+/**
+ * @brief Write the queued records, sync them and close the log (the readers must be closed before).
+ * @param log
+ */
+void close_message_log(MessageLog *log) {
+    if (log->ring == NULL) {
+        return;
+    }
+    atomic_store(&log->running, false);
+    pthread_join(log->writer, NULL);
+    close_segment(&log->active, true);
+    free(log->ring);
+    log->ring = NULL;
+}
+
+/**
+ * @brief Map a segment for reading.
+ * @param reader
+ * @param base_offset
+ * @return 0 on success, -1 on error
+ */
+static int map_reader_segment(MessageLogReader *reader, uint64_t base_offset) {
+    char path[PATH_MAX];
+    segment_path(path, sizeof(path), reader->directory, base_offset, MESSAGE_LOG_SUFFIX);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        if (fd != -1) close(fd);
+        return -1;
+    }
+
+    MessageLogSegment *segment = &reader->segment;
+    memset(segment, 0, sizeof(MessageLogSegment));
+    segment->fd = fd;
+    segment->index_fd = -1;
+    segment->base_offset = base_offset;
+    segment->size = (size_t) st.st_size;
+    if (segment->size > 0) {
+        segment->data = mmap(NULL, segment->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (segment->data == MAP_FAILED) {
+            segment->data = NULL;
+            close(fd);
+            segment->fd = -1;
+            return -1;
+        }
+        madvise(segment->data, segment->size, MADV_SEQUENTIAL);
+    }
+    return 0;
+}
+
+static void unmap_reader_segment(MessageLogReader *reader) {
+    MessageLogSegment *segment = &reader->segment;
+    if (segment->data != NULL) {
+        munmap(segment->data, segment->size);
+    }
+    if (segment->fd != -1) {
+        close(segment->fd);
+    }
+    memset(segment, 0, sizeof(MessageLogSegment));
+    segment->fd = segment->index_fd = -1;
+}
+
+/**
+ * @brief Find the last entry of the index of a segment with an offset (or a message ID) <= a key.
+ * @param directory
+ * @param base_offset Segment of the index
+ * @param end Size of the records of the segment (the entries after it are ignored)
+ * @param key
+ * @param by_msg_id Compare the message IDs instead of the offsets (the IDs grow with the offsets)
+ * @param entry The entry found
+ * @return true if an entry was found
+ */
+static bool find_index_entry(const char *directory, uint64_t base_offset, size_t end, uint64_t key, bool by_msg_id,
+                             MessageLogIndexEntry *entry) {
+    char path[PATH_MAX];
+    segment_path(path, sizeof(path), directory, base_offset, MESSAGE_LOG_INDEX_SUFFIX);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd != -1) close(fd);
+        return false;
+    }
+
+    bool found = false;
+    MessageLogIndexEntry *index = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (index != MAP_FAILED) {
+        size_t count = count_index_entries(index, (size_t) st.st_size / sizeof(MessageLogIndexEntry), end);
+        // Binary search of the last entry <= the key
+        size_t low = 0, high = count;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if ((by_msg_id ? index[middle].msg_id : index[middle].offset) <= key) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        if (low > 0) {
+            *entry = index[low - 1];
+            found = true;
+        }
+        munmap(index, (size_t) st.st_size);
+    }
+    close(fd);
+    return found;
+}
+
+/**
+ * @brief Open a reader on the records of a directory, starting from an offset (or from the oldest record after it).
+ * @param reader
+ * @param directory
+ * @param log The live log writing in the directory, or NULL
+ * @param from_offset
+ * @return 0 on success, -1 on error
+ */
+int open_log_reader(MessageLogReader *reader, const char *directory, MessageLog *log, uint64_t from_offset) {
+    memset(reader, 0, sizeof(MessageLogReader));
+    snprintf(reader->directory, sizeof(reader->directory), "%s", directory);
+    reader->log = log;
+    reader->segment.fd = reader->segment.index_fd = -1;
+    reader->next_offset = from_offset;
+
+    size_t count;
+    uint64_t *bases = list_segments(directory, &count);
+    if (count == 0) {
+        free(bases);
+        return log != NULL ? 0 : -1;    // A live log creates its first segment later
+    }
+
+    // Last segment that starts at or before the offset (the oldest one if the offset was deleted)
+    size_t selected = 0;
+    for (size_t i = 0; i < count && bases[i] <= from_offset; i++) {
+        selected = i;
+    }
+    uint64_t base_offset = bases[selected];
+    free(bases);
+
+    if (map_reader_segment(reader, base_offset) != 0) {
+        return -1;
+    }
+    if (from_offset < base_offset) {
+        reader->next_offset = base_offset;
+        return 0;
+    }
+
+    // Jump close to the offset with the sparse index, then scan
+    MessageLogSegment *segment = &reader->segment;
+    MessageLogIndexEntry entry;
+    if (find_index_entry(reader->directory, base_offset, segment->size, from_offset, false, &entry)) {
+        segment->position = entry.position;
+    }
+    while (segment->position + sizeof(MessageLogRecord) <= segment->size) {
+        const MessageLogRecord *record = (const MessageLogRecord *) (segment->data + segment->position);
+        if (record->size == 0 || record->offset >= from_offset) {
+            break;
+        }
+        segment->position += record_stride(record->size);
+    }
+    return 0;
+}
+
+/**
+ * @brief Move the reader to the segment that starts at its next offset, if it exists.
+ * @param reader
+ * @return true if the reader moved
+ */
+static bool next_reader_segment(MessageLogReader *reader) {
+    char path[PATH_MAX];
+    segment_path(path, sizeof(path), reader->directory, reader->next_offset, MESSAGE_LOG_SUFFIX);
+    if (access(path, R_OK) != 0) {
+        return false;
+    }
+    unmap_reader_segment(reader);
+    return map_reader_segment(reader, reader->next_offset) == 0;
+}
+
+/**
+ * @brief Read the next record of the log.
+ * @param reader
+ * @param record
+ * @param data
+ * @param next_segment Move to the next segment at the end of the current one (it unmaps the records already read)
+ * @return 1 if a record was read, 0 if there is none yet (or it is in the next segment), -1 on error
+ */
+static int read_record(MessageLogReader *reader, const MessageLogRecord **record, const char **data,
+                       bool next_segment) {
+    if (reader->log != NULL &&
+        reader->next_offset >= atomic_load_explicit(&reader->log->committed_offset, memory_order_acquire)) {
+        return 0;
+    }
+
+    if (reader->segment.data == NULL && !next_reader_segment(reader)) {
+        return 0;
+    }
+
+    MessageLogSegment *segment = &reader->segment;
+    while (true) {
+        if (segment->position + sizeof(MessageLogRecord) <= segment->size) {
+            const MessageLogRecord *current = (const MessageLogRecord *) (segment->data + segment->position);
+            size_t stride = record_stride(current->size);
+            if (current->size != 0 && segment->position + stride <= segment->size) {
+                if (current->offset != reader->next_offset) {
+                    logger(LOG_LEVEL_ERROR, "Message log: offset %" PRIu64 " found instead of %" PRIu64,
+                           current->offset, reader->next_offset);
+                    return -1;
+                }
+                *record = current;
+                *data = (const char *) (current + 1);
+                segment->position += stride;
+                reader->next_offset++;
+                return 1;
+            }
+        }
+
+        // End of the segment: the next record is at the start of the next one
+        if (!next_segment || !next_reader_segment(reader)) {
+            return 0;
+        }
+    }
+}
+
+/**
+ * @brief Get the next record of the log.
+ * @param reader
+ * @param record The header of the record (valid until the next call)
+ * @param data The frame, that follows the header
+ * @return 1 if a record was read, 0 if there is none yet, -1 on error
+ */
+int log_reader_next(MessageLogReader *reader, const MessageLogRecord **record, const char **data) {
+    return read_record(reader, record, data, true);
+}
+
+/**
+ * @brief Get the next records of the log, all from the same segment (the frames stay mapped until the next call).
+ * @param reader
+ * @param frames
+ * @param sizes
+ * @param max_count
+ * @return The number of records read, -1 on error
+ */
+int log_reader_next_batch(MessageLogReader *reader, const char **frames, size_t *sizes, size_t max_count) {
+    size_t count = 0;
+    const MessageLogRecord *record;
+    const char *data;
+    while (count < max_count) {
+        int rc = read_record(reader, &record, &data, count == 0);
+        if (rc < 0) {
+            return count > 0 ? (int) count : -1;
+        }
+        if (rc == 0) {
+            break;
+        }
+        frames[count] = data;
+        sizes[count] = record->size;
+        count++;
+    }
+    return (int) count;
+}
+
+/**
+ * @brief Find the offset of the first record with a message ID >= a given one.
+ * @param directory
+ * @param log The live log writing in the directory, or NULL
+ * @param msg_id
+ * @param offset The offset found
+ * @return 0 on success, -1 if there is no such record (yet)
+ */
+int message_log_find_msg_id(const char *directory, MessageLog *log, uint64_t msg_id, uint64_t *offset) {
+    size_t count;
+    uint64_t *bases = list_segments(directory, &count);
+    if (count == 0) {
+        free(bases);
+        return -1;
+    }
+
+    // The closest indexed record before the ID, in the last segment that has one
+    uint64_t from_offset = bases[0];
+    MessageLogIndexEntry entry;
+    for (size_t i = count; i > 0; i--) {
+        if (find_index_entry(directory, bases[i - 1], SIZE_MAX, msg_id, true, &entry)) {
+            from_offset = entry.offset;
+            break;
+        }
+    }
+    free(bases);
+
+    MessageLogReader reader;
+    if (open_log_reader(&reader, directory, log, from_offset) != 0) {
+        return -1;
+    }
+    int found = -1;
+    const MessageLogRecord *record;
+    const char *data;
+    while (log_reader_next(&reader, &record, &data) == 1) {
+        if (record->msg_id >= msg_id) {
+            *offset = record->offset;
+            found = 0;
+            break;
+        }
+    }
+    close_log_reader(&reader);
+    return found;
+}
+
+/**
+ * @brief Release the segment mapped by the reader.
+ * @param reader
+ */
+void close_log_reader(MessageLogReader *reader) {
+    unmap_reader_segment(reader);
+}
@@ -0,0 +1,134 @@
+//  =====================================================================
+//  message_log.h
+//
+//  Append-only log of the received frames: preallocated memory-mapped
+//  segment files with a sparse offset index
+//  =====================================================================
+
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <limits.h>
+
+#define MESSAGE_LOG_ALIGN 8                     // Records start on 8 bytes boundaries (in the ring and on disk)
+#define MESSAGE_LOG_WRAP UINT32_MAX             // Size of the marker that sends the reader of the ring back to 0
+#define MESSAGE_LOG_SUFFIX ".log"
+#define MESSAGE_LOG_INDEX_SUFFIX ".index"
+#define MESSAGE_LOG_MIN_SEGMENT (64 * 1024)
+#define MESSAGE_LOG_DIRECTORY_SIZE (PATH_MAX - 64)  // Room for the names of the segment files
+
+// Header of a record, followed by the frame (the end of a segment is a header with size 0)
+typedef struct {
+    uint32_t size;                              // Size of the frame
+    uint16_t topic_id;
+    uint16_t flags;
+    uint64_t offset;                            // Position of the record in the log (0, 1, 2, ...)
+    uint64_t msg_id;
+    uint64_t receive_ns;                        // CLOCK_REALTIME of the append
+} MessageLogRecord;
+
+// Entry of the sparse index of a segment: one every index_interval bytes of records
+typedef struct {
+    uint64_t offset;
+    uint64_t msg_id;
+    uint64_t position;                          // Byte position of the record in the segment
+} MessageLogIndexEntry;
+
+typedef struct {
+    uint64_t base_offset;                       // Offset of the first record (also the name of the files)
+    int fd;
+    int index_fd;
+    char *data;                                 // Whole preallocated file, mapped
+    size_t size;
+    size_t position;                            // End of the written records
+    size_t flushed;                             // End of the records already synced to disk
+    MessageLogIndexEntry *index;
+    size_t index_capacity;
+    size_t index_count;
+    size_t last_index_position;
+} MessageLogSegment;
+
+typedef struct {
+    const char *directory;                      // Created if missing
+    size_t segment_size;                        // Bytes preallocated for every segment file
+    size_t index_interval;                      // Bytes of records between two entries of the sparse index
+    int flush_interval_ms;                      // Sync the appended records at least this often (0: only by count)
+    size_t flush_messages;                      // ... or every flush_messages records (0: only by time)
+    size_t queue_size;                          // Bytes of the ring between the appending thread and the writer
+    int writer_cpu;                             // CPU of the writer thread (-1: no pinning)
+} MessageLogOptions;
+
+typedef struct {
+    MessageLogOptions options;
+    char directory[MESSAGE_LOG_DIRECTORY_SIZE];
+
+    // Ring of records: single producer (the receive thread), single consumer (the writer thread)
+    char *ring;
+    size_t ring_size;
+    _Alignas(64) _Atomic uint64_t tail;
+    _Alignas(64) _Atomic uint64_t head;
+    uint64_t next_offset;                       // Offset of the next appended record (appending thread only)
+
+    pthread_t writer;
+    _Atomic bool running;
+    _Atomic bool flush_requested;               // Sync as soon as the ring is empty (message_log_sync)
+    _Atomic bool failed;                        // A segment could not be created, the records are not written
+    MessageLogSegment active;                   // Writer thread only
+    size_t unflushed;
+    uint64_t last_flush_ns;
+
+    _Atomic uint64_t first_offset;              // Oldest record on disk
+    _Atomic uint64_t committed_offset;          // Records before this offset are in the segments (visible to readers)
+    _Atomic uint64_t durable_offset;            // Records before this offset are synced to disk
+
+    _Atomic uint64_t appended;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t flushes;
+    _Atomic uint64_t segments;                  // Segments created (rolls included)
+    _Atomic uint64_t stalls;                    // Appends that waited for room in the ring
+} MessageLog;
+
+// Sequential reader of the records from a given offset, on the segments of a directory (live log or not)
+typedef struct {
+    char directory[MESSAGE_LOG_DIRECTORY_SIZE];
+    MessageLog *log;                            // Live log: the records after its committed offset are not read
+    MessageLogSegment segment;                  // Only base_offset, fd, data, size and position are used
+    uint64_t next_offset;
+} MessageLogReader;
+
+// Open the log (the records of a previous run are kept) and start its writer thread, return 0 on success
+int open_message_log(MessageLog *log, const MessageLogOptions *options);
+
+// Queue a frame for the log (called by a single thread), return 0 or -1 if the log is closed
+int message_log_append(MessageLog *log, uint16_t topic_id, uint64_t msg_id, const char *data, size_t size);
+
+// Wait until the queued records are written and synced to disk
+void message_log_sync(MessageLog *log);
+
+// Log the statistics of the log
+void report_message_log(MessageLog *log);
+
+// Write the queued records, sync them and close the segments
+void close_message_log(MessageLog *log);
+
+// Open a reader on the records of a directory from an offset (log can be NULL), return 0 on success
+int open_log_reader(MessageLogReader *reader, const char *directory, MessageLog *log, uint64_t from_offset);
+
+// Get the next record (the frame follows the header), return 1, 0 if there is none yet, -1 on error
+int log_reader_next(MessageLogReader *reader, const MessageLogRecord **record, const char **data);
+
+// Get up to max_count records of the same segment (the frames stay mapped until the next call), return the count or -1
+int log_reader_next_batch(MessageLogReader *reader, const char **frames, size_t *sizes, size_t max_count);
+
+// Find the offset of the first record with a message ID >= msg_id (log can be NULL), return 0 or -1 if not found
+int message_log_find_msg_id(const char *directory, MessageLog *log, uint64_t msg_id, uint64_t *offset);
+
+// Release the segment mapped by the reader
+void close_log_reader(MessageLogReader *reader);
+
+#endif //MESSAGE_LOG_H
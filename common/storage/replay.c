@@ -0,0 +1,329 @@
+#include "replay.h"
+#include "core/config.h"
+#include "core/logger.h"
+#include "core/topics.h"
+#include "utils/time_utils.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * A consumer that joins late (or restarts) sends a request to the replay address of the server, with the position it
+ * wants to start from (an offset of the log, or a message ID: the first record with that ID or a newer one) and the
+ * address where it receives. The server starts a session for it: a thread with its own reader of the log and its own
+ * transport to the consumer. The reader maps the segments and walks them sequentially, so the history is read with
+ * large sequential reads of the page cache, and every batch of records is sent straight from the mapped segment (no
+ * copy in user space) at the configured catch-up rate.
+ * The live records are appended to the same log, so when the reader reaches the last committed record the session
+ * simply keeps following the log: the consumer gets the live messages right after the history, with no gap and in
+ * the same order (the duplicate window of the consumer drops the overlap with a direct stream, if any).
+ * The requests are sent more than once on lossy networks: a request for an address with a running session is
+ * ignored, "cancel@<ip>:<port>" stops the session. When the server stops, every session sends STOP to its consumer.
+ */
+
+#define REPLAY_IDLE_SLEEP_US 100        // Sleep of a session that caught up with the live records
+#define REPLAY_STOP_REPEAT 3            // STOP messages sent to the consumer (they can be lost)
+
+/**
+ * @brief Parse a replay request.
+ * @param text offset:<offset>@<ip>:<port>, id:<message ID>@<ip>:<port> or cancel@<ip>:<port>
+ * @param request
+ * @return 0 on success, -1 if the request is not valid
+ */
+int parse_replay_request(const char *text, ReplayRequest *request) {
+    memset(request, 0, sizeof(ReplayRequest));
+    const char *at = strchr(text, REPLAY_ADDRESS_SEPARATOR);
+    if (at == NULL || at[1] == '\0' || strlen(at + 1) >= sizeof(request->address)) {
+        return -1;
+    }
+
+    const char *number = NULL;
+    if (strncmp(text, REPLAY_FROM_OFFSET, strlen(REPLAY_FROM_OFFSET)) == 0) {
+        request->type = REPLAY_REQUEST_OFFSET;
+        number = text + strlen(REPLAY_FROM_OFFSET);
+    } else if (strncmp(text, REPLAY_FROM_ID, strlen(REPLAY_FROM_ID)) == 0) {
+        request->type = REPLAY_REQUEST_MSG_ID;
+        number = text + strlen(REPLAY_FROM_ID);
+    } else if (strncmp(text, REPLAY_CANCEL, strlen(REPLAY_CANCEL)) == 0 && text + strlen(REPLAY_CANCEL) == at) {
+        request->type = REPLAY_REQUEST_CANCEL;
+    } else {
+        return -1;
+    }
+
+    if (number != NULL) {
+        char *end;
+        request->from = strtoull(number, &end, 10);
+        if (end == number || end != at) {
+            return -1;
+        }
+    }
+    snprintf(request->address, sizeof(request->address), "%s", at + 1);
+    return 0;
+}
+
+static void *session_thread(void *arg) {
+    ReplaySession *session = (ReplaySession *) arg;
+    ReplayServer *server = session->server;
+    const char *group = get_group(MAIN_GROUP);
+    const char *frames[REPLAY_BATCH_SIZE];
+    size_t sizes[REPLAY_BATCH_SIZE];
+
+    uint64_t start_ns = get_monotonic_time_nanos();
+    uint64_t rate = server->options.rate > 0 ? (uint64_t) server->options.rate : 0;
+    uint64_t history = 0;
+    bool live = false;
+
+    while (atomic_load(&server->running) && !atomic_load(&session->cancelled)) {
+        int count = log_reader_next_batch(&session->reader, frames, sizes, REPLAY_BATCH_SIZE);
+        if (count < 0) {
+            logger(LOG_LEVEL_ERROR, "Replay to %s: the log cannot be read", session->request.address);
+            break;
+        }
+        if (count == 0) {
+            if (!live) {
+                live = true;
+                atomic_store(&session->live_offset, session->reader.next_offset);
+                logger(LOG_LEVEL_INFO, "Replay to %s: history caught up at offset %" PRIu64 " (%" PRIu64
+                                       " messages), following the live messages",
+                       session->request.address, session->reader.next_offset, history);
+            }
+            usleep(REPLAY_IDLE_SLEEP_US);
+            continue;
+        }
+
+        transport_send_batch(session->transport, group, frames, sizes, (size_t) count);
+        atomic_fetch_add(&session->replayed, (uint64_t) count);
+
+        // Catch-up rate (the live messages come at the rate of the producers)
+        if (!live) {
+            history += (uint64_t) count;
+            uint64_t due_ns = rate > 0 ? start_ns + history * 1000000000ULL / rate : 0;
+            uint64_t now = get_monotonic_time_nanos();
+            if (due_ns > now) {
+                struct timespec pause = {.tv_sec = (time_t) ((due_ns - now) / 1000000000ULL),
+                                         .tv_nsec = (long) ((due_ns - now) % 1000000000ULL)};
+                nanosleep(&pause, NULL);
+            }
+        }
+    }
+
+    // The server stops: so does the consumer (a cancelled session just ends)
+    if (!atomic_load(&session->cancelled)) {
+        const char *stop = control_frame(TOPIC_STOP);
+        for (int i = 0; i < REPLAY_STOP_REPEAT; i++) {
+            transport_send(session->transport, group, stop, strlen(stop), 0);
+        }
+    }
+
+    close_log_reader(&session->reader);
+    transport_close(session->transport);
+    session->transport = NULL;
+    atomic_store(&session->active, false);
+    return NULL;
+}
+
+/**
+ * @brief Log what a session sent (the session is done).
+ * @param session
+ */
+static void report_session(ReplaySession *session) {
+    logger(LOG_LEVEL_INFO, "Replay to %s: %" PRIu64 " messages from offset %" PRIu64 "%s",
+           session->request.address, atomic_load(&session->replayed), session->start_offset,
+           atomic_load(&session->cancelled) ? " (cancelled)" : "");
+}
+
+/**
+ * @brief Start a session for a request (or cancel the session of its address).
+ * @param server
+ * @param request
+ */
+static void handle_request(ReplayServer *server, const ReplayRequest *request) {
+    MessageLog *log = server->options.log;
+    pthread_mutex_lock(&server->mutex);
+
+    // A running session for the same address: a duplicate of the request, or its cancellation
+    ReplaySession *free_slot = NULL;
+    for (int i = 0; i < REPLAY_MAX_SESSIONS; i++) {
+        ReplaySession *session = &server->sessions[i];
+        if (session->used && atomic_load(&session->active) &&
+            strcmp(session->request.address, request->address) == 0) {
+            if (request->type == REPLAY_REQUEST_CANCEL) {
+                atomic_store(&session->cancelled, true);
+            }
+            pthread_mutex_unlock(&server->mutex);
+            return;
+        }
+        if (free_slot == NULL && (!session->used || !atomic_load(&session->active))) {
+            free_slot = session;
+        }
+    }
+    if (request->type == REPLAY_REQUEST_CANCEL) {
+        pthread_mutex_unlock(&server->mutex);
+        return;
+    }
+    if (free_slot == NULL) {
+        pthread_mutex_unlock(&server->mutex);
+        logger(LOG_LEVEL_WARN, "Replay to %s refused: too many sessions", request->address);
+        return;
+    }
+
+    // Slot of a finished session
+    ReplaySession *session = free_slot;
+    if (session->used) {
+        pthread_join(session->thread, NULL);
+        report_session(session);
+    }
+    memset(session, 0, sizeof(ReplaySession));
+    session->server = server;
+    session->request = *request;
+
+    // From a message ID: the first record with that ID or a newer one (only the live ones, if there is none yet)
+    session->start_offset = request->from;
+    if (request->type == REPLAY_REQUEST_MSG_ID &&
+        message_log_find_msg_id(log->directory, log, request->from, &session->start_offset) != 0) {
+        session->start_offset = atomic_load(&log->committed_offset);
+    }
+
+    char address[TRANSPORT_ADDRESS_SIZE];
+    snprintf(address, sizeof(address), "%s://%s", server->options.protocol, request->address);
+    session->transport = transport_open(server->options.protocol, server->options.context, TRANSPORT_SENDER, address,
+                                        NULL, server->options.timeout);
+    if (session->transport == NULL ||
+        open_log_reader(&session->reader, log->directory, log, session->start_offset) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to start the replay to %s", request->address);
+        transport_close(session->transport);
+        pthread_mutex_unlock(&server->mutex);
+        return;
+    }
+
+    session->used = true;
+    atomic_store(&session->active, true);
+    if (pthread_create(&session->thread, NULL, session_thread, session) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to start the replay thread");
+        close_log_reader(&session->reader);
+        transport_close(session->transport);
+        session->used = false;
+        atomic_store(&session->active, false);
+    } else {
+        logger(LOG_LEVEL_INFO, "Replay to %s from offset %" PRIu64, request->address, session->start_offset);
+    }
+    pthread_mutex_unlock(&server->mutex);
+}
+
+static void *request_thread(void *arg) {
+    ReplayServer *server = (ReplayServer *) arg;
+    char buffer[REPLAY_REQUEST_SIZE];
+
+    while (atomic_load(&server->running)) {
+        int size = transport_recv(server->requests, buffer, sizeof(buffer), 0);
+        if (size <= 0) {
+            continue;
+        }
+
+        ReplayRequest request;
+        if (parse_replay_request(buffer, &request) != 0) {
+            logger(LOG_LEVEL_WARN, "Invalid replay request: %s", buffer);
+            continue;
+        }
+        handle_request(server, &request);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Open the request transport and start the thread that serves the requests.
+ * @param server
+ * @param options
+ * @return 0 on success, -1 on error
+ */
+int start_replay_server(ReplayServer *server, const ReplayOptions *options) {
+    memset(server, 0, sizeof(ReplayServer));
+    server->options = *options;
+    if (options->log == NULL || options->request_address == NULL) {
+        logger(LOG_LEVEL_ERROR, "The replay needs a message log and a request address");
+        return -1;
+    }
+
+    server->requests = transport_open(options->protocol, options->context, TRANSPORT_RECEIVER,
+                                      options->request_address, get_group(MAIN_GROUP), options->timeout);
+    if (server->requests == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the replay transport on %s", options->request_address);
+        return -1;
+    }
+
+    pthread_mutex_init(&server->mutex, NULL);
+    atomic_store(&server->running, true);
+    if (pthread_create(&server->thread, NULL, request_thread, server) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to start the replay thread");
+        atomic_store(&server->running, false);
+        transport_close(server->requests);
+        server->requests = NULL;
+        return -1;
+    }
+    logger(LOG_LEVEL_INFO, "Replay requests on %s (catch-up rate: %d msg/s)", options->request_address,
+           options->rate);
+    return 0;
+}
+
+/**
+ * @brief Stop the request thread and the sessions (call it before closing the log).
+ * @param server
+ */
+void stop_replay_server(ReplayServer *server) {
+    if (server->requests == NULL) {
+        return;
+    }
+    atomic_store(&server->running, false);
+    pthread_join(server->thread, NULL);
+
+    for (int i = 0; i < REPLAY_MAX_SESSIONS; i++) {
+        ReplaySession *session = &server->sessions[i];
+        if (session->used) {
+            pthread_join(session->thread, NULL);
+            report_session(session);
+            session->used = false;
+        }
+    }
+
+    transport_close(server->requests);
+    server->requests = NULL;
+    pthread_mutex_destroy(&server->mutex);
+}
+
+/**
+ * @brief Ask the replay of the log of a server (the request is sent REPLAY_REQUEST_REPEAT times).
+ * @param protocol
+ * @param context
+ * @param source Replay address of the server (<ip>:<port>)
+ * @param from "offset:<offset>" or "id:<message ID>"
+ * @param reply_address Address where the consumer receives (<ip>:<port>)
+ * @return 0 on success, -1 on error
+ */
+int request_replay(const char *protocol, void *context, const char *source, const char *from,
+                   const char *reply_address) {
+    char request[REPLAY_REQUEST_SIZE];
+    int length = snprintf(request, sizeof(request), "%s%c%s", from, REPLAY_ADDRESS_SEPARATOR, reply_address);
+    ReplayRequest parsed;
+    if (length >= (int) sizeof(request) || parse_replay_request(request, &parsed) != 0) {
+        logger(LOG_LEVEL_ERROR, "Invalid replay request: %s", request);
+        return -1;
+    }
+
+    char address[TRANSPORT_ADDRESS_SIZE];
+    snprintf(address, sizeof(address), "%s://%s", protocol, source);
+    Transport *transport = transport_open(protocol, context, TRANSPORT_SENDER, address, NULL, 0);
+    if (transport == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the replay transport to %s", address);
+        return -1;
+    }
+    for (int i = 0; i < REPLAY_REQUEST_REPEAT; i++) {
+        transport_send(transport, get_group(MAIN_GROUP), request, (size_t) length, 0);
+    }
+    transport_close(transport);
+    logger(LOG_LEVEL_INFO, "Replay requested to %s: %s", source, request);
+    return 0;
+}
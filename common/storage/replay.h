@@ -0,0 +1,89 @@
+//  =====================================================================
+//  replay.h
+//
+//  Replay of the message log to late consumers: the history from an
+//  offset (or a message ID), then the live messages
+//  =====================================================================
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "storage/message_log.h"
+#include "transport/transport.h"
+
+#define REPLAY_MAX_SESSIONS 16
+#define REPLAY_BATCH_SIZE 64                    // Records sent with a single batch
+#define REPLAY_REQUEST_SIZE 128
+#define REPLAY_REQUEST_REPEAT 3                 // Requests sent by a consumer (the duplicates are ignored)
+#define REPLAY_FROM_OFFSET "offset:"            // Request: offset:<offset>@<ip>:<port>
+#define REPLAY_FROM_ID "id:"                    // Request: id:<message ID>@<ip>:<port>
+#define REPLAY_CANCEL "cancel"                  // Request: cancel@<ip>:<port>
+#define REPLAY_ADDRESS_SEPARATOR '@'
+#define REPLAY_ADDRESS_SIZE 64
+
+typedef enum {
+    REPLAY_REQUEST_OFFSET,
+    REPLAY_REQUEST_MSG_ID,
+    REPLAY_REQUEST_CANCEL
+} ReplayRequestType;
+
+typedef struct {
+    ReplayRequestType type;
+    uint64_t from;                              // Offset or message ID
+    char address[REPLAY_ADDRESS_SIZE];          // <ip>:<port> of the consumer
+} ReplayRequest;
+
+typedef struct ReplayServer ReplayServer;
+
+// Stream of the log to a consumer: history at the catch-up rate, then the live records as they are committed
+typedef struct {
+    ReplayServer *server;
+    ReplayRequest request;
+    Transport *transport;
+    MessageLogReader reader;
+    pthread_t thread;
+    bool used;                                  // Slot taken (the thread may be done)
+    _Atomic bool active;                        // The thread is running
+    _Atomic bool cancelled;
+    uint64_t start_offset;
+    _Atomic uint64_t replayed;
+    _Atomic uint64_t live_offset;               // Offset where the history was caught up (0: not yet)
+} ReplaySession;
+
+// The log and the strings must stay valid until the server is stopped
+typedef struct {
+    const char *protocol;
+    void *context;                              // ZMQ context (NULL for the other backends)
+    const char *request_address;                // Full address where the consumers send their requests
+    MessageLog *log;
+    int rate;                                   // Catch-up rate in messages per second (0: as fast as possible)
+    int timeout;                                // Receive timeout of the request transport
+} ReplayOptions;
+
+struct ReplayServer {
+    ReplayOptions options;
+    Transport *requests;
+    pthread_t thread;
+    _Atomic bool running;
+    pthread_mutex_t mutex;
+    ReplaySession sessions[REPLAY_MAX_SESSIONS];
+};
+
+// Parse a request (offset:<n>@<ip>:<port>, id:<n>@<ip>:<port> or cancel@<ip>:<port>), return 0 or -1 if invalid
+int parse_replay_request(const char *text, ReplayRequest *request);
+
+// Start the thread that serves the replay requests, return 0 on success
+int start_replay_server(ReplayServer *server, const ReplayOptions *options);
+
+// Stop the sessions (they send STOP to their consumers) and the request thread
+void stop_replay_server(ReplayServer *server);
+
+// Ask a replay to the server at source (<ip>:<port>), on reply_address (<ip>:<port>), from "offset:<n>" or "id:<n>"
+int request_replay(const char *protocol, void *context, const char *source, const char *from,
+                   const char *reply_address);
+
+#endif //REPLAY_H
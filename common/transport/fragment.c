@@ -0,0 +1,756 @@
+#include "fragment.h"
+#include "core/logger.h"
+#include "utils/time_utils.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The backends move datagrams, so a message larger than a datagram used to be truncated by the receiver. When the
+ * fragmentation is enabled on a transport (both sides), transport_send splits such a message into fragments of at most
+ * fragment_size bytes: a FragmentHeader (sender, sequence number of the message, total size, offset, index, count)
+ * followed by a slice of the message. The fragments go out with send_batch (one sendmmsg per FRAGMENT_SEND_BATCH
+ * fragments with rawudp). The messages that fit in a datagram are sent as they are, with no header.
+ * The receiver keeps max_pending reassembly slots, allocated once with a buffer of max_message_size bytes and a bitmap
+ * of the received fragments: every fragment is copied at its offset, the message is returned when the last missing
+ * fragment arrives, whatever the arrival order. The duplicates are dropped by the bitmap (and by a short history of the
+ * completed messages, for the late ones).
+ * The GC runs at every receive: a slot without fragments for timeout_ms is dropped (counted as expired), so a lost
+ * fragment never holds a slot forever. Before that, after nack_interval_ms without progress, the receiver calls its
+ * NACK handler with the missing indexes (frag:<sender>:<seq>:<first>-<last>,...): the server sends it on the ACK
+ * channel, and the client answers with fragment_resend, that rebuilds only the missing fragments from the copy of the
+ * message kept by the sender transport (the last cache_messages messages). So a lost datagram costs one fragment, not
+ * a whole multi-MB message.
+ */
+
+static FragmentState *g_fragment_senders[FRAGMENT_MAX_SENDERS];
+static pthread_mutex_t g_fragment_senders_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t g_fragment_sender_counter = 0;
+
+/**
+ * @brief Generate the ID of a sender transport, different for the transports of a process and (very likely) for the
+ * processes that send to the same receiver.
+ * @return
+ */
+static uint32_t new_sender_id(void) {
+    uint64_t x = ((uint64_t) getpid() << 32) ^ get_monotonic_time_nanos() ^
+                 ((uint64_t) __atomic_add_fetch(&g_fragment_sender_counter, 1, __ATOMIC_RELAXED) << 48);
+    // splitmix64 finalizer
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (uint32_t) x != 0 ? (uint32_t) x : 1;
+}
+
+/**
+ * @brief Fill the options with the default values.
+ * @param options
+ */
+void fragment_default_options(FragmentOptions *options) {
+    options->fragment_size = FRAGMENT_DEFAULT_SIZE;
+    options->max_message_size = FRAGMENT_DEFAULT_MAX_MESSAGE;
+    options->max_pending = FRAGMENT_DEFAULT_PENDING;
+    options->timeout_ms = FRAGMENT_DEFAULT_TIMEOUT_MS;
+    options->nack_interval_ms = FRAGMENT_DEFAULT_NACK_INTERVAL_MS;
+    options->cache_messages = FRAGMENT_DEFAULT_CACHE;
+}
+
+/**
+ * @brief Allocate the fragmentation state: the reassembly slots (buffers and bitmaps) and the retransmission cache.
+ * @param options
+ * @return The state, or NULL on error
+ */
+FragmentState *create_fragment_state(const FragmentOptions *options) {
+    if (options->fragment_size < FRAGMENT_MIN_SIZE || options->fragment_size > TRANSPORT_MAX_MESSAGE_SIZE ||
+        options->max_message_size == 0 || options->max_message_size > UINT32_MAX || options->max_pending < 1) {
+        logger(LOG_LEVEL_ERROR, "Invalid fragmentation options (fragment size %zu, max message %zu, pending %d)",
+               options->fragment_size, options->max_message_size, options->max_pending);
+        return NULL;
+    }
+
+    FragmentState *state = calloc(1, sizeof(FragmentState));
+    if (state == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the fragmentation state");
+        return NULL;
+    }
+    state->options = *options;
+    state->sender_id = new_sender_id();
+    pthread_mutex_init(&state->cache_mutex, NULL);
+
+    // The senders may use a smaller fragment size: the bitmaps are sized for the smallest one
+    size_t min_payload = FRAGMENT_MIN_SIZE - sizeof(FragmentHeader);
+    state->max_fragments = (uint32_t) ((options->max_message_size + min_payload - 1) / min_payload);
+    size_t bitmap_words = (state->max_fragments + 63) / 64;
+
+    state->tx_buffer = malloc(FRAGMENT_SEND_BATCH * options->fragment_size);
+    state->rx_datagram = malloc(TRANSPORT_MAX_MESSAGE_SIZE);
+    state->slots = calloc((size_t) options->max_pending, sizeof(FragmentSlot));
+    if (options->cache_messages > 0) {
+        state->cache = calloc((size_t) options->cache_messages, sizeof(FragmentCacheEntry));
+    }
+    bool failed = state->tx_buffer == NULL || state->rx_datagram == NULL || state->slots == NULL ||
+                  (options->cache_messages > 0 && state->cache == NULL);
+    for (int i = 0; !failed && i < options->max_pending; i++) {
+        state->slots[i].buffer = malloc(options->max_message_size);
+        state->slots[i].bitmap = calloc(bitmap_words, sizeof(uint64_t));
+        failed = state->slots[i].buffer == NULL || state->slots[i].bitmap == NULL;
+    }
+    if (failed) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the fragmentation buffers");
+        release_fragment_state(state);
+        return NULL;
+    }
+    return state;
+}
+
+void release_fragment_state(FragmentState *state) {
+    if (state == NULL) {
+        return;
+    }
+    for (int i = 0; state->slots != NULL && i < state->options.max_pending; i++) {
+        free(state->slots[i].buffer);
+        free(state->slots[i].bitmap);
+    }
+    for (int i = 0; state->cache != NULL && i < state->options.cache_messages; i++) {
+        free(state->cache[i].data);
+    }
+    free(state->slots);
+    free(state->cache);
+    free(state->tx_buffer);
+    free(state->rx_datagram);
+    pthread_mutex_destroy(&state->cache_mutex);
+    free(state);
+}
+
+size_t fragment_payload_size(const FragmentState *state) {
+    return state->options.fragment_size - sizeof(FragmentHeader);
+}
+
+uint32_t fragment_count(const FragmentState *state, size_t size) {
+    if (size <= state->options.fragment_size) {
+        return 1;
+    }
+    size_t payload = fragment_payload_size(state);
+    return (uint32_t) ((size + payload - 1) / payload);
+}
+
+bool is_fragment(const char *data, size_t size) {
+    uint32_t magic;
+    if (size < sizeof(FragmentHeader)) {
+        return false;
+    }
+    memcpy(&magic, data, sizeof(magic));
+    return magic == FRAGMENT_MAGIC;
+}
+
+// ================================================== Sender ==========================================================
+
+/**
+ * @brief Build and send the fragments [first, last] of a message, FRAGMENT_SEND_BATCH at a time.
+ * @param transport
+ * @param group
+ * @param datagrams Buffer of FRAGMENT_SEND_BATCH datagrams of fragment_size bytes
+ * @param fragment_size
+ * @param sender_id
+ * @param seq
+ * @param data The whole message
+ * @param size
+ * @param first
+ * @param last
+ * @return The number of fragments sent, or -1 on error
+ */
+static int send_fragment_range(Transport *transport, const char *group, char *datagrams, size_t fragment_size,
+                               uint32_t sender_id, uint64_t seq, const char *data, size_t size, uint32_t first,
+                               uint32_t last) {
+    size_t payload = fragment_size - sizeof(FragmentHeader);
+    uint32_t count = (uint32_t) ((size + payload - 1) / payload);
+    const char *buffers[FRAGMENT_SEND_BATCH];
+    size_t sizes[FRAGMENT_SEND_BATCH];
+    int sent = 0;
+
+    for (uint32_t index = first; index <= last && index < count;) {
+        size_t batch = 0;
+        for (; batch < FRAGMENT_SEND_BATCH && index <= last && index < count; batch++, index++) {
+            size_t offset = (size_t) index * payload;
+            size_t slice = size - offset < payload ? size - offset : payload;
+            FragmentHeader header = {
+                    .magic = FRAGMENT_MAGIC,
+                    .sender_id = sender_id,
+                    .seq = seq,
+                    .total_size = (uint32_t) size,
+                    .offset = (uint32_t) offset,
+                    .index = index,
+                    .count = count
+            };
+            char *datagram = datagrams + batch * fragment_size;
+            memcpy(datagram, &header, sizeof(header));
+            memcpy(datagram + sizeof(header), data + offset, slice);
+            buffers[batch] = datagram;
+            sizes[batch] = sizeof(header) + slice;
+        }
+
+        int rc;
+        if (transport->ops->send_batch != NULL) {
+            rc = transport->ops->send_batch(transport, group, buffers, sizes, batch);
+        } else {
+            rc = 0;
+            while ((size_t) rc < batch && transport->ops->send(transport, group, buffers[rc], sizes[rc], 0) >= 0) {
+                rc++;
+            }
+        }
+        if (rc != (int) batch) {
+            logger(LOG_LEVEL_ERROR, "Failed to send the fragments of message %" PRIu64 " (%d of %zu)", seq, rc, batch);
+            return -1;
+        }
+        sent += rc;
+    }
+    return sent;
+}
+
+/**
+ * @brief Split a message into fragments and send them. A copy of the message is kept in the cache, for the NACKs.
+ * @param transport
+ * @param state
+ * @param group
+ * @param data
+ * @param size
+ * @return size on success, -1 on error
+ */
+int fragment_send(Transport *transport, FragmentState *state, const char *group, const char *data, size_t size) {
+    if (size > state->options.max_message_size) {
+        state->stats.oversized++;
+        logger(LOG_LEVEL_ERROR, "Message of %zu bytes larger than the max fragmented message (%zu bytes)", size,
+               state->options.max_message_size);
+        return -1;
+    }
+
+    uint64_t seq = state->next_seq++;
+    if (state->cache != NULL) {
+        pthread_mutex_lock(&state->cache_mutex);
+        FragmentCacheEntry *entry = &state->cache[seq % (uint64_t) state->options.cache_messages];
+        if (entry->capacity < size) {
+            char *data_copy = realloc(entry->data, size);
+            if (data_copy != NULL) {
+                entry->data = data_copy;
+                entry->capacity = size;
+            }
+        }
+        if (entry->capacity >= size) {
+            memcpy(entry->data, data, size);
+            entry->seq = seq;
+            entry->size = size;
+        } else {
+            entry->size = 0;    // Not cached: the NACKs of the message are ignored
+        }
+        pthread_mutex_unlock(&state->cache_mutex);
+    }
+
+    uint32_t count = fragment_count(state, size);
+    int sent = send_fragment_range(transport, group, state->tx_buffer, state->options.fragment_size,
+                                   state->sender_id, seq, data, size, 0, count - 1);
+    if (sent < 0) {
+        return -1;
+    }
+    state->stats.fragmented++;
+    state->stats.fragments_sent += (uint64_t) sent;
+    return (int) size;
+}
+
+void register_fragment_sender(FragmentState *state) {
+    pthread_mutex_lock(&g_fragment_senders_mutex);
+    for (int i = 0; i < FRAGMENT_MAX_SENDERS; i++) {
+        if (g_fragment_senders[i] == NULL) {
+            g_fragment_senders[i] = state;
+            pthread_mutex_unlock(&g_fragment_senders_mutex);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&g_fragment_senders_mutex);
+    logger(LOG_LEVEL_WARN, "Too many fragment senders (max %d), the NACKs of %08x are ignored", FRAGMENT_MAX_SENDERS,
+           state->sender_id);
+}
+
+void unregister_fragment_sender(FragmentState *state) {
+    pthread_mutex_lock(&g_fragment_senders_mutex);
+    for (int i = 0; i < FRAGMENT_MAX_SENDERS; i++) {
+        if (g_fragment_senders[i] == state) {
+            g_fragment_senders[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&g_fragment_senders_mutex);
+}
+
+/**
+ * @brief Resend the fragments listed in a NACK. The fragments are rebuilt from the cache of the sender transport that
+ * sent the message (any transport of the process), and sent on the given transport.
+ * @param transport Used for sending the fragments (e.g. the radio of the resends)
+ * @param group
+ * @param nack frag:<sender>:<seq>:<first>-<last>,<index>,...
+ * @return The number of fragments resent, or -1 if the NACK is invalid or the message is not cached anymore
+ */
+int fragment_resend(Transport *transport, const char *group, const char *nack) {
+    size_t prefix = strlen(FRAGMENT_NACK_PREFIX);
+    if (strncmp(nack, FRAGMENT_NACK_PREFIX, prefix) != 0) {
+        return -1;
+    }
+    char *end;
+    uint32_t sender_id = (uint32_t) strtoul(nack + prefix, &end, 16);
+    if (*end != ':') {
+        return -1;
+    }
+    uint64_t seq = strtoull(end + 1, &end, 10);
+    if (*end != ':') {
+        return -1;
+    }
+    const char *ranges = end + 1;
+
+    // The registry lock keeps the sender alive (its transport cannot be closed) while its cache is used
+    pthread_mutex_lock(&g_fragment_senders_mutex);
+    FragmentState *sender = NULL;
+    for (int i = 0; i < FRAGMENT_MAX_SENDERS && sender == NULL; i++) {
+        if (g_fragment_senders[i] != NULL && g_fragment_senders[i]->sender_id == sender_id) {
+            sender = g_fragment_senders[i];
+        }
+    }
+    if (sender == NULL || sender->cache == NULL) {
+        pthread_mutex_unlock(&g_fragment_senders_mutex);
+        return -1;
+    }
+
+    char *datagrams = malloc(FRAGMENT_SEND_BATCH * sender->options.fragment_size);
+    if (datagrams == NULL) {
+        pthread_mutex_unlock(&g_fragment_senders_mutex);
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the resent fragments");
+        return -1;
+    }
+
+    int resent = -1;
+    pthread_mutex_lock(&sender->cache_mutex);
+    FragmentCacheEntry *entry = &sender->cache[seq % (uint64_t) sender->options.cache_messages];
+    if (entry->seq == seq && entry->size > 0) {
+        resent = 0;
+        const char *ptr = ranges;
+        while (*ptr >= '0' && *ptr <= '9') {
+            uint32_t first = (uint32_t) strtoul(ptr, &end, 10);
+            uint32_t last = *end == '-' ? (uint32_t) strtoul(end + 1, &end, 10) : first;
+            int rc = send_fragment_range(transport, group, datagrams, sender->options.fragment_size, sender_id, seq,
+                                         entry->data, entry->size, first, last);
+            if (rc < 0) {
+                break;
+            }
+            resent += rc;
+            ptr = *end == ',' ? end + 1 : end;
+        }
+        __atomic_fetch_add(&sender->stats.fragments_resent, (uint64_t) resent, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&sender->cache_mutex);
+    pthread_mutex_unlock(&g_fragment_senders_mutex);
+    free(datagrams);
+    return resent;
+}
+
+// ================================================= Receiver =========================================================
+
+static bool is_done(const FragmentState *state, uint32_t sender_id, uint64_t seq) {
+    for (size_t i = 0; i < FRAGMENT_DONE_HISTORY; i++) {
+        if (state->done[i].sender_id == sender_id && state->done[i].seq == seq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Find the slot of a message, or take a free one (the least recently updated one if all are busy).
+ * @param state
+ * @param header
+ * @param now_ns
+ * @return The slot, or NULL if all the slots hold messages not yet released by the caller
+ */
+static FragmentSlot *find_slot(FragmentState *state, const FragmentHeader *header, long long now_ns) {
+    FragmentSlot *free_slot = NULL;
+    FragmentSlot *oldest = NULL;
+    for (int i = 0; i < state->options.max_pending; i++) {
+        FragmentSlot *slot = &state->slots[i];
+        if (!slot->active) {
+            if (free_slot == NULL) free_slot = slot;
+            continue;
+        }
+        if (slot->delivered) {
+            continue;
+        }
+        if (slot->sender_id == header->sender_id && slot->seq == header->seq) {
+            return slot;
+        }
+        if (oldest == NULL || slot->last_ns < oldest->last_ns) {
+            oldest = slot;
+        }
+    }
+
+    FragmentSlot *slot = free_slot;
+    if (slot == NULL && oldest != NULL) {
+        // Too many messages at the same time: the one that waits for the longest is dropped
+        logger(LOG_LEVEL_WARN, "No free reassembly slot, message %" PRIu64 " of %08x dropped", oldest->seq,
+               oldest->sender_id);
+        state->stats.expired++;
+        slot = oldest;
+    }
+    if (slot == NULL) {
+        return NULL;
+    }
+
+    slot->active = true;
+    slot->delivered = false;
+    slot->sender_id = header->sender_id;
+    slot->seq = header->seq;
+    slot->total_size = header->total_size;
+    slot->count = header->count;
+    slot->received = 0;
+    slot->highest = 0;
+    slot->first_ns = now_ns;
+    slot->last_ns = now_ns;
+    slot->last_nack_ns = 0;
+    memset(slot->bitmap, 0, ((state->max_fragments + 63) / 64) * sizeof(uint64_t));
+    return slot;
+}
+
+/**
+ * @brief Add a fragment to the message it belongs to.
+ * @param state
+ * @param datagram
+ * @param size
+ * @param now_ns Monotonic time of the arrival
+ * @param message Set to the reassembled message when it is complete (valid until the slot is released)
+ * @param message_size
+ * @return 1 if the message is complete, 0 if fragments are still missing (or the fragment is a duplicate), -1 if the
+ * fragment is invalid
+ */
+int fragment_reassemble(FragmentState *state, const char *datagram, size_t size, long long now_ns,
+                        const char **message, size_t *message_size) {
+    if (!is_fragment(datagram, size)) {
+        return -1;
+    }
+    FragmentHeader header;
+    memcpy(&header, datagram, sizeof(header));
+    size_t slice = size - sizeof(header);
+
+    if (header.total_size > state->options.max_message_size || header.count > state->max_fragments) {
+        if (header.index == 0) {
+            state->stats.oversized++;
+            logger(LOG_LEVEL_WARN, "Fragmented message of %" PRIu32 " bytes larger than the max (%zu bytes)",
+                   header.total_size, state->options.max_message_size);
+        }
+        return -1;
+    }
+    if (header.count == 0 || header.index >= header.count || (size_t) header.offset + slice > header.total_size) {
+        return -1;
+    }
+    state->stats.fragments_received++;
+
+    if (is_done(state, header.sender_id, header.seq)) {
+        state->stats.duplicates++;
+        return 0;
+    }
+    FragmentSlot *slot = find_slot(state, &header, now_ns);
+    if (slot == NULL) {
+        return 0;   // Dropped, it is asked again by the NACK
+    }
+    if (slot->total_size != header.total_size || slot->count != header.count) {
+        return -1;
+    }
+
+    uint64_t bit = 1ULL << (header.index % 64);
+    if (slot->bitmap[header.index / 64] & bit) {
+        state->stats.duplicates++;
+        return 0;
+    }
+    slot->bitmap[header.index / 64] |= bit;
+    memcpy(slot->buffer + header.offset, datagram + sizeof(header), slice);
+    slot->received++;
+    slot->last_ns = now_ns;
+    if (header.index > slot->highest) {
+        slot->highest = header.index;
+    }
+
+    if (slot->received < slot->count) {
+        return 0;
+    }
+
+    slot->delivered = true;
+    state->done[state->done_next] = (FragmentDone) {.sender_id = slot->sender_id, .seq = slot->seq};
+    state->done_next = (state->done_next + 1) % FRAGMENT_DONE_HISTORY;
+    state->stats.reassembled++;
+    *message = slot->buffer;
+    *message_size = slot->total_size;
+    return 1;
+}
+
+/**
+ * @brief Release the slots of the messages already returned to the caller.
+ * @param state
+ */
+static void release_delivered(FragmentState *state) {
+    for (int i = 0; i < state->options.max_pending; i++) {
+        if (state->slots[i].delivered) {
+            state->slots[i].delivered = false;
+            state->slots[i].active = false;
+        }
+    }
+}
+
+/**
+ * @brief Write the NACK of the missing fragments of a message, as ranges of indexes.
+ * @param slot
+ * @param nack
+ * @param nack_size
+ * @return The size of the NACK (it may list only the first missing fragments), 0 if nothing is missing
+ */
+size_t fragment_format_nack(const FragmentSlot *slot, char *nack, size_t nack_size) {
+    int len = snprintf(nack, nack_size, "%s%08" PRIx32 ":%" PRIu64 ":", FRAGMENT_NACK_PREFIX, slot->sender_id,
+                       slot->seq);
+    if (len < 0 || (size_t) len >= nack_size) {
+        return 0;
+    }
+    size_t used = (size_t) len;
+    bool any = false;
+
+    uint32_t index = 0;
+    while (index < slot->count) {
+        if (slot->bitmap[index / 64] & (1ULL << (index % 64))) {
+            index++;
+            continue;
+        }
+        uint32_t last = index;
+        while (last + 1 < slot->count && !(slot->bitmap[(last + 1) / 64] & (1ULL << ((last + 1) % 64)))) {
+            last++;
+        }
+        char range[32];
+        int range_len = last > index ? snprintf(range, sizeof(range), "%s%" PRIu32 "-%" PRIu32, any ? "," : "", index,
+                                                last)
+                                     : snprintf(range, sizeof(range), "%s%" PRIu32, any ? "," : "", index);
+        if (used + (size_t) range_len >= nack_size) {
+            break;      // The next NACK asks for the others
+        }
+        memcpy(nack + used, range, (size_t) range_len + 1);
+        used += (size_t) range_len;
+        any = true;
+        index = last + 1;
+    }
+    return any ? used : 0;
+}
+
+/**
+ * @brief Drop the messages that did not receive fragments for timeout_ms, and send the NACKs of the incomplete ones
+ * that did not progress for nack_interval_ms.
+ * @param state
+ * @param now_ns
+ * @return The number of dropped messages
+ */
+int fragment_collect(FragmentState *state, long long now_ns) {
+    long long timeout_ns = (long long) state->options.timeout_ms * 1000000LL;
+    long long nack_ns = (long long) state->options.nack_interval_ms * 1000000LL;
+    int dropped = 0;
+
+    for (int i = 0; i < state->options.max_pending; i++) {
+        FragmentSlot *slot = &state->slots[i];
+        if (!slot->active || slot->delivered) {
+            continue;
+        }
+        if (now_ns - slot->last_ns > timeout_ns) {
+            logger(LOG_LEVEL_WARN, "Fragmented message %" PRIu64 " of %08x expired (%" PRIu32 " of %" PRIu32
+                                   " fragments)", slot->seq, slot->sender_id, slot->received, slot->count);
+            slot->active = false;
+            state->stats.expired++;
+            dropped++;
+            continue;
+        }
+        if (state->nack_fn != NULL && nack_ns > 0 && now_ns - slot->last_ns >= nack_ns &&
+            now_ns - slot->last_nack_ns >= nack_ns) {
+            char nack[FRAGMENT_NACK_SIZE];
+            size_t size = fragment_format_nack(slot, nack, sizeof(nack));
+            if (size > 0) {
+                state->nack_fn(nack, size, state->nack_arg);
+                state->stats.nacks++;
+            }
+            slot->last_nack_ns = now_ns;
+        }
+    }
+    return dropped;
+}
+
+/**
+ * @brief Receive datagrams until a message is complete. The messages sent without fragmentation are returned as they
+ * are, the fragments are reassembled and the complete message is copied to the buffer.
+ * @param transport
+ * @param state
+ * @param buffer
+ * @param buffer_size
+ * @param flags TRANSPORT_DONTWAIT
+ * @return The size of the message, or -1 on timeout/error
+ */
+int fragment_recv(Transport *transport, FragmentState *state, char *buffer, size_t buffer_size, int flags) {
+    release_delivered(state);
+
+    // Datagrams go straight to the buffer of the caller when it can hold a fragment
+    bool direct = buffer_size > state->options.fragment_size;
+    char *datagram = direct ? buffer : state->rx_datagram;
+    size_t datagram_size = direct ? buffer_size : TRANSPORT_MAX_MESSAGE_SIZE;
+
+    while (true) {
+        int rc = transport->ops->recv(transport, datagram, datagram_size, flags);
+        long long now_ns = (long long) get_monotonic_time_nanos();
+        if (rc < 0) {
+            fragment_collect(state, now_ns);
+            return -1;
+        }
+
+        if (!is_fragment(datagram, (size_t) rc)) {
+            if (direct) {
+                return rc;
+            }
+            size_t size = (size_t) rc < buffer_size ? (size_t) rc : buffer_size - 1;
+            memcpy(buffer, datagram, size);
+            buffer[size] = '\0';
+            return (int) size;
+        }
+
+        const char *message;
+        size_t message_size;
+        int complete = fragment_reassemble(state, datagram, (size_t) rc, now_ns, &message, &message_size);
+        fragment_collect(state, now_ns);
+        if (complete != 1) {
+            continue;
+        }
+
+        release_delivered(state);
+        if (message_size >= buffer_size) {
+            state->stats.oversized++;
+            logger(LOG_LEVEL_ERROR, "Reassembled message of %zu bytes larger than the receive buffer (%zu bytes)",
+                   message_size, buffer_size);
+            continue;
+        }
+        memcpy(buffer, message, message_size);
+        buffer[message_size] = '\0';
+        return (int) message_size;
+    }
+}
+
+/**
+ * @brief Receive a batch of messages. The fragments are reassembled in place: the complete messages point to their
+ * reassembly buffer, and they stay valid until the next receive on the transport.
+ * @param transport
+ * @param state
+ * @param messages
+ * @param max_count
+ * @param flags TRANSPORT_DONTWAIT
+ * @return The number of messages, or -1 on timeout/error
+ */
+int fragment_recv_batch(Transport *transport, FragmentState *state, TransportMessage *messages, size_t max_count,
+                        int flags) {
+    release_delivered(state);
+
+    while (true) {
+        int received;
+        if (transport->ops->recv_batch != NULL) {
+            received = transport->ops->recv_batch(transport, messages, max_count, flags);
+        } else {
+            received = transport->ops->recv(transport, state->rx_datagram, TRANSPORT_MAX_MESSAGE_SIZE, flags);
+            if (received >= 0) {
+                messages[0].group = transport->group;
+                messages[0].data = state->rx_datagram;
+                messages[0].size = (size_t) received;
+                memset(&messages[0].timestamps, 0, sizeof(TransportTimestamps));
+                received = 1;
+            }
+        }
+        long long now_ns = (long long) get_monotonic_time_nanos();
+        if (received < 0) {
+            fragment_collect(state, now_ns);
+            return -1;
+        }
+
+        // The complete messages replace their fragments in the array (out <= i)
+        int out = 0;
+        for (int i = 0; i < received; i++) {
+            if (!is_fragment(messages[i].data, messages[i].size)) {
+                messages[out++] = messages[i];
+                continue;
+            }
+            const char *message;
+            size_t message_size;
+            if (fragment_reassemble(state, messages[i].data, messages[i].size, now_ns, &message, &message_size) == 1) {
+                messages[out] = messages[i];
+                messages[out].data = message;
+                messages[out].size = message_size;
+                out++;
+            }
+        }
+        fragment_collect(state, now_ns);
+        if (out > 0) {
+            return out;
+        }
+    }
+}
+
+// ================================================= Transport ========================================================
+
+/**
+ * @brief Enable the fragmentation on a transport. The senders split the messages larger than a datagram, the receivers
+ * reassemble them (both must enable it, with the same or a larger max_message_size on the receiver).
+ * @param transport
+ * @param options NULL for the default options
+ * @return 0 on success, -1 on error
+ */
+int transport_enable_fragmentation(Transport *transport, const FragmentOptions *options) {
+    FragmentOptions defaults;
+    if (options == NULL) {
+        fragment_default_options(&defaults);
+        options = &defaults;
+    }
+    if (transport->fragments != NULL) {
+        return 0;
+    }
+
+    transport->fragments = create_fragment_state(options);
+    if (transport->fragments == NULL) {
+        return -1;
+    }
+    if (transport->role == TRANSPORT_SENDER) {
+        register_fragment_sender(transport->fragments);
+    }
+    return 0;
+}
+
+void transport_set_nack_handler(Transport *transport, FragmentNackFn nack_fn, void *arg) {
+    if (transport->fragments != NULL) {
+        transport->fragments->nack_fn = nack_fn;
+        transport->fragments->nack_arg = arg;
+    }
+}
+
+/**
+ * @brief Log the statistics of the fragmentation of a transport.
+ * @param transport
+ * @param role
+ */
+void report_fragment_stats(const Transport *transport, const char *role) {
+    const FragmentState *state = transport != NULL ? transport->fragments : NULL;
+    if (state == NULL) {
+        return;
+    }
+    const FragmentStats *stats = &state->stats;
+    if (transport->role == TRANSPORT_SENDER) {
+        logger(LOG_LEVEL_INFO2, "[%s] fragmentation: %" PRIu64 " messages in %" PRIu64 " fragments, %" PRIu64
+                                " fragments resent, %" PRIu64 " oversized", role, stats->fragmented,
+               stats->fragments_sent, __atomic_load_n(&stats->fragments_resent, __ATOMIC_RELAXED), stats->oversized);
+    } else {
+        logger(LOG_LEVEL_INFO2, "[%s] reassembly: %" PRIu64 " messages from %" PRIu64 " fragments, %" PRIu64
+                                " duplicates, %" PRIu64 " expired, %" PRIu64 " oversized, %" PRIu64 " NACKs", role,
+               stats->reassembled, stats->fragments_received, stats->duplicates, stats->expired, stats->oversized,
+               stats->nacks);
+    }
+}
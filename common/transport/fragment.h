@@ -0,0 +1,171 @@
+//  =====================================================================
+//  fragment.h
+//
+//  Fragmentation of the large messages into datagram sized fragments,
+//  reassembly with a timeout GC and selective retransmission (NACKs)
+//  =====================================================================
+
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "transport/transport.h"
+
+#define FRAGMENT_MAGIC 0x52464D46u              // "RFMF", never the start of a text frame
+#define FRAGMENT_MIN_SIZE 128                   // Smallest datagram (header included)
+#define FRAGMENT_DEFAULT_SIZE 1400              // Fits an Ethernet MTU with the IP, UDP and backend headers
+#define FRAGMENT_DEFAULT_MAX_MESSAGE (4 * 1024 * 1024)
+#define FRAGMENT_DEFAULT_PENDING 4
+#define FRAGMENT_DEFAULT_TIMEOUT_MS 1000
+#define FRAGMENT_DEFAULT_NACK_INTERVAL_MS 20
+#define FRAGMENT_DEFAULT_CACHE 8
+#define FRAGMENT_SEND_BATCH 64                  // Fragments moved with a single send_batch
+#define FRAGMENT_MAX_SENDERS 64                 // Sender transports that can answer the NACKs
+#define FRAGMENT_NACK_PREFIX "frag:"            // NACK: frag:<sender>:<seq>:<first>-<last>,<index>,...
+#define FRAGMENT_NACK_SIZE 1024
+#define FRAGMENT_DONE_HISTORY 16                // Reassembled messages remembered for dropping their duplicates
+
+// Header of every fragment, followed by the bytes [offset, offset + size) of the message
+typedef struct {
+    uint32_t magic;
+    uint32_t sender_id;                         // Random ID of the sender transport
+    uint64_t seq;                               // Fragmented message of the sender
+    uint32_t total_size;                        // Size of the whole message
+    uint32_t offset;
+    uint32_t index;
+    uint32_t count;                             // Fragments of the message
+} FragmentHeader;
+
+typedef struct FragmentOptions {
+    size_t fragment_size;                       // Max size of a datagram, header included
+    size_t max_message_size;                    // Largest message that can be reassembled
+    int max_pending;                            // Messages reassembled at the same time (per receiver)
+    int timeout_ms;                             // Incomplete messages are dropped after this time without fragments
+    int nack_interval_ms;                       // Missing fragments are asked again after this time (0: never)
+    int cache_messages;                         // Last messages kept by a sender for the retransmissions
+} FragmentOptions;
+
+typedef struct {
+    uint64_t fragmented;                        // Messages split by the sender
+    uint64_t fragments_sent;
+    uint64_t fragments_resent;
+    uint64_t fragments_received;
+    uint64_t duplicates;
+    uint64_t reassembled;
+    uint64_t expired;                           // Incomplete messages dropped by the GC
+    uint64_t oversized;                         // Messages larger than max_message_size, or than the caller buffer
+    uint64_t nacks;
+} FragmentStats;
+
+// Message being reassembled: the buffer and the bitmap are allocated once, when the fragmentation is enabled
+typedef struct {
+    bool active;
+    bool delivered;                             // Returned to the caller, released at the next receive
+    uint32_t sender_id;
+    uint64_t seq;
+    uint32_t total_size;
+    uint32_t count;
+    uint32_t received;
+    uint32_t highest;                           // Highest index received
+    uint64_t *bitmap;
+    char *buffer;
+    long long first_ns;
+    long long last_ns;                          // Arrival of the last fragment
+    long long last_nack_ns;
+} FragmentSlot;
+
+// Copy of a message recently fragmented, used to resend the fragments asked by the NACKs
+typedef struct {
+    uint64_t seq;
+    size_t size;
+    size_t capacity;
+    char *data;
+} FragmentCacheEntry;
+
+// Called with the NACK of an incomplete message (to be sent back to the sender, e.g. on the ACK channel)
+typedef void (*FragmentNackFn)(const char *nack, size_t size, void *arg);
+
+// Message recently reassembled (its late duplicates must not start a new reassembly)
+typedef struct {
+    uint32_t sender_id;
+    uint64_t seq;
+} FragmentDone;
+
+struct FragmentState {
+    FragmentOptions options;
+    FragmentStats stats;
+    // Sender side
+    uint32_t sender_id;
+    uint64_t next_seq;
+    char *tx_buffer;                            // Datagrams of a send batch (FRAGMENT_SEND_BATCH fragments)
+    pthread_mutex_t cache_mutex;                // The owner thread sends, a responder thread resends
+    FragmentCacheEntry *cache;
+    // Receiver side
+    FragmentSlot *slots;
+    uint32_t max_fragments;                     // Capacity of the bitmaps
+    FragmentDone done[FRAGMENT_DONE_HISTORY];
+    size_t done_next;
+    char *rx_datagram;                          // Datagrams received when the buffer of the caller is too small
+    FragmentNackFn nack_fn;
+    void *nack_arg;
+};
+
+// Split the messages of a transport larger than a datagram into fragments (NULL options for the defaults), the
+// receivers reassemble them: both sides must enable it
+int transport_enable_fragmentation(Transport *transport, const FragmentOptions *options);
+
+// Handler of the NACKs of a receiver (e.g. sent back on the ACK channel, answered with fragment_resend)
+void transport_set_nack_handler(Transport *transport, FragmentNackFn nack_fn, void *arg);
+
+// Fill the options with the default values
+void fragment_default_options(FragmentOptions *options);
+
+// Allocate the state (reassembly slots and retransmission cache), return NULL on error
+FragmentState *create_fragment_state(const FragmentOptions *options);
+
+void release_fragment_state(FragmentState *state);
+
+// Largest payload of a single fragment
+size_t fragment_payload_size(const FragmentState *state);
+
+// Number of fragments of a message (1 for the ones that are sent as they are)
+uint32_t fragment_count(const FragmentState *state, size_t size);
+
+// Check if a datagram is a fragment
+bool is_fragment(const char *data, size_t size);
+
+// Add a fragment, return 1 with the complete message (valid until the next call), 0 if incomplete, -1 if invalid
+int fragment_reassemble(FragmentState *state, const char *datagram, size_t size, long long now_ns,
+                        const char **message, size_t *message_size);
+
+// Drop the messages without fragments for timeout_ms and send the NACKs of the incomplete ones, return the dropped
+int fragment_collect(FragmentState *state, long long now_ns);
+
+// Write the NACK of the missing fragments of a slot, return its size (0 if nothing is missing)
+size_t fragment_format_nack(const FragmentSlot *slot, char *nack, size_t nack_size);
+
+// Split a message into fragments and send them (the message is cached for the retransmissions), return size or -1
+int fragment_send(Transport *transport, FragmentState *state, const char *group, const char *data, size_t size);
+
+// Receive datagrams until a message is complete (or the backend times out), return its size or -1
+int fragment_recv(Transport *transport, FragmentState *state, char *buffer, size_t buffer_size, int flags);
+
+// Receive a batch, the complete messages point to the reassembly buffers (valid until the next receive)
+int fragment_recv_batch(Transport *transport, FragmentState *state, TransportMessage *messages, size_t max_count,
+                        int flags);
+
+// Resend the fragments listed in a NACK, from the cache of the sender transport that sent them, return the count
+int fragment_resend(Transport *transport, const char *group, const char *nack);
+
+// Register or unregister a sender state, so its cache answers the NACKs received by any thread
+void register_fragment_sender(FragmentState *state);
+
+void unregister_fragment_sender(FragmentState *state);
+
+// Log the statistics of the fragmentation of a transport (nothing if it is not enabled)
+void report_fragment_stats(const Transport *transport, const char *role);
+
+#endif //FRAGMENT_H
@@ -0,0 +1,690 @@
+#define _GNU_SOURCE     // Needed for sendmmsg/recvmmsg
+
+#include "rawudp.h"
+#include "transport.h"
+#include "core/logger.h"
+#include "utils/time_utils.h"
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#endif
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * The ZMQ UDP path (RADIO/DISH) needs the draft API, adds its own framing and hands every datagram to an internal I/O
+ * thread. This transport talks to the kernel directly: every datagram is a RawUdpHeader followed by the payload.
+ * - Senders connect the socket to the receiver, and send the header and the payload with a single scatter/gather
+ *   syscall (no copy). rawudp_send_batch moves up to batch_size datagrams with one sendmmsg.
+ * - Receivers bind the socket, read up to batch_size datagrams with one recvmmsg and return them one by one from the
+ *   cache, dropping the datagrams of the groups they did not join.
+ * On platforms without sendmmsg/recvmmsg the batches fall back to one syscall per datagram.
+ * With a multicast address (224.0.0.0/4) every receiver binding it joins the multicast group, so a single send reaches
+ * all the receivers (e.g. many servers subscribed to one client). The multicast loop is enabled on the senders, so
+ * receivers on the same host get the datagrams too.
+ * Every header carries the time of the send call (CLOCK_REALTIME, ns). With rawudp_enable_timestamping (Linux
+ * SO_TIMESTAMPING) the receivers also get the time at which the kernel (or the NIC, when it supports hardware
+ * timestamps) received every datagram, read from the ancillary data of the same recvmmsg; the senders get the time at
+ * which the kernel handed every datagram to the device, from the error queue of the socket. So the one-way latency can
+ * be split in the time spent in the application before the send, in the stacks and on the wire, at ns resolution.
+ */
+
+#define RAWUDP_SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+#define RAWUDP_MULTICAST_TTL 1      // Multicast datagrams do not leave the local network
+
+#ifndef __linux__
+// Same layout as the Linux definition, used only as storage for the one-datagram-per-syscall fallback
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#endif
+
+/**
+ * @brief Check if a connection string uses the raw UDP transport.
+ * @param connection
+ * @return
+ */
+bool is_rawudp_connection(const char *connection) {
+    return connection != NULL && strncmp(connection, RAWUDP_SCHEME, strlen(RAWUDP_SCHEME)) == 0;
+}
+
+/**
+ * @brief Resolve a connection string (<scheme>://<ip>:<port>) into an IPv4 address.
+ * @param connection
+ * @param address
+ * @return 0 on success, -1 otherwise
+ */
+static int resolve_connection(const char *connection, struct sockaddr_in *address) {
+    const char *host_start = strstr(connection, "://");
+    host_start = host_start != NULL ? host_start + 3 : connection;
+
+    const char *port_start = strrchr(host_start, ':');
+    if (port_start == NULL) {
+        logger(LOG_LEVEL_ERROR, "Missing port in connection: %s", connection);
+        return -1;
+    }
+
+    char host[256];
+    size_t host_len = (size_t) (port_start - host_start);
+    if (host_len == 0 || host_len >= sizeof(host)) {
+        logger(LOG_LEVEL_ERROR, "Invalid host in connection: %s", connection);
+        return -1;
+    }
+    memcpy(host, host_start, host_len);
+    host[host_len] = '\0';
+
+    memset(address, 0, sizeof(struct sockaddr_in));
+    address->sin_family = AF_INET;
+    address->sin_port = htons((uint16_t) strtol(port_start + 1, NULL, 10));
+
+    if (strcmp(host, "*") == 0) {
+        address->sin_addr.s_addr = htonl(INADDR_ANY);
+        return 0;
+    }
+    if (inet_pton(AF_INET, host, &address->sin_addr) == 1) {
+        return 0;
+    }
+
+    // Fall back to name resolution (e.g. localhost)
+    struct addrinfo hints = {0}, *result = NULL;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, NULL, &hints, &result) != 0 || result == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to resolve host: %s", host);
+        return -1;
+    }
+    address->sin_addr = ((struct sockaddr_in *) result->ai_addr)->sin_addr;
+    freeaddrinfo(result);
+    return 0;
+}
+
+/**
+ * @brief Fill a datagram header, the send time is set to now.
+ * @param header
+ * @param group
+ * @param size
+ */
+void rawudp_fill_header(RawUdpHeader *header, const char *group, size_t size) {
+    header->magic = htons(RAWUDP_MAGIC);
+    header->length = htons((uint16_t) size);
+    memset(header->group, 0, RAWUDP_GROUP_SIZE);
+    if (group != NULL) {
+        strncpy(header->group, group, RAWUDP_GROUP_SIZE - 1);
+    }
+
+    uint64_t now = (uint64_t) get_current_time_nanos();    // CLOCK_REALTIME, the clock of the kernel timestamps
+    header->send_ns_high = htonl((uint32_t) (now >> 32));
+    header->send_ns_low = htonl((uint32_t) now);
+}
+
+/**
+ * @brief Allocate the receive cache of a socket.
+ * @param socket
+ * @return 0 on success, -1 otherwise
+ */
+static int init_receive_cache(RawUdpSocket *socket) {
+    size_t batch = socket->batch_size;
+    socket->rx_storage = malloc(batch * RAWUDP_MAX_FRAME_SIZE);
+    struct mmsghdr *msgs = calloc(batch, sizeof(struct mmsghdr));
+    struct iovec *iov = calloc(batch, sizeof(struct iovec));
+
+    if (socket->rx_storage == NULL || msgs == NULL || iov == NULL) {
+        free(socket->rx_storage);
+        free(msgs);
+        free(iov);
+        socket->rx_storage = NULL;
+        return -1;
+    }
+
+    if (socket->timestamping) {
+        socket->rx_control = malloc(batch * RAWUDP_CONTROL_SIZE);
+        if (socket->rx_control == NULL) {
+            free(socket->rx_storage);
+            free(msgs);
+            free(iov);
+            socket->rx_storage = NULL;
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < batch; i++) {
+        iov[i].iov_base = socket->rx_storage + i * RAWUDP_MAX_FRAME_SIZE;
+        iov[i].iov_len = RAWUDP_MAX_FRAME_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        if (socket->rx_control != NULL) {
+            msgs[i].msg_hdr.msg_control = socket->rx_control + i * RAWUDP_CONTROL_SIZE;
+            msgs[i].msg_hdr.msg_controllen = RAWUDP_CONTROL_SIZE;
+        }
+    }
+
+    socket->rx_msgs = msgs;
+    socket->rx_iov = iov;
+    socket->rx_count = 0;
+    socket->rx_next = 0;
+    return 0;
+}
+
+/**
+ * @brief Create a raw UDP socket.
+ * @param connection rawudp://<ip>:<port>
+ * @param timeout Receive timeout in milliseconds
+ * @param group NULL for sending sockets, the group to join for receiving sockets
+ * @param batch_size Max datagrams moved per syscall (0 for the default, at most RAWUDP_MAX_BATCH_SIZE)
+ * @return The socket, or NULL on failure
+ */
+RawUdpSocket *rawudp_create(const char *connection, int timeout, const char *group, size_t batch_size) {
+    struct sockaddr_in address;
+    if (resolve_connection(connection, &address) != 0) {
+        return NULL;
+    }
+
+    RawUdpSocket *socket_ptr = calloc(1, sizeof(RawUdpSocket));
+    if (socket_ptr == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for raw UDP socket");
+        return NULL;
+    }
+    if (batch_size > RAWUDP_MAX_BATCH_SIZE) {
+        logger(LOG_LEVEL_WARN, "Raw UDP batch size %zu reduced to %d", batch_size, RAWUDP_MAX_BATCH_SIZE);
+        batch_size = RAWUDP_MAX_BATCH_SIZE;
+    }
+    socket_ptr->batch_size = batch_size > 0 ? batch_size : RAWUDP_DEFAULT_BATCH_SIZE;
+    socket_ptr->is_receiver = group != NULL;
+    socket_ptr->is_multicast = IN_MULTICAST(ntohl(address.sin_addr.s_addr));
+
+    socket_ptr->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_ptr->fd < 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to [CREATE] raw UDP socket: %s", strerror(errno));
+        free(socket_ptr);
+        return NULL;
+    }
+
+    // Bigger kernel buffers, so that bursts are not dropped while the receiver is busy (best effort)
+    int buffer_size = RAWUDP_SOCKET_BUFFER_SIZE;
+    setsockopt(socket_ptr->fd, SOL_SOCKET, socket_ptr->is_receiver ? SO_RCVBUF : SO_SNDBUF,
+               &buffer_size, sizeof(buffer_size));
+
+    if (timeout > 0) {
+        struct timeval tv = {.tv_sec = timeout / 1000, .tv_usec = (timeout % 1000) * 1000};
+        setsockopt(socket_ptr->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    int rc;
+    if (socket_ptr->is_receiver) {
+        // Needed also by multicast, where every receiver of the host binds the same address
+        int reuse = 1;
+        setsockopt(socket_ptr->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        rc = bind(socket_ptr->fd, (struct sockaddr *) &address, sizeof(address));
+        if (rc == 0 && socket_ptr->is_multicast) {
+            struct ip_mreq membership = {.imr_multiaddr = address.sin_addr};
+            membership.imr_interface.s_addr = htonl(INADDR_ANY);
+            rc = setsockopt(socket_ptr->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership));
+        }
+        if (rc == 0) {
+            // The receive cache is allocated on the first receive (backends reading the fd directly never use it)
+            strncpy(socket_ptr->group, group, RAWUDP_GROUP_SIZE - 1);
+        }
+    } else {
+        if (socket_ptr->is_multicast) {
+            unsigned char loop = 1, ttl = RAWUDP_MULTICAST_TTL;
+            setsockopt(socket_ptr->fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+            setsockopt(socket_ptr->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        }
+
+        // Connected sockets skip the route lookup on every send
+        rc = connect(socket_ptr->fd, (struct sockaddr *) &address, sizeof(address));
+    }
+
+    if (rc != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to [%s] raw UDP socket %s: %s",
+               socket_ptr->is_receiver ? "BIND" : "CONNECT", connection, strerror(errno));
+        close(socket_ptr->fd);
+        free(socket_ptr);
+        return NULL;
+    }
+
+    logger(LOG_LEVEL_INFO, "Successfully created and configured [raw UDP socket with connection: %s]", connection);
+    return socket_ptr;
+}
+
+/**
+ * @brief Enable the kernel timestamps of the datagrams (SO_TIMESTAMPING). Receivers get the software receive timestamp
+ * of the kernel, or the hardware one when the NIC provides it (hardware timestamps must be enabled on the interface,
+ * e.g. with hwstamp_ctl). Senders get the software send timestamp of the kernel through the error queue.
+ * @param socket
+ * @return 0 on success, -1 if the platform does not support it
+ */
+int rawudp_enable_timestamping(RawUdpSocket *socket) {
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+    unsigned int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+    if (socket->is_receiver) {
+        flags |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE;
+    } else {
+        // OPT_ID numbers the datagrams, OPT_TSONLY does not loop the payload back in the error queue
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    }
+    if (setsockopt(socket->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+        logger(LOG_LEVEL_WARN, "Failed to enable SO_TIMESTAMPING: %s", strerror(errno));
+        return -1;
+    }
+
+    if (!socket->is_receiver && socket->tx_send_ns == NULL) {
+        socket->tx_send_ns = calloc(RAWUDP_TX_TRACKED, sizeof(uint64_t));
+        if (socket->tx_send_ns == NULL) {
+            logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the send timestamps");
+            return -1;
+        }
+        socket->tx_next_id = 0;
+    }
+
+    // The receive cache is allocated again with the space for the ancillary data
+    free(socket->rx_storage);
+    free(socket->rx_msgs);
+    free(socket->rx_iov);
+    free(socket->rx_control);
+    socket->rx_storage = NULL;
+    socket->rx_msgs = NULL;
+    socket->rx_iov = NULL;
+    socket->rx_control = NULL;
+    socket->rx_count = 0;
+    socket->rx_next = 0;
+
+    socket->timestamping = true;
+    return 0;
+#else
+    (void) socket;
+    logger(LOG_LEVEL_WARN, "SO_TIMESTAMPING is not supported on this platform");
+    return -1;
+#endif
+}
+
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+
+/**
+ * @brief Read the SO_TIMESTAMPING ancillary data of a message.
+ * @param hdr
+ * @param hardware Set to true if the timestamp comes from the NIC
+ * @param error Filled with the extended error of the error queue (NULL for received datagrams)
+ * @return The timestamp in ns, 0 if not present
+ */
+static uint64_t read_timestamp(struct msghdr *hdr, bool *hardware, struct sock_extended_err *error) {
+    uint64_t timestamp = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+            // ts[0] software, ts[2] raw hardware
+            struct timespec ts[3];
+            memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+            int index = ts[2].tv_sec != 0 || ts[2].tv_nsec != 0 ? 2 : 0;
+            timestamp = (uint64_t) ts[index].tv_sec * 1000000000ULL + (uint64_t) ts[index].tv_nsec;
+            *hardware = index == 2;
+        } else if (error != NULL && cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) {
+            memcpy(error, CMSG_DATA(cmsg), sizeof(struct sock_extended_err));
+        }
+    }
+    return timestamp;
+}
+
+#endif
+
+/**
+ * @brief Remember the send time of the datagrams just sent, and collect the kernel send timestamps.
+ * @param socket
+ * @param send_ns
+ * @param count
+ */
+static void track_sent(RawUdpSocket *socket, uint64_t send_ns, size_t count) {
+    if (socket->tx_send_ns == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        socket->tx_send_ns[socket->tx_next_id++ % RAWUDP_TX_TRACKED] = send_ns;
+    }
+    rawudp_collect_tx_timestamps(socket);
+}
+
+/**
+ * @brief Collect the kernel send timestamps queued in the error queue of a sender, without blocking. The time between
+ * the send call and the kernel timestamp is the cost of the sender stack (syscall, UDP/IP, qdisc).
+ * @param socket
+ */
+void rawudp_collect_tx_timestamps(RawUdpSocket *socket) {
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+    if (!socket->timestamping || socket->is_receiver) {
+        return;
+    }
+
+    char control[RAWUDP_CONTROL_SIZE];
+    while (true) {
+        struct msghdr hdr = {0};
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+
+        socket->syscalls++;
+        if (recvmsg(socket->fd, &hdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;  // Nothing else queued
+        }
+
+        bool hardware = false;
+        struct sock_extended_err error = {0};
+        uint64_t timestamp = read_timestamp(&hdr, &hardware, &error);
+        if (timestamp == 0 || error.ee_origin != SO_EE_ORIGIN_TIMESTAMPING) {
+            continue;
+        }
+
+        // ee_data is the number of the datagram (32 bit counter, RAWUDP_TX_TRACKED divides 2^32)
+        uint64_t send_ns = socket->tx_send_ns[error.ee_data % RAWUDP_TX_TRACKED];
+        if (send_ns != 0 && timestamp >= send_ns) {
+            socket->tx_stack_ns += timestamp - send_ns;
+            socket->tx_timestamps++;
+        }
+    }
+#else
+    (void) socket;
+#endif
+}
+
+/**
+ * @brief Send a single message with a group.
+ * @param socket
+ * @param group
+ * @param msg
+ * @param size
+ * @param flags TRANSPORT_DONTWAIT is supported
+ * @return The number of bytes of the payload sent, or -1 on failure
+ */
+int rawudp_send_group(RawUdpSocket *socket, const char *group, const char *msg, size_t size, int flags) {
+    if (size > RAWUDP_MAX_FRAME_SIZE - sizeof(RawUdpHeader)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    RawUdpHeader header;
+    rawudp_fill_header(&header, group, size);
+
+    struct iovec iov[2] = {
+            {.iov_base = &header, .iov_len = sizeof(header)},
+            {.iov_base = (void *) msg, .iov_len = size}
+    };
+    struct msghdr hdr = {0};
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = 2;
+
+    int send_flags = (flags & TRANSPORT_DONTWAIT) ? MSG_DONTWAIT : 0;
+    ssize_t rc = sendmsg(socket->fd, &hdr, send_flags);
+    socket->syscalls++;
+    if (rc < 0 && errno == ECONNREFUSED) {
+        // Error of a previous datagram (receiver not bound yet), reported on this send: retry once
+        rc = sendmsg(socket->fd, &hdr, send_flags);
+        socket->syscalls++;
+    }
+    if (rc >= 0 && socket->timestamping) {
+        track_sent(socket, ((uint64_t) ntohl(header.send_ns_high) << 32) | ntohl(header.send_ns_low), 1);
+    }
+    return rc < 0 ? -1 : (int) size;
+}
+
+/**
+ * @brief Send up to count messages with a group, batch_size datagrams per syscall.
+ * @param socket
+ * @param group
+ * @param msgs
+ * @param sizes
+ * @param count
+ * @return The number of messages sent, or -1 if nothing could be sent (errno EMSGSIZE if a message is too large)
+ */
+int rawudp_send_batch(RawUdpSocket *socket, const char *group, const char **msgs, const size_t *sizes, size_t count) {
+    // The length field of the header has 16 bits: a larger message would be cut (checked before sending any)
+    for (size_t i = 0; i < count; i++) {
+        if (sizes[i] > RAWUDP_MAX_FRAME_SIZE - sizeof(RawUdpHeader)) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+    }
+
+    RawUdpHeader header;
+    rawudp_fill_header(&header, group, 0);
+
+    size_t sent = 0;
+    while (sent < count) {
+        size_t batch = count - sent < socket->batch_size ? count - sent : socket->batch_size;
+
+        RawUdpHeader headers[batch];
+        struct iovec iov[batch][2];
+
+#ifdef __linux__
+        struct mmsghdr batch_msgs[batch];
+        memset(batch_msgs, 0, sizeof(batch_msgs));
+#endif
+
+        for (size_t i = 0; i < batch; i++) {
+            headers[i] = header;
+            headers[i].length = htons((uint16_t) sizes[sent + i]);
+            iov[i][0].iov_base = &headers[i];
+            iov[i][0].iov_len = sizeof(RawUdpHeader);
+            iov[i][1].iov_base = (void *) msgs[sent + i];
+            iov[i][1].iov_len = sizes[sent + i];
+#ifdef __linux__
+            batch_msgs[i].msg_hdr.msg_iov = iov[i];
+            batch_msgs[i].msg_hdr.msg_iovlen = 2;
+#endif
+        }
+
+#ifdef __linux__
+        int rc = sendmmsg(socket->fd, batch_msgs, (unsigned int) batch, 0);
+        socket->syscalls++;
+        if (rc < 0 && errno == ECONNREFUSED) {
+            // Error of a previous datagram (receiver not bound yet), reported on this send: retry once
+            rc = sendmmsg(socket->fd, batch_msgs, (unsigned int) batch, 0);
+            socket->syscalls++;
+        }
+        if (rc <= 0) {
+            break;
+        }
+        sent += (size_t) rc;
+#else
+        for (size_t i = 0; i < batch; i++) {
+            struct msghdr hdr = {0};
+            hdr.msg_iov = iov[i];
+            hdr.msg_iovlen = 2;
+            socket->syscalls++;
+            ssize_t rc = sendmsg(socket->fd, &hdr, 0);
+            if (rc < 0 && errno == ECONNREFUSED) {
+                rc = sendmsg(socket->fd, &hdr, 0);
+                socket->syscalls++;
+            }
+            if (rc < 0) {
+                return sent > 0 ? (int) sent : -1;
+            }
+            sent++;
+        }
+#endif
+    }
+
+    if (sent > 0 && socket->timestamping) {
+        track_sent(socket, ((uint64_t) ntohl(header.send_ns_high) << 32) | ntohl(header.send_ns_low), sent);
+    }
+    return sent > 0 ? (int) sent : -1;
+}
+
+/**
+ * @brief Fill the receive cache with one batch of datagrams.
+ * @param socket
+ * @param flags
+ * @return The number of datagrams read, or -1 on timeout/error
+ */
+static int fill_receive_cache(RawUdpSocket *socket, int flags) {
+    if (socket->rx_storage == NULL && init_receive_cache(socket) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the receive cache");
+        return -1;
+    }
+
+    struct mmsghdr *msgs = (struct mmsghdr *) socket->rx_msgs;
+    socket->rx_count = 0;
+    socket->rx_next = 0;
+    socket->syscalls++;
+
+    if (socket->rx_control != NULL) {
+        // The kernel shrinks msg_controllen to the ancillary data actually written
+        for (size_t i = 0; i < socket->batch_size; i++) {
+            msgs[i].msg_hdr.msg_controllen = RAWUDP_CONTROL_SIZE;
+        }
+    }
+
+#ifdef __linux__
+    // MSG_WAITFORONE: block (up to the timeout) for the first datagram, then take only what is already queued
+    int rc = recvmmsg(socket->fd, msgs, (unsigned int) socket->batch_size,
+                      (flags & TRANSPORT_DONTWAIT) ? MSG_DONTWAIT : MSG_WAITFORONE, NULL);
+#else
+    ssize_t size = recvmsg(socket->fd, &msgs[0].msg_hdr, (flags & TRANSPORT_DONTWAIT) ? MSG_DONTWAIT : 0);
+    int rc = size < 0 ? -1 : 1;
+    if (rc == 1) msgs[0].msg_len = (unsigned int) size;
+#endif
+    if (rc <= 0) {
+        return -1;
+    }
+
+    socket->rx_count = (size_t) rc;
+    return rc;
+}
+
+/**
+ * @brief Decode a datagram read from the socket.
+ * @param frame Header and payload
+ * @param frame_size
+ * @param group The joined group (the datagrams of the other groups are dropped)
+ * @param datagram Filled with the group and the payload (pointing inside frame)
+ * @return true if the datagram is valid and belongs to the group
+ */
+bool rawudp_decode(const char *frame, size_t frame_size, const char *group, RawUdpDatagram *datagram) {
+    if (frame_size < sizeof(RawUdpHeader)) {
+        return false;
+    }
+
+    const RawUdpHeader *header = (const RawUdpHeader *) frame;
+    size_t payload_size = ntohs(header->length);
+    if (ntohs(header->magic) != RAWUDP_MAGIC || payload_size > frame_size - sizeof(RawUdpHeader)) {
+        return false;   // Not one of our datagrams (or truncated)
+    }
+    if (strncmp(header->group, group, RAWUDP_GROUP_SIZE) != 0) {
+        return false;   // Group not joined
+    }
+
+    datagram->group = header->group;
+    datagram->data = frame + sizeof(RawUdpHeader);
+    datagram->size = payload_size;
+    datagram->send_ns = ((uint64_t) ntohl(header->send_ns_high) << 32) | ntohl(header->send_ns_low);
+    datagram->kernel_rx_ns = 0;
+    datagram->hardware_timestamp = false;
+    return true;
+}
+
+/**
+ * @brief Take the next valid datagram from the receive cache.
+ * @param socket
+ * @param datagram
+ * @return true if a datagram was available
+ */
+static bool next_cached_datagram(RawUdpSocket *socket, RawUdpDatagram *datagram) {
+    struct mmsghdr *msgs = (struct mmsghdr *) socket->rx_msgs;
+
+    while (socket->rx_next < socket->rx_count) {
+        size_t index = socket->rx_next++;
+        const char *frame = socket->rx_storage + index * RAWUDP_MAX_FRAME_SIZE;
+        if (rawudp_decode(frame, msgs[index].msg_len, socket->group, datagram)) {
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+            if (socket->rx_control != NULL) {
+                datagram->kernel_rx_ns = read_timestamp(&msgs[index].msg_hdr, &datagram->hardware_timestamp, NULL);
+            }
+#endif
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Receive a single message.
+ * @param socket
+ * @param buffer
+ * @param buffer_size
+ * @param flags TRANSPORT_DONTWAIT is supported
+ * @return The size of the message, or -1 on timeout/error
+ */
+int rawudp_receive(RawUdpSocket *socket, char *buffer, size_t buffer_size, int flags) {
+    RawUdpDatagram datagram;
+    while (!next_cached_datagram(socket, &datagram)) {
+        if (fill_receive_cache(socket, flags) < 0) {
+            return -1;
+        }
+    }
+
+    size_t size = datagram.size < buffer_size - 1 ? datagram.size : buffer_size - 1;
+    memcpy(buffer, datagram.data, size);
+    buffer[size] = '\0';
+
+    if (socket->timestamping) {
+        socket->last_rx = datagram;
+        socket->last_rx_user_ns = (uint64_t) get_current_time_nanos();
+    }
+    return (int) size;
+}
+
+/**
+ * @brief Receive up to max_count datagrams without copying them.
+ * @param socket
+ * @param datagrams
+ * @param max_count
+ * @param flags TRANSPORT_DONTWAIT is supported
+ * @return The number of datagrams, or -1 on timeout/error
+ */
+int rawudp_receive_batch(RawUdpSocket *socket, RawUdpDatagram *datagrams, size_t max_count, int flags) {
+    size_t count = 0;
+
+    // Only the datagrams already in the cache, or one new batch
+    while (count == 0) {
+        while (count < max_count && next_cached_datagram(socket, &datagrams[count])) {
+            count++;
+        }
+        if (count > 0) {
+            break;
+        }
+        if (fill_receive_cache(socket, flags) < 0) {
+            return -1;
+        }
+    }
+    return (int) count;
+}
+
+/**
+ * @brief Close the socket and release its resources.
+ * @param socket
+ */
+void rawudp_close(RawUdpSocket *socket) {
+    if (socket == NULL) {
+        return;
+    }
+    if (socket->tx_timestamps > 0) {
+        logger(LOG_LEVEL_INFO, "Sender stack (send call -> kernel TX timestamp): avg %.0f ns over %llu datagrams",
+               (double) socket->tx_stack_ns / (double) socket->tx_timestamps,
+               (unsigned long long) socket->tx_timestamps);
+    }
+    close(socket->fd);
+    free(socket->rx_storage);
+    free(socket->rx_msgs);
+    free(socket->rx_iov);
+    free(socket->rx_control);
+    free(socket->tx_send_ns);
+    free(socket);
+}
@@ -0,0 +1,106 @@
+//  =====================================================================
+//  rawudp.h
+//
+//  Native UDP transport (plain sockets, sendmmsg/recvmmsg batching)
+//  =====================================================================
+
+#ifndef RAWUDP_H
+#define RAWUDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#define RAWUDP_SCHEME "rawudp://"
+#define RAWUDP_MAGIC 0x524D             // "RM"
+#define RAWUDP_GROUP_SIZE 16            // Same limit as ZMQ groups (15 chars + null terminator)
+#define RAWUDP_MAX_FRAME_SIZE 65536     // Max size of a datagram (header included)
+#define RAWUDP_DEFAULT_BATCH_SIZE 32    // Datagrams moved per syscall
+#define RAWUDP_MAX_BATCH_SIZE 256       // Bound of batch_size (the send arrays of a batch are on the stack)
+#define RAWUDP_CONTROL_SIZE 256         // Ancillary data of a received datagram (kernel timestamps)
+#define RAWUDP_TX_TRACKED 1024          // Send times kept for matching the kernel TX timestamps
+
+/**
+ * Header carried in front of every datagram. It replaces the ZMQ framing and carries the group, so that a receiver
+ * can drop the datagrams of the groups it did not join.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t magic;                     // RAWUDP_MAGIC (network byte order)
+    uint16_t length;                    // Payload length (network byte order)
+    char group[RAWUDP_GROUP_SIZE];      // Group of the datagram (null padded)
+    uint32_t send_ns_high;              // Time of the send call in ns, CLOCK_REALTIME (network byte order)
+    uint32_t send_ns_low;
+} RawUdpHeader;
+
+// Datagram returned by rawudp_receive_batch (data points to the internal buffers of the socket)
+typedef struct {
+    const char *group;
+    const char *data;
+    size_t size;
+    uint64_t send_ns;                   // Time of the send call on the sender (from the header)
+    uint64_t kernel_rx_ns;              // Kernel (or NIC) receive timestamp, 0 without timestamping
+    bool hardware_timestamp;            // kernel_rx_ns comes from the NIC
+} RawUdpDatagram;
+
+typedef struct {
+    int fd;
+    bool is_receiver;
+    bool is_multicast;                  // Receivers joined the multicast group of the address
+    char group[RAWUDP_GROUP_SIZE];      // Joined group (receivers only)
+    size_t batch_size;
+
+    // Receive cache: datagrams read with one recvmmsg and returned one by one
+    char *rx_storage;
+    void *rx_msgs;                      // struct mmsghdr[batch_size]
+    void *rx_iov;                       // struct iovec[batch_size]
+    size_t rx_count;
+    size_t rx_next;
+
+    // SO_TIMESTAMPING (see rawudp_enable_timestamping)
+    bool timestamping;
+    char *rx_control;                   // Ancillary data of the receive cache (RAWUDP_CONTROL_SIZE per datagram)
+    RawUdpDatagram last_rx;             // Last datagram returned by rawudp_receive (only the timestamps are valid)
+    uint64_t last_rx_user_ns;           // Time at which rawudp_receive returned it
+    uint64_t *tx_send_ns;               // Send time of the datagrams in flight, indexed by datagram number
+    uint64_t tx_next_id;                // Number of datagrams sent (kernel counter of SOF_TIMESTAMPING_OPT_ID)
+    uint64_t tx_stack_ns;               // Sum of the sender stack times (send call -> kernel TX timestamp)
+    uint64_t tx_timestamps;             // Number of kernel TX timestamps collected
+
+    uint64_t syscalls;                  // Send/receive syscalls issued on the socket
+} RawUdpSocket;
+
+// Check if a connection string uses the raw UDP transport (rawudp://<ip>:<port>)
+bool is_rawudp_connection(const char *connection);
+
+// Create a raw UDP socket: with a group it binds and receives, without a group it connects and sends
+RawUdpSocket *rawudp_create(const char *connection, int timeout, const char *group, size_t batch_size);
+
+// Send a single message with a group (flags: TRANSPORT_DONTWAIT)
+int rawudp_send_group(RawUdpSocket *socket, const char *group, const char *msg, size_t size, int flags);
+
+// Send up to count messages with a group, using one sendmmsg for each batch
+int rawudp_send_batch(RawUdpSocket *socket, const char *group, const char **msgs, const size_t *sizes, size_t count);
+
+// Receive a single message (null terminated, flags: TRANSPORT_DONTWAIT), datagrams are read in batches and cached
+int rawudp_receive(RawUdpSocket *socket, char *buffer, size_t buffer_size, int flags);
+
+// Receive up to max_count datagrams without copying them (valid until the next receive on the same socket)
+int rawudp_receive_batch(RawUdpSocket *socket, RawUdpDatagram *datagrams, size_t max_count, int flags);
+
+// Enable SO_TIMESTAMPING: kernel/NIC receive timestamps on receivers, kernel send timestamps on senders
+int rawudp_enable_timestamping(RawUdpSocket *socket);
+
+// Collect the kernel send timestamps from the error queue of a sender (called after every send with timestamping)
+void rawudp_collect_tx_timestamps(RawUdpSocket *socket);
+
+// Fill the header of a datagram (the send time is set to now)
+void rawudp_fill_header(RawUdpHeader *header, const char *group, size_t size);
+
+// Decode a datagram read from the socket, return false if it is not valid or it belongs to another group
+bool rawudp_decode(const char *frame, size_t frame_size, const char *group, RawUdpDatagram *datagram);
+
+// Close the socket and release its resources
+void rawudp_close(RawUdpSocket *socket);
+
+#endif //RAWUDP_H
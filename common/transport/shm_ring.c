@@ -0,0 +1,351 @@
+#define _GNU_SOURCE
+
+#include "shm_ring.h"
+#include "core/logger.h"
+#include "utils/time_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * A POSIX shared memory object (/dev/shm/realmq-<ip>-<port>) holds a ring of fixed size slots, every slot carries the
+ * frame of rawudp (RawUdpHeader + payload), so the group semantics are the same of the UDP transports.
+ * - The producer copies the frame in the slot at tail and publishes it by advancing tail, the consumer reads the slots
+ *   between head and tail and releases them by advancing head. No lock is taken between the two sides: head and tail
+ *   are atomics on different cache lines (single producer, single consumer). Several producers of the same process or
+ *   of different processes (e.g. the client threads) are serialized by a spinlock in the ring, held only for the copy.
+ * - An idle consumer spins SHM_RING_SPIN_COUNT times, then it sets consumer_waiting and sleeps on a futex in the
+ *   shared memory. Producers issue the futex wake only when the consumer is sleeping, so a busy consumer costs no
+ *   syscall at all on either side. Without futexes (not Linux) the consumer sleeps SHM_RING_SLEEP_NS between polls.
+ * Both sides create the object if it does not exist yet, so the start order does not matter. The consumer drops the
+ * messages left by a previous run when it opens the ring, and removes the object when it closes it.
+ * The responder traffic (ACKs) uses the ring of the responder address, so every direction has its own ring.
+ */
+
+#define SHM_RING_SPIN_COUNT 2000            // Polls of an empty ring before sleeping
+#define SHM_RING_SLEEP_NS 50000             // Poll interval without futexes
+#define SHM_RING_STATE_INITIALIZING 1
+#define SHM_RING_STATE_READY 2
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * @brief Get the remaining time before a deadline.
+ * @param deadline_ms Deadline (0 for no deadline)
+ * @return The remaining ms, -1 for no deadline, 0 if expired
+ */
+static int remaining_ms(uint64_t deadline_ms) {
+    if (deadline_ms == 0) {
+        return -1;
+    }
+    uint64_t now = get_monotonic_time_nanos() / 1000000;
+    return now >= deadline_ms ? 0 : (int) (deadline_ms - now);
+}
+
+/**
+ * @brief Build the name of the shared memory object of a connection (shm://<ip>:<port> -> /realmq-<ip>-<port>).
+ * @param connection
+ * @param name
+ * @return 0 on success, -1 otherwise
+ */
+static int ring_name(const char *connection, char name[SHM_RING_NAME_SIZE]) {
+    const char *endpoint = strstr(connection, "://");
+    endpoint = endpoint != NULL ? endpoint + 3 : connection;
+    if (*endpoint == '\0') {
+        logger(LOG_LEVEL_ERROR, "Invalid shared memory connection: %s", connection);
+        return -1;
+    }
+
+    int written = snprintf(name, SHM_RING_NAME_SIZE, "/realmq-%s", endpoint);
+    if (written < 0 || written >= SHM_RING_NAME_SIZE) {
+        logger(LOG_LEVEL_ERROR, "Shared memory connection too long: %s", connection);
+        return -1;
+    }
+    for (char *c = name + 1; *c != '\0'; c++) {
+        if (*c == '/' || *c == ':' || *c == '*') *c = '-';
+    }
+    return 0;
+}
+
+#ifdef __linux__
+
+static void ring_wait(ShmRing *ring, uint32_t seq, int timeout) {
+    struct timespec ts = {.tv_sec = timeout / 1000, .tv_nsec = (long) (timeout % 1000) * 1000000};
+    // Not FUTEX_PRIVATE: the word is shared with other processes
+    syscall(SYS_futex, &ring->memory->header.wakeup_seq, FUTEX_WAIT, seq, timeout >= 0 ? &ts : NULL, NULL, 0);
+    ring->syscalls++;
+}
+
+static void ring_wake(ShmRing *ring) {
+    atomic_fetch_add(&ring->memory->header.wakeup_seq, 1);
+    syscall(SYS_futex, &ring->memory->header.wakeup_seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+    ring->syscalls++;
+}
+
+#else
+
+static void ring_wait(ShmRing *ring, uint32_t seq, int timeout) {
+    (void) seq;
+    (void) timeout;
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = SHM_RING_SLEEP_NS};
+    nanosleep(&ts, NULL);
+    ring->syscalls++;
+}
+
+static void ring_wake(ShmRing *ring) {
+    (void) ring;    // The consumer polls
+}
+
+#endif
+
+/**
+ * @brief Open the ring of a connection, creating it if needed.
+ * @param connection shm://<ip>:<port> (the address only names the ring, nothing is bound)
+ * @param group The group to receive (consumer), NULL for producers
+ * @return The ring, or NULL on failure
+ */
+ShmRing *shm_ring_open(const char *connection, const char *group) {
+    ShmRing *ring = calloc(1, sizeof(ShmRing));
+    if (ring == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for shared memory ring");
+        return NULL;
+    }
+    if (ring_name(connection, ring->name) != 0) {
+        free(ring);
+        return NULL;
+    }
+    ring->is_consumer = group != NULL;
+    if (group != NULL) {
+        strncpy(ring->group, group, RAWUDP_GROUP_SIZE - 1);
+    }
+
+    int fd = shm_open(ring->name, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        logger(LOG_LEVEL_ERROR, "Failed to open shared memory %s: %s", ring->name, strerror(errno));
+        free(ring);
+        return NULL;
+    }
+    // Same size on both sides, the new pages are zeroed (state 0 = uninitialized)
+    if (ftruncate(fd, sizeof(ShmRingMemory)) == -1) {
+        logger(LOG_LEVEL_ERROR, "Failed to resize shared memory %s: %s", ring->name, strerror(errno));
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+
+    int mmap_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    mmap_flags |= MAP_POPULATE;     // Prefault the ring, no page fault on the hot path
+#endif
+    ring->memory = mmap(NULL, sizeof(ShmRingMemory), PROT_READ | PROT_WRITE, mmap_flags, fd, 0);
+    close(fd);  // The mapping keeps the object alive
+    if (ring->memory == MAP_FAILED) {
+        logger(LOG_LEVEL_ERROR, "Failed to map shared memory %s: %s", ring->name, strerror(errno));
+        free(ring);
+        return NULL;
+    }
+
+    ShmRingHeader *header = &ring->memory->header;
+    uint32_t expected = 0;
+    if (atomic_compare_exchange_strong(&header->state, &expected, SHM_RING_STATE_INITIALIZING)) {
+        header->slot_count = SHM_RING_SLOT_COUNT;
+        header->slot_size = SHM_RING_SLOT_SIZE;
+        atomic_store(&header->state, SHM_RING_STATE_READY);
+    }
+    while (atomic_load(&header->state) != SHM_RING_STATE_READY) {
+        cpu_relax();
+    }
+    if (header->slot_count != SHM_RING_SLOT_COUNT || header->slot_size != SHM_RING_SLOT_SIZE) {
+        logger(LOG_LEVEL_ERROR, "Shared memory %s has a different layout (%u slots of %u bytes)", ring->name,
+               header->slot_count, header->slot_size);
+        munmap(ring->memory, sizeof(ShmRingMemory));
+        free(ring);
+        return NULL;
+    }
+
+    if (ring->is_consumer) {
+        // Drop the messages of a previous run
+        atomic_store(&header->head, atomic_load(&header->tail));
+        atomic_store(&header->consumer_waiting, 0);
+    }
+    return ring;
+}
+
+static ShmRingSlot *ring_slot(ShmRing *ring, uint64_t index) {
+    return &ring->memory->slots[index & (SHM_RING_SLOT_COUNT - 1)];
+}
+
+/**
+ * @brief Send up to count messages with a group. The producers lock is taken once for the whole batch and the
+ *        consumer is woken up at most once.
+ * @param ring
+ * @param group
+ * @param msgs
+ * @param sizes
+ * @param count
+ * @param timeout Max wait in ms when the ring is full (0 no wait, -1 forever)
+ * @return The number of messages sent, or -1 if none was sent
+ */
+int shm_ring_send_batch(ShmRing *ring, const char *group, const char **msgs, const size_t *sizes, size_t count,
+                        int timeout) {
+    ShmRingHeader *header = &ring->memory->header;
+    uint64_t deadline = timeout > 0 ? get_monotonic_time_nanos() / 1000000 + (uint64_t) timeout : 0;
+
+    while (atomic_exchange_explicit(&header->producer_lock, 1, memory_order_acquire) != 0) {
+        while (atomic_load_explicit(&header->producer_lock, memory_order_relaxed) != 0) {
+            cpu_relax();
+        }
+    }
+
+    uint64_t tail = atomic_load_explicit(&header->tail, memory_order_relaxed);
+    size_t sent = 0;
+    for (; sent < count; sent++) {
+        if (sizes[sent] > SHM_RING_MAX_PAYLOAD) {
+            logger(LOG_LEVEL_ERROR, "Message too big for shared memory ring: %zu bytes", sizes[sent]);
+            errno = EMSGSIZE;
+            break;
+        }
+
+        // Full ring: wait for the consumer (backpressure instead of the drops of UDP)
+        while (tail - atomic_load_explicit(&header->head, memory_order_acquire) == SHM_RING_SLOT_COUNT) {
+            if (timeout == 0 || (deadline != 0 && remaining_ms(deadline) == 0)) {
+                errno = EAGAIN;
+                goto publish;
+            }
+            // Publish what is already written, so that the consumer can make room (waking it if it sleeps)
+            atomic_store(&header->tail, tail);
+            if (atomic_load(&header->consumer_waiting)) {
+                ring_wake(ring);
+            }
+            sched_yield();
+        }
+
+        ShmRingSlot *slot = ring_slot(ring, tail);
+        rawudp_fill_header((RawUdpHeader *) slot->frame, group, sizes[sent]);
+        memcpy(slot->frame + sizeof(RawUdpHeader), msgs[sent], sizes[sent]);
+        slot->frame_size = (uint32_t) (sizeof(RawUdpHeader) + sizes[sent]);
+        tail++;
+    }
+
+publish:
+    // seq_cst: the store of tail and the load of consumer_waiting cannot be reordered (see shm_ring_receive_batch)
+    atomic_store(&header->tail, tail);
+    atomic_store_explicit(&header->producer_lock, 0, memory_order_release);
+
+    if (sent > 0 && atomic_load(&header->consumer_waiting)) {
+        ring_wake(ring);
+    }
+    return sent > 0 ? (int) sent : -1;
+}
+
+/**
+ * @brief Receive up to max_count messages of the joined group. The messages point to the slots of the ring, that are
+ *        given back to the producers on the next receive.
+ * @param ring
+ * @param datagrams
+ * @param max_count
+ * @param timeout Max wait in ms (0 no wait, -1 forever)
+ * @return The number of messages received, or -1 on timeout
+ */
+int shm_ring_receive_batch(ShmRing *ring, RawUdpDatagram *datagrams, size_t max_count, int timeout) {
+    ShmRingHeader *header = &ring->memory->header;
+    shm_ring_release(ring);
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+
+    uint64_t deadline = timeout > 0 ? get_monotonic_time_nanos() / 1000000 + (uint64_t) timeout : 0;
+    int spins = 0;
+
+    while (true) {
+        uint64_t tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+
+        if (tail == head) {
+            if (timeout == 0) {
+                return -1;
+            }
+            if (spins < SHM_RING_SPIN_COUNT) {
+                spins++;
+                cpu_relax();
+                continue;
+            }
+
+            int wait_ms = remaining_ms(deadline);
+            if (wait_ms == 0) {
+                return -1;
+            }
+            // Announce the sleep, then check again: a producer either sees consumer_waiting or its tail is seen here
+            uint32_t seq = atomic_load(&header->wakeup_seq);
+            atomic_store(&header->consumer_waiting, 1);
+            if (atomic_load(&header->tail) == head) {
+                ring_wait(ring, seq, wait_ms);
+            }
+            atomic_store(&header->consumer_waiting, 0);
+            continue;
+        }
+
+        size_t count = 0;
+        uint64_t index = head;
+        for (; index != tail && count < max_count; index++) {
+            ShmRingSlot *slot = ring_slot(ring, index);
+            if (rawudp_decode(slot->frame, slot->frame_size, ring->group, &datagrams[count])) {
+                count++;
+            }
+        }
+
+        if (count > 0) {
+            ring->pending_release = index - head;
+            return (int) count;
+        }
+
+        // Only messages of other groups, release them and wait again
+        head = index;
+        atomic_store_explicit(&header->head, head, memory_order_release);
+    }
+}
+
+/**
+ * @brief Give the slots returned by the last receive back to the producers.
+ * @param ring
+ */
+void shm_ring_release(ShmRing *ring) {
+    if (ring->pending_release == 0) {
+        return;
+    }
+    ShmRingHeader *header = &ring->memory->header;
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed) + ring->pending_release;
+    atomic_store_explicit(&header->head, head, memory_order_release);
+    ring->pending_release = 0;
+}
+
+/**
+ * @brief Close the ring. The consumer also removes the shared memory object (the producers keep their mapping).
+ * @param ring
+ */
+void shm_ring_close(ShmRing *ring) {
+    if (ring == NULL) {
+        return;
+    }
+    if (ring->is_consumer) {
+        shm_unlink(ring->name);
+    }
+    munmap(ring->memory, sizeof(ShmRingMemory));
+    free(ring);
+}
@@ -0,0 +1,81 @@
+//  =====================================================================
+//  shm_ring.h
+//
+//  Shared-memory ring for processes on the same host (lock-free SPSC)
+//  =====================================================================
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "rawudp.h"
+
+#define SHM_RING_SCHEME "shm://"
+#define SHM_RING_CACHE_LINE 64
+#define SHM_RING_SLOT_COUNT 1024        // Must be a power of 2
+#define SHM_RING_SLOT_SIZE 2048         // Multiple of the cache line (frame size included)
+#define SHM_RING_NAME_SIZE 64
+#define SHM_RING_DEFAULT_BATCH_SIZE 32  // Messages returned by a single receive batch
+
+/**
+ * Control block at the start of the shared memory. The producer and the consumer indexes live on different cache
+ * lines, so that the two sides do not invalidate each other's line on every message (false sharing).
+ */
+typedef struct {
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint32_t state;   // 0 uninitialized, 1 initializing, 2 ready
+    uint32_t slot_count;
+    uint32_t slot_size;
+
+    // Written by the producers
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint64_t tail;
+    _Atomic uint32_t producer_lock;     // Serializes the producers (e.g. the client threads)
+
+    // Written by the consumer
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint64_t head;
+    _Atomic uint32_t consumer_waiting;  // The consumer sleeps on wakeup_seq
+    _Atomic uint32_t wakeup_seq;        // Futex word
+} ShmRingHeader;
+
+// A slot carries the same frame of rawudp (RawUdpHeader + payload)
+typedef struct {
+    _Alignas(SHM_RING_CACHE_LINE) uint32_t frame_size;
+    char frame[SHM_RING_SLOT_SIZE - sizeof(uint32_t)];
+} ShmRingSlot;
+
+typedef struct {
+    ShmRingHeader header;
+    ShmRingSlot slots[SHM_RING_SLOT_COUNT];
+} ShmRingMemory;
+
+typedef struct {
+    ShmRingMemory *memory;
+    bool is_consumer;
+    char name[SHM_RING_NAME_SIZE];      // Name of the shared memory object
+    char group[RAWUDP_GROUP_SIZE];      // Joined group (consumer only)
+    uint64_t pending_release;           // Slots returned by shm_ring_receive_batch, released on the next receive
+    uint64_t syscalls;                  // futex wait/wake calls
+} ShmRing;
+
+// Max payload of a message (the slot also holds the frame size and the RawUdpHeader)
+#define SHM_RING_MAX_PAYLOAD (sizeof(((ShmRingSlot *) 0)->frame) - sizeof(RawUdpHeader))
+
+// Open the ring of a connection (shm://<ip>:<port>): with a group it consumes messages, without a group it produces
+ShmRing *shm_ring_open(const char *connection, const char *group);
+
+// Send up to count messages with a group, timeout in ms when the ring is full (0 no wait, -1 forever)
+int shm_ring_send_batch(ShmRing *ring, const char *group, const char **msgs, const size_t *sizes, size_t count,
+                        int timeout);
+
+// Receive up to max_count messages without copying them (valid until the next receive on the same ring)
+int shm_ring_receive_batch(ShmRing *ring, RawUdpDatagram *datagrams, size_t max_count, int timeout);
+
+// Give the slots of the last receive back to the producers (done anyway by the next receive)
+void shm_ring_release(ShmRing *ring);
+
+// Close the ring (the consumer also removes the shared memory object)
+void shm_ring_close(ShmRing *ring);
+
+#endif //SHM_RING_H
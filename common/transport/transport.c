@@ -0,0 +1,395 @@
+#include "transport.h"
+#include "fragment.h"
+#include "core/logger.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * Every protocol is a backend that fills a TransportOps table. The client and the server only see a Transport and call
+ * the transport_* functions, so they contain no protocol specific code: the backend is picked by name from the
+ * configuration (protocol: tcp, udp, rawudp, ...) when the transport is opened.
+ * The batched and zero-copy operations are optional: when a backend does not implement them, the generic functions
+ * fall back to one send/recv per message, so the callers can always use them.
+ * New backends are added to the built-in table below, or registered at runtime with register_transport.
+ * When the fragmentation is enabled (transport_enable_fragmentation), the messages larger than a datagram are split and
+ * reassembled here (see fragment.c), so the backends and the callers are unchanged.
+ */
+
+static const TransportOps *g_transports[TRANSPORT_MAX_BACKENDS] = {
+        &zmq_tcp_transport,
+        &zmq_udp_transport,
+        &zmq_inproc_transport,
+        &rawudp_transport,
+        &uring_transport,
+        &shm_transport
+};
+static size_t g_transport_count = 6;
+static pthread_mutex_t g_transport_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Register a new backend.
+ * @param ops The operations of the backend (it must stay valid until the end of the process)
+ * @return 0 on success, -1 if the name is already used or the registry is full
+ */
+int register_transport(const TransportOps *ops) {
+    if (ops == NULL || ops->name == NULL || ops->open == NULL || ops->send == NULL || ops->recv == NULL ||
+        ops->close == NULL) {
+        logger(LOG_LEVEL_ERROR, "Invalid transport backend");
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_transport_mutex);
+    for (size_t i = 0; i < g_transport_count; i++) {
+        if (strcmp(g_transports[i]->name, ops->name) == 0) {
+            pthread_mutex_unlock(&g_transport_mutex);
+            logger(LOG_LEVEL_ERROR, "Transport backend already registered: %s", ops->name);
+            return -1;
+        }
+    }
+    if (g_transport_count == TRANSPORT_MAX_BACKENDS) {
+        pthread_mutex_unlock(&g_transport_mutex);
+        logger(LOG_LEVEL_ERROR, "Too many transport backends");
+        return -1;
+    }
+    g_transports[g_transport_count++] = ops;
+    pthread_mutex_unlock(&g_transport_mutex);
+    return 0;
+}
+
+/**
+ * @brief Find a backend by name.
+ * @param name
+ * @return The operations of the backend, or NULL if not found
+ */
+const TransportOps *find_transport(const char *name) {
+    if (name == NULL) {
+        return NULL;
+    }
+
+    const TransportOps *ops = NULL;
+    pthread_mutex_lock(&g_transport_mutex);
+    for (size_t i = 0; i < g_transport_count; i++) {
+        if (strcmp(g_transports[i]->name, name) == 0) {
+            ops = g_transports[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_transport_mutex);
+    return ops;
+}
+
+/**
+ * @brief Open a transport.
+ * @param protocol Name of the backend
+ * @param context Shared context (the ZMQ context for the ZMQ backends, it can be NULL for the others)
+ * @param role
+ * @param address <protocol>://<ip>:<port>
+ * @param group The group to join (receivers only, NULL for senders)
+ * @param timeout Receive timeout in ms
+ * @return The transport, or NULL on failure
+ */
+Transport *transport_open(const char *protocol, void *context, TransportRole role, const char *address,
+                          const char *group, int timeout) {
+    const TransportOps *ops = find_transport(protocol);
+    if (ops == NULL) {
+        logger(LOG_LEVEL_ERROR, "Unknown transport: %s", protocol != NULL ? protocol : "(null)");
+        return NULL;
+    }
+    if (address == NULL) {
+        logger(LOG_LEVEL_ERROR, "Missing address for transport: %s", protocol);
+        return NULL;
+    }
+
+    Transport *transport = calloc(1, sizeof(Transport));
+    if (transport == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for transport");
+        return NULL;
+    }
+    transport->ops = ops;
+    transport->context = context;
+    transport->role = role;
+    transport->timeout = timeout;
+    // The address is copied, since get_address returns a shared buffer
+    strncpy(transport->address, address, TRANSPORT_ADDRESS_SIZE - 1);
+    if (group != NULL) {
+        strncpy(transport->group, group, TRANSPORT_GROUP_SIZE - 1);
+    }
+
+    if (ops->open(transport, transport->address) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to open transport %s on %s", ops->name, transport->address);
+        free(transport);
+        return NULL;
+    }
+    return transport;
+}
+
+/**
+ * @brief Send a message with a group.
+ * @param transport
+ * @param group
+ * @param data
+ * @param size
+ * @param flags TRANSPORT_DONTWAIT
+ * @return The number of bytes sent, or -1 on error
+ */
+int transport_send(Transport *transport, const char *group, const char *data, size_t size, int flags) {
+    if (transport->fragments != NULL && size > transport->fragments->options.fragment_size) {
+        return fragment_send(transport, transport->fragments, group, data, size);
+    }
+    return transport->ops->send(transport, group, data, size, flags);
+}
+
+/**
+ * @brief Send a batch on a transport with the fragmentation: the runs of small messages go through the batch of the
+ * backend, the large messages are fragmented one by one.
+ * @param transport
+ * @param group
+ * @param data
+ * @param sizes
+ * @param count
+ * @return The number of messages sent, or -1 if none was sent
+ */
+static int send_batch_fragmented(Transport *transport, const char *group, const char **data, const size_t *sizes,
+                                 size_t count) {
+    size_t sent = 0;
+    while (sent < count) {
+        if (sizes[sent] > transport->fragments->options.fragment_size) {
+            if (fragment_send(transport, transport->fragments, group, data[sent], sizes[sent]) < 0) {
+                break;
+            }
+            sent++;
+            continue;
+        }
+
+        size_t run = 1;
+        while (sent + run < count && sizes[sent + run] <= transport->fragments->options.fragment_size) {
+            run++;
+        }
+        int rc;
+        if (transport->ops->send_batch != NULL) {
+            rc = transport->ops->send_batch(transport, group, data + sent, sizes + sent, run);
+        } else {
+            rc = 0;
+            while ((size_t) rc < run &&
+                   transport->ops->send(transport, group, data[sent + rc], sizes[sent + rc], 0) >= 0) {
+                rc++;
+            }
+        }
+        if (rc > 0) {
+            sent += (size_t) rc;
+        }
+        if (rc != (int) run) {
+            break;
+        }
+    }
+    return sent > 0 ? (int) sent : -1;
+}
+
+/**
+ * @brief Send count messages with a group, with one syscall per batch if the backend supports it.
+ * @param transport
+ * @param group
+ * @param data
+ * @param sizes
+ * @param count
+ * @return The number of messages sent, or -1 if none was sent
+ */
+int transport_send_batch(Transport *transport, const char *group, const char **data, const size_t *sizes,
+                         size_t count) {
+    if (transport->fragments != NULL) {
+        return send_batch_fragmented(transport, group, data, sizes, count);
+    }
+    if (transport->ops->send_batch != NULL) {
+        return transport->ops->send_batch(transport, group, data, sizes, count);
+    }
+
+    size_t sent = 0;
+    for (; sent < count; sent++) {
+        if (transport->ops->send(transport, group, data[sent], sizes[sent], 0) < 0) {
+            break;
+        }
+    }
+    return sent > 0 ? (int) sent : -1;
+}
+
+/**
+ * @brief Send a buffer without copying it (if the backend supports it). free_fn is always called, also on error.
+ * @param transport
+ * @param group
+ * @param data
+ * @param size
+ * @param free_fn
+ * @param hint Passed to free_fn
+ * @return The number of bytes sent, or -1 on error
+ */
+int transport_send_zero_copy(Transport *transport, const char *group, void *data, size_t size,
+                             TransportFreeFn free_fn, void *hint) {
+    if (transport->fragments != NULL && size > transport->fragments->options.fragment_size) {
+        // The fragments are copied in the datagrams anyway
+        int rc = fragment_send(transport, transport->fragments, group, data, size);
+        if (free_fn != NULL) {
+            free_fn(data, hint);
+        }
+        return rc;
+    }
+    if (transport->ops->send_zero_copy != NULL) {
+        return transport->ops->send_zero_copy(transport, group, data, size, free_fn, hint);
+    }
+
+    int rc = transport->ops->send(transport, group, data, size, 0);
+    if (free_fn != NULL) {
+        free_fn(data, hint);
+    }
+    return rc;
+}
+
+/**
+ * @brief Receive a message (null terminated).
+ * @param transport
+ * @param buffer
+ * @param buffer_size
+ * @param flags TRANSPORT_DONTWAIT
+ * @return The size of the message, or -1 on timeout/error
+ */
+int transport_recv(Transport *transport, char *buffer, size_t buffer_size, int flags) {
+    if (transport->fragments != NULL) {
+        return fragment_recv(transport, transport->fragments, buffer, buffer_size, flags);
+    }
+    return transport->ops->recv(transport, buffer, buffer_size, flags);
+}
+
+/**
+ * @brief Receive up to max_count messages. The messages are valid until the next receive on the same transport.
+ * @param transport
+ * @param messages
+ * @param max_count
+ * @param flags TRANSPORT_DONTWAIT
+ * @return The number of messages received, or -1 on timeout/error
+ */
+int transport_recv_batch(Transport *transport, TransportMessage *messages, size_t max_count, int flags) {
+    if (max_count == 0) {
+        return 0;
+    }
+    if (transport->fragments != NULL) {
+        return fragment_recv_batch(transport, transport->fragments, messages, max_count, flags);
+    }
+    if (transport->ops->recv_batch != NULL) {
+        return transport->ops->recv_batch(transport, messages, max_count, flags);
+    }
+
+    // Fallback: a single message in the buffer of the transport
+    if (transport->rx_buffer == NULL) {
+        transport->rx_buffer = malloc(TRANSPORT_MAX_MESSAGE_SIZE);
+        if (transport->rx_buffer == NULL) {
+            logger(LOG_LEVEL_ERROR, "Failed to allocate memory for transport buffer");
+            return -1;
+        }
+    }
+
+    int rc = transport->ops->recv(transport, transport->rx_buffer, TRANSPORT_MAX_MESSAGE_SIZE, flags);
+    if (rc < 0) {
+        return -1;
+    }
+    messages[0].group = transport->group;
+    messages[0].data = transport->rx_buffer;
+    messages[0].size = (size_t) rc;
+    if (transport_recv_timestamps(transport, &messages[0].timestamps) != 0) {
+        memset(&messages[0].timestamps, 0, sizeof(TransportTimestamps));
+    }
+    return 1;
+}
+
+/**
+ * @brief Get a file descriptor that can be used with poll/epoll.
+ * @param transport
+ * @return The file descriptor, or -1 if the backend does not expose one
+ */
+int transport_poll_fd(Transport *transport) {
+    if (transport->ops->poll_fd == NULL) {
+        return -1;
+    }
+    return transport->ops->poll_fd(transport);
+}
+
+/**
+ * @brief Get the number of send/receive syscalls issued by the backend.
+ * @param transport
+ * @return The number of syscalls, or -1 if the backend does not track them (e.g. ZMQ, that uses its own I/O threads)
+ */
+long long transport_syscall_count(Transport *transport) {
+    if (transport->ops->syscall_count == NULL) {
+        return -1;
+    }
+    return transport->ops->syscall_count(transport);
+}
+
+/**
+ * @brief Enable the kernel timestamps of the messages (send and receive), used to split the one-way latency in its
+ * components. Only the raw socket backends support it.
+ * @param transport
+ * @return 0 on success, -1 if the backend does not support it
+ */
+int transport_enable_timestamping(Transport *transport) {
+    if (transport->ops->enable_timestamping == NULL) {
+        logger(LOG_LEVEL_WARN, "The %s transport does not support kernel timestamps (use rawudp)",
+               transport->ops->name);
+        return -1;
+    }
+    return transport->ops->enable_timestamping(transport);
+}
+
+/**
+ * @brief Get the timestamps of the last message returned by transport_recv.
+ * @param transport
+ * @param timestamps
+ * @return 0 on success, -1 if the backend does not provide them
+ */
+int transport_recv_timestamps(Transport *transport, TransportTimestamps *timestamps) {
+    if (transport->ops->recv_timestamps == NULL) {
+        return -1;
+    }
+    return transport->ops->recv_timestamps(transport, timestamps);
+}
+
+/**
+ * @brief Check if the backend implements batched operations natively.
+ * @param transport
+ * @return
+ */
+bool transport_supports_batch(const Transport *transport) {
+    return transport->ops->send_batch != NULL || transport->ops->recv_batch != NULL;
+}
+
+/**
+ * @brief Close the transport and release its resources.
+ * @param transport
+ */
+void transport_close(Transport *transport) {
+    if (transport == NULL) {
+        return;
+    }
+    transport->ops->close(transport);
+    if (transport->fragments != NULL) {
+        unregister_fragment_sender(transport->fragments);
+        release_fragment_state(transport->fragments);
+    }
+    free(transport->rx_buffer);
+    free(transport);
+}
+
+/**
+ * Example of usage:
+
+    Transport *radio = transport_open(config.protocol, context, TRANSPORT_SENDER, get_address(MAIN_ADDRESS), NULL,
+                                      config.signal_msg_timeout);
+    transport_send(radio, get_group(MAIN_GROUP), msg, strlen(msg), 0);
+    transport_close(radio);
+
+    Transport *dish = transport_open(config.protocol, context, TRANSPORT_RECEIVER, get_address(MAIN_ADDRESS),
+                                     get_group(MAIN_GROUP), config.signal_msg_timeout);
+    char buffer[1024];
+    if (transport_recv(dish, buffer, sizeof(buffer), 0) != -1) { ... }
+    transport_close(dish);
+ */
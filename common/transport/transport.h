@@ -0,0 +1,147 @@
+//  =====================================================================
+//  transport.h
+//
+//  Pluggable transport layer (vtable of backends: ZMQ TCP, ZMQ UDP, ...)
+//  =====================================================================
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRANSPORT_DONTWAIT 1                // Flag for send/recv: return immediately instead of blocking
+#define TRANSPORT_MAX_BACKENDS 16           // Max number of registered backends
+#define TRANSPORT_MAX_MESSAGE_SIZE 65536    // Buffer used by the generic recv_batch fallback
+#define TRANSPORT_ADDRESS_SIZE 256
+#define TRANSPORT_GROUP_SIZE 16             // Same limit as ZMQ groups (15 chars + null terminator)
+
+typedef enum {
+    TRANSPORT_SENDER,       // Sends messages to one receiver (e.g. RADIO, PUB)
+    TRANSPORT_RECEIVER      // Receives the messages of a group (e.g. DISH, SUB)
+} TransportRole;
+
+// Timestamps of a received message in ns (CLOCK_REALTIME), 0 when the backend does not provide them
+typedef struct {
+    uint64_t send_ns;           // Send call on the sender (carried by the message)
+    uint64_t kernel_rx_ns;      // Arrival in the kernel, or in the NIC when hardware is true (needs timestamping)
+    uint64_t user_rx_ns;        // Return of the receive call to the application
+    bool hardware;
+} TransportTimestamps;
+
+// Message returned by transport_recv_batch (data points to buffers owned by the transport)
+typedef struct {
+    const char *group;
+    const char *data;
+    size_t size;
+    TransportTimestamps timestamps;
+} TransportMessage;
+
+// Callback used to release the buffer of a zero-copy send, once the backend does not need it anymore
+typedef void (*TransportFreeFn)(void *data, void *hint);
+
+typedef struct Transport Transport;
+
+// Fragmentation state of a transport (see fragment.h)
+typedef struct FragmentState FragmentState;
+
+/**
+ * Operations implemented by a backend. The optional operations can be NULL, in that case the generic transport_*
+ * functions fall back to the single message operations.
+ */
+typedef struct {
+    const char *name;   // Name used in the configuration (protocol: <name>)
+
+    // Open the backend socket (transport->role, group, timeout and context are already set)
+    int (*open)(Transport *transport, const char *address);
+
+    int (*send)(Transport *transport, const char *group, const char *data, size_t size, int flags);
+
+    // Optional: send count messages with the least number of syscalls, return the number of messages sent
+    int (*send_batch)(Transport *transport, const char *group, const char **data, const size_t *sizes, size_t count);
+
+    // Optional: send a buffer without copying it, free_fn is called when the backend releases it
+    int (*send_zero_copy)(Transport *transport, const char *group, void *data, size_t size, TransportFreeFn free_fn,
+                          void *hint);
+
+    // Receive a message (null terminated), return its size or -1 on timeout/error
+    int (*recv)(Transport *transport, char *buffer, size_t buffer_size, int flags);
+
+    // Optional: receive up to max_count messages without copying them, return the number of messages received
+    int (*recv_batch)(Transport *transport, TransportMessage *messages, size_t max_count, int flags);
+
+    // Optional: file descriptor that can be used with poll/epoll (-1 if not available)
+    int (*poll_fd)(Transport *transport);
+
+    // Optional: number of send/receive syscalls issued so far (for benchmarks)
+    long long (*syscall_count)(Transport *transport);
+
+    // Optional: enable the kernel timestamps of the messages (SO_TIMESTAMPING), return -1 if not supported
+    int (*enable_timestamping)(Transport *transport);
+
+    // Optional: timestamps of the last message returned by recv, return -1 if not available
+    int (*recv_timestamps)(Transport *transport, TransportTimestamps *timestamps);
+
+    void (*close)(Transport *transport);
+} TransportOps;
+
+struct Transport {
+    const TransportOps *ops;
+    void *handle;                           // Backend socket
+    void *context;                          // Shared context (ZMQ context for the ZMQ backends)
+    TransportRole role;
+    int timeout;                            // Receive timeout in ms
+    char address[TRANSPORT_ADDRESS_SIZE];
+    char group[TRANSPORT_GROUP_SIZE];       // Joined group (receivers only)
+    char *rx_buffer;                        // Buffer of the recv_batch fallback (allocated on first use)
+    FragmentState *fragments;               // Fragmentation of the large messages (NULL: disabled)
+};
+
+// Built-in backends
+extern const TransportOps zmq_tcp_transport;
+extern const TransportOps zmq_udp_transport;
+extern const TransportOps zmq_inproc_transport;
+extern const TransportOps rawudp_transport;
+extern const TransportOps uring_transport;
+extern const TransportOps shm_transport;
+
+// Register a new backend, return -1 if the name is already used or the registry is full
+int register_transport(const TransportOps *ops);
+
+// Find a backend by name, return NULL if not found
+const TransportOps *find_transport(const char *name);
+
+// Open a transport with the backend called protocol (receivers join group, senders pass NULL)
+Transport *transport_open(const char *protocol, void *context, TransportRole role, const char *address,
+                          const char *group, int timeout);
+
+int transport_send(Transport *transport, const char *group, const char *data, size_t size, int flags);
+
+int transport_send_batch(Transport *transport, const char *group, const char **data, const size_t *sizes,
+                         size_t count);
+
+int transport_send_zero_copy(Transport *transport, const char *group, void *data, size_t size,
+                             TransportFreeFn free_fn, void *hint);
+
+int transport_recv(Transport *transport, char *buffer, size_t buffer_size, int flags);
+
+int transport_recv_batch(Transport *transport, TransportMessage *messages, size_t max_count, int flags);
+
+int transport_poll_fd(Transport *transport);
+
+// Number of send/receive syscalls issued by the backend, -1 if the backend does not track them
+long long transport_syscall_count(Transport *transport);
+
+// Enable the kernel timestamps of the messages, -1 if the backend does not support them
+int transport_enable_timestamping(Transport *transport);
+
+// Timestamps of the last message returned by transport_recv, -1 if the backend does not provide them
+int transport_recv_timestamps(Transport *transport, TransportTimestamps *timestamps);
+
+// Check if the backend implements batched operations natively
+bool transport_supports_batch(const Transport *transport);
+
+void transport_close(Transport *transport);
+
+#endif //TRANSPORT_H
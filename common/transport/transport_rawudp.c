@@ -0,0 +1,95 @@
+#include "transport.h"
+#include "rawudp.h"
+#include "utils/time_utils.h"
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * Backend of the native UDP transport (see rawudp.c). It is the only built-in backend with native batched operations:
+ * send_batch maps to sendmmsg and recv_batch to recvmmsg, the received datagrams are returned without copying them.
+ * It is also the backend with kernel timestamps (SO_TIMESTAMPING), returned with the received messages.
+ */
+
+static int rawudp_transport_open(Transport *transport, const char *address) {
+    const char *group = transport->role == TRANSPORT_RECEIVER ? transport->group : NULL;
+    transport->handle = rawudp_create(address, transport->timeout, group, RAWUDP_DEFAULT_BATCH_SIZE);
+    return transport->handle != NULL ? 0 : -1;
+}
+
+static int rawudp_transport_send(Transport *transport, const char *group, const char *data, size_t size, int flags) {
+    return rawudp_send_group((RawUdpSocket *) transport->handle, group, data, size, flags);
+}
+
+static int rawudp_transport_send_batch(Transport *transport, const char *group, const char **data,
+                                       const size_t *sizes, size_t count) {
+    return rawudp_send_batch((RawUdpSocket *) transport->handle, group, data, sizes, count);
+}
+
+static int rawudp_transport_recv(Transport *transport, char *buffer, size_t buffer_size, int flags) {
+    return rawudp_receive((RawUdpSocket *) transport->handle, buffer, buffer_size, flags);
+}
+
+static int rawudp_transport_recv_batch(Transport *transport, TransportMessage *messages, size_t max_count,
+                                       int flags) {
+    RawUdpDatagram datagrams[RAWUDP_DEFAULT_BATCH_SIZE];
+    if (max_count > RAWUDP_DEFAULT_BATCH_SIZE) {
+        max_count = RAWUDP_DEFAULT_BATCH_SIZE;
+    }
+
+    int rc = rawudp_receive_batch((RawUdpSocket *) transport->handle, datagrams, max_count, flags);
+    bool timestamping = rc > 0 && ((RawUdpSocket *) transport->handle)->timestamping;
+    uint64_t user_rx_ns = timestamping ? (uint64_t) get_current_time_nanos() : 0;
+    for (int i = 0; i < rc; i++) {
+        messages[i].group = datagrams[i].group;
+        messages[i].data = datagrams[i].data;
+        messages[i].size = datagrams[i].size;
+        messages[i].timestamps.send_ns = datagrams[i].send_ns;
+        messages[i].timestamps.kernel_rx_ns = datagrams[i].kernel_rx_ns;
+        messages[i].timestamps.user_rx_ns = user_rx_ns;
+        messages[i].timestamps.hardware = datagrams[i].hardware_timestamp;
+    }
+    return rc;
+}
+
+static int rawudp_transport_poll_fd(Transport *transport) {
+    return ((RawUdpSocket *) transport->handle)->fd;
+}
+
+static long long rawudp_transport_syscall_count(Transport *transport) {
+    return (long long) ((RawUdpSocket *) transport->handle)->syscalls;
+}
+
+static int rawudp_transport_enable_timestamping(Transport *transport) {
+    return rawudp_enable_timestamping((RawUdpSocket *) transport->handle);
+}
+
+static int rawudp_transport_recv_timestamps(Transport *transport, TransportTimestamps *timestamps) {
+    RawUdpSocket *socket = (RawUdpSocket *) transport->handle;
+    if (!socket->timestamping || socket->last_rx_user_ns == 0) {
+        return -1;
+    }
+    timestamps->send_ns = socket->last_rx.send_ns;
+    timestamps->kernel_rx_ns = socket->last_rx.kernel_rx_ns;
+    timestamps->user_rx_ns = socket->last_rx_user_ns;
+    timestamps->hardware = socket->last_rx.hardware_timestamp;
+    return 0;
+}
+
+static void rawudp_transport_close(Transport *transport) {
+    rawudp_close((RawUdpSocket *) transport->handle);
+    transport->handle = NULL;
+}
+
+const TransportOps rawudp_transport = {
+        .name = "rawudp",
+        .open = rawudp_transport_open,
+        .send = rawudp_transport_send,
+        .send_batch = rawudp_transport_send_batch,
+        .send_zero_copy = NULL,     // sendmsg already sends the payload without copying it
+        .recv = rawudp_transport_recv,
+        .recv_batch = rawudp_transport_recv_batch,
+        .poll_fd = rawudp_transport_poll_fd,
+        .syscall_count = rawudp_transport_syscall_count,
+        .enable_timestamping = rawudp_transport_enable_timestamping,
+        .recv_timestamps = rawudp_transport_recv_timestamps,
+        .close = rawudp_transport_close
+};
@@ -0,0 +1,84 @@
+#include "transport.h"
+#include "shm_ring.h"
+#include <string.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * Backend of the shared memory transport (see shm_ring.c), for a client and a server on the same host. The address
+ * (shm://<ip>:<port>) only names the ring, so the main and the responder addresses of the configuration give one ring
+ * per direction. Sends copy the message in the ring, receives return the messages without copying them.
+ */
+
+static int shm_timeout(Transport *transport, int flags) {
+    return (flags & TRANSPORT_DONTWAIT) ? 0 : transport->timeout;
+}
+
+static int shm_transport_open(Transport *transport, const char *address) {
+    const char *group = transport->role == TRANSPORT_RECEIVER ? transport->group : NULL;
+    transport->handle = shm_ring_open(address, group);
+    return transport->handle != NULL ? 0 : -1;
+}
+
+static int shm_transport_send(Transport *transport, const char *group, const char *data, size_t size, int flags) {
+    int rc = shm_ring_send_batch((ShmRing *) transport->handle, group, &data, &size, 1, shm_timeout(transport, flags));
+    return rc == 1 ? (int) size : -1;
+}
+
+static int shm_transport_send_batch(Transport *transport, const char *group, const char **data, const size_t *sizes,
+                                    size_t count) {
+    return shm_ring_send_batch((ShmRing *) transport->handle, group, data, sizes, count, transport->timeout);
+}
+
+static int shm_transport_recv(Transport *transport, char *buffer, size_t buffer_size, int flags) {
+    ShmRing *ring = (ShmRing *) transport->handle;
+    RawUdpDatagram datagram;
+    if (shm_ring_receive_batch(ring, &datagram, 1, shm_timeout(transport, flags)) != 1) {
+        return -1;
+    }
+
+    size_t size = datagram.size < buffer_size - 1 ? datagram.size : buffer_size - 1;
+    memcpy(buffer, datagram.data, size);
+    buffer[size] = '\0';
+    shm_ring_release(ring);     // The message is copied, the slot can be reused right away
+    return (int) size;
+}
+
+static int shm_transport_recv_batch(Transport *transport, TransportMessage *messages, size_t max_count, int flags) {
+    RawUdpDatagram datagrams[SHM_RING_DEFAULT_BATCH_SIZE];
+    if (max_count > SHM_RING_DEFAULT_BATCH_SIZE) {
+        max_count = SHM_RING_DEFAULT_BATCH_SIZE;
+    }
+
+    int rc = shm_ring_receive_batch((ShmRing *) transport->handle, datagrams, max_count, shm_timeout(transport, flags));
+    for (int i = 0; i < rc; i++) {
+        messages[i].group = datagrams[i].group;
+        messages[i].data = datagrams[i].data;
+        messages[i].size = datagrams[i].size;
+        messages[i].timestamps = (TransportTimestamps) {.send_ns = datagrams[i].send_ns};
+    }
+    return rc;
+}
+
+static long long shm_transport_syscall_count(Transport *transport) {
+    return (long long) ((ShmRing *) transport->handle)->syscalls;
+}
+
+static void shm_transport_close(Transport *transport) {
+    shm_ring_close((ShmRing *) transport->handle);
+    transport->handle = NULL;
+}
+
+const TransportOps shm_transport = {
+        .name = "shm",
+        .open = shm_transport_open,
+        .send = shm_transport_send,
+        .send_batch = shm_transport_send_batch,
+        .send_zero_copy = NULL,     // The message is copied in the ring anyway
+        .recv = shm_transport_recv,
+        .recv_batch = shm_transport_recv_batch,
+        .poll_fd = NULL,            // The consumer sleeps on a futex, there is no file descriptor
+        .syscall_count = shm_transport_syscall_count,
+        .enable_timestamping = NULL,    // No kernel in the path of the messages
+        .recv_timestamps = NULL,
+        .close = shm_transport_close
+};
@@ -0,0 +1,421 @@
+#include "transport.h"
+#include "rawudp.h"
+#include "core/logger.h"
+#include <errno.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * Datagram backend on top of io_uring, with the same wire format of rawudp (a rawudp peer can talk to a uring peer).
+ * The socket is created, bound/connected and filtered exactly like rawudp, only the I/O goes through the ring:
+ * - Receivers arm a single multishot recv that takes its buffers from a provided buffer ring. The kernel keeps filling
+ *   buffers and posting completions while the thread is busy, so a burst of datagrams is collected with one
+ *   io_uring_enter (or none, when the completions are already in the ring). A buffer goes back to the ring as soon as
+ *   its message is consumed.
+ * - Senders prepare one sendmsg per message (header + payload, no copy) and submit the whole batch with one
+ *   io_uring_enter that also waits for the completions, so the caller can reuse its buffers when the call returns.
+ *   The client batches its sends with send_batch_size, and diff_from_subscriber batches the resends.
+ * When liburing is not available at build time, or the kernel refuses io_uring at runtime (old kernel, seccomp), the
+ * transport falls back to the rawudp backend, that uses the same sockets with sendmmsg/recvmmsg.
+ */
+
+/**
+ * @brief Open the rawudp backend in place of io_uring.
+ * @param transport
+ * @param address
+ * @return
+ */
+static int uring_fallback_open(Transport *transport, const char *address) {
+    transport->ops = &rawudp_transport;
+    return rawudp_transport.open(transport, address);
+}
+
+#ifdef REALMQ_HAVE_IO_URING
+
+#include <liburing.h>
+
+#define URING_QUEUE_DEPTH 256           // Max sends per submission
+#define URING_BUFFER_COUNT 256          // Provided buffers (power of 2)
+#define URING_BUFFER_SIZE 4096          // Max datagram size (header included) for receivers
+#define URING_BUFFER_GROUP 0
+#define URING_TAG_RECV 1
+#define URING_TAG_SEND 2
+#define URING_TAG_BITS 8                // The index of a send in its submission follows the tag
+
+typedef struct {
+    RawUdpSocket *socket;               // Socket and group, shared with rawudp
+    struct io_uring ring;
+
+    // Receivers
+    struct io_uring_buf_ring *buf_ring;
+    char *buffers;
+    bool recv_armed;
+    unsigned short held[URING_BUFFER_COUNT];    // Buffers returned by recv_batch, given back on the next receive
+    size_t held_count;
+
+    // Senders (storage of the submissions in flight)
+    RawUdpHeader headers[URING_QUEUE_DEPTH];
+    struct iovec iov[URING_QUEUE_DEPTH][2];
+    struct msghdr msgs[URING_QUEUE_DEPTH];
+
+    uint64_t syscalls;                  // io_uring_enter calls
+} UringState;
+
+static void uring_recycle_buffer(UringState *state, unsigned short bid) {
+    io_uring_buf_ring_add(state->buf_ring, state->buffers + (size_t) bid * URING_BUFFER_SIZE, URING_BUFFER_SIZE, bid,
+                          io_uring_buf_ring_mask(URING_BUFFER_COUNT), 0);
+    io_uring_buf_ring_advance(state->buf_ring, 1);
+}
+
+static void uring_recycle_held(UringState *state) {
+    for (size_t i = 0; i < state->held_count; i++) {
+        uring_recycle_buffer(state, state->held[i]);
+    }
+    state->held_count = 0;
+}
+
+/**
+ * @brief Setup the provided buffers of a receiver.
+ * @param state
+ * @return 0 on success, -1 otherwise
+ */
+static int uring_setup_buffers(UringState *state) {
+    int rc = 0;
+    state->buf_ring = io_uring_setup_buf_ring(&state->ring, URING_BUFFER_COUNT, URING_BUFFER_GROUP, 0, &rc);
+    if (state->buf_ring == NULL) {
+        logger(LOG_LEVEL_WARN, "Failed to register the io_uring buffer ring: %s", strerror(-rc));
+        return -1;
+    }
+
+    state->buffers = malloc((size_t) URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (state->buffers == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the io_uring buffers");
+        return -1;
+    }
+    for (unsigned short i = 0; i < URING_BUFFER_COUNT; i++) {
+        io_uring_buf_ring_add(state->buf_ring, state->buffers + (size_t) i * URING_BUFFER_SIZE, URING_BUFFER_SIZE, i,
+                              io_uring_buf_ring_mask(URING_BUFFER_COUNT), i);
+    }
+    io_uring_buf_ring_advance(state->buf_ring, URING_BUFFER_COUNT);
+    return 0;
+}
+
+static void uring_release(UringState *state) {
+    if (state->buf_ring != NULL) {
+        io_uring_free_buf_ring(&state->ring, state->buf_ring, URING_BUFFER_COUNT, URING_BUFFER_GROUP);
+    }
+    io_uring_queue_exit(&state->ring);
+    free(state->buffers);
+    rawudp_close(state->socket);
+    free(state);
+}
+
+static int uring_open(Transport *transport, const char *address) {
+    const char *group = transport->role == TRANSPORT_RECEIVER ? transport->group : NULL;
+    RawUdpSocket *socket = rawudp_create(address, transport->timeout, group, RAWUDP_DEFAULT_BATCH_SIZE);
+    if (socket == NULL) {
+        return -1;
+    }
+
+    UringState *state = calloc(1, sizeof(UringState));
+    if (state == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for io_uring transport");
+        rawudp_close(socket);
+        return -1;
+    }
+    state->socket = socket;
+
+    int rc = io_uring_queue_init(URING_QUEUE_DEPTH, &state->ring, 0);
+    if (rc < 0) {
+        logger(LOG_LEVEL_WARN, "io_uring not available (%s), falling back to rawudp", strerror(-rc));
+        rawudp_close(socket);
+        free(state);
+        return uring_fallback_open(transport, address);
+    }
+
+    if (transport->role == TRANSPORT_RECEIVER && uring_setup_buffers(state) != 0) {
+        // Provided buffer rings need Linux 5.19+, multishot recv 6.0+
+        logger(LOG_LEVEL_WARN, "io_uring multishot receive not available, falling back to rawudp");
+        uring_release(state);
+        return uring_fallback_open(transport, address);
+    }
+
+    transport->handle = state;
+    return 0;
+}
+
+/**
+ * @brief Submit the prepared sendmsg and wait for their completions with one io_uring_enter.
+ * @param state
+ * @param count Prepared sendmsg
+ * @param refused Filled with the indexes of the messages refused with ECONNREFUSED (NULL to count them as failed)
+ * @param refused_count
+ * @return The number of messages sent
+ */
+static int uring_complete_sends(UringState *state, size_t count, size_t *refused, size_t *refused_count) {
+    int rc = io_uring_submit_and_wait(&state->ring, (unsigned) count);
+    state->syscalls++;
+    if (rc < 0) {
+        logger(LOG_LEVEL_ERROR, "io_uring submit failed: %s", strerror(-rc));
+        return 0;
+    }
+
+    int sent = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct io_uring_cqe *cqe;
+        if (io_uring_wait_cqe(&state->ring, &cqe) != 0) {
+            break;
+        }
+        if (cqe->res >= 0) {
+            sent++;
+        } else if (cqe->res == -ECONNREFUSED && refused != NULL) {
+            refused[(*refused_count)++] = (size_t) (io_uring_cqe_get_data64(cqe) >> URING_TAG_BITS);
+        } else {
+            errno = -cqe->res;
+        }
+        io_uring_cqe_seen(&state->ring, cqe);
+    }
+    return sent;
+}
+
+/**
+ * @brief Submit count sendmsg and wait for their completions with one io_uring_enter. The messages refused with
+ * ECONNREFUSED (error of a previous datagram, e.g. receiver not bound yet, reported on this send) are resubmitted once.
+ * @return The number of messages sent
+ */
+static int uring_submit_sends(UringState *state, const char *group, const char **data, const size_t *sizes,
+                              size_t count) {
+    RawUdpHeader header;
+    rawudp_fill_header(&header, group, 0);
+
+    for (size_t i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&state->ring);
+        if (sqe == NULL) {
+            count = i;
+            break;
+        }
+
+        state->headers[i] = header;
+        state->headers[i].length = htons((uint16_t) sizes[i]);
+        state->iov[i][0].iov_base = &state->headers[i];
+        state->iov[i][0].iov_len = sizeof(RawUdpHeader);
+        state->iov[i][1].iov_base = (void *) data[i];
+        state->iov[i][1].iov_len = sizes[i];
+        memset(&state->msgs[i], 0, sizeof(struct msghdr));
+        state->msgs[i].msg_iov = state->iov[i];
+        state->msgs[i].msg_iovlen = 2;
+
+        io_uring_prep_sendmsg(sqe, state->socket->fd, &state->msgs[i], 0);
+        io_uring_sqe_set_data64(sqe, URING_TAG_SEND | ((uint64_t) i << URING_TAG_BITS));
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t refused[URING_QUEUE_DEPTH];
+    size_t refused_count = 0;
+    int sent = uring_complete_sends(state, count, refused, &refused_count);
+    if (refused_count == 0) {
+        return sent;
+    }
+
+    for (size_t i = 0; i < refused_count; i++) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&state->ring);
+        if (sqe == NULL) {
+            refused_count = i;
+            break;
+        }
+        io_uring_prep_sendmsg(sqe, state->socket->fd, &state->msgs[refused[i]], 0);
+        io_uring_sqe_set_data64(sqe, URING_TAG_SEND | ((uint64_t) refused[i] << URING_TAG_BITS));
+    }
+    errno = ECONNREFUSED;
+    return sent + (refused_count > 0 ? uring_complete_sends(state, refused_count, NULL, NULL) : 0);
+}
+
+static int uring_send(Transport *transport, const char *group, const char *data, size_t size, int flags) {
+    (void) flags;   // The submission never blocks on a UDP socket
+    UringState *state = (UringState *) transport->handle;
+    if (size > RAWUDP_MAX_FRAME_SIZE - sizeof(RawUdpHeader)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    return uring_submit_sends(state, group, &data, &size, 1) == 1 ? (int) size : -1;
+}
+
+static int uring_send_batch(Transport *transport, const char *group, const char **data, const size_t *sizes,
+                            size_t count) {
+    UringState *state = (UringState *) transport->handle;
+    for (size_t i = 0; i < count; i++) {
+        if (sizes[i] > RAWUDP_MAX_FRAME_SIZE - sizeof(RawUdpHeader)) {
+            errno = EMSGSIZE;   // Would not fit in the length of the header
+            return -1;
+        }
+    }
+
+    size_t sent = 0;
+    while (sent < count) {
+        size_t batch = count - sent < URING_QUEUE_DEPTH ? count - sent : URING_QUEUE_DEPTH;
+        int rc = uring_submit_sends(state, group, data + sent, sizes + sent, batch);
+        sent += (size_t) rc;
+        if ((size_t) rc < batch) {
+            break;
+        }
+    }
+    return sent > 0 ? (int) sent : -1;
+}
+
+static void uring_arm_recv(UringState *state) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&state->ring);
+    if (sqe == NULL) {
+        return;
+    }
+    io_uring_prep_recv_multishot(sqe, state->socket->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    io_uring_sqe_set_data64(sqe, URING_TAG_RECV);
+    state->recv_armed = true;   // Submitted with the next io_uring_enter
+}
+
+/**
+ * @brief Take the next datagram of the group from the completions, waiting for it if needed.
+ * @param state
+ * @param flags TRANSPORT_DONTWAIT
+ * @param timeout Max wait in ms (0 or less for no timeout)
+ * @param datagram Points to the provided buffer, that must be recycled by the caller
+ * @param bid Id of the provided buffer
+ * @return 0 on success, -1 on timeout/error
+ */
+static int uring_next_datagram(UringState *state, int flags, int timeout, RawUdpDatagram *datagram,
+                               unsigned short *bid) {
+    while (true) {
+        if (!state->recv_armed) {
+            uring_arm_recv(state);
+        }
+
+        struct io_uring_cqe *cqe = NULL;
+        if (io_uring_peek_cqe(&state->ring, &cqe) != 0) {
+            if (flags & TRANSPORT_DONTWAIT) {
+                if (io_uring_sq_ready(&state->ring) > 0) {
+                    io_uring_submit(&state->ring);
+                    state->syscalls++;
+                }
+                return -1;
+            }
+
+            struct __kernel_timespec ts = {.tv_sec = timeout / 1000, .tv_nsec = (long long) (timeout % 1000) * 1000000};
+            int rc = io_uring_submit_and_wait_timeout(&state->ring, &cqe, 1, timeout > 0 ? &ts : NULL, NULL);
+            state->syscalls++;
+            if (rc < 0 || cqe == NULL) {
+                return -1;  // -ETIME on timeout
+            }
+        }
+
+        int res = cqe->res;
+        unsigned int cqe_flags = cqe->flags;
+        io_uring_cqe_seen(&state->ring, cqe);
+
+        if (!(cqe_flags & IORING_CQE_F_MORE)) {
+            // The multishot recv terminated (e.g. -ENOBUFS when all the buffers are in use), arm it again
+            state->recv_armed = false;
+        }
+        if (res < 0 || !(cqe_flags & IORING_CQE_F_BUFFER)) {
+            if (res != -ENOBUFS) logger(LOG_LEVEL_DEBUG, "io_uring recv completion: %s", strerror(-res));
+            continue;
+        }
+
+        *bid = (unsigned short) (cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+        const char *frame = state->buffers + (size_t) *bid * URING_BUFFER_SIZE;
+        if (rawudp_decode(frame, (size_t) res, state->socket->group, datagram)) {
+            return 0;
+        }
+        uring_recycle_buffer(state, *bid);     // Not for us
+    }
+}
+
+static int uring_recv(Transport *transport, char *buffer, size_t buffer_size, int flags) {
+    UringState *state = (UringState *) transport->handle;
+    uring_recycle_held(state);
+
+    RawUdpDatagram datagram;
+    unsigned short bid;
+    if (uring_next_datagram(state, flags, transport->timeout, &datagram, &bid) != 0) {
+        return -1;
+    }
+
+    size_t size = datagram.size < buffer_size - 1 ? datagram.size : buffer_size - 1;
+    memcpy(buffer, datagram.data, size);
+    buffer[size] = '\0';
+    uring_recycle_buffer(state, bid);
+    return (int) size;
+}
+
+static int uring_recv_batch(Transport *transport, TransportMessage *messages, size_t max_count, int flags) {
+    UringState *state = (UringState *) transport->handle;
+    uring_recycle_held(state);
+
+    size_t count = 0;
+    while (count < max_count && state->held_count < URING_BUFFER_COUNT) {
+        // Wait only for the first message, then take what is already completed
+        RawUdpDatagram datagram;
+        unsigned short bid;
+        int wait_flags = count == 0 ? flags : TRANSPORT_DONTWAIT;
+        if (uring_next_datagram(state, wait_flags, transport->timeout, &datagram, &bid) != 0) {
+            break;
+        }
+
+        state->held[state->held_count++] = bid;
+        messages[count].group = datagram.group;
+        messages[count].data = datagram.data;
+        messages[count].size = datagram.size;
+        messages[count].timestamps = (TransportTimestamps) {.send_ns = datagram.send_ns};
+        count++;
+    }
+    return count > 0 ? (int) count : -1;
+}
+
+static int uring_poll_fd(Transport *transport) {
+    // The ring fd becomes readable when completions are posted (the socket is drained by the kernel)
+    return ((UringState *) transport->handle)->ring.ring_fd;
+}
+
+static long long uring_syscall_count(Transport *transport) {
+    return (long long) ((UringState *) transport->handle)->syscalls;
+}
+
+static void uring_close(Transport *transport) {
+    uring_release((UringState *) transport->handle);
+    transport->handle = NULL;
+}
+
+const TransportOps uring_transport = {
+        .name = "uring",
+        .open = uring_open,
+        .send = uring_send,
+        .send_batch = uring_send_batch,
+        .send_zero_copy = NULL,     // sendmsg already sends the payload without copying it
+        .recv = uring_recv,
+        .recv_batch = uring_recv_batch,
+        .poll_fd = uring_poll_fd,
+        .syscall_count = uring_syscall_count,
+        .enable_timestamping = NULL,    // The multishot recv does not return the ancillary data (use rawudp)
+        .recv_timestamps = NULL,
+        .close = uring_close
+};
+
+#else
+
+static int uring_open(Transport *transport, const char *address) {
+    logger(LOG_LEVEL_WARN, "Built without liburing, falling back to rawudp");
+    return uring_fallback_open(transport, address);
+}
+
+// Only open is needed: it always replaces the operations of the transport with the rawudp ones
+const TransportOps uring_transport = {
+        .name = "uring",
+        .open = uring_open
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "transport.h"
+#include "core/zhelpers.h"
+#include "core/logger.h"
+#include <unistd.h>
+
+// =====================================================================================================================
+/* How it works (in a nutshell):
+ * - tcp: the sender binds a PUB socket and the receiver connects a SUB socket subscribed to everything. PUB/SUB has no
+ *        groups, every address carries a single channel. A subscriber that connects after the first messages loses
+ *        them ("slow joiner syndrome"), so the sender waits ZMQ_TCP_SLOW_JOINER_MS after the bind. Reconnections are
+ *        handled by ZMQ on the connecting socket (ZMQ_RECONNECT_IVL).
+ * - udp: the sender connects a RADIO socket and the receiver binds a DISH socket that joins its group (draft API).
+ * - inproc: the sender connects a PUSH socket and the receiver binds a PULL socket, over ZMQ inproc:// (no network
+ *           stack, only the threads of one process that share the ZMQ context, e.g. realmq_bench). PUSH/PULL has no
+ *           groups and never drops: a full queue blocks the sender.
+ * All the backends keep the ZMQ context of the process in transport->context.
+ */
+
+#define ZMQ_TCP_SLOW_JOINER_MS 2000
+#define ZMQ_TCP_RECONNECT_IVL_MS 100
+#define ZMQ_TCP_RECONNECT_IVL_MAX_MS 1000
+
+static int zmq_flags(int flags) {
+    return (flags & TRANSPORT_DONTWAIT) ? ZMQ_DONTWAIT : 0;
+}
+
+static int zmq_transport_recv(Transport *transport, char *buffer, size_t buffer_size, int flags) {
+    return zmq_receive(transport->handle, buffer, buffer_size, zmq_flags(flags));
+}
+
+static int zmq_transport_poll_fd(Transport *transport) {
+    int fd = -1;
+    size_t fd_size = sizeof(fd);
+    if (zmq_getsockopt(transport->handle, ZMQ_FD, &fd, &fd_size) != 0) {
+        return -1;
+    }
+    return fd;
+}
+
+static void zmq_transport_close(Transport *transport) {
+    zmq_close(transport->handle);
+    transport->handle = NULL;
+}
+
+// ================================================= TCP (PUB/SUB) ====================================================
+
+static int zmq_tcp_open(Transport *transport, const char *address) {
+    if (transport->role == TRANSPORT_SENDER) {
+        transport->handle = create_socket(transport->context, ZMQ_PUB, address, transport->timeout, NULL);
+        if (transport->handle == NULL) {
+            return -1;
+        }
+        // Give the subscribers the time to connect before the first message
+        s_sleep(ZMQ_TCP_SLOW_JOINER_MS);
+    } else {
+        transport->handle = create_socket(transport->context, ZMQ_SUB, address, transport->timeout,
+                                          transport->group);
+        if (transport->handle == NULL) {
+            return -1;
+        }
+        int reconnect_ivl = ZMQ_TCP_RECONNECT_IVL_MS;
+        int reconnect_ivl_max = ZMQ_TCP_RECONNECT_IVL_MAX_MS;
+        zmq_setsockopt(transport->handle, ZMQ_RECONNECT_IVL, &reconnect_ivl, sizeof(reconnect_ivl));
+        zmq_setsockopt(transport->handle, ZMQ_RECONNECT_IVL_MAX, &reconnect_ivl_max, sizeof(reconnect_ivl_max));
+    }
+    return 0;
+}
+
+static int zmq_tcp_send(Transport *transport, const char *group, const char *data, size_t size, int flags) {
+    (void) group;   // One channel per address
+    return zmq_send(transport->handle, data, size, zmq_flags(flags));
+}
+
+static int zmq_tcp_send_zero_copy(Transport *transport, const char *group, void *data, size_t size,
+                                  TransportFreeFn free_fn, void *hint) {
+    (void) group;
+    zmq_msg_t message;
+    if (zmq_msg_init_data(&message, data, size, free_fn, hint) != 0) {
+        if (free_fn != NULL) free_fn(data, hint);
+        return -1;
+    }
+    int rc = zmq_msg_send(&message, transport->handle, 0);
+    if (rc == -1) {
+        zmq_msg_close(&message);    // Calls free_fn
+    }
+    return rc;
+}
+
+const TransportOps zmq_tcp_transport = {
+        .name = "tcp",
+        .open = zmq_tcp_open,
+        .send = zmq_tcp_send,
+        .send_batch = NULL,
+        .send_zero_copy = zmq_tcp_send_zero_copy,
+        .recv = zmq_transport_recv,
+        .recv_batch = NULL,
+        .poll_fd = zmq_transport_poll_fd,
+        .syscall_count = NULL,      // The syscalls are issued by the ZMQ I/O threads
+        .enable_timestamping = NULL,    // The sockets are owned by the ZMQ I/O threads
+        .recv_timestamps = NULL,
+        .close = zmq_transport_close
+};
+
+// ================================================ UDP (RADIO/DISH) ==================================================
+
+static int zmq_udp_open(Transport *transport, const char *address) {
+    if (transport->role == TRANSPORT_SENDER) {
+        transport->handle = create_socket(transport->context, ZMQ_RADIO, address, transport->timeout, NULL);
+    } else {
+        transport->handle = create_socket(transport->context, ZMQ_DISH, address, transport->timeout,
+                                          transport->group);
+    }
+    return transport->handle != NULL ? 0 : -1;
+}
+
+static int zmq_udp_send(Transport *transport, const char *group, const char *data, size_t size, int flags) {
+    zmq_msg_t message;
+    zmq_msg_init_size(&message, size);
+    memcpy(zmq_msg_data(&message), data, size);
+
+    int rc = zmq_msg_set_group(&message, group);
+    if (rc != 0) {
+        zmq_msg_close(&message);
+        return rc;
+    }
+
+    rc = zmq_msg_send(&message, transport->handle, zmq_flags(flags));
+    zmq_msg_close(&message);
+    return rc;
+}
+
+static int zmq_udp_send_zero_copy(Transport *transport, const char *group, void *data, size_t size,
+                                  TransportFreeFn free_fn, void *hint) {
+    zmq_msg_t message;
+    if (zmq_msg_init_data(&message, data, size, free_fn, hint) != 0) {
+        if (free_fn != NULL) free_fn(data, hint);
+        return -1;
+    }
+
+    int rc = zmq_msg_set_group(&message, group);
+    if (rc == 0) {
+        rc = zmq_msg_send(&message, transport->handle, 0);
+    }
+    if (rc == -1) {
+        zmq_msg_close(&message);    // Calls free_fn
+    }
+    return rc;
+}
+
+const TransportOps zmq_udp_transport = {
+        .name = "udp",
+        .open = zmq_udp_open,
+        .send = zmq_udp_send,
+        .send_batch = NULL,
+        .send_zero_copy = zmq_udp_send_zero_copy,
+        .recv = zmq_transport_recv,
+        .recv_batch = NULL,
+        .poll_fd = zmq_transport_poll_fd,
+        .syscall_count = NULL,
+        .enable_timestamping = NULL,
+        .recv_timestamps = NULL,
+        .close = zmq_transport_close
+};
+
+// =============================================== INPROC (PUSH/PULL) =================================================
+
+static int zmq_inproc_open(Transport *transport, const char *address) {
+    // Every sender thread connects its own PUSH socket, the receiver binds the PULL socket
+    int type = transport->role == TRANSPORT_SENDER ? ZMQ_PUSH : ZMQ_PULL;
+    transport->handle = create_socket(transport->context, type, address, transport->timeout, NULL);
+    return transport->handle != NULL ? 0 : -1;
+}
+
+const TransportOps zmq_inproc_transport = {
+        .name = "inproc",
+        .open = zmq_inproc_open,
+        .send = zmq_tcp_send,       // One channel per address, as PUB/SUB
+        .send_batch = NULL,
+        .send_zero_copy = zmq_tcp_send_zero_copy,
+        .recv = zmq_transport_recv,
+        .recv_batch = NULL,
+        .poll_fd = zmq_transport_poll_fd,
+        .syscall_count = NULL,
+        .enable_timestamping = NULL,
+        .recv_timestamps = NULL,
+        .close = zmq_transport_close
+};
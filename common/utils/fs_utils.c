@@ -3,103 +3,104 @@
 #include "time_utils.h"
 #include "core/config.h"
 #include "qos/dynamic_array.h"
-#include <json-c/json.h>
-#include <json_object.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
 
 
 char *date_time = NULL;
 static int file_counter = 0; // Counter for the file names
-#define MAX_MESSAGES 100000 // Max messages per file
-pthread_mutex_t json_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for json_messages
-json_object *g_json_messages = NULL; // Global JSON object to store the received messages
+pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER; // Serializes the exports
+LatencyRecords g_latency_records; // Latency of the received messages
+static StatsWriter g_stats_writer; // Appends the new records to the current stats file
+static bool g_stats_writer_open = false;
+static char g_stats_metadata[512]; // Run metadata in the header of the columnar stats files
+LatencyHistogram g_latency_histogram; // Latency of all the received messages (us)
+static LatencyHistogram g_histogram_previous; // g_latency_histogram at the previous report
+static LatencyHistogram g_histogram_interval;
+static long long g_histogram_tick_us = 0; // Time of the previous report
+static FILE *g_histogram_file = NULL; // Histograms of the intervals (config.histogram_file)
+ClockOffset g_clock_offset; // Offset of the clock of the client (0 until the first exchange)
 
 /**
- * @brief Save statistics to a file
+ * @brief Path of a stats file, creating its folder
+ * @param index Rotation counter of the file
+ * @param arg
+ * @return The path (malloc'd)
  */
-void save_stats_to_file(json_object **json_messages_ptr) {
-
-    if (json_messages_ptr == NULL || *json_messages_ptr == NULL || json_object_array_length(*json_messages_ptr) == 0) {
-        return;
-    }
-
-    pthread_mutex_lock(&json_mutex); // Lock the mutex
-
-    json_object *json_messages = *json_messages_ptr; // Dereference the pointer for easier usage
-
-    bool free_space = false;
-    if (json_object_array_length(json_messages) >= MAX_MESSAGES) {
-        // Get new file name
-        file_counter++;
-        free_space = true;
-    }
-
-
+static char *stats_file_path(int index, void *arg) {
+    (void) arg;
+    file_counter = index;
     char *fullPath = create_stats_path();
+    if (fullPath == NULL) {
+        return NULL;
+    }
 
     // Extract the folder path
     char *folder = strdup(fullPath); // Duplicate fullPath because dirname can modify the input argument
-    char *dir = dirname(folder);
-
+    create_if_not_exist_folder(dirname(folder));
     free(folder); // Free the memory allocated by strdup
+    return fullPath;
+}
 
-    create_if_not_exist_folder(dir);
-
-    logger(LOG_LEVEL_DEBUG, "Saving statistics to file: %s", fullPath);
-
-    // Todo check if the file exists with bool check_file_exists(char* fullPath) and if it exists, append to it instead of overwriting it
-
-    FILE *file = fopen(fullPath, "w");
-    free(fullPath);
-
-    if (file == NULL) {
-        logger(LOG_LEVEL_ERROR, "Impossibile aprire il file per la scrittura.");
-        pthread_mutex_unlock(&json_mutex); // Unlock the mutex
+/**
+ * @brief Save statistics to a file: only the records received since the previous save are appended to the current
+ * file, that is rotated after config.stats_file_records records or config.stats_file_mb MB
+ */
+void save_stats_to_file(LatencyRecords *records) {
+    if (records == NULL || records->capacity == 0) {
         return;
     }
 
-    if (config.use_json) {
-        json_object *jobj = json_object_new_object();
-        json_object_object_add(jobj, "messages", json_messages);
-
-        const char *json_data = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY);
-        fprintf(file, "%s\n", json_data);
-
-        // Clear json_messages
-        json_messages = json_object_new_array(); // Added to store all messages
-    } else {
-        // Write the CSV header
-        fprintf(file, "id,num,diff\n");
+    // The stats thread is cancelled at the end of the run: never in the middle of a write, holding the mutex
+    int cancel_state;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    pthread_mutex_lock(&stats_mutex); // Lock the mutex
 
-        unsigned long array_len = json_object_array_length(json_messages);
-        for (unsigned int i = 0; i < array_len; i++) {
-            json_object *json_msg = json_object_array_get_idx(json_messages, i);
-
-            uint64_t send_time = json_object_get_int64(json_object_object_get(json_msg, "send_time"));
-            uint64_t recv_time = json_object_get_int64(json_object_object_get(json_msg, "recv_time"));
-
-            double diff = (double) (recv_time - send_time);
-
-            diff = diff / 1000; // Convert from nanoseconds to milliseconds
-
-            if (json_msg) {
-                fprintf(file, "%s,%d,%.4f\n",
-                        json_object_get_string(json_object_object_get(json_msg, "id")),
-                        i + 1,
-                        diff
-                );
-            }
+    if (!g_stats_writer_open) {
+        if (date_time == NULL) {
+            date_time = get_current_date_time();
         }
+        snprintf(g_stats_metadata, sizeof(g_stats_metadata),
+                 "date_time=%s\nprotocol=%s\nnum_threads=%d\nnum_messages=%d\nmessage_size=%d\n"
+                 "msg_per_minute=%d\nsubscriber_id=%d\ntimestamping=%d\n",
+                 date_time, config.protocol, config.num_threads, config.num_messages,
+                 config.message_size, config.use_msg_per_minute ? config.msg_per_minute : 0, config.subscriber_id,
+                 config.timestamping);
+        StatsWriterOptions options = {
+                .path_fn = stats_file_path,
+                .path_arg = NULL,
+                .format = config.use_binary ? STATS_FORMAT_COLUMNAR
+                          : config.use_json ? STATS_FORMAT_JSON : STATS_FORMAT_CSV,
+                .metadata = g_stats_metadata,
+                // With the latency components when the kernel timestamps are enabled
+                .components = config.timestamping,
+                .max_file_records = config.stats_file_records > 0 ? (uint64_t) config.stats_file_records : 0,
+                .max_file_bytes = config.stats_file_mb > 0 ? (size_t) config.stats_file_mb * 1024 * 1024 : 0
+        };
+        g_stats_writer_open = open_stats_writer(&g_stats_writer, &options) == 0;
     }
-    fclose(file);
-
-    if (free_space) {
-        // Clean the json_messages array
-        json_object_put(json_messages); // This will free the memory associated with json_messages
-        *json_messages_ptr = json_object_new_array(); // Create a new array and update the original pointer
+    if (g_stats_writer_open && stats_writer_flush(&g_stats_writer, records) < 0) {
+        logger(LOG_LEVEL_ERROR, "Impossibile aprire il file per la scrittura.");
     }
 
-    pthread_mutex_unlock(&json_mutex); // Unlock the mutex
+    pthread_mutex_unlock(&stats_mutex); // Unlock the mutex
+    pthread_setcancelstate(cancel_state, NULL);
+}
 
+/**
+ * @brief Complete and close the current stats file (the next save starts a new writer)
+ */
+void close_stats_file() {
+    pthread_mutex_lock(&stats_mutex);
+    if (g_stats_writer_open) {
+        logger(LOG_LEVEL_DEBUG, "Stats: %" PRIu64 " records, %" PRIu64 " bytes in %" PRIu64 " flushes, %" PRIu64
+                                " rotations", g_stats_writer.records, g_stats_writer.bytes, g_stats_writer.flushes,
+               g_stats_writer.rotations);
+        close_stats_writer(&g_stats_writer);
+        g_stats_writer_open = false;
+    }
+    pthread_mutex_unlock(&stats_mutex);
 }
 
 
@@ -138,7 +139,8 @@ char *create_stats_path() {
     }
 
     // Get the file extension
-    char *file_extension = config.use_json ? ".json" : ".csv";  // Added the dot (.) before the extensions
+    // Added the dot (.) before the extensions
+    char *file_extension = config.use_binary ? STATS_COLUMNAR_EXTENSION : config.use_json ? ".json" : ".csv";
 
     // Calculate the total length of the final string
     // Lengths of the folder path, date_time, file extension, and additional characters
@@ -176,43 +178,159 @@ void release_date_time() {
     date_time = NULL;
 }
 
-// ============================================= JSON Processing =======================================================
+// ============================================= Latency Records =======================================================
 
 /**
- * @brief Initialize the global JSON object
+ * @brief Initialize the global latency records
+ * @param capacity Records of a stats file
+ * @return 0 on success, -1 on error
  */
-void init_json_messages() {
-    if (g_json_messages == NULL) {
-        g_json_messages = json_object_new_array();
+int init_stats_records(size_t capacity) {
+    if (g_latency_records.capacity != 0) {
+        return 0;
+    }
+    if (init_histogram(&g_latency_histogram, config.histogram_bits) != 0 ||
+        init_histogram(&g_histogram_previous, config.histogram_bits) != 0 ||
+        init_histogram(&g_histogram_interval, config.histogram_bits) != 0) {
+        return -1;
     }
+    g_histogram_tick_us = get_current_time_microseconds();
+    g_latency_histogram.start_us = g_histogram_tick_us;
+    init_clock_offset(&g_clock_offset);
+    return init_latency_records(&g_latency_records, capacity);
 }
 
 /**
- * @brief Free the global JSON object
+ * @brief Free the global latency records
  */
-void release_json_messages() {
-    json_object_put(g_json_messages);
-    g_json_messages = NULL;
+void release_stats_records() {
+    close_stats_file();
+    if (atomic_load(&g_latency_records.dropped) > 0) {
+        logger(LOG_LEVEL_WARN, "Latency records dropped (stats ring full): %" PRIu64,
+               (uint64_t) atomic_load(&g_latency_records.dropped));
+    }
+    release_latency_records(&g_latency_records);
+
+    if (g_histogram_file != NULL) {
+        fclose(g_histogram_file);
+        g_histogram_file = NULL;
+    }
+    release_histogram(&g_latency_histogram);
+    release_histogram(&g_histogram_previous);
+    release_histogram(&g_histogram_interval);
 }
 
 /**
- * @brief Add a new message to the global JSON object
- * @param json_str
- * @param recv_time
+ * @brief Add the latency record of a new message, and its latency to the histogram. With the kernel timestamps, the
+ * record also keeps the send call, the kernel receive and the return of the receive call, for the components of the
+ * one-way latency:
+ * - queue: from the creation of the message to the send call (marshalling and batching on the client)
+ * - wire: from the send call to the kernel receive timestamp (sender stack, NIC and network)
+ * - stack: from the kernel receive timestamp to the return of the receive call (receiver stack and scheduling)
+ * @param msg
+ * @param timestamps Timestamps of the transport (NULL if not available), the receive time is the return of the
+ * receive call instead of now, so the latency does not include the decoding of the message
+ * @return The one-way latency of the message in microseconds
  */
-void process_json_message(Message *msg) {
-    long long recv_time = get_current_time_microseconds(); // Get the current time
-    // Add the message to the statistical data
-
-    // Create a JSON object for the message
-    json_object *j_obj = json_object_new_object();
-    json_object_object_add(j_obj, "id", json_object_new_int64((long long)msg->id));
-    json_object_object_add(j_obj, "send_time", json_object_new_int64(msg->timestamp));
-    json_object_object_add(j_obj, "recv_time", json_object_new_int64(recv_time));
-    // json_object_object_add(j_obj, "message", json_object_new_string(msg->content));
-
-    pthread_mutex_lock(&json_mutex);    // Import for not corrupting the json_messages array during the saving
-    json_object_array_add(g_json_messages, j_obj);
-    pthread_mutex_unlock(&json_mutex);
+long long record_message_latency(Message *msg, const TransportTimestamps *timestamps) {
+    bool has_timestamps = timestamps != NULL && timestamps->send_ns != 0 && timestamps->user_rx_ns != 0;
+    long long recv_time = has_timestamps ? (long long) (timestamps->user_rx_ns / 1000)
+                                         : get_current_time_microseconds(); // Get the current time
+
+    // Send time on the clock of the server: minus the offset of the client clock (0 without clock sync)
+    double offset_us = clock_offset_at(&g_clock_offset, recv_time);
+    long long send_time = msg->timestamp - llround(offset_us);
+
+    // A copy into the preallocated ring, no allocation and no lock
+    LatencyRecord record = {
+            .id = msg->id,
+            .send_time = send_time,
+            .recv_time = recv_time
+    };
+    if (has_timestamps) {
+        record.send_ns = (int64_t) timestamps->send_ns - llround(offset_us * 1000.0);
+        record.recv_ns = (int64_t) timestamps->user_rx_ns;
+        record.kernel_rx_ns = (int64_t) timestamps->kernel_rx_ns;
+        record.hardware = timestamps->hardware;
+    }
+    append_latency_record(&g_latency_records, &record);
+
+    long long latency_us = recv_time - send_time;
+    if (latency_us >= 0 && g_latency_histogram.counts != NULL) {
+        histogram_record(&g_latency_histogram, (uint64_t) latency_us);
+    }
+    return latency_us;
+}
+
+/**
+ * @brief Append a histogram to the .hist file of the run (opened by the first call)
+ * @param histogram
+ */
+static void append_histogram_file(const LatencyHistogram *histogram) {
+    if (g_histogram_file == NULL) {
+        if (date_time == NULL) {
+            date_time = get_current_date_time();
+        }
+        create_if_not_exist_folder(config.stats_folder_path);
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s_%s_latency.hist", config.stats_folder_path, date_time, config.protocol);
+        g_histogram_file = fopen(path, "ab");
+        if (g_histogram_file == NULL) {
+            logger(LOG_LEVEL_ERROR, "Failed to open the histogram file %s", path);
+            return;
+        }
+    }
+
+    size_t size = histogram_encoded_max_size(histogram);
+    uint8_t *buffer = malloc(size);
+    if (buffer == NULL) {
+        return;
+    }
+    size = histogram_encode(histogram, buffer, size);
+    fwrite(buffer, 1, size, g_histogram_file);
+    fflush(g_histogram_file);
+    free(buffer);
+}
+
+static void log_percentiles(const char *name, const LatencyHistogram *histogram) {
+    logger(LOG_LEVEL_INFO2, "Latency %s (%" PRIu64 " messages): p50 %" PRIu64 " us, p90 %" PRIu64 " us, p99 %" PRIu64
+                            " us, p99.9 %" PRIu64 " us, max %" PRIu64 " us", name, histogram_count(histogram),
+           histogram_percentile(histogram, 50), histogram_percentile(histogram, 90),
+           histogram_percentile(histogram, 99), histogram_percentile(histogram, 99.9),
+           histogram_count(histogram) > 0 ? (uint64_t) histogram->max : 0);
 }
 
+/**
+ * @brief Log the latency percentiles of the interval since the previous report and of the whole run, and append the
+ * histogram of the interval to the .hist file (config.histogram_file)
+ */
+void report_latency_histogram() {
+    if (g_latency_histogram.counts == NULL) {
+        return;
+    }
+    int cancel_state;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    pthread_mutex_lock(&stats_mutex);
+
+    long long now_us = get_current_time_microseconds();
+    histogram_interval(&g_histogram_interval, &g_latency_histogram, &g_histogram_previous);
+    g_histogram_interval.start_us = g_histogram_tick_us;
+    g_histogram_interval.end_us = now_us;
+    g_latency_histogram.end_us = now_us;
+    g_histogram_tick_us = now_us;
+
+    log_percentiles("interval", &g_histogram_interval);
+    log_percentiles("cumulative", &g_latency_histogram);
+    double offset_us, uncertainty_us, drift_ppm;
+    uint64_t exchanges;
+    if (clock_offset_snapshot(&g_clock_offset, &offset_us, &uncertainty_us, &drift_ppm, &exchanges)) {
+        logger(LOG_LEVEL_INFO2, "Client clock offset: %.1f us (+/- %.1f us, drift %.2f ppm, %" PRIu64 " exchanges)",
+               offset_us, uncertainty_us, drift_ppm, exchanges);
+    }
+    if (config.histogram_file && histogram_count(&g_histogram_interval) > 0) {
+        append_histogram_file(&g_histogram_interval);
+    }
+
+    pthread_mutex_unlock(&stats_mutex);
+    pthread_setcancelstate(cancel_state, NULL);
+}
@@ -19,19 +19,28 @@
 #include <pthread.h>
 #include <assert.h>
 #include <stdbool.h>
-#include <json-c/json.h>
 #include "qos/dynamic_array.h"
+#include "transport/transport.h"
+#include "stats/latency_records.h"
+#include "stats/stats_writer.h"
+#include "stats/histogram.h"
+#include "stats/clock_offset.h"
 
 
 // Get the date + time for the filename
 extern char *date_time;
 
-extern pthread_mutex_t json_mutex; // Mutex for json_messages
-extern json_object *g_json_messages; // Global JSON object to store the received messages
+extern pthread_mutex_t stats_mutex; // Serializes the saves (the receive threads never take it)
+extern LatencyRecords g_latency_records; // Latency of the received messages, exported by save_stats_to_file
+extern LatencyHistogram g_latency_histogram; // Latency of all the received messages (us), for the percentiles
+extern ClockOffset g_clock_offset; // Offset of the clock of the client, subtracted from the latency (server thread)
 
 
-// Function to save the statistics to a file
-void save_stats_to_file(json_object **json_messages_ptr);
+// Function to append the records received since the previous save to the current statistics file
+void save_stats_to_file(LatencyRecords *records);
+
+// Function to complete and close the current statistics file
+void close_stats_file();
 
 // Function to check if a file exists
 bool check_file_exists(char *file_path);
@@ -45,14 +54,17 @@ char *create_stats_path();
 // Function to release the date_time variable
 void release_date_time();
 
-// Function to initialize the global JSON object
-void init_json_messages();
+// Function to initialize the global latency records (capacity records per stats file), return 0 on success
+int init_stats_records(size_t capacity);
+
+// Free the global latency records
+void release_stats_records();
 
-// Free the global JSON object
-void release_json_messages();
+// Log the interval and cumulative latency percentiles (and append the interval to the histogram file)
+void report_latency_histogram();
 
-// Add a new message to the global JSON object
-void process_json_message(Message *message);
+// Add the latency record of a new message, return its latency in microseconds (timestamps can be NULL)
+long long record_message_latency(Message *message, const TransportTimestamps *timestamps);
 
 
 #endif //FS_UTILS_H
@@ -113,6 +113,17 @@ long long get_current_time_nanos() {
     return (long long) (ts.tv_sec) * 1000000000 + (long long) (ts.tv_nsec);
 }
 
+/**
+ * @brief Get the monotonic time (precision: nanoseconds), not affected by the changes of the wall clock
+ *
+ * @return uint64_t
+ */
+uint64_t get_monotonic_time_nanos(void) {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
 
 /**
  * @brief Get the current time object
@@ -8,6 +8,7 @@
 #define TIME_UTILS_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 #include <signal.h>
@@ -52,6 +53,9 @@ long long get_current_time_millis();
 // Function to get the current time in nanoseconds
 long long get_current_time_nanos();
 
+// Function to get the monotonic time in nanoseconds (intervals and timeouts, not comparable across hosts)
+uint64_t get_monotonic_time_nanos(void);
+
 // Function to get the current time as timespec
 timespec get_current_time();
 
@@ -24,7 +24,7 @@ char *IDS_SEPARATOR = ",";
  * @param responder
  * @param last_id
  */
-void process_message_ids(void *responder, char *last_id) {
+void process_message_ids(Transport *responder, char *last_id) {
     pthread_mutex_lock(&message_ids_mutex); // ensure thread safety
 
     if (num_message_ids > 0) {
@@ -57,7 +57,7 @@ void process_message_ids(void *responder, char *last_id) {
                 }
 
                 // Send the current string of IDs
-                while (zmq_send_group(responder, get_group(RESPONDER_GROUP), ids_string, 0) < 0) {
+                while (transport_send(responder, get_group(RESPONDER_GROUP), ids_string, strlen(ids_string), 0) < 0) {
                     if (errno == EAGAIN) {
                         logger(LOG_LEVEL_ERROR, "Timeout occurred while sending IDs.");
                         continue; // Or apply your desired logic for timeouts
@@ -78,7 +78,7 @@ void process_message_ids(void *responder, char *last_id) {
 
         if (ids_string[0] != '\0' && current_id_count > 0) {
             // Send remaining IDs
-            while (zmq_send_group(responder, get_group(RESPONDER_GROUP), ids_string, 0) < 0) {
+            while (transport_send(responder, get_group(RESPONDER_GROUP), ids_string, strlen(ids_string), 0) < 0) {
                 if (errno == EAGAIN) {
                     logger(LOG_LEVEL_ERROR, "Timeout occurred while sending IDs.");
                     continue; // Or apply your desired logic for timeouts
@@ -18,6 +18,7 @@
 #include <libgen.h>
 #include <pthread.h>
 #include <assert.h>
+#include "transport/transport.h"
 
 // Flag to indicate if keyboard interruption has been received
 extern volatile sig_atomic_t interrupted;
@@ -31,7 +32,7 @@ extern char *IDS_SEPARATOR;
 extern pthread_mutex_t message_ids_mutex; // Mutex to protect message_ids
 
 // Function that process the IDs received since the last heartbeat and send them back to the client
-void process_message_ids(void *responder, char *last_id);
+void process_message_ids(Transport *responder, char *last_id);
 
 // Function to get message ID from the list of IDs using the index
 char *get_message_id(int index);
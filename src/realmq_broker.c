@@ -0,0 +1,107 @@
+#include <zmq.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include "utils/utils.h"
+#include "core/config.h"
+#include "core/logger.h"
+#include "core/zhelpers.h"
+#include "core/topics.h"
+#include "core/realtime.h"
+#include "transport/transport.h"
+#include "broker/broker.h"
+
+//#define QOS_ENABLE    // Better enable it from the CMakelists.txt
+
+// ============================================= Global configuration ==================================================
+void *g_shared_context;
+Logger broker_logger;
+Broker g_broker;
+// =====================================================================================================================
+
+int main(void) {
+    printf("Broker started\n");
+    signal(SIGINT, handle_interrupt); // Register the interruption handling function
+
+    logConfig logger_config = {
+            .show_timestamp = 1,
+            .show_logger_name = 1,
+            .show_thread_id = 1,
+            .log_to_console = 1,
+            .log_level = LOG_LEVEL_INFO
+    };
+
+    Logger_init("realmq_broker", &logger_config, &broker_logger);
+
+    if (read_config("../config.yaml") != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to read config.yaml");
+        return 1;
+    }
+
+    // Print configuration
+    print_configuration();
+
+    // Topics (same order as the producers and the consumers, so the same IDs)
+    if (init_topics(config.topics, NULL) == -1) {
+        logger(LOG_LEVEL_ERROR, "Failed to initialize the topics");
+        return 1;
+    }
+
+    apply_process_realtime_profile();
+    g_shared_context = create_context();
+
+    // get_address returns a shared buffer, the addresses are copied
+    char ingress_address[TRANSPORT_ADDRESS_SIZE];
+    char producer_ack_address[TRANSPORT_ADDRESS_SIZE];
+    char consumer_ack_address[TRANSPORT_ADDRESS_SIZE];
+    snprintf(ingress_address, sizeof(ingress_address), "%s", get_address(MAIN_ADDRESS));
+    snprintf(producer_ack_address, sizeof(producer_ack_address), "%s", get_address(RESPONDER_ADDRESS));
+    snprintf(consumer_ack_address, sizeof(consumer_ack_address), "%s://%s", config.protocol,
+             config.broker.ack_address != NULL ? config.broker.ack_address : "");
+
+    BrokerOptions options = {
+            .protocol = config.protocol,
+            .context = g_shared_context,
+            .ingress_address = ingress_address,
+#ifdef QOS_ENABLE
+            // Hop-by-hop ACKs, as the client and the server
+            .producer_ack_address = producer_ack_address,
+            .consumer_ack_address = config.broker.ack_address != NULL ? consumer_ack_address : NULL,
+#endif
+            .broker_id = config.subscriber_id,
+            .shards = config.broker.shards,
+            .first_cpu = config.broker.first_cpu,
+            .producers = config.broker.producers,
+            .heartbeat_ms = config.broker.heartbeat_ms,
+            .resend_ms = config.broker.resend_ms,
+            .timeout = config.signal_msg_timeout,
+            .pool_frames = 0
+    };
+
+    if (init_broker(&g_broker, &options) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to initialize the broker");
+        return 1;
+    }
+    if (broker_add_consumers(&g_broker, config.broker.consumers) == -1 || start_broker(&g_broker) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to start the broker");
+        release_broker(&g_broker);
+        return 1;
+    }
+
+    // Until the STOP of all the producers, or Ctrl+C (the queued frames are still forwarded)
+    while (!interrupted && g_broker.running_shards > 0) {
+        sleep(1);
+    }
+    stop_broker(&g_broker);
+
+    report_broker(&g_broker);
+    report_topics("broker");
+
+    // Release resources
+    release_broker(&g_broker);
+    zmq_ctx_destroy(g_shared_context);
+    release_topics();
+    release_config();
+
+    return 0;
+}
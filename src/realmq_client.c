@@ -4,38 +4,84 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <ctype.h>
+#include <inttypes.h>
 #include "utils/utils.h"
 #include "utils/time_utils.h"
 #include "core/zhelpers.h"
+#include "transport/transport.h"
+#include "transport/fragment.h"
 #include "core/logger.h"
 #include "core/config.h"
 #include "qos/accrual_detector.h"
 #include "qos/dynamic_array.h"
+#include "qos/subscribers.h"
+#include "qos/retransmit_store.h"
 // #include "utils/memory_leak_detector.h"
 #include "qos/accrual_detector/phi_accrual_failure_detector.h"
 #include "string_manip.h"
+#include "core/counters.h"
+#include "core/realtime.h"
+#include "core/topics.h"
+#include "stats/metrics.h"
+#include "core/trace.h"
+#include "stats/clock_offset.h"
+#include "stats/echo.h"
 
 //#define QOS_ENABLE    // Better enable it from the CMakelists.txt
 
 // ============================================= Global configuration ==================================================
 void *g_shared_context;
-void *g_radio;
-int g_count_msg = 0;
-int g_missed_count = 0;
+Transport *g_radio;
 
 Logger client_logger;
 
-// Mutex for g_count_msg
-pthread_mutex_t g_count_msg_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t g_array_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Payload sizes cycled by the messages (echo.payload_sizes, or message_size alone)
+int g_payload_sizes[ECHO_MAX_SIZES];
+int g_payload_count = 0;
+int g_payload_max = 0;
+EchoStats g_echo;               // Round trips of the echo mode (written by the responder thread)
 // =====================================================================================================================
 
 #ifdef QOS_ENABLE
+
+/**
+ * @brief Answer a clock offset probe of a server with a heartbeat carrying the times of the exchange
+ * (1:sync:<subscriber_id>|<t1>|<t2>|<t3>).
+ * @param probe The probe without its header (sync:<t1>)
+ * @param subscriber_id The server that sent it
+ * @param recv_us Time of the probe (t2)
+ */
+static void reply_clock_probe(const char *probe, int subscriber_id, long long recv_us) {
+    long long t1 = strtoll(probe + strlen(CLOCK_SYNC_PREFIX), NULL, 10);
+    char reply[128];
+    int len = snprintf(reply, sizeof(reply), "%s%s%d|%lld|%lld|%lld", control_frame(TOPIC_HEARTBEAT),
+                       CLOCK_SYNC_PREFIX, subscriber_id, t1, recv_us, get_current_time_microseconds());
+    transport_send(g_radio, get_group(MAIN_GROUP), reply, (size_t) len, 0);
+}
+
 void *responder_thread(void *arg) {
-    void *socket = (void *) arg;
+    apply_thread_realtime_profile(THREAD_ROLE_RESPONDER);
+
+    Transport *dish = (Transport *) arg;
+
+    ReceiveContext receive_ctx;
+    init_receive_context(&receive_ctx, config.receive_strategy, config.spin_us, config.signal_msg_timeout);
+
+    // The ACKs fit in 2 KB, the reflected frames of the echo mode are as large as the messages
+    size_t buffer_size = 2048;
+    if (config.echo.mode != ECHO_OFF && (size_t) g_payload_max + 256 > buffer_size) {
+        buffer_size = (size_t) g_payload_max + 256;
+    }
+    char *buffer = malloc(buffer_size);
+    if (buffer == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the responder buffer");
+        return NULL;
+    }
+
     while (true) {
-        char buffer[2048];
-        if (zmq_receive(socket, buffer, sizeof(buffer), 0) == -1) {
+        if (receive_with_strategy(&receive_ctx, dish, buffer, buffer_size) == -1) {
+            // No ACK within the timeout: release the messages held back only by the subscribers declared dead
+            retransmit_stores_release_acked(live_subscribers_mask(0));
             continue;
         }
 
@@ -43,18 +89,48 @@ void *responder_thread(void *arg) {
             logger(LOG_LEVEL_INFO, "Received STOP message");
             break;
         }
+        long long recv_us = get_current_time_microseconds();
 
         // printf("Buffer: %s\n", buffer);
 
+        // Every ACK starts with the ID of the subscriber (server) that sent it
+        int subscriber_id;
+        const char *ids = parse_ack_header(buffer, &subscriber_id);
+        if (subscriber_ack_received(subscriber_id) == -1) {
+            continue;
+        }
+
+        // NACK of the missing fragments of a large message: only those are resent
+        if (strncmp(ids, FRAGMENT_NACK_PREFIX, strlen(FRAGMENT_NACK_PREFIX)) == 0) {
+            fragment_resend(g_radio, get_group(MAIN_GROUP), ids);
+            continue;
+        }
+
+        // Clock offset probe of the server: answered at once, its times give the offset of the two clocks
+        if (strncmp(ids, CLOCK_SYNC_PREFIX, strlen(CLOCK_SYNC_PREFIX)) == 0) {
+            reply_clock_probe(ids, subscriber_id, recv_us);
+            continue;
+        }
+
+        // Message reflected by the server (echo mode): its round trip, from its creation to now
+        if (strncmp(ids, ECHO_PREFIX, strlen(ECHO_PREFIX)) == 0) {
+            echo_record(&g_echo, ids + strlen(ECHO_PREFIX), recv_us);
+            continue;
+        }
+
         // Retrieve all messages ids sent from the client to the server
-        DynamicArray *new_array = unmarshal_uint64_array(buffer);
+        TRACE_BEGIN(TRACE_ACK_DECODE, subscriber_id);
+        DynamicArray *new_array = unmarshal_uint64_array(ids);
+        TRACE_END(TRACE_ACK_DECODE, new_array != NULL ? new_array->size : 0);
         if (new_array == NULL) {
             continue;
         }
 
-        pthread_mutex_lock(&g_array_mutex);
-        int missed_count = diff_from_arrays(&g_array, new_array, g_radio);
-        pthread_mutex_unlock(&g_array_mutex);
+        // Applied to the store of every topic, each one under its own lock
+        TRACE_BEGIN(TRACE_ACK_DIFF, new_array->size);
+        int missed_count = retransmit_stores_ack(new_array, subscriber_id, live_subscribers_mask(0), g_radio);
+        TRACE_END(TRACE_ACK_DIFF, missed_count);
+        gauge_set(GAUGE_RETRANSMIT_WINDOW, (double) retransmit_stores_pending());
 
         // Release the resources
         release_dynamic_array(new_array);
@@ -64,44 +140,87 @@ void *responder_thread(void *arg) {
         if (missed_count) logger(LOG_LEVEL_WARN, "Missed count: %d", missed_count);
         adjust_intervals(g_detector->state->history, missed_count);
 
-        // Update the g_missed_count
-        if (missed_count > 0) {
-            pthread_mutex_lock(&g_count_msg_mutex);
-            g_missed_count += missed_count;
-            pthread_mutex_unlock(&g_count_msg_mutex);
-        }
+        // Update the missed counter (lock-free, per-thread slot)
+        if (missed_count > 0) counter_add(COUNTER_MISSED, missed_count);
     }
 
+    free(buffer);
+    report_receive_context(&receive_ctx, "responder");
     logger(LOG_LEVEL_DEBUG, "Responder thread exiting");
     return NULL;
 }
 #endif
 
 
+// Messages of a sender thread waiting to be sent with a single batch
+typedef struct {
+    const char **buffers;       // Marshaled messages
+    size_t *sizes;
+    long long *deadlines;       // Absolute deadlines of the messages (0 for none)
+    int count;
+} SendQueue;
+
+
+/**
+ * @brief Send the pending messages of a queue with a single batch, earliest-deadline-first, and release their buffers.
+ * @param radio
+ * @param queue Emptied
+ * @return 0 on success, -1 if not all the messages were sent
+ */
+static int flush_send_queue(Transport *radio, SendQueue *queue) {
+    if (queue->count == 0) {
+        return 0;
+    }
+
+    sort_by_deadline(queue->buffers, queue->sizes, queue->deadlines, (size_t) queue->count);
+    TRACE_BEGIN(TRACE_SEND, queue->count);
+    int sent = transport_send_batch(radio, get_group(MAIN_GROUP), queue->buffers, queue->sizes, queue->count);
+    TRACE_END(TRACE_SEND, sent);
+    for (int i = 0; i < queue->count; i++) {
+        if (i < sent) {
+            counter_add(COUNTER_BYTES_SENT, queue->sizes[i]);
+        }
+        free((void *) queue->buffers[i]);
+    }
+    if (sent > 0) {
+        counter_add(COUNTER_SENT, sent);
+    }
+
+    int rc = sent == queue->count ? 0 : -1;
+    queue->count = 0;
+    return rc;
+}
+
+
+
 void client_thread(void *thread_id) {
     signal(SIGINT, handle_interrupt); // Register the interruption handling function
 
     int thread_num = *(int *) thread_id;
-    int rc;
 
-    // Unique radio for each thread
-    void *radio = create_socket(
+    apply_thread_realtime_profile(THREAD_ROLE_SENDER);
+
+    // Unique radio for each thread (the backend is picked from the protocol in the configuration)
+    Transport *radio = transport_open(
+            config.protocol,
             g_shared_context,
-            get_zmq_type(CLIENT),
+            TRANSPORT_SENDER,
             get_address(MAIN_ADDRESS),
-            config.signal_msg_timeout,
-            NULL
+            NULL,
+            config.signal_msg_timeout
     );
-
-    // Send first message only with TCP for avoiding the problem of "slow joiner syndrome."
-    if (get_protocol_type() == TCP) {
-        rc = zmq_send_group(radio, "GRP", "START", 0);
-        if (rc == -1) {
-            printf("Error in sending message\n");
-            return;
-        }
-        logger(LOG_LEVEL_INFO, "Sent START message");
-        sleep(2);
+    if (radio == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the transport of thread %d", thread_num);
+        return;
+    }
+    if (config.timestamping) {
+        // Kernel send timestamps: the sender stack time is reported when the transport is closed
+        transport_enable_timestamping(radio);
+    }
+    if (enable_configured_fragmentation(radio) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to enable the fragmentation of thread %d", thread_num);
+        transport_close(radio);
+        return;
     }
 
     // Wait for the specified time before starting to send messages
@@ -109,9 +228,43 @@ void client_thread(void *thread_id) {
 
     int count_msg = 0;
 
+    // Buffer of the messages, of the largest payload size (+1 for the null terminator)
+    char *message = malloc((size_t) g_payload_max + 1);
+    if (message == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the messages of thread %d", thread_num);
+        transport_close(radio);
+        return;
+    }
+
+    // Topic of the messages of this thread (the threads are spread round robin over the configured topics)
+    uint16_t topic_id = topic_for_thread(thread_num);
+
+    // QoS class of the messages of the topic: only the reliable ones are tracked, acknowledged and resent
+    QosClass qos = topic_qos(topic_id);
+    bool reliable = qos == QOS_RELIABLE;
+
+    // Deadline of the messages of the topic after their creation (0: no deadline)
+    long long deadline_us = topic_deadline_us(topic_id);
+
+    // Reliable messages of the topic awaiting ACK, shared only with the other threads of the topic
+    RetransmitStore *store = retransmit_store(topic_id);
+    if (reliable && store == NULL) {
+        logger(LOG_LEVEL_ERROR, "No retransmission store for topic %u of thread %d", topic_id, thread_num);
+        transport_close(radio);
+        free(message);
+        return;
+    }
+
+    // Messages waiting to be sent with a single batch (config.send_batch_size = 1 sends them one by one), all of the
+    // class of the topic of the thread
+    const char *queue_buffers[config.send_batch_size];
+    size_t queue_sizes[config.send_batch_size];
+    long long queue_deadlines[config.send_batch_size];
+    SendQueue queue = {.buffers = queue_buffers, .sizes = queue_sizes, .deadlines = queue_deadlines, .count = 0};
+
 #ifdef QOS_ENABLE
     // Send the first heartbeat
-    send_heartbeat(NULL, NULL, true);
+    if (reliable) send_heartbeat(NULL, NULL, true);
 #endif
 
     // Message Loop
@@ -119,34 +272,28 @@ void client_thread(void *thread_id) {
 
         // Only used for STOPPING thread
         if (count_msg == config.num_messages) {
+            if (flush_send_queue(radio, &queue) == -1) {
+                printf("Error in sending message\n");
+            }
 
 #ifdef QOS_ENABLE
-            // Before sending the STOP message, wait until the g_array is empty (all messages are sent)
-            while (true) {
-                // Wait until g_array is empty
-                pthread_mutex_lock(&g_array_mutex);
-                if (g_array.size == 0) {
-                    pthread_mutex_unlock(&g_array_mutex);
-                    break;
-                }
+            // Before sending the STOP message, wait until the stores of every topic are empty (all messages are sent)
+            while (retransmit_stores_pending() != 0) {
                 // Send a heartbeat message (for flushing the messages)
                 send_heartbeat(radio, get_group(MAIN_GROUP), true);
 
-                // logger(LOG_LEVEL_INFO, "[*stop*] Waiting for g_array to be empty (size: %d)", g_array.size);
+                // logger(LOG_LEVEL_INFO, "[*stop*] Waiting for the stores to be empty (size: %zu)",
+                //        retransmit_stores_pending());
 
-                pthread_mutex_unlock(&g_array_mutex);
                 sleep(1);
             }
 #endif
-            // Send STOP message
+            // Send STOP message, with the first message ID of the client (it identifies the producer for a broker)
+            char stop[32];
+            snprintf(stop, sizeof(stop), "%s%" PRIu64, control_frame(TOPIC_STOP), config.first_message_id);
             for (int i = 0; i < 3; i++) {
                 // Send 3 messages to notify the server that the client has finished sending messages
-                if (get_protocol_type() == TCP) {
-
-                    zmq_send_group(radio, "GRP", "STOP", 0);
-                } else {
-                    zmq_send(radio, "STOP", 4, 0);
-                }
+                transport_send(radio, get_group(MAIN_GROUP), stop, strlen(stop), 0);
                 sleep(1);
                 logger(LOG_LEVEL_INFO, "Sent STOP message");
                 handle_interrupt(0);
@@ -158,79 +305,95 @@ void client_thread(void *thread_id) {
         // ----------------------------------------- Send Message ------------------------------------------------------
         // Before sending a message, I check if the responder already finished sending ACKs for the previous messages
         // If not, I wait until the responder finishes sending ACKs, this prevents for sending twice the same message
-        // Because It remains in the g_array until the responder finishes sending ACKs for more than a row
-
-        int try_lock_result = pthread_mutex_trylock(&g_array_mutex);
-        if (try_lock_result == EBUSY) {
-            // The mutex was locked by the responder thread
-            // logger(LOG_LEVEL_WARN, "[client] Waiting for g_array to be empty (size: %d)", g_array.size);
-            continue;
+        // Because It remains in the store of the topic until the responder finishes sending ACKs for more than a row
+        // The best-effort messages are never in a store: they skip the check and the heartbeat
+
+        if (reliable) {
+            int try_lock_result = pthread_mutex_trylock(&store->mutex);
+            if (try_lock_result == EBUSY) {
+                // The mutex was locked by the responder thread
+                // logger(LOG_LEVEL_WARN, "[client] Waiting for the store (size: %zu)", store->messages.size);
+                continue;
+
+            } else if (try_lock_result == 0) {
+                // The mutex was not locked, and now it's locked by this thread
+                // Since we only wanted to check, immediately unlock it
+                pthread_mutex_unlock(&store->mutex);
+                // logger(LOG_LEVEL_DEBUG, "Client thread is unlocking the store mutex");
+            } else {
+                logger(LOG_LEVEL_ERROR, "Error in pthread_mutex_trylock");
+                continue;
+            }
 
-        } else if (try_lock_result == 0) {
-            // The mutex was not locked, and now it's locked by this thread
-            // Since we only wanted to check, immediately unlock it
-            pthread_mutex_unlock(&g_array_mutex);
-            // logger(LOG_LEVEL_DEBUG, "Client thread is unlocking g_array_mutex");
-        } else {
-            logger(LOG_LEVEL_ERROR, "Error in pthread_mutex_trylock");
-            continue;
+            // ----------------------------------------- PACKET DETECTION ----------------------------------------------
+            // Send a heartbeat before starting to send messages
+            TRACE_BEGIN(TRACE_HEARTBEAT, 0);
+            send_heartbeat(radio, get_group(MAIN_GROUP), false);
+            TRACE_END(TRACE_HEARTBEAT, 0);
+            // ---------------------------------------------------------------------------------------------------------
         }
-
-        // ----------------------------------------- PACKET DETECTION --------------------------------------------------
-        // Send a heartbeat before starting to send messages
-        send_heartbeat(radio, get_group(MAIN_GROUP), false);
-        // -------------------------------------------------------------------------------------------------------------
 #endif
-        pthread_mutex_lock(&g_array_mutex);
+        if (reliable) {
+            TRACE_BEGIN(TRACE_ARRAY_LOCK, 0);
+            pthread_mutex_lock(&store->mutex);
+            TRACE_END(TRACE_ARRAY_LOCK, 0);
+        }
 
-        // Create a message of total size = config.message_size
-        char message[config.message_size];
-        sprintf(message, "Thread %d - Message %d - ", thread_num, count_msg);
+        // Create a message of the next payload size (on the heap, the fragmented ones can be several MB), the sizes
+        // smaller than its header text are padded to it
+        TRACE_BEGIN(TRACE_CREATE, count_msg);
+        int message_size = g_payload_sizes[count_msg % g_payload_count];
+        snprintf(message, (size_t) g_payload_max + 1, "Thread %d - Message %d - ", thread_num, count_msg);
 
         unsigned long current_len = strlen(message);
-        char *rnd_string = random_string(config.message_size - current_len);
+        char *rnd_string = random_string((unsigned long) message_size > current_len
+                                         ? (unsigned int) (message_size - current_len) : 0);
         strcat(message, rnd_string);
 
         Message *msg = create_element(message);
         // printf("Message: %s\n", message);
         free(rnd_string);
+        TRACE_END(TRACE_CREATE, msg != NULL ? msg->id : 0);
         if (msg == NULL) {
             continue;
         }
+        msg->topic_id = topic_id;
+        msg->qos = qos;
+        if (deadline_us > 0) {
+            msg->deadline = msg->timestamp + deadline_us;
+        }
 
 #ifdef QOS_ENABLE
-        add_to_dynamic_array(&g_array, msg);
+        if (reliable) add_to_dynamic_array(&store->messages, msg);
 #endif
         // logger(LOG_LEVEL_DEBUG, "Sending message with ID: %" PRIu64, msg->id);
 
         // ----------------------------------------- Send message to server --------------------------------------------
+        TRACE_BEGIN(TRACE_MARSHAL, msg->id);
         const char *msg_buffer = marshal_message(msg);
+        TRACE_END(TRACE_MARSHAL, msg->id);
 
         if (msg_buffer == NULL) {
             release_element(msg, sizeof(Message));
-            pthread_mutex_unlock(&g_array_mutex);
+            if (reliable) pthread_mutex_unlock(&store->mutex);
             continue;
         }
 
-        if (get_protocol_type() == TCP) {
-            rc = zmq_send(radio, msg_buffer, strlen(msg_buffer), 0);
-
-            // Check if the message was sent correctly
-            zmq_recv(radio, (void *) msg_buffer, sizeof(msg_buffer), 0);
-        } else {
-            rc = zmq_send_group(radio, "GRP", msg_buffer, 0);
-        }
-
-        // Free msg_buffer after It's been used
-        free((void *) msg_buffer);
+        // msg_buffer is released by flush_send_queue, after It's been sent
+        queue.buffers[queue.count] = msg_buffer;
+        queue.sizes[queue.count] = strlen(msg_buffer);
+        queue.deadlines[queue.count] = msg->deadline;
+        queue.count++;
+        topic_stat_add(topic_id, TOPIC_STAT_SENT, 1);
 
-        if (rc == -1) {
+        // A full batch is sent (closed loop: no batching)
+        bool closed_loop = config.echo.mode == ECHO_CLOSED_LOOP;
+        if ((queue.count == config.send_batch_size || closed_loop) && flush_send_queue(radio, &queue) == -1) {
             printf("Error in sending message\n");
             release_element(msg, sizeof(Message));
-            pthread_mutex_unlock(&g_array_mutex);
+            if (reliable) pthread_mutex_unlock(&store->mutex);
             break;
         }
-
         // -------------------------------------------------------------------------------------------------------------
 
         if (count_msg % 1000 == 0 && count_msg != 0) {
@@ -238,27 +401,30 @@ void client_thread(void *thread_id) {
         }
         count_msg++;
 
+#ifdef QOS_ENABLE
+        uint64_t msg_id = msg->id;
+#endif
         release_element(msg, sizeof(Message));
 
 
-        pthread_mutex_unlock(&g_array_mutex);
+        if (reliable) pthread_mutex_unlock(&store->mutex);
 
-#ifndef QOS_ENABLE
-        try_reconnect(g_shared_context, &radio, get_address(MAIN_ADDRESS), get_zmq_type(CLIENT));
+#ifdef QOS_ENABLE
+        // Closed loop: the next message only after the echo of this one, or after the timeout if one of them was lost
+        if (closed_loop) {
+            echo_wait(&g_echo, msg_id, config.signal_msg_timeout);
+        }
 #endif
 
         // Random sleep from 0 to 1ms
         rand_sleep(0, 1);
     }
 
-// Add count_msg to g_count_msg
-    pthread_mutex_lock(&g_count_msg_mutex);
-    g_count_msg +=
-            count_msg;
-    pthread_mutex_unlock(&g_count_msg_mutex);
-
 // Release the resources
-    zmq_close(radio);
+    flush_send_queue(radio, &queue);
+    report_fragment_stats(radio, "client");
+    transport_close(radio);
+    free(message);
     logger(LOG_LEVEL_DEBUG,
            "***Exiting client thread %d.", thread_num);
 }
@@ -291,8 +457,38 @@ int main(void) {
     // Print configuration
     print_configuration();
 
-    // Initialize the dynamic array
-    init_dynamic_array(&g_array, 100000, sizeof(Message));
+#ifdef TRACE_ENABLE
+    start_configured_tracer("client");
+#endif
+
+    // Topics (same order as the server, so the same IDs)
+    if (init_topics(config.topics, NULL) == -1) {
+        logger(LOG_LEVEL_ERROR, "Failed to initialize the topics");
+        return 1;
+    }
+    init_topic_qos(config.reliable_topics);
+    if (init_topic_deadlines(config.topic_deadlines, config.deadline_us) == -1) {
+        logger(LOG_LEVEL_ERROR, "Failed to set the topic deadlines: %s", config.topic_deadlines);
+        return 1;
+    }
+
+    // Message IDs after first_message_id (disjoint ranges for the producers of a broker)
+    set_message_id(config.first_message_id);
+
+    // Retransmission stores of the reliable topics (messages awaiting ACK)
+    init_retransmit_stores();
+
+    // Payload sizes cycled by the messages
+    g_payload_count = parse_payload_sizes(config.echo.payload_sizes, config.message_size, g_payload_sizes,
+                                          ECHO_MAX_SIZES);
+    for (int i = 0; i < g_payload_count; i++) {
+        if (g_payload_sizes[i] > g_payload_max) g_payload_max = g_payload_sizes[i];
+    }
+
+    // Real-time profile (memory locking, priority inheritance mutexes and prefaulting of the pools)
+    apply_process_realtime_profile();
+    init_realtime_mutex(&msg_ids_mutex);
+    prefault_retransmit_stores();
 
 #ifdef QOS_ENABLE
     // Load the configuration for the failure detector
@@ -308,27 +504,53 @@ int main(void) {
     // Initialize the failure detector
     init_phi_accrual_detector(&detector_config);
 
+    // Subscribers of the stream (one for unicast), each one with its failure detector fed by its ACKs
+    init_subscribers(config.num_subscribers, config.signal_msg_timeout);
+
 
-    void *dish = create_socket(
+    Transport *dish = transport_open(
+            config.protocol,
             g_shared_context,
-            ZMQ_DISH,
+            TRANSPORT_RECEIVER,
             get_address(RESPONDER_ADDRESS),
-            config.signal_msg_timeout,
-            get_group(RESPONDER_GROUP)
+            get_group(RESPONDER_GROUP),
+            config.signal_msg_timeout
     );
 
 
 
     // Used only for sending missed messages
-    g_radio = create_socket(
+    g_radio = transport_open(
+            config.protocol,
             g_shared_context,
-            get_zmq_type(CLIENT),
+            TRANSPORT_SENDER,
             get_address(MAIN_ADDRESS),
-            config.signal_msg_timeout,
-            NULL
+            NULL,
+            config.signal_msg_timeout
     );
+    if (dish == NULL || g_radio == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the responder transports");
+        return 1;
+    }
+    // The resends of the missed messages are fragmented too
+    enable_configured_fragmentation(g_radio);
+
+    // Echo mode: the server reflects the messages on the responder channel (reassembled like the main channel)
+    if (config.echo.mode != ECHO_OFF) {
+        if (init_echo_stats(&g_echo, g_payload_sizes, g_payload_count, config.histogram_bits,
+                            config.echo.mode == ECHO_CLOSED_LOOP) != 0 ||
+            enable_configured_fragmentation(dish) != 0) {
+            logger(LOG_LEVEL_ERROR, "Failed to initialize the echo mode");
+            return 1;
+        }
+    }
 #endif
 
+    // Live counters and gauges (failure detector, ACK round, retransmit window) for a scraper
+    MetricsServer metrics;
+    bool metrics_enabled = config.metrics.client_address != NULL && config.metrics.client_address[0] != '\0' &&
+                           start_metrics_server(&metrics, config.metrics.client_address, "client") == 0;
+
     timespec start_time = get_current_time();
     logger(LOG_LEVEL_DEBUG, "Start Time: %.3f", get_current_time_value(&start_time));
 
@@ -361,21 +583,36 @@ int main(void) {
            get_elapsed_time(start_time, NULL), config.server_action->sleep_starting_time);
 
 #ifdef QOS_ENABLE
-    zmq_close(dish);
-    zmq_close(g_radio);
+    transport_close(dish);
+    transport_close(g_radio);
+    report_echo_stats(&g_echo, "client");
+    release_echo_stats(&g_echo);
 #endif
     logger(LOG_LEVEL_INFO, "Closed DISH socket");
     zmq_ctx_destroy(g_shared_context);
     logger(LOG_LEVEL_INFO, "Destroyed context");
 
-    logger(LOG_LEVEL_INFO2, "Total messages sent: %d", g_count_msg);
-    logger(LOG_LEVEL_INFO2, "Total messages missed: %d", g_missed_count);
+    logger(LOG_LEVEL_INFO2, "Total messages sent: %" PRIu64 " (%" PRIu64 " bytes)",
+           counter_get(COUNTER_SENT), counter_get(COUNTER_BYTES_SENT));
+    logger(LOG_LEVEL_INFO2, "Total messages missed: %" PRIu64, counter_get(COUNTER_MISSED));
+    logger(LOG_LEVEL_INFO2, "Total messages resent: %" PRIu64, counter_get(COUNTER_RESENT));
+    logger(LOG_LEVEL_INFO2, "Total deadline misses (dropped instead of resent): %" PRIu64,
+           counter_get(COUNTER_DEADLINE_MISSED));
+    report_topics("client");
+    if (metrics_enabled) {
+        stop_metrics_server(&metrics);
+    }
+#ifdef TRACE_ENABLE
+    stop_tracer();  // Last dump, every traced thread is joined
+#endif
 
     // Release the resources
+    release_topics();
     release_config();
-    release_dynamic_array(&g_array);
+    release_retransmit_stores();
 #ifdef QOS_ENABLE
     delete_phi_accrual_detector(g_detector);
+    release_subscribers();
 #endif
     logger(LOG_LEVEL_INFO, "Released configuration");
 
@@ -1,142 +1,397 @@
 #include <zmq.h>
 #include <string.h>
 #include <stdio.h>
-#include <json_object.h>
+#include <inttypes.h>
+#include <math.h>
 #include "utils/utils.h"
 #include "utils/fs_utils.h"
 #include "core/config.h"
 #include "core/logger.h"
 #include "utils/memory_leak_detector.h"
 #include "core/zhelpers.h"
+#include "transport/transport.h"
+#include "transport/fragment.h"
 #include "qos/dynamic_array.h"
 #include "qos/buffer_segments.h"
+#include "qos/subscribers.h"
 #include "utils/time_utils.h"
+#include "core/counters.h"
+#include "core/realtime.h"
+#include "core/topics.h"
+#include "storage/message_log.h"
+#include "storage/replay.h"
+#include "stats/metrics.h"
+#include "core/trace.h"
 
 //#define QOS_ENABLE    // Better enable it from the CMakelists.txt
 
 // ============================================= Global configuration ==================================================
 void *g_shared_context;
-void *g_dish;
-void *g_radio;
-pthread_mutex_t g_count_msg_mutex = PTHREAD_MUTEX_INITIALIZER;
+Transport *g_dish;
+Transport *g_radio;
 Logger server_logger;
-long long received_messages = 0;
-long long count_msg = 0;
+long long received_messages = 0;    // Max received message ID (written only by the server thread)
 #define MAX(a, b) (((a)>(b))?(a):(b))
+
+// Window used to detect duplicated messages (e.g. resent by the client after a lost ACK)
+#define DUPLICATE_WINDOW 65536
+static uint64_t g_seen_ids[DUPLICATE_WINDOW];
+
+// Append-only log of the received frames (message_log section of the configuration)
+MessageLog g_message_log;
+bool g_log_enabled = false;
+ReplayServer g_replay;              // Replay of the log to the late consumers
+bool g_replay_enabled = false;
 // =====================================================================================================================
 
 
 #ifdef QOS_ENABLE
 
 // Function for sending ACKs to the client
-void send_ids(void *radio) {
+void send_ids(Transport *radio) {
+    TRACE_BEGIN(TRACE_ACK_ENCODE, g_array.size);
+
     // Create a buffer with the IDs
     BufferSegmentArray segments_array = marshal_and_split(&g_array);
 
+    // Every ACK starts with the ID of this subscriber (<subscriber_id>#<id>|<id>|...), the client aggregates the ACKs
+    // of all the subscribers of a multicast stream
+    char ack[MAX_SEGMENT_SIZE + 16];
+
     // Send segments with max size of MAX_SEGMENT_SIZE
     for (size_t i = 0; i < segments_array.count; i++) {
         // printf("Sending segment %s\n", segments_array.segments[i].data);
 
         // Send the buffer with the IDs
-        zmq_send_group(
-                radio,
-                get_group(RESPONDER_GROUP),
-                segments_array.segments[i].data,
-                0
-        );
+        int len = snprintf(ack, sizeof(ack), "%d%c%s", config.subscriber_id, ACK_SUBSCRIBER_SEPARATOR,
+                           segments_array.segments[i].data);
+        transport_send(radio, get_group(RESPONDER_GROUP), ack, (size_t) len, 0);
     }
 
     // Send a wakeup message
     if (segments_array.count == 0) {
         // Send an empty message to notify the client that there are no more IDs (needed for cleaning the g_array)
-        zmq_send_group(
-                radio,
-                get_group(RESPONDER_GROUP),
-                "WAKEUP",
-                0
-        );
+        int len = snprintf(ack, sizeof(ack), "%d%cWAKEUP", config.subscriber_id, ACK_SUBSCRIBER_SEPARATOR);
+        transport_send(radio, get_group(RESPONDER_GROUP), ack, (size_t) len, 0);
     }
 
     free_segment_array(&segments_array);
 
     // Clean the array of IDs
     clean_all_elements(&g_array);
+    TRACE_END(TRACE_ACK_ENCODE, segments_array.count);
+}
+
+/**
+ * @brief Send the NACK of the missing fragments of a large message on the ACK channel (<subscriber_id>#frag:...), the
+ * client resends only those fragments.
+ * @param nack
+ * @param size
+ * @param arg The responder transport
+ */
+static void send_fragment_nack(const char *nack, size_t size, void *arg) {
+    char ack[FRAGMENT_NACK_SIZE + 16];
+    int len = snprintf(ack, sizeof(ack), "%d%c%.*s", config.subscriber_id, ACK_SUBSCRIBER_SEPARATOR, (int) size,
+                       nack);
+    transport_send((Transport *) arg, get_group(RESPONDER_GROUP), ack, (size_t) len, 0);
+}
+
+/**
+ * @brief Send a clock offset probe (<subscriber_id>#sync:<t1>) every clock_sync_interval_ms, the client answers with a
+ * heartbeat carrying the times of the exchange.
+ * @param radio
+ * @param last_probe_us Time of the previous probe
+ */
+static void send_clock_probe(Transport *radio, long long *last_probe_us) {
+    long long now_us = get_current_time_microseconds();
+    if (config.clock_sync_interval_ms <= 0 || now_us - *last_probe_us < config.clock_sync_interval_ms * 1000LL) {
+        return;
+    }
+    *last_probe_us = now_us;
+
+    char probe[64];
+    int len = snprintf(probe, sizeof(probe), "%d%c%s%lld", config.subscriber_id, ACK_SUBSCRIBER_SEPARATOR,
+                       CLOCK_SYNC_PREFIX, now_us);
+    transport_send(radio, get_group(RESPONDER_GROUP), probe, (size_t) len, 0);
+}
+
+/**
+ * @brief Add the exchange of a clock sync reply (sync:<subscriber_id>|<t1>|<t2>|<t3>) to the offset estimate, the
+ * replies to the probes of the other servers are ignored.
+ * @param payload The heartbeat without its topic
+ * @param recv_us Time of the reply (t4)
+ */
+static void handle_clock_reply(const char *payload, long long recv_us) {
+    int subscriber_id;
+    long long t1, t2, t3;
+    if (sscanf(payload + strlen(CLOCK_SYNC_PREFIX), "%d|%lld|%lld|%lld", &subscriber_id, &t1, &t2, &t3) != 4 ||
+        subscriber_id != config.subscriber_id) {
+        return;
+    }
+    if (clock_offset_add_sample(&g_clock_offset, t1, t2, t3, recv_us) == 1) {
+        gauge_set(GAUGE_CLOCK_OFFSET_US, g_clock_offset.offset_us);
+        gauge_set(GAUGE_CLOCK_UNCERTAINTY_US, g_clock_offset.uncertainty_us);
+    }
 }
 
 #endif
 
 // Function for handling periodic statistics saving
 void *stats_saver_thread(void *args) {
+    apply_thread_realtime_profile(THREAD_ROLE_STATS);
+
     while (!interrupted) {
         // Wait for the specified time before the next save
         sleep(config.save_interval_seconds);
 
         // Save statistics to a file
-        save_stats_to_file(&g_json_messages);
+        save_stats_to_file(&g_latency_records);
+        report_latency_histogram();
     }
     logger(LOG_LEVEL_DEBUG, "***Exiting stats saver thread.");
     return NULL;
 }
 
-void *server_thread(void *args) {
-    // Wait for the specified time before starting to receive messages
-    s_sleep(config.server_action->sleep_starting_time);
+/**
+ * Check if a message ID was already received, inside the last DUPLICATE_WINDOW IDs.
+ * @param msg_id
+ * @return true if the message is a duplicate
+ */
+static bool is_duplicate(uint64_t msg_id) {
+    uint64_t *slot = &g_seen_ids[msg_id % DUPLICATE_WINDOW];
+    if (*slot == msg_id) {
+        return true;
+    }
+    *slot = msg_id;
+    return false;
+}
 
-    while (!interrupted) {
-        char buffer[1024];
-        if (zmq_receive(g_dish, buffer, sizeof(buffer), 0) == -1) {
-            continue;
-        }
+// State of the server thread, passed to the topic handlers
+typedef struct {
+    ReceiveContext *receive_ctx;
+    TransportTimestamps timestamps;
+    bool has_timestamps;
+    long long count_msg;
+    char *echo_buffer;              // Reflected frames of the echo mode (NULL when it is off)
+    size_t echo_buffer_size;
+} ServerFrameContext;
 
-        // printf("Received message: %s\n", buffer);
+#ifdef QOS_ENABLE
 
-        // If message start with "STOP" then stop the server
-        if (strncmp(buffer, "STOP", 4) == 0) {
-            logger(LOG_LEVEL_INFO, "Received STOP signal");
+/**
+ * @brief Send a data frame back to the client as it is (<subscriber_id>#echo:<frame>), for its round trip time.
+ * @param ctx
+ * @param frame
+ * @param size
+ */
+static void send_echo(ServerFrameContext *ctx, const char *frame, size_t size) {
+    int len = snprintf(ctx->echo_buffer, ctx->echo_buffer_size, "%d%c%s", config.subscriber_id,
+                       ACK_SUBSCRIBER_SEPARATOR, ECHO_PREFIX);
+    if ((size_t) len + size > ctx->echo_buffer_size) {
+        return;
+    }
+    memcpy(ctx->echo_buffer + len, frame, size);
+    transport_send(g_radio, get_group(RESPONDER_GROUP), ctx->echo_buffer, (size_t) len + size, 0);
+}
+
+#endif
+
+static int handle_stop(uint16_t topic_id, const char *frame, size_t size, void *arg) {
+    logger(LOG_LEVEL_INFO, "Received STOP signal");
 #ifdef QOS_ENABLE
-            send_ids(g_radio);    // Notify last IDs
+    send_ids(g_radio);    // Notify last IDs
 #endif
-            break;
-        } else if (strncmp(buffer, "START", 5) == 0) {
-            // Needed for the first message for TCP (slow joiner syndrome)
-            logger(LOG_LEVEL_INFO, "Received START signal");
-            continue;
-        } else if (strncmp(buffer, "HB", 2) == 0) {
+    return TOPIC_STOP_RECEIVING;
+}
+
+static int handle_heartbeat(uint16_t topic_id, const char *frame, size_t size, void *arg) {
 #ifdef QOS_ENABLE
-            // UDP Packet Detection
-            send_ids(g_radio);
+    // Reply to a clock offset probe: not a heartbeat of the failure detector
+    const char *payload = parse_topic(frame, &topic_id);
+    if (strncmp(payload, CLOCK_SYNC_PREFIX, strlen(CLOCK_SYNC_PREFIX)) == 0) {
+        handle_clock_reply(payload, get_current_time_microseconds());
+        return TOPIC_CONTINUE;
+    }
+
+    // UDP Packet Detection
+    send_ids(g_radio);
 #endif
-            continue;
-        }
+    return TOPIC_CONTINUE;
+}
 
-        Message *msg = unmarshal_message(buffer);
-        if (msg == NULL) {
-            continue;
-        }
+static int handle_data(uint16_t topic_id, const char *frame, size_t size, void *arg) {
+    ServerFrameContext *ctx = arg;
 
-        // Process the message (for statistics)
-        process_json_message(msg);
+    TRACE_BEGIN(TRACE_UNMARSHAL, size);
+    Message *msg = unmarshal_message(frame);
+    TRACE_END(TRACE_UNMARSHAL, msg != NULL ? msg->id : 0);
+    if (msg == NULL) {
+        return TOPIC_CONTINUE;
+    }
 
-        // logger(LOG_LEVEL_DEBUG, "Received message, with ID: %lu", msg->id);
+    if (is_duplicate(msg->id)) {
+        counter_inc(COUNTER_DUPLICATES);
+#ifdef QOS_ENABLE
+        // ACK it again, the previous ACK may have been lost
+        if (msg->qos == QOS_RELIABLE) add_to_dynamic_array(&g_array, &msg->id);
+#endif
+        release_element(msg, sizeof(Message));
+        return TOPIC_CONTINUE;
+    }
 
 #ifdef QOS_ENABLE
-        add_to_dynamic_array(&g_array, &msg->id);
+    // Echo mode: back to the client before any other processing (every frame in closed loop, a sample in open loop)
+    if (ctx->echo_buffer != NULL && (config.echo.mode == ECHO_CLOSED_LOOP || msg->id % config.echo.sample == 0)) {
+        send_echo(ctx, frame, size);
+    }
 #endif
-        pthread_mutex_lock(&g_count_msg_mutex);
-        count_msg++;
-        // keep max from received messages and msg->id
-        received_messages = MAX(received_messages, msg->id);
-        pthread_mutex_unlock(&g_count_msg_mutex);
 
+    // Arrived past its deadline: discarded (still acknowledged, so that the client releases it). The deadline is on the
+    // clock of the client: the offset of that clock is added to the current time (0 without clock sync)
+    long long now_us = get_current_time_microseconds();
+    if (message_expired(msg, now_us + llround(clock_offset_at(&g_clock_offset, now_us)))) {
+        counter_inc(COUNTER_DEADLINE_MISSED);
+        topic_stat_add(topic_id, TOPIC_STAT_EXPIRED, 1);
+#ifdef QOS_ENABLE
+        if (msg->qos == QOS_RELIABLE) add_to_dynamic_array(&g_array, &msg->id);
+#endif
         release_element(msg, sizeof(Message));
+        return TOPIC_CONTINUE;
+    }
+
+    // Durable copy of the frame: only a copy into the ring of the log, its writer thread does the I/O
+    if (g_log_enabled) {
+        message_log_append(&g_message_log, topic_id, msg->id, frame, size);
+    }
+
+    // Process the message (for statistics)
+    TRACE_BEGIN(TRACE_STATS, msg->id);
+    long long latency_us = record_message_latency(msg, ctx->has_timestamps ? &ctx->timestamps : NULL);
+    TRACE_END(TRACE_STATS, latency_us);
+    receive_context_add_latency(ctx->receive_ctx, latency_us);
+    topic_add_latency(topic_id, latency_us);
+
+    // logger(LOG_LEVEL_DEBUG, "Received message, with ID: %lu", msg->id);
+
+#ifdef QOS_ENABLE
+    // The best-effort messages are never acknowledged (the client does not track them)
+    if (msg->qos == QOS_RELIABLE) add_to_dynamic_array(&g_array, &msg->id);
+#endif
+    ctx->count_msg++;
+    counter_inc(COUNTER_RECEIVED);
+    counter_add(COUNTER_BYTES_RECEIVED, size);
+    topic_stat_add(topic_id, TOPIC_STAT_RECEIVED, 1);
+    topic_stat_add(topic_id, TOPIC_STAT_BYTES_RECEIVED, size);
+    // keep max from received messages and msg->id
+    received_messages = MAX(received_messages, msg->id);
+
+    release_element(msg, sizeof(Message));
+
+    if (ctx->count_msg % 1000 == 0 && ctx->count_msg != 0) {
+        logger(LOG_LEVEL_INFO, "Received %lld messages", ctx->count_msg);
+    }
+    return TOPIC_CONTINUE;
+}
+
+#ifdef QOS_ENABLE
+
+static int handle_filtered(uint16_t topic_id, const char *frame, size_t size, void *arg) {
+    // Not joined: acknowledge it anyway, so that the client does not resend it
+    Message *msg = unmarshal_message(frame);
+    if (msg != NULL) {
+        if (msg->qos == QOS_RELIABLE) add_to_dynamic_array(&g_array, &msg->id);
+        release_element(msg, sizeof(Message));
+    }
+    return TOPIC_CONTINUE;
+}
+
+#endif
 
-        if (count_msg % 1000 == 0 && count_msg != 0) {
-            logger(LOG_LEVEL_INFO, "Received %d messages", count_msg);
+/**
+ * Register the handlers of the control topics and of the configured topics.
+ */
+static void register_topic_handlers(void) {
+    set_topic_handler(TOPIC_STOP, handle_stop);
+    set_topic_handler(TOPIC_HEARTBEAT, handle_heartbeat);
+    for (uint16_t i = TOPIC_FIRST_USER; i < MAX_TOPICS; i++) {
+        if (g_topics[i].registered) {
+            set_topic_handler(i, handle_data);
         }
     }
+#ifdef QOS_ENABLE
+    set_filtered_topic_handler(handle_filtered);
+#endif
+}
+
+void *server_thread(void *args) {
+    apply_thread_realtime_profile(THREAD_ROLE_RECEIVER);
+
+    // Wait for the specified time before starting to receive messages
+    s_sleep(config.server_action->sleep_starting_time);
+
+    ReceiveContext receive_ctx;
+    init_receive_context(&receive_ctx, config.receive_strategy, config.spin_us, config.signal_msg_timeout);
+
+    ServerFrameContext ctx = {.receive_ctx = &receive_ctx, .count_msg = 0};
+
+    // The reassembled messages can be much larger than a datagram
+    size_t buffer_size = 1024;
+    if (config.fragmentation.size > 0) {
+        buffer_size = (size_t) config.fragmentation.max_message_kb * 1024 + 1;
+    }
+    char *buffer = malloc(buffer_size);
+    if (buffer == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for the receive buffer");
+        return NULL;
+    }
+#ifdef QOS_ENABLE
+    if (config.echo.mode != ECHO_OFF) {
+        ctx.echo_buffer_size = buffer_size + 16;    // The frame and the <subscriber_id>#echo: header
+        ctx.echo_buffer = malloc(ctx.echo_buffer_size);
+    }
+#endif
+
+#ifdef QOS_ENABLE
+    long long last_probe_us = 0;
+#endif
+    while (!interrupted) {
+        int size = receive_with_strategy(&receive_ctx, g_dish, buffer, buffer_size);
+#ifdef QOS_ENABLE
+        send_clock_probe(g_radio, &last_probe_us);
+#endif
+        if (size == -1) {
+            continue;
+        }
+        TRACE_INSTANT(TRACE_RECEIVE, size);
+
+        // Send, kernel and application receive times of the message (only with the kernel timestamps)
+        ctx.has_timestamps = config.timestamping && transport_recv_timestamps(g_dish, &ctx.timestamps) == 0;
+
+        // printf("Received message: %s\n", buffer);
+
+        // The topic ID of the frame selects the handler (STOP, heartbeat or the data of a topic)
+        if (dispatch_topic(buffer, (size_t) size, &ctx) == TOPIC_STOP_RECEIVING) {
+            break;
+        }
+    }
+    free(buffer);
+    free(ctx.echo_buffer);
+    report_receive_context(&receive_ctx, "server");
     logger(LOG_LEVEL_DEBUG, "***Exiting server thread.");
 }
 
+// Latency records waiting for the stats saver (gauge of the metrics)
+static double stats_queue_gauge(void *arg) {
+    LatencyRecords *records = (LatencyRecords *) arg;
+    return (double) (atomic_load(&records->head) - atomic_load(&records->tail));
+}
+
+// Bytes of the message log ring not written yet (gauge of the metrics)
+static double log_queue_gauge(void *arg) {
+    MessageLog *log = (MessageLog *) arg;
+    return (double) (atomic_load(&log->head) - atomic_load(&log->tail));
+}
+
 int main(void) {
     printf("Server started\n");
 
@@ -162,29 +417,121 @@ int main(void) {
     // Print configuration
     print_configuration();
 
-    // Initialize JSON statistics
-    init_json_messages();
+#ifdef TRACE_ENABLE
+    start_configured_tracer("server");
+#endif
 
+    // Topics (same order as the client, so the same IDs) and their handlers
+    if (init_topics(config.topics, config.subscribe_topics) == -1) {
+        logger(LOG_LEVEL_ERROR, "Failed to initialize the topics");
+        return 1;
+    }
+    register_topic_handlers();
+
+    // Latency records of the statistics (preallocated, one stats file of records)
+    if (init_stats_records((size_t) config.stats_capacity) != 0) {
+        return 1;
+    }
+
+    // Real-time profile (memory locking, priority inheritance mutexes and prefaulting of the pools)
+    apply_process_realtime_profile();
+    init_realtime_mutex(&stats_mutex);
+    init_realtime_mutex(&msg_ids_mutex);
+    prefault_memory(g_array.data, g_array.capacity * g_array.element_size);
+    prefault_memory(g_seen_ids, sizeof(g_seen_ids));
+
+    // Message log (optional)
+    if (config.message_log.directory != NULL && config.message_log.directory[0] != '\0') {
+        MessageLogOptions log_options = {
+                .directory = config.message_log.directory,
+                .segment_size = (size_t) config.message_log.segment_mb * 1024 * 1024,
+                .index_interval = (size_t) config.message_log.index_interval_kb * 1024,
+                .flush_interval_ms = config.message_log.flush_interval_ms,
+                .flush_messages = (size_t) config.message_log.flush_messages,
+                .queue_size = (size_t) config.message_log.queue_kb * 1024,
+                .writer_cpu = config.message_log.writer_cpu
+        };
+        g_log_enabled = open_message_log(&g_message_log, &log_options) == 0;
+        if (!g_log_enabled) {
+            logger(LOG_LEVEL_WARN, "Failed to open the message log, the messages are not logged");
+        }
+    }
+
+    // Live counters, latency buckets and queue depths for a scraper
+    MetricsServer metrics;
+    bool metrics_enabled = false;
+    if (config.metrics.server_address != NULL && config.metrics.server_address[0] != '\0') {
+        metrics_set_histogram(&g_latency_histogram);
+        gauge_source(GAUGE_STATS_QUEUE, stats_queue_gauge, &g_latency_records);
+        if (g_log_enabled) {
+            gauge_source(GAUGE_LOG_QUEUE_BYTES, log_queue_gauge, &g_message_log);
+        }
+        metrics_enabled = start_metrics_server(&metrics, config.metrics.server_address, "server") == 0;
+    }
 
     // Create a new context
     g_shared_context = create_context();
 
-    // Dish socket
-    g_dish = create_socket(
-            g_shared_context, get_zmq_type(SERVER),
+    // Dish transport (the backend is picked from the protocol in the configuration)
+    g_dish = transport_open(
+            config.protocol, g_shared_context, TRANSPORT_RECEIVER,
             get_address(MAIN_ADDRESS),
-            config.signal_msg_timeout,
-            get_group(MAIN_GROUP)
+            get_group(MAIN_GROUP),
+            config.signal_msg_timeout
     );
+    if (g_dish == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the receiver transport");
+        return 1;
+    }
+    if (config.timestamping && transport_enable_timestamping(g_dish) != 0) {
+        config.timestamping = false;    // The stats keep the latency measured by the application only
+    }
+    if (enable_configured_fragmentation(g_dish) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to enable the fragmentation of the receiver transport");
+        return 1;
+    }
+
+    // Replay of the log to the late consumers
+    char replay_address[TRANSPORT_ADDRESS_SIZE];
+    if (g_log_enabled && config.message_log.replay_address != NULL && config.message_log.replay_address[0] != '\0') {
+        snprintf(replay_address, sizeof(replay_address), "%s://%s", config.protocol,
+                 config.message_log.replay_address);
+        ReplayOptions replay_options = {
+                .protocol = config.protocol,
+                .context = g_shared_context,
+                .request_address = replay_address,
+                .log = &g_message_log,
+                .rate = config.message_log.replay_rate,
+                .timeout = config.signal_msg_timeout
+        };
+        g_replay_enabled = start_replay_server(&g_replay, &replay_options) == 0;
+    }
+
+    // Late consumer: the history of another server (then its live messages) comes on the main address
+    if (config.replay_source != NULL && config.replay_source[0] != '\0') {
+        request_replay(config.protocol, g_shared_context, config.replay_source,
+                       config.replay_from != NULL ? config.replay_from : REPLAY_FROM_OFFSET "0", config.main_address);
+    }
 
 #ifdef QOS_ENABLE
-    // Responder socket
-    g_radio = create_socket(
-            g_shared_context, ZMQ_RADIO,
+    // Responder transport
+    g_radio = transport_open(
+            config.protocol, g_shared_context, TRANSPORT_SENDER,
             get_address(RESPONDER_ADDRESS),
-            config.signal_msg_timeout,
-            NULL
+            NULL,
+            config.signal_msg_timeout
     );
+    if (g_radio == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the responder transport");
+        return 1;
+    }
+    // The missing fragments of the large messages are asked again on the ACK channel
+    transport_set_nack_handler(g_dish, send_fragment_nack, g_radio);
+    // The reflected frames of the echo mode are as large as the messages
+    if (config.echo.mode != ECHO_OFF && enable_configured_fragmentation(g_radio) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to enable the fragmentation of the responder transport");
+        return 1;
+    }
 #endif
 
     // ============================================= Threads Part ======================================================
@@ -207,26 +554,51 @@ int main(void) {
     // ============================================= End Threads Part ==================================================
 
     // Save final statistics to a file
-    save_stats_to_file(&g_json_messages);
+    save_stats_to_file(&g_latency_records);
+    close_stats_file();
+    report_latency_histogram();
 
     // Wait a bit before sending the stop signal to the responder thread (in client)
     sleep(3);
-    zmq_send_group(g_radio, get_group(RESPONDER_GROUP), "STOP", 0);
+    if (g_radio != NULL) {
+        transport_send(g_radio, get_group(RESPONDER_GROUP), "STOP", strlen("STOP"), 0);
+    }
 
-    logger(LOG_LEVEL_INFO2, "Total received messages: %d", count_msg);
+    logger(LOG_LEVEL_INFO2, "Total received messages: %" PRIu64 " (%" PRIu64 " bytes)",
+           counter_get(COUNTER_RECEIVED), counter_get(COUNTER_BYTES_RECEIVED));
+    logger(LOG_LEVEL_INFO2, "Total duplicated messages: %" PRIu64, counter_get(COUNTER_DUPLICATES));
+    logger(LOG_LEVEL_INFO2, "Total expired messages (discarded): %" PRIu64, counter_get(COUNTER_DEADLINE_MISSED));
     logger(LOG_LEVEL_INFO2, "Max received message ID: %lld", received_messages);
+    report_topics("server");
+    report_fragment_stats(g_dish, "server");
+    if (metrics_enabled) {
+        stop_metrics_server(&metrics);
+    }
+
+    // The replay sessions stop their consumers, then the queued frames are written and synced by the close
+    if (g_replay_enabled) {
+        stop_replay_server(&g_replay);
+    }
+    if (g_log_enabled) {
+        close_message_log(&g_message_log);
+        report_message_log(&g_message_log);
+    }
 
     // Release resources
 #ifdef QOS_ENABLE
-    zmq_close(g_radio);
+    transport_close(g_radio);
 #endif
-    zmq_close(g_dish);
+    transport_close(g_dish);
     zmq_ctx_destroy(g_shared_context);
 
     release_dynamic_array(&g_array);
+    release_topics();
     release_config();
     release_date_time();
-    release_json_messages();
+    release_stats_records();
+#ifdef TRACE_ENABLE
+    stop_tracer();  // Last dump, after the replay and message log threads
+#endif
 
     check_for_leaks(); // Check for memory leaks
 
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "core/logger.h"
+#include "stats/latency_records.h"
+#include "stats/stats_columnar.h"
+
+// Reader and converter of the columnar stats files (.rmqs) of the server: the records are printed as the CSV of the
+// server (id,num,diff[,queue,wire,stack]), so the Python scripts (latency_plot.py, merge_csv.py, ...) read them as
+// before. Several files (the rotations of a run) are merged into one CSV, with num running over all of them.
+//
+// Usage: realmq_stats [-c] [-i] [-o output.csv] file.rmqs...
+//   -c  add the queue, wire and stack columns (when the files have the kernel timestamps)
+//   -i  print only the header and the metadata of the files
+//   -o  write the CSV to a file instead of the standard output
+
+// ============================================= Global configuration ==================================================
+Logger stats_logger;
+// =====================================================================================================================
+
+static void print_info(const char *path, const StatsReader *reader, uint64_t records, uint64_t blocks) {
+    const StatsFileHeader *header = reader->header;
+    fprintf(stderr, "%s: version %u, file %u, created %lld us, %s, %llu records in %llu blocks, %zu bytes "
+                    "(%.2f bytes/record)\n%.*s", path, header->version, header->file_index,
+            (long long) header->created_us,
+            (header->flags & STATS_COLUMNAR_FLAG_COMPONENTS) ? "with components" : "without components",
+            (unsigned long long) records, (unsigned long long) blocks, reader->size,
+            records > 0 ? (double) reader->size / (double) records : 0.0, (int) header->metadata_size,
+            reader->metadata);
+}
+
+int main(int argc, char *argv[]) {
+    logConfig logger_config = {
+            .show_timestamp = 0,
+            .show_logger_name = 1,
+            .show_thread_id = 0,
+            .log_to_console = 1,
+            .log_level = LOG_LEVEL_WARN
+    };
+    Logger_init("realmq_stats", &logger_config, &stats_logger);
+
+    bool components = false, info_only = false;
+    const char *output_path = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "cio:")) != -1) {
+        switch (option) {
+            case 'c':
+                components = true;
+                break;
+            case 'i':
+                info_only = true;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c] [-i] [-o output.csv] file.rmqs...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-c] [-i] [-o output.csv] file.rmqs...\n", argv[0]);
+        return 1;
+    }
+
+    FILE *output = stdout;
+    if (!info_only && output_path != NULL && (output = fopen(output_path, "w")) == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to open %s", output_path);
+        return 1;
+    }
+    if (!info_only) {
+        fputs(components ? LATENCY_CSV_HEADER_COMPONENTS : LATENCY_CSV_HEADER, output);
+    }
+
+    LatencyRecord *records = malloc(STATS_BLOCK_RECORDS * sizeof(LatencyRecord));
+    char row[LATENCY_RECORD_MAX_TEXT];
+    uint64_t num = 0;
+    int rc = 0;
+    for (int i = optind; i < argc && records != NULL; i++) {
+        StatsReader reader;
+        if (open_stats_reader(&reader, argv[i]) != 0) {
+            rc = 1;
+            continue;
+        }
+
+        uint64_t file_records = 0, blocks = 0;
+        long count;
+        while ((count = stats_reader_next_block(&reader, records, STATS_BLOCK_RECORDS)) > 0) {
+            blocks++;
+            file_records += (uint64_t) count;
+            for (long j = 0; j < count && !info_only; j++) {
+                format_latency_record_csv(&records[j], ++num, components, row, sizeof(row));
+                fputs(row, output);
+            }
+        }
+        if (count < 0) {
+            // A run stopped in the middle of a write: the complete blocks are still valid
+            logger(LOG_LEVEL_WARN, "%s: corrupt or truncated block after %llu records", argv[i],
+                   (unsigned long long) file_records);
+        }
+        if (info_only) {
+            print_info(argv[i], &reader, file_records, blocks);
+        }
+        close_stats_reader(&reader);
+    }
+
+    free(records);
+    if (output != stdout) {
+        fclose(output);
+    }
+    return rc;
+}
@@ -0,0 +1,198 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "core/zhelpers.h"
+#include "core/topics.h"
+#include "broker/broker.h"
+#include "transport/transport.h"
+#include "transport/rawudp.h"
+#include "bench_utils.h"
+
+/*
+ * Throughput benchmark of the broker: a producer thread sends frames of several topics to the broker, that forwards
+ * them to the consumer threads (every consumer subscribes to all the topics, so every frame is fanned out to all of
+ * them). Producer, broker and consumers run in the same process over loopback, every frame carries the monotonic send
+ * time so that the latency producer -> broker -> consumer is measured without clock skew.
+ * The run is repeated with 1, 2 and 4 forwarding shards, the frames of a topic always go through the same shard.
+ * ACKs are disabled: the benchmark measures the forwarding path (refcounted buffers, batched sends per consumer).
+ *
+ * Usage: ./bench_broker [num_messages] [message_size] [consumers] [protocol] [pause_us]
+ *  - protocol: rawudp (default), uring or udp
+ *  - pause_us: pause between two batches of the producer (0 for a burst, that measures the max throughput)
+ */
+
+#define BENCH_GROUP "GRP"
+#define BENCH_IP "127.0.0.1"
+#define BENCH_INGRESS_PORT 5780
+#define BENCH_CONSUMER_PORT 5781
+#define BENCH_MAX_CONSUMERS 8
+#define BENCH_TOPICS "t0,t1,t2,t3,t4,t5,t6,t7"
+#define BENCH_NUM_TOPICS 8
+#define BENCH_TIMEOUT_MS 200
+
+typedef struct {
+    Transport *receiver;
+    size_t num_messages;
+    size_t received;
+    uint64_t *latencies_ns;
+    volatile bool *producer_done;
+    uint64_t last_receive_ns;
+} BenchConsumer;
+
+static size_t g_num_messages = 100000;
+static size_t g_message_size = 64;
+static int g_consumers = 2;
+static const char *g_protocol = "rawudp";
+static int g_pause_us = 20;
+
+static void *consumer_thread(void *arg) {
+    BenchConsumer *consumer = (BenchConsumer *) arg;
+    TransportMessage messages[RAWUDP_DEFAULT_BATCH_SIZE];
+
+    while (consumer->received < consumer->num_messages) {
+        int rc = transport_recv_batch(consumer->receiver, messages, RAWUDP_DEFAULT_BATCH_SIZE, 0);
+        uint64_t now = get_monotonic_time_nanos();
+        for (int i = 0; i < rc; i++) {
+            // <topic>:<id>|<send_ns>|<payload>
+            const char *time = strchr(messages[i].data, '|');
+            if (time == NULL || consumer->received >= consumer->num_messages) continue;
+            consumer->latencies_ns[consumer->received++] = now - strtoull(time + 1, NULL, 10);
+            consumer->last_receive_ns = now;
+        }
+
+        // Stop when the producer is done and nothing arrived within the timeout (lost frames)
+        if (rc < 0 && *consumer->producer_done) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void run_producer(Transport *producer) {
+    char *payloads = malloc(BROKER_BATCH_SIZE * (g_message_size + 1));
+    const char *frames[BROKER_BATCH_SIZE];
+    size_t sizes[BROKER_BATCH_SIZE];
+    uint64_t msg_id = 1;
+
+    for (size_t sent = 0; sent < g_num_messages;) {
+        size_t batch = g_num_messages - sent < BROKER_BATCH_SIZE ? g_num_messages - sent : BROKER_BATCH_SIZE;
+
+        for (size_t i = 0; i < batch; i++, msg_id++) {
+            char *payload = payloads + i * (g_message_size + 1);
+            int written = snprintf(payload, g_message_size + 1, "%d:%llu|%llu|",
+                                   TOPIC_FIRST_USER + (int) (msg_id % BENCH_NUM_TOPICS),
+                                   (unsigned long long) msg_id, (unsigned long long) get_monotonic_time_nanos());
+            memset(payload + written, 'x', g_message_size - (size_t) written);
+            payload[g_message_size] = '\0';
+            frames[i] = payload;
+            sizes[i] = g_message_size;
+        }
+
+        int rc = transport_send_batch(producer, BENCH_GROUP, frames, sizes, batch);
+        sent += rc > 0 ? (size_t) rc : 0;
+
+        if (g_pause_us > 0) usleep((useconds_t) g_pause_us);
+    }
+    free(payloads);
+}
+
+static void run_benchmark(int shards, void *context) {
+    char ingress[TRANSPORT_ADDRESS_SIZE];
+    char addresses[BENCH_MAX_CONSUMERS][TRANSPORT_ADDRESS_SIZE];
+    snprintf(ingress, sizeof(ingress), "%s://%s:%d", g_protocol, BENCH_IP, BENCH_INGRESS_PORT);
+
+    BrokerOptions options = {
+            .protocol = g_protocol,
+            .context = context,
+            .ingress_address = ingress,
+            .shards = shards,
+            .first_cpu = -1,
+            .heartbeat_ms = 100,
+            .resend_ms = 1000,
+            .timeout = BENCH_TIMEOUT_MS
+    };
+    Broker broker;
+    if (init_broker(&broker, &options) != 0) {
+        fprintf(stderr, "Failed to initialize the broker\n");
+        return;
+    }
+
+    volatile bool producer_done = false;
+    BenchConsumer consumers[BENCH_MAX_CONSUMERS];
+    for (int i = 0; i < g_consumers; i++) {
+        snprintf(addresses[i], sizeof(addresses[i]), "%s://%s:%d", g_protocol, BENCH_IP, BENCH_CONSUMER_PORT + i);
+        consumers[i] = (BenchConsumer) {
+                .receiver = transport_open(g_protocol, context, TRANSPORT_RECEIVER, addresses[i], BENCH_GROUP,
+                                           BENCH_TIMEOUT_MS),
+                .num_messages = g_num_messages,
+                .latencies_ns = calloc(g_num_messages, sizeof(uint64_t)),
+                .producer_done = &producer_done
+        };
+        broker_add_consumer(&broker, addresses[i], "*");
+    }
+
+    Transport *producer = transport_open(g_protocol, context, TRANSPORT_SENDER, ingress, NULL, BENCH_TIMEOUT_MS);
+    if (producer == NULL || start_broker(&broker) != 0) {
+        fprintf(stderr, "Failed to start the %s broker\n", g_protocol);
+    } else {
+        pthread_t tids[BENCH_MAX_CONSUMERS];
+        for (int i = 0; i < g_consumers; i++) {
+            pthread_create(&tids[i], NULL, consumer_thread, &consumers[i]);
+        }
+        usleep(100000);     // Let the broker and the consumers block in recv
+
+        uint64_t start = get_monotonic_time_nanos();
+        run_producer(producer);
+        producer_done = true;
+        for (int i = 0; i < g_consumers; i++) {
+            pthread_join(tids[i], NULL);
+        }
+        stop_broker(&broker);
+
+        char name[32];
+        for (int i = 0; i < g_consumers; i++) {
+            uint64_t end = consumers[i].last_receive_ns > start ? consumers[i].last_receive_ns
+                                                                : get_monotonic_time_nanos();
+            snprintf(name, sizeof(name), "%d shard%s #%d", shards, shards > 1 ? "s" : "", i);
+            bench_report(name, consumers[i].latencies_ns, consumers[i].received, g_num_messages, end - start,
+                         g_message_size);
+        }
+        printf("  broker: received %llu, dropped %llu (pool empty)\n",
+               (unsigned long long) broker.received, (unsigned long long) broker.dropped);
+    }
+
+    transport_close(producer);
+    release_broker(&broker);
+    for (int i = 0; i < g_consumers; i++) {
+        transport_close(consumers[i].receiver);
+        free(consumers[i].latencies_ns);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) g_num_messages = strtoul(argv[1], NULL, 10);
+    if (argc > 2) g_message_size = strtoul(argv[2], NULL, 10);
+    if (argc > 3) g_consumers = atoi(argv[3]);
+    if (argc > 4) g_protocol = argv[4];
+    if (argc > 5) g_pause_us = atoi(argv[5]);
+    if (g_message_size < 48) g_message_size = 48;   // Room for the topic, the ID and the timestamp
+    if (g_message_size >= BROKER_FRAME_SIZE) g_message_size = BROKER_FRAME_SIZE - 1;
+    if (g_consumers < 1) g_consumers = 1;
+    if (g_consumers > BENCH_MAX_CONSUMERS) g_consumers = BENCH_MAX_CONSUMERS;
+
+    printf("Messages: %zu, size: %zu B, consumers: %d, protocol: %s, pause: %d us\n",
+           g_num_messages, g_message_size, g_consumers, g_protocol, g_pause_us);
+
+    init_topics(BENCH_TOPICS, NULL);
+    void *context = create_context();
+
+    int shards[] = {1, 2, 4};
+    for (size_t i = 0; i < sizeof(shards) / sizeof(shards[0]); i++) {
+        run_benchmark(shards[i], context);
+    }
+
+    zmq_ctx_destroy(context);
+    release_topics();
+    return 0;
+}
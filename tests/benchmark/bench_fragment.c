@@ -0,0 +1,138 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "core/logger.h"
+#include "transport/transport.h"
+#include "transport/fragment.h"
+#include "bench_utils.h"
+
+/*
+ * Throughput of the large messages (64 KB, 1 MB and 4 MB) over the rawudp loopback, with the fragmentation of the
+ * transport layer: the sender splits every message in datagrams of fragment_size bytes (sendmmsg batches), the
+ * receiver reassembles them. A window of messages in flight keeps the socket buffers from overflowing, the fragments
+ * that are lost anyway are asked by the NACKs of the receiver and resent from a second sender transport, as the
+ * responder thread of the client does.
+ * The latency is measured from the send call of the first fragment to the return of the reassembled message.
+ *
+ * Usage: ./bench_fragment [num_messages] [fragment_size] [window]
+ */
+
+#define BENCH_GROUP "GRP"
+#define BENCH_ADDRESS "rawudp://127.0.0.1:5659"
+#define BENCH_TIMEOUT_MS 500
+
+typedef struct {
+    Transport *receiver;
+    Transport *resender;
+    size_t num_messages;
+    size_t message_size;
+    _Atomic size_t received;
+    uint64_t *latencies_ns;
+    volatile bool sender_done;
+} BenchRun;
+
+static size_t g_num_messages = 200;
+static size_t g_fragment_size = FRAGMENT_DEFAULT_SIZE;
+static size_t g_window = 2;
+
+static void resend_missing(const char *nack, size_t size, void *arg) {
+    (void) size;
+    fragment_resend((Transport *) arg, BENCH_GROUP, nack);
+}
+
+static void *receiver_thread(void *arg) {
+    BenchRun *run = (BenchRun *) arg;
+    char *buffer = malloc(run->message_size + 1);
+
+    while (run->received < run->num_messages) {
+        int rc = transport_recv(run->receiver, buffer, run->message_size + 1, 0);
+        if (rc < 0) {
+            if (run->sender_done) break;
+            continue;
+        }
+        uint64_t send_ns = strtoull(buffer, NULL, 10);
+        run->latencies_ns[run->received] = get_monotonic_time_nanos() - send_ns;
+        run->received++;
+    }
+    free(buffer);
+    return NULL;
+}
+
+static void run_benchmark(size_t message_size) {
+    FragmentOptions options;
+    fragment_default_options(&options);
+    options.fragment_size = g_fragment_size;
+    options.max_message_size = message_size;
+    options.max_pending = (int) g_window + 1;
+    options.cache_messages = (int) g_window + 2;
+
+    BenchRun run = {.num_messages = g_num_messages, .message_size = message_size, .received = 0};
+    run.receiver = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, BENCH_ADDRESS, BENCH_GROUP, BENCH_TIMEOUT_MS);
+    Transport *sender = transport_open("rawudp", NULL, TRANSPORT_SENDER, BENCH_ADDRESS, NULL, BENCH_TIMEOUT_MS);
+    run.resender = transport_open("rawudp", NULL, TRANSPORT_SENDER, BENCH_ADDRESS, NULL, BENCH_TIMEOUT_MS);
+    if (run.receiver == NULL || sender == NULL || run.resender == NULL ||
+        transport_enable_fragmentation(run.receiver, &options) != 0 ||
+        transport_enable_fragmentation(sender, &options) != 0) {
+        fprintf(stderr, "Failed to open the rawudp transports\n");
+        return;
+    }
+    transport_set_nack_handler(run.receiver, resend_missing, run.resender);
+
+    char *message = malloc(message_size + 1);
+    memset(message, 'x', message_size);
+    message[message_size] = '\0';
+    run.latencies_ns = calloc(g_num_messages, sizeof(uint64_t));
+
+    pthread_t receiver;
+    pthread_create(&receiver, NULL, receiver_thread, &run);
+
+    size_t sent = 0;
+    uint64_t start = get_monotonic_time_nanos();
+    for (size_t i = 0; i < g_num_messages; i++) {
+        // At most window messages in flight
+        uint64_t wait_start = get_monotonic_time_nanos();
+        while (i - run.received >= g_window &&
+               get_monotonic_time_nanos() - wait_start < BENCH_TIMEOUT_MS * 1000000ULL) {
+            usleep(10);
+        }
+        int written = snprintf(message, message_size, "%020llu|", (unsigned long long) get_monotonic_time_nanos());
+        message[written] = 'x';
+        if (transport_send(sender, BENCH_GROUP, message, message_size, 0) == (int) message_size) {
+            sent++;
+        }
+    }
+    run.sender_done = true;
+    pthread_join(receiver, NULL);
+    uint64_t elapsed = get_monotonic_time_nanos() - start;
+
+    char name[16];
+    snprintf(name, sizeof(name), "%zu KB", message_size / 1024);
+    bench_report(name, run.latencies_ns, run.received, sent, elapsed, message_size);
+    const FragmentStats *stats = &run.receiver->fragments->stats;
+    printf("  fragments: %llu received, %llu resent, %llu NACKs, %llu duplicates, %llu expired messages\n",
+           (unsigned long long) stats->fragments_received,
+           (unsigned long long) sender->fragments->stats.fragments_resent,
+           (unsigned long long) stats->nacks, (unsigned long long) stats->duplicates,
+           (unsigned long long) stats->expired);
+
+    transport_close(sender);
+    transport_close(run.resender);
+    transport_close(run.receiver);
+    free(run.latencies_ns);
+    free(message);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) g_num_messages = strtoul(argv[1], NULL, 10);
+    if (argc > 2) g_fragment_size = strtoul(argv[2], NULL, 10);
+    if (argc > 3) g_window = strtoul(argv[3], NULL, 10);
+    if (g_window < 1) g_window = 1;
+
+    printf("Messages: %zu, fragments of %zu bytes, window of %zu messages\n", g_num_messages, g_fragment_size,
+           g_window);
+    run_benchmark(64 * 1024);
+    run_benchmark(1024 * 1024);
+    run_benchmark(4 * 1024 * 1024);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "storage/message_log.h"
+#include "bench_utils.h"
+
+/*
+ * Sustained append throughput of the message log of the server, with 64 B and 4 KB messages. A single thread appends
+ * as fast as it can, as the receive thread of the server would: the reported latency is the time spent inside
+ * message_log_append (a copy into the ring, or the wait for room when the writer thread falls behind the disk), the
+ * throughput includes the time needed to write and sync the last record (message_log_sync).
+ * Every run starts from an empty directory, so the segments are created (and preallocated) during the run.
+ *
+ * Usage: ./bench_message_log [num_messages] [directory] [flush_messages] [flush_interval_ms] [segment_mb]
+ */
+
+#define BENCH_DEFAULT_DIRECTORY "/tmp/realmq_bench_log"
+
+static size_t g_num_messages = 200000;
+static const char *g_directory = BENCH_DEFAULT_DIRECTORY;
+static size_t g_flush_messages = 1000;
+static int g_flush_interval_ms = 100;
+static size_t g_segment_mb = 64;
+
+static void clean_directory(void) {
+    char command[512];
+    snprintf(command, sizeof(command), "rm -rf '%s'", g_directory);
+    if (system(command) != 0) {
+        fprintf(stderr, "Failed to clean %s\n", g_directory);
+    }
+}
+
+static void run_benchmark(size_t message_size) {
+    clean_directory();
+
+    MessageLogOptions options = {
+            .directory = g_directory,
+            .segment_size = g_segment_mb * 1024 * 1024,
+            .index_interval = 4096,
+            .flush_interval_ms = g_flush_interval_ms,
+            .flush_messages = g_flush_messages,
+            .queue_size = 4 * 1024 * 1024,
+            .writer_cpu = -1
+    };
+    MessageLog log;
+    if (open_message_log(&log, &options) != 0) {
+        fprintf(stderr, "Failed to open the message log in %s\n", g_directory);
+        return;
+    }
+
+    char *frame = malloc(message_size);
+    uint64_t *latencies_ns = calloc(g_num_messages, sizeof(uint64_t));
+    memset(frame, 'x', message_size);
+
+    size_t appended = 0;
+    uint64_t start = get_monotonic_time_nanos();
+    for (uint64_t i = 0; i < g_num_messages; i++) {
+        int written = snprintf(frame, message_size, "2:%llu|0|", (unsigned long long) i + 1);
+        frame[written] = 'x';
+
+        uint64_t before = get_monotonic_time_nanos();
+        if (message_log_append(&log, 2, i + 1, frame, message_size) == 0) {
+            latencies_ns[appended++] = get_monotonic_time_nanos() - before;
+        }
+    }
+    message_log_sync(&log);
+    uint64_t elapsed = get_monotonic_time_nanos() - start;
+
+    char name[16];
+    snprintf(name, sizeof(name), "%zu B", message_size);
+    bench_report(name, latencies_ns, appended, g_num_messages, elapsed, message_size);
+    printf("  flushes: %llu, segments: %llu, stalled appends: %llu\n",
+           (unsigned long long) log.flushes, (unsigned long long) log.segments, (unsigned long long) log.stalls);
+
+    close_message_log(&log);
+    free(latencies_ns);
+    free(frame);
+    clean_directory();
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) g_num_messages = strtoul(argv[1], NULL, 10);
+    if (argc > 2) g_directory = argv[2];
+    if (argc > 3) g_flush_messages = strtoul(argv[3], NULL, 10);
+    if (argc > 4) g_flush_interval_ms = atoi(argv[4]);
+    if (argc > 5) g_segment_mb = strtoul(argv[5], NULL, 10);
+
+    printf("Messages: %zu, directory: %s, flush every %zu messages or %d ms, segments of %zu MB\n",
+           g_num_messages, g_directory, g_flush_messages, g_flush_interval_ms, g_segment_mb);
+
+    // The latency column is the time spent in message_log_append
+    run_benchmark(64);
+    run_benchmark(4096);
+    return 0;
+}
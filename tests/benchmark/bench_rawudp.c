@@ -0,0 +1,182 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "core/zhelpers.h"
+#include "core/logger.h"
+#include "transport/transport.h"
+#include "transport/rawudp.h"
+#include "bench_utils.h"
+
+/*
+ * End-to-end benchmark of the ZMQ UDP path (RADIO/DISH) against the native UDP transports: rawudp (sendmmsg/recvmmsg)
+ * and uring (io_uring batched submissions and multishot receive, it falls back to rawudp without io_uring support),
+ * and against the shared memory ring (shm), that skips the network stack entirely.
+ * Sender and receiver run as two threads of the same process over loopback, every payload carries the monotonic send
+ * time so that the one-way latency is measured without clock skew. Both backends go through the same transport calls:
+ * the batched operations map to sendmmsg/recvmmsg for rawudp, and fall back to one message per call for udp.
+ * Besides the latency distribution, the syscalls per message of sender and receiver are reported (n/a for ZMQ, whose
+ * syscalls are issued by its I/O threads: use `strace -c -f ./bench_rawudp` to count them).
+ *
+ * Usage: ./bench_rawudp [num_messages] [message_size] [batch_size] [pause_us]
+ *  - pause_us: pause between two batches (0 for a burst, that measures the max throughput)
+ */
+
+#define BENCH_GROUP "GRP"
+#define BENCH_ZMQ_ADDRESS "udp://127.0.0.1:5655"
+#define BENCH_RAW_ADDRESS "rawudp://127.0.0.1:5656"
+#define BENCH_URING_ADDRESS "uring://127.0.0.1:5657"
+#define BENCH_SHM_ADDRESS "shm://127.0.0.1:5658"
+#define BENCH_TIMEOUT_MS 200
+
+typedef struct {
+    Transport *receiver;
+    size_t num_messages;
+    size_t received;
+    uint64_t *latencies_ns;
+    volatile bool sender_done;
+    uint64_t last_receive_ns;
+} BenchRun;
+
+static size_t g_num_messages = 100000;
+static size_t g_message_size = 64;
+static size_t g_batch_size = RAWUDP_DEFAULT_BATCH_SIZE;
+static int g_pause_us = 0;
+
+static void fill_payload(char *payload, uint64_t send_ns) {
+    int written = snprintf(payload, g_message_size + 1, "%020llu|", (unsigned long long) send_ns);
+    for (size_t i = (size_t) written; i < g_message_size; i++) {
+        payload[i] = 'x';
+    }
+    payload[g_message_size] = '\0';
+}
+
+static void record(BenchRun *run, const char *data) {
+    uint64_t now = get_monotonic_time_nanos();
+    uint64_t send_ns = strtoull(data, NULL, 10);
+    if (run->received < run->num_messages) {
+        run->latencies_ns[run->received++] = now - send_ns;
+    }
+    run->last_receive_ns = now;
+}
+
+static void *receiver_thread(void *arg) {
+    BenchRun *run = (BenchRun *) arg;
+    TransportMessage messages[RAWUDP_DEFAULT_BATCH_SIZE];
+
+    while (run->received < run->num_messages) {
+        int rc = transport_recv_batch(run->receiver, messages, RAWUDP_DEFAULT_BATCH_SIZE, 0);
+        for (int i = 0; i < rc; i++) {
+            record(run, messages[i].data);
+        }
+
+        // Stop when the sender is done and nothing arrived within the timeout (lost messages)
+        if (rc < 0 && run->sender_done) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void run_sender(BenchRun *run, Transport *sender) {
+    char *payloads = malloc(g_batch_size * (g_message_size + 1));
+    const char *msgs[g_batch_size];
+    size_t sizes[g_batch_size];
+
+    for (size_t sent = 0; sent < run->num_messages;) {
+        size_t batch = run->num_messages - sent < g_batch_size ? run->num_messages - sent : g_batch_size;
+
+        for (size_t i = 0; i < batch; i++) {
+            char *payload = payloads + i * (g_message_size + 1);
+            fill_payload(payload, get_monotonic_time_nanos());
+            msgs[i] = payload;
+            sizes[i] = g_message_size;
+        }
+
+        int rc = transport_send_batch(sender, BENCH_GROUP, msgs, sizes, batch);
+        sent += rc > 0 ? (size_t) rc : 0;
+
+        if (g_pause_us > 0) usleep((useconds_t) g_pause_us);
+    }
+    free(payloads);
+}
+
+static void report_syscalls(const char *side, Transport *transport, size_t messages) {
+    long long syscalls = transport_syscall_count(transport);
+    if (syscalls < 0 || messages == 0) {
+        printf("  %-8s syscalls: n/a\n", side);
+        return;
+    }
+    printf("  %-8s syscalls: %lld (%.3f per message)\n", side, syscalls, (double) syscalls / (double) messages);
+}
+
+static void run_benchmark(const char *protocol, const char *address, void *context) {
+    Transport *receiver = transport_open(protocol, context, TRANSPORT_RECEIVER, address, BENCH_GROUP, BENCH_TIMEOUT_MS);
+    Transport *sender = transport_open(protocol, context, TRANSPORT_SENDER, address, NULL, BENCH_TIMEOUT_MS);
+    if (receiver == NULL || sender == NULL) {
+        fprintf(stderr, "Failed to open the %s transports\n", protocol);
+        transport_close(sender);
+        transport_close(receiver);
+        return;
+    }
+
+    BenchRun run = {
+            .receiver = receiver,
+            .num_messages = g_num_messages,
+            .received = 0,
+            .latencies_ns = calloc(g_num_messages, sizeof(uint64_t)),
+            .sender_done = false
+    };
+
+    pthread_t receiver_tid;
+    pthread_create(&receiver_tid, NULL, receiver_thread, &run);
+    usleep(100000);     // Let the receiver block in recv
+
+    uint64_t start = get_monotonic_time_nanos();
+    run_sender(&run, sender);
+    run.sender_done = true;
+    pthread_join(receiver_tid, NULL);
+
+    uint64_t end = run.last_receive_ns > start ? run.last_receive_ns : get_monotonic_time_nanos();
+    bench_report(protocol, run.latencies_ns, run.received, run.num_messages, end - start, g_message_size);
+    free(run.latencies_ns);
+
+    // The backend name can differ from the protocol after a fallback (e.g. uring -> rawudp)
+    if (strcmp(sender->ops->name, protocol) != 0) {
+        printf("  %s is not available, measured %s\n", protocol, sender->ops->name);
+    }
+    report_syscalls("sender", sender, run.num_messages);
+    report_syscalls("receiver", receiver, run.received);
+
+    transport_close(sender);
+    transport_close(receiver);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) g_num_messages = strtoul(argv[1], NULL, 10);
+    if (argc > 2) g_message_size = strtoul(argv[2], NULL, 10);
+    if (argc > 3) g_batch_size = strtoul(argv[3], NULL, 10);
+    if (argc > 4) g_pause_us = atoi(argv[4]);
+    if (g_message_size < 32) g_message_size = 32;   // Room for the timestamp
+    if (g_batch_size == 0) g_batch_size = 1;
+
+    printf("Messages: %zu, size: %zu B, batch: %zu, pause: %d us\n",
+           g_num_messages, g_message_size, g_batch_size, g_pause_us);
+
+    void *context = create_context();
+
+    // ZMQ UDP (RADIO/DISH)
+    run_benchmark("udp", BENCH_ZMQ_ADDRESS, context);
+
+    // Native UDP (sendmmsg/recvmmsg)
+    run_benchmark("rawudp", BENCH_RAW_ADDRESS, context);
+
+    // Native UDP (io_uring)
+    run_benchmark("uring", BENCH_URING_ADDRESS, context);
+
+    // Shared memory ring (same host only)
+    run_benchmark("shm", BENCH_SHM_ADDRESS, context);
+
+    zmq_ctx_destroy(context);
+    return 0;
+}
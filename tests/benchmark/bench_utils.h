@@ -0,0 +1,45 @@
+//  =====================================================================
+//  bench_utils.h
+//
+//  Helpers shared by the benchmark executables
+//  =====================================================================
+
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "utils/time_utils.h"  // get_monotonic_time_nanos: same clock on every thread of the process
+
+static int bench_compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// Get a percentile from a sorted array of samples
+static inline uint64_t bench_percentile(const uint64_t *sorted, size_t count, double percentile) {
+    if (count == 0) return 0;
+    size_t index = (size_t) (percentile / 100.0 * (double) (count - 1) + 0.5);
+    return sorted[index < count ? index : count - 1];
+}
+
+// Print throughput and latency percentiles of a run (the samples are sorted in place)
+static inline void bench_report(const char *name, uint64_t *latencies_ns, size_t received, size_t sent,
+                                uint64_t elapsed_ns, size_t message_size) {
+    qsort(latencies_ns, received, sizeof(uint64_t), bench_compare_u64);
+
+    double seconds = (double) elapsed_ns / 1e9;
+    double rate = seconds > 0 ? (double) received / seconds : 0;
+    printf("%-12s | sent: %8zu | received: %8zu (loss %5.2f%%) | %10.0f msg/s | %8.2f MB/s | "
+           "latency p50: %7.2f us, p99: %8.2f us, p99.9: %8.2f us, max: %8.2f us\n",
+           name, sent, received, sent > 0 ? 100.0 * (double) (sent - received) / (double) sent : 0.0,
+           rate, rate * (double) message_size / 1e6,
+           (double) bench_percentile(latencies_ns, received, 50) / 1e3,
+           (double) bench_percentile(latencies_ns, received, 99) / 1e3,
+           (double) bench_percentile(latencies_ns, received, 99.9) / 1e3,
+           received > 0 ? (double) latencies_ns[received - 1] / 1e3 : 0.0);
+}
+
+#endif //BENCH_UTILS_H
@@ -0,0 +1,219 @@
+#include <zmq.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <inttypes.h>
+#include "core/zhelpers.h"
+#include "core/config.h"
+#include "core/logger.h"
+#include "core/counters.h"
+#include "core/realtime.h"
+#include "core/receive_strategy.h"
+#include "transport/transport.h"
+#include "qos/dynamic_array.h"
+#include "utils/utils.h"
+#include "string_manip.h"
+#include "bench_utils.h"
+
+/*
+ * Single binary benchmark of RealMQ: the server role and the client roles run as threads of the same process, so a
+ * run needs no second terminal, no sleep before the start and no slow joiner delay. By default the messages go over
+ * ZMQ inproc:// (PUSH/PULL inside the ZMQ context of the process), that removes the network stack from the
+ * measurement of the codec (create_element, marshal_message, unmarshal_message) and of the receive strategy. Any
+ * other protocol of the transport layer can be passed to compare it over loopback (udp, rawudp, uring, shm, tcp).
+ * The messages are the same of realmq_client (config.num_threads threads, config.num_messages messages each of
+ * config.message_size bytes), the latency goes from the creation of a message to its decoding on the server.
+ * The QoS loop (ACKs and resends) is not part of the run, it needs the client and the server in separate processes.
+ *
+ * Usage: ./realmq_bench [config_path] [protocol]
+ *  - config_path: default ../config.yaml
+ *  - protocol: default inproc
+ */
+
+#define BENCH_DEFAULT_CONFIG "../config.yaml"
+#define BENCH_DEFAULT_PROTOCOL "inproc"
+
+Logger bench_logger;
+
+static void *g_context;
+static char g_main_address[TRANSPORT_ADDRESS_SIZE];
+
+static size_t g_total_messages;
+static uint64_t *g_send_ns;             // Send time of every message, indexed by message ID
+static uint64_t *g_latencies_ns;
+static size_t g_received;
+static uint64_t g_last_receive_ns;
+static atomic_int g_clients_done;
+
+static void *bench_client_thread(void *arg) {
+    int thread_num = *(int *) arg;
+    apply_thread_realtime_profile(THREAD_ROLE_SENDER);
+
+    Transport *radio = transport_open(config.protocol, g_context, TRANSPORT_SENDER, g_main_address, NULL,
+                                      config.signal_msg_timeout);
+    if (radio == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the transport of thread %d", thread_num);
+        atomic_fetch_add(&g_clients_done, 1);
+        return NULL;
+    }
+
+    char message[config.message_size + 1];
+    for (int i = 0; i < config.num_messages && !interrupted; i++) {
+        // Same message of realmq_client
+        snprintf(message, sizeof(message), "Thread %d - Message %d - ", thread_num, i);
+        size_t current_len = strlen(message);
+        if (current_len < (size_t) config.message_size) {
+            char *rnd_string = random_string(config.message_size - current_len);
+            strcat(message, rnd_string);
+            free(rnd_string);
+        }
+
+        Message *msg = create_element(message);
+        if (msg == NULL) {
+            continue;
+        }
+        if (msg->id <= g_total_messages) {
+            g_send_ns[msg->id] = get_monotonic_time_nanos();
+        }
+
+        const char *msg_buffer = marshal_message(msg);
+        release_element(msg, sizeof(Message));
+        if (msg_buffer == NULL) {
+            continue;
+        }
+
+        size_t msg_len = strlen(msg_buffer);
+        int rc = transport_send(radio, get_group(MAIN_GROUP), msg_buffer, msg_len, 0);
+        free((void *) msg_buffer);
+        if (rc == -1) {
+            logger(LOG_LEVEL_ERROR, "Error in sending message");
+            break;
+        }
+        counter_inc(COUNTER_SENT);
+        counter_add(COUNTER_BYTES_SENT, msg_len);
+    }
+
+    transport_close(radio);
+    atomic_fetch_add(&g_clients_done, 1);
+    return NULL;
+}
+
+static void *bench_server_thread(void *arg) {
+    Transport *dish = (Transport *) arg;
+    apply_thread_realtime_profile(THREAD_ROLE_RECEIVER);
+
+    ReceiveContext receive_ctx;
+    init_receive_context(&receive_ctx, config.receive_strategy, config.spin_us, config.signal_msg_timeout);
+
+    char buffer[TRANSPORT_MAX_MESSAGE_SIZE];
+    while (g_received < g_total_messages && !interrupted) {
+        int size = receive_with_strategy(&receive_ctx, dish, buffer, sizeof(buffer));
+        if (size == -1) {
+            // Nothing within the timeout after the last send: the missing messages are lost
+            if (atomic_load(&g_clients_done) == config.num_threads) {
+                break;
+            }
+            continue;
+        }
+
+        Message *msg = unmarshal_message(buffer);
+        if (msg == NULL) {
+            continue;
+        }
+        uint64_t now = get_monotonic_time_nanos();
+        if (msg->id >= 1 && msg->id <= g_total_messages) {
+            g_latencies_ns[g_received++] = now - g_send_ns[msg->id];
+            receive_context_add_latency(&receive_ctx, (long long) ((now - g_send_ns[msg->id]) / 1000));
+        }
+        g_last_receive_ns = now;
+
+        counter_inc(COUNTER_RECEIVED);
+        counter_add(COUNTER_BYTES_RECEIVED, size);
+        release_element(msg, sizeof(Message));
+    }
+
+    report_receive_context(&receive_ctx, "server");
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    uint64_t setup_start = get_monotonic_time_nanos();
+    signal(SIGINT, handle_interrupt);
+
+    logConfig logger_config = {
+            .show_timestamp = 1,
+            .show_logger_name = 1,
+            .show_thread_id = 1,
+            .log_to_console = 1,
+            .log_level = LOG_LEVEL_WARN
+    };
+    Logger_init("realmq_bench", &logger_config, &bench_logger);
+
+    const char *config_path = argc > 1 ? argv[1] : BENCH_DEFAULT_CONFIG;
+    if (read_config(config_path) != 0) {
+        logger(LOG_LEVEL_ERROR, "Failed to read %s", config_path);
+        return 1;
+    }
+    free(config.protocol);
+    config.protocol = strdup(argc > 2 ? argv[2] : BENCH_DEFAULT_PROTOCOL);
+
+    if (get_protocol_type() == TCP && config.num_threads > 1) {
+        // Every tcp sender binds its PUB socket on the main address
+        logger(LOG_LEVEL_WARN, "tcp supports a single client thread, using 1 instead of %d", config.num_threads);
+        config.num_threads = 1;
+    }
+    print_configuration();
+
+    g_total_messages = (size_t) config.num_threads * (size_t) config.num_messages;
+    g_send_ns = calloc(g_total_messages + 1, sizeof(uint64_t));
+    g_latencies_ns = calloc(g_total_messages + 1, sizeof(uint64_t));
+    if (g_send_ns == NULL || g_latencies_ns == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to allocate memory for %zu messages", g_total_messages);
+        return 1;
+    }
+
+    apply_process_realtime_profile();
+    prefault_memory(g_send_ns, (g_total_messages + 1) * sizeof(uint64_t));
+    prefault_memory(g_latencies_ns, (g_total_messages + 1) * sizeof(uint64_t));
+
+    g_context = create_context();
+    snprintf(g_main_address, sizeof(g_main_address), "%s", get_address(MAIN_ADDRESS));
+
+    // The receiver is opened first: inproc needs the bind before the connect
+    Transport *dish = transport_open(config.protocol, g_context, TRANSPORT_RECEIVER, g_main_address,
+                                     get_group(MAIN_GROUP), config.signal_msg_timeout);
+    if (dish == NULL) {
+        logger(LOG_LEVEL_ERROR, "Failed to open the receiver transport");
+        return 1;
+    }
+
+    pthread_t server;
+    pthread_create(&server, NULL, bench_server_thread, dish);
+
+    printf("Setup: %.2f ms\n", (double) (get_monotonic_time_nanos() - setup_start) / 1e6);
+    uint64_t start = get_monotonic_time_nanos();
+
+    pthread_t clients[config.num_threads];
+    int thread_ids[config.num_threads];
+    for (int i = 0; i < config.num_threads; i++) {
+        thread_ids[i] = i;
+        pthread_create(&clients[i], NULL, bench_client_thread, &thread_ids[i]);
+    }
+    for (int i = 0; i < config.num_threads; i++) {
+        pthread_join(clients[i], NULL);
+    }
+    pthread_join(server, NULL);
+
+    uint64_t end = g_last_receive_ns > start ? g_last_receive_ns : get_monotonic_time_nanos();
+    bench_report(config.protocol, g_latencies_ns, g_received, (size_t) counter_get(COUNTER_SENT), end - start,
+                 (size_t) config.message_size);
+
+    transport_close(dish);
+    zmq_ctx_destroy(g_context);
+
+    free(g_send_ns);
+    free(g_latencies_ns);
+    release_config();
+    return 0;
+}
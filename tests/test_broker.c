@@ -0,0 +1,161 @@
+#include "unity.h"
+#include <string.h>
+#include <unistd.h>
+#include "broker/broker.h"
+#include "broker/frame_pool.h"
+#include "core/topics.h"
+#include "transport/transport.h"
+
+// The broker runs over rawudp on loopback: producer -> 5770 -> broker -> 5771 (prices) / 5772 (all the topics)
+#define INGRESS "rawudp://127.0.0.1:5770"
+#define PRICES_CONSUMER "rawudp://127.0.0.1:5771"
+#define ALL_CONSUMER "rawudp://127.0.0.1:5772"
+#define PRODUCER_ACK "rawudp://127.0.0.1:5773"
+#define CONSUMER_ACK "rawudp://127.0.0.1:5774"
+
+static Broker g_test_broker;
+static Transport *g_producer;
+static Transport *g_prices;
+static Transport *g_all;
+
+void setUp(void) {
+    init_topics("prices,news", NULL);
+    g_prices = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, PRICES_CONSUMER, "GRP", 500);
+    g_all = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, ALL_CONSUMER, "GRP", 500);
+    g_producer = transport_open("rawudp", NULL, TRANSPORT_SENDER, INGRESS, NULL, 500);
+    TEST_ASSERT_NOT_NULL(g_prices);
+    TEST_ASSERT_NOT_NULL(g_all);
+    TEST_ASSERT_NOT_NULL(g_producer);
+}
+
+void tearDown(void) {
+    transport_close(g_producer);
+    transport_close(g_prices);
+    transport_close(g_all);
+    release_topics();
+}
+
+static void start_test_broker(bool acks, int producers) {
+    BrokerOptions options = {
+            .protocol = "rawudp",
+            .ingress_address = INGRESS,
+            .producer_ack_address = acks ? PRODUCER_ACK : NULL,
+            .consumer_ack_address = acks ? CONSUMER_ACK : NULL,
+            .shards = 2,
+            .first_cpu = -1,
+            .producers = producers,
+            .heartbeat_ms = 20,
+            .resend_ms = 5000,
+            .timeout = 100,
+            .pool_frames = 64
+    };
+    TEST_ASSERT_EQUAL_INT(0, init_broker(&g_test_broker, &options));
+    TEST_ASSERT_EQUAL_INT(0, broker_add_consumer(&g_test_broker, PRICES_CONSUMER, "prices"));
+    TEST_ASSERT_EQUAL_INT(1, broker_add_consumer(&g_test_broker, ALL_CONSUMER, "*"));
+    TEST_ASSERT_EQUAL_INT(0, start_broker(&g_test_broker));
+}
+
+static void send_frame(const char *frame) {
+    TEST_ASSERT_EQUAL_INT((int) strlen(frame), transport_send(g_producer, "GRP", frame, strlen(frame), 0));
+}
+
+void test_frame_pool_refcount(void) {
+    FramePool pool;
+    TEST_ASSERT_EQUAL_INT(0, init_frame_pool(&pool, 2, 16));
+
+    FrameBuffer *frame = frame_acquire(&pool, "2:1|0|a", 7);
+    TEST_ASSERT_NOT_NULL(frame);
+    TEST_ASSERT_EQUAL_STRING("2:1|0|a", frame->data);
+    TEST_ASSERT_NULL(frame_acquire(&pool, "this frame is too big", 21));
+
+    // Two consumers and the pending table hold the same buffer
+    frame_retain(frame, 2);
+    frame_release(frame);
+    frame_release_fn(frame->data, frame);
+    TEST_ASSERT_EQUAL_size_t(1, frame_pool_available(&pool));
+    frame_release(frame);
+    TEST_ASSERT_EQUAL_size_t(2, frame_pool_available(&pool));
+
+    FrameBuffer *first = frame_acquire(&pool, "a", 1);
+    FrameBuffer *second = frame_acquire(&pool, "b", 1);
+    TEST_ASSERT_NULL(frame_acquire(&pool, "c", 1));
+    frame_release(first);
+    frame_release(second);
+    release_frame_pool(&pool);
+}
+
+void test_broker_forwards_by_topic(void) {
+    start_test_broker(false, 0);
+    send_frame("2:1|0|price");
+    send_frame("3:2|0|news");
+
+    char buffer[256];
+    TEST_ASSERT_GREATER_THAN(0, transport_recv(g_prices, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING("2:1|0|price", buffer);
+    TEST_ASSERT_EQUAL_INT(-1, transport_recv(g_prices, buffer, sizeof(buffer), 0));   // news is not forwarded
+
+    int received = 0;
+    while (transport_recv(g_all, buffer, sizeof(buffer), 0) > 0) {
+        TEST_ASSERT_TRUE(strcmp(buffer, "2:1|0|price") == 0 || strcmp(buffer, "3:2|0|news") == 0);
+        received++;
+    }
+    TEST_ASSERT_EQUAL_INT(2, received);
+
+    stop_broker(&g_test_broker);
+    TEST_ASSERT_EQUAL_UINT64(2, g_test_broker.received);
+    TEST_ASSERT_EQUAL_size_t(g_test_broker.pool.count, frame_pool_available(&g_test_broker.pool));
+    release_broker(&g_test_broker);
+}
+
+void test_broker_hop_by_hop_acks(void) {
+    Transport *producer_acks = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, PRODUCER_ACK, "REP", 500);
+    Transport *consumer_acks = transport_open("rawudp", NULL, TRANSPORT_SENDER, CONSUMER_ACK, NULL, 500);
+    TEST_ASSERT_NOT_NULL(producer_acks);
+    TEST_ASSERT_NOT_NULL(consumer_acks);
+    start_test_broker(true, 1);
+
+    // Accepted by the broker: acknowledged to the producer on its heartbeat
+    send_frame("2:5|0|price");
+    send_frame(control_frame(TOPIC_HEARTBEAT));
+    char buffer[256];
+    TEST_ASSERT_GREATER_THAN(0, transport_recv(producer_acks, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING("0#5", buffer);
+
+    // Pending until both the consumers acknowledge it (they get the heartbeats of the broker)
+    TEST_ASSERT_GREATER_THAN(0, transport_recv(g_prices, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING("2:5|0|price", buffer);
+    TEST_ASSERT_GREATER_THAN(0, transport_recv(g_prices, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING(control_frame(TOPIC_HEARTBEAT), buffer);
+    size_t in_use = g_test_broker.pool.count - frame_pool_available(&g_test_broker.pool);
+    TEST_ASSERT_EQUAL_size_t(1, in_use);
+
+    transport_send(consumer_acks, "REP", "0#5", 3, 0);
+    transport_send(consumer_acks, "REP", "1#5", 3, 0);
+    for (int i = 0; i < 100 && frame_pool_available(&g_test_broker.pool) != g_test_broker.pool.count; i++) {
+        usleep(10000);
+    }
+    TEST_ASSERT_EQUAL_size_t(g_test_broker.pool.count, frame_pool_available(&g_test_broker.pool));
+
+    // The STOP of the only producer (sent more than once) stops the broker, that stops the consumers
+    send_frame("0:0");
+    send_frame("0:0");
+    wait_broker(&g_test_broker);
+    bool stopped = false;
+    while (!stopped && transport_recv(g_all, buffer, sizeof(buffer), 0) > 0) {
+        stopped = strcmp(buffer, control_frame(TOPIC_STOP)) == 0;
+    }
+    TEST_ASSERT_TRUE(stopped);
+    TEST_ASSERT_EQUAL_INT(1, g_test_broker.num_stopped_producers);
+
+    release_broker(&g_test_broker);
+    transport_close(producer_acks);
+    transport_close(consumer_acks);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_frame_pool_refcount);
+    RUN_TEST(test_broker_forwards_by_topic);
+    RUN_TEST(test_broker_hop_by_hop_acks);
+    return UNITY_END();
+}
@@ -0,0 +1,88 @@
+#include "unity.h"
+#include <math.h>
+#include <stdlib.h>
+#include "stats/clock_offset.h"
+
+#define OFFSET_US 5000.0        // Clock of the client ahead of the server
+#define DRIFT 50e-6             // 50 ppm
+#define MIN_DELAY_US 100        // One way, without queuing
+
+static ClockOffset g_clock;
+
+// Clock of the client at a time of the server
+static long long remote_time(long long local_us) {
+    return local_us + llround(OFFSET_US + DRIFT * (double) local_us);
+}
+
+// One exchange every 100 ms: queuing on one of the two ways for most of them (asymmetric delays)
+static int exchange(long long t1, int queuing_us, bool on_the_way_back) {
+    long long t2 = remote_time(t1 + MIN_DELAY_US + (on_the_way_back ? 0 : queuing_us));
+    long long t3 = t2 + 20;
+    long long t4 = t1 + 2 * MIN_DELAY_US + 20 + queuing_us;
+    return clock_offset_add_sample(&g_clock, t1, t2, t3, t4);
+}
+
+void setUp(void) {
+    init_clock_offset(&g_clock);
+    srand(42);
+}
+
+void tearDown(void) {
+}
+
+void test_no_exchange_no_offset(void) {
+    TEST_ASSERT_EQUAL_DOUBLE(0.0, clock_offset_at(&g_clock, 123456));
+    TEST_ASSERT_FALSE(clock_offset_snapshot(&g_clock, NULL, NULL, NULL, NULL));
+}
+
+void test_min_delay_filter(void) {
+    // Symmetric exchange first, then queuing on the way out only: a naive average would be off by queuing / 2
+    TEST_ASSERT_EQUAL_INT(1, exchange(0, 0, false));
+    for (int i = 1; i < CLOCK_FILTER_SIZE; i++) {
+        TEST_ASSERT_EQUAL_INT(0, exchange(i * 100000LL, 2000, false));
+    }
+    double offset, uncertainty;
+    TEST_ASSERT_TRUE(clock_offset_snapshot(&g_clock, &offset, &uncertainty, NULL, NULL));
+    TEST_ASSERT_DOUBLE_WITHIN(1.0, OFFSET_US, offset);
+    TEST_ASSERT_DOUBLE_WITHIN(1.0, MIN_DELAY_US, uncertainty);
+
+    // Once out of the window, the best of the slow ones is used
+    TEST_ASSERT_EQUAL_INT(1, exchange(CLOCK_FILTER_SIZE * 100000LL, 2000, false));
+    TEST_ASSERT_TRUE(fabs(clock_offset_at(&g_clock, CLOCK_FILTER_SIZE * 100000LL) - OFFSET_US) > 900);
+}
+
+void test_drift_tracking(void) {
+    long long t = 0;
+    for (int i = 0; i < 600; i++, t += 100000) {
+        exchange(t, rand() % 3 == 0 ? 0 : rand() % 3000, rand() % 2 == 0);
+    }
+
+    // 60 s of exchanges: the offset between and after the probes follows the drift
+    double offset, uncertainty, drift_ppm;
+    uint64_t samples;
+    TEST_ASSERT_TRUE(clock_offset_snapshot(&g_clock, &offset, &uncertainty, &drift_ppm, &samples));
+    TEST_ASSERT_EQUAL_UINT64(600, samples);
+    TEST_ASSERT_DOUBLE_WITHIN(5.0, DRIFT * 1e6, drift_ppm);
+    TEST_ASSERT_TRUE(uncertainty >= MIN_DELAY_US && uncertainty < 2 * MIN_DELAY_US);
+
+    long long later = t + 1000000;
+    double expected = OFFSET_US + DRIFT * (double) later;
+    TEST_ASSERT_DOUBLE_WITHIN(uncertainty, expected, clock_offset_at(&g_clock, later));
+}
+
+void test_reject_invalid_exchanges(void) {
+    // The reply before the probe, or a remote processing longer than the round trip
+    TEST_ASSERT_EQUAL_INT(-1, clock_offset_add_sample(&g_clock, 1000, 5000, 5010, 900));
+    TEST_ASSERT_EQUAL_INT(-1, clock_offset_add_sample(&g_clock, 1000, 5000, 6000, 1200));
+    TEST_ASSERT_EQUAL_UINT64(2, g_clock.rejected);
+    TEST_ASSERT_FALSE(g_clock.valid);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_no_exchange_no_offset);
+    RUN_TEST(test_min_delay_filter);
+    RUN_TEST(test_drift_tracking);
+    RUN_TEST(test_reject_invalid_exchanges);
+    return UNITY_END();
+}
@@ -11,6 +11,11 @@ void setUp(void) {
     fprintf(fp, "  stats_folder_path: tmp\n");
     fprintf(fp, "  protocol: tcp\n");
     fprintf(fp, "  use_json: 0\n");
+    fprintf(fp, "\n# Real-time settings\nrealtime:\n");
+    fprintf(fp, "  enabled: true\n");
+    fprintf(fp, "  sender_cpu: 2\n");
+    fprintf(fp, "  sched_fifo: true\n");
+    fprintf(fp, "  receiver_priority: 90\n");
     fclose(fp);
 
 
@@ -34,8 +39,20 @@ void test_read_configuration(void) {
     TEST_ASSERT_EQUAL_INT(0, config.use_json);
 }
 
+void test_read_realtime_configuration(void) {
+    TEST_ASSERT_TRUE(config.realtime.enabled);
+    TEST_ASSERT_EQUAL_INT(2, config.realtime.sender_cpu);
+    TEST_ASSERT_TRUE(config.realtime.sched_fifo);
+    TEST_ASSERT_EQUAL_INT(90, config.realtime.receiver_priority);
+
+    // Not specified values keep their defaults
+    TEST_ASSERT_EQUAL_INT(-1, config.realtime.receiver_cpu);
+    TEST_ASSERT_FALSE(config.realtime.lock_memory);
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_read_configuration);
+    RUN_TEST(test_read_realtime_configuration);
     return UNITY_END();
 }
@@ -0,0 +1,66 @@
+#include "unity.h"
+#include <pthread.h>
+#include "core/counters.h"
+
+#define NUM_THREADS 8
+#define NUM_INCREMENTS 100000
+
+void setUp(void) {
+    counters_reset();
+}
+
+void tearDown(void) {
+    counters_reset();
+}
+
+void *increment_thread(void *arg) {
+    (void) arg;
+    for (int i = 0; i < NUM_INCREMENTS; i++) {
+        counter_inc(COUNTER_SENT);
+        counter_add(COUNTER_BYTES_SENT, 64);
+    }
+    return NULL;
+}
+
+void test_counter_inc_and_get(void) {
+    counter_inc(COUNTER_RECEIVED);
+    counter_inc(COUNTER_RECEIVED);
+    counter_add(COUNTER_MISSED, 5);
+
+    TEST_ASSERT_EQUAL_UINT64(2, counter_get(COUNTER_RECEIVED));
+    TEST_ASSERT_EQUAL_UINT64(5, counter_get(COUNTER_MISSED));
+    TEST_ASSERT_EQUAL_UINT64(0, counter_get(COUNTER_RESENT));
+}
+
+void test_counters_aggregate_over_threads(void) {
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, increment_thread, NULL);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    CountersSnapshot snapshot;
+    counters_snapshot(&snapshot);
+    TEST_ASSERT_EQUAL_UINT64((uint64_t) NUM_THREADS * NUM_INCREMENTS, snapshot.values[COUNTER_SENT]);
+    TEST_ASSERT_EQUAL_UINT64((uint64_t) NUM_THREADS * NUM_INCREMENTS * 64, snapshot.values[COUNTER_BYTES_SENT]);
+}
+
+void test_counter_slot_is_cache_line_sized(void) {
+    TEST_ASSERT_EQUAL_size_t(0, sizeof(CounterSlot) % COUNTERS_CACHE_LINE_SIZE);
+}
+
+void test_counter_name(void) {
+    TEST_ASSERT_EQUAL_STRING("duplicates", counter_name(COUNTER_DUPLICATES));
+    TEST_ASSERT_EQUAL_STRING("unknown", counter_name(COUNTER_TYPE_COUNT));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_counter_inc_and_get);
+    RUN_TEST(test_counters_aggregate_over_threads);
+    RUN_TEST(test_counter_slot_is_cache_line_sized);
+    RUN_TEST(test_counter_name);
+    return UNITY_END();
+}
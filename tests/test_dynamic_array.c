@@ -3,6 +3,8 @@
 #include "qos/dynamic_array.h"
 #include "qos/interpolation_search.h"
 #include <inttypes.h>
+#include <limits.h>
+#include <string.h>
 
 #define MAX_CAPACITY 100000     // KEEP THIS VALUE FOR TESTING (or some test would fail)
 
@@ -228,6 +230,47 @@ void test_removing_ids_value(void) {
     test_removing_ids_(sizeof(uint64_t));
 }
 
+void test_marshal_keeps_deadline(void) {
+    Message *msg = create_element("Hello world");
+    msg->deadline = msg->timestamp + 5000;
+    const char *buffer = marshal_message(msg);
+    Message *copy = unmarshal_message(buffer);
+    TEST_ASSERT_EQUAL_INT64(msg->timestamp, copy->timestamp);
+    TEST_ASSERT_EQUAL_INT64(msg->deadline, copy->deadline);
+    TEST_ASSERT_EQUAL_STRING("Hello world", copy->content);
+    TEST_ASSERT_FALSE(message_expired(copy, msg->deadline));
+    TEST_ASSERT_TRUE(message_expired(copy, msg->deadline + 1));
+    free((void *) buffer);
+    release_element(copy, sizeof(Message));
+
+    // Without deadline the frame keeps the old format, and the message never expires
+    msg->deadline = 0;
+    buffer = marshal_message(msg);
+    copy = unmarshal_message(buffer);
+    TEST_ASSERT_NULL(strchr(buffer, DEADLINE_SEPARATOR));
+    TEST_ASSERT_EQUAL_INT64(0, copy->deadline);
+    TEST_ASSERT_FALSE(message_expired(copy, LLONG_MAX));
+    free((void *) buffer);
+    release_element(copy, sizeof(Message));
+    release_element(msg, sizeof(Message));
+}
+
+void test_sort_by_deadline(void) {
+    const char *buffers[] = {"a", "b", "c", "d", "e"};
+    size_t sizes[] = {1, 2, 3, 4, 5};
+    long long deadlines[] = {300, 0, 100, 300, 200};
+    sort_by_deadline(buffers, sizes, deadlines, 5);
+
+    // Earliest first, ties in the original order, the messages without deadline last
+    const char *expected[] = {"c", "e", "a", "d", "b"};
+    long long expected_deadlines[] = {100, 200, 300, 300, 0};
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL_STRING(expected[i], buffers[i]);
+        TEST_ASSERT_EQUAL_size_t(expected[i][0] - 'a' + 1, sizes[i]);
+        TEST_ASSERT_EQUAL_INT64(expected_deadlines[i], deadlines[i]);
+    }
+}
+
 
 int main(void) {
     UNITY_BEGIN();
@@ -250,6 +293,10 @@ int main(void) {
     // Tests for get_element_by_index
     RUN_TEST(test_get_element_by_index);
     RUN_TEST(test_get_element_by_index_using_random);
+
+    // Tests for the deadlines
+    RUN_TEST(test_marshal_keeps_deadline);
+    RUN_TEST(test_sort_by_deadline);
     // More RUN_TEST() calls...
     return UNITY_END();
 }
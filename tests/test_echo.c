@@ -0,0 +1,94 @@
+#include "unity.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "stats/echo.h"
+
+static EchoStats g_echo;
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+    release_echo_stats(&g_echo);
+}
+
+// Frame of the client: <topic_id>:<id>|<timestamp>|<content>, with a content of size bytes
+static void make_frame(char *frame, size_t frame_size, uint64_t id, long long timestamp, int size) {
+    int len = snprintf(frame, frame_size, "2:%llu|%lld|", (unsigned long long) id, timestamp);
+    memset(frame + len, 'x', (size_t) size);
+    frame[len + size] = '\0';
+}
+
+void test_parse_mode_and_sizes(void) {
+    TEST_ASSERT_EQUAL_INT(ECHO_OFF, parse_echo_mode("off"));
+    TEST_ASSERT_EQUAL_INT(ECHO_OPEN_LOOP, parse_echo_mode("open"));
+    TEST_ASSERT_EQUAL_INT(ECHO_CLOSED_LOOP, parse_echo_mode("closed"));
+    TEST_ASSERT_EQUAL_INT(-1, parse_echo_mode("sometimes"));
+    TEST_ASSERT_EQUAL_STRING("closed", echo_mode_name(ECHO_CLOSED_LOOP));
+
+    int sizes[ECHO_MAX_SIZES];
+    TEST_ASSERT_EQUAL_INT(3, parse_payload_sizes("64, 1024,65536", 100, sizes, ECHO_MAX_SIZES));
+    TEST_ASSERT_EQUAL_INT(64, sizes[0]);
+    TEST_ASSERT_EQUAL_INT(65536, sizes[2]);
+    TEST_ASSERT_EQUAL_INT(1, parse_payload_sizes("", 100, sizes, ECHO_MAX_SIZES));
+    TEST_ASSERT_EQUAL_INT(100, sizes[0]);
+    TEST_ASSERT_EQUAL_INT(1, parse_payload_sizes("0,-5,512", 100, sizes, ECHO_MAX_SIZES));
+    TEST_ASSERT_EQUAL_INT(512, sizes[0]);
+}
+
+void test_round_trip_per_size(void) {
+    int sizes[] = {64, 1024};
+    TEST_ASSERT_EQUAL_INT(0, init_echo_stats(&g_echo, sizes, 2, 7, false));
+
+    char frame[2048];
+    for (uint64_t id = 1; id <= 100; id++) {
+        bool large = id % 2 == 0;
+        make_frame(frame, sizeof(frame), id, 1000000, large ? 1024 : 64);
+        TEST_ASSERT_EQUAL_INT64(large ? 500 : 100, echo_record(&g_echo, frame, 1000000 + (large ? 500 : 100)));
+    }
+    TEST_ASSERT_EQUAL_UINT64(100, histogram_count(&g_echo.all));
+    TEST_ASSERT_EQUAL_UINT64(50, histogram_count(&g_echo.by_size[0]));
+    TEST_ASSERT_EQUAL_UINT64(100, histogram_percentile(&g_echo.by_size[0], 99));
+    TEST_ASSERT_EQUAL_UINT64(500, histogram_percentile(&g_echo.by_size[1], 50));
+
+    // Not a data frame, or sent after its echo was received (another clock)
+    TEST_ASSERT_EQUAL_INT64(-1, echo_record(&g_echo, "2:WAKEUP", 1000000));
+    make_frame(frame, sizeof(frame), 101, 2000000, 64);
+    TEST_ASSERT_EQUAL_INT64(-1, echo_record(&g_echo, frame, 1000000));
+    TEST_ASSERT_EQUAL_UINT64(2, g_echo.malformed);
+    TEST_ASSERT_EQUAL_UINT64(100, histogram_count(&g_echo.all));
+}
+
+static void *delayed_echo(void *arg) {
+    usleep(20000);
+    char frame[128];
+    make_frame(frame, sizeof(frame), *(uint64_t *) arg, 1000, 16);
+    echo_record(&g_echo, frame, 21000);
+    return NULL;
+}
+
+void test_closed_loop_wait(void) {
+    int size = 16;
+    TEST_ASSERT_EQUAL_INT(0, init_echo_stats(&g_echo, &size, 1, 7, true));
+
+    uint64_t id = 42;
+    pthread_t echo_thread;
+    pthread_create(&echo_thread, NULL, delayed_echo, &id);
+    TEST_ASSERT_TRUE(echo_wait(&g_echo, id, 2000));
+    pthread_join(echo_thread, NULL);
+
+    // Already received: no wait, a lost one times out
+    TEST_ASSERT_TRUE(echo_wait(&g_echo, id, 0));
+    TEST_ASSERT_FALSE(echo_wait(&g_echo, id + ECHO_WAIT_SLOTS, 10));
+    TEST_ASSERT_EQUAL_UINT64(1, g_echo.timeouts);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_mode_and_sizes);
+    RUN_TEST(test_round_trip_per_size);
+    RUN_TEST(test_closed_loop_wait);
+    return UNITY_END();
+}
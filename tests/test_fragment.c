@@ -0,0 +1,297 @@
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "transport/transport.h"
+#include "transport/fragment.h"
+#include "utils/time_utils.h"
+
+#define RAWUDP_ADDRESS "rawudp://127.0.0.1:5795"
+
+// ------------------------------------------ Capture backend (for tests) ----------------------------------------------
+// Keeps the sent datagrams in order, the tests reorder, duplicate or drop them before they are received
+
+#define CAPTURE_MAX 64
+#define CAPTURE_SIZE 256
+
+typedef struct {
+    char data[CAPTURE_MAX][CAPTURE_SIZE];
+    size_t sizes[CAPTURE_MAX];
+    size_t count;
+    size_t head;
+} CaptureState;
+
+static CaptureState g_capture;
+
+static int capture_open(Transport *transport, const char *address) {
+    (void) address;
+    transport->handle = &g_capture;
+    return 0;
+}
+
+static int capture_send(Transport *transport, const char *group, const char *data, size_t size, int flags) {
+    (void) transport;
+    (void) group;
+    (void) flags;
+    if (g_capture.count == CAPTURE_MAX || size > CAPTURE_SIZE) {
+        return -1;
+    }
+    memcpy(g_capture.data[g_capture.count], data, size);
+    g_capture.sizes[g_capture.count++] = size;
+    return (int) size;
+}
+
+static int capture_recv(Transport *transport, char *buffer, size_t buffer_size, int flags) {
+    (void) transport;
+    (void) flags;
+    if (g_capture.head == g_capture.count) {
+        return -1;
+    }
+    size_t size = g_capture.sizes[g_capture.head];
+    if (size > buffer_size - 1) size = buffer_size - 1;
+    memcpy(buffer, g_capture.data[g_capture.head++], size);
+    buffer[size] = '\0';
+    return (int) size;
+}
+
+static void capture_close(Transport *transport) {
+    (void) transport;
+}
+
+static const TransportOps capture_transport = {
+        .name = "capture",
+        .open = capture_open,
+        .send = capture_send,
+        .recv = capture_recv,
+        .close = capture_close
+};
+
+// Remove a captured datagram (lost on the wire)
+static void capture_drop(size_t index) {
+    memmove(&g_capture.data[index], &g_capture.data[index + 1], (g_capture.count - index - 1) * CAPTURE_SIZE);
+    memmove(&g_capture.sizes[index], &g_capture.sizes[index + 1], (g_capture.count - index - 1) * sizeof(size_t));
+    g_capture.count--;
+}
+
+// Receive a captured datagram again, at position to
+static void capture_duplicate(size_t from, size_t to) {
+    char copy[CAPTURE_SIZE];
+    size_t size = g_capture.sizes[from];
+    memcpy(copy, g_capture.data[from], CAPTURE_SIZE);
+    memmove(&g_capture.data[to + 1], &g_capture.data[to], (g_capture.count - to) * CAPTURE_SIZE);
+    memmove(&g_capture.sizes[to + 1], &g_capture.sizes[to], (g_capture.count - to) * sizeof(size_t));
+    memcpy(g_capture.data[to], copy, CAPTURE_SIZE);
+    g_capture.sizes[to] = size;
+    g_capture.count++;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+static char g_nack[FRAGMENT_NACK_SIZE];
+static int g_nack_count;
+
+static void save_nack(const char *nack, size_t size, void *arg) {
+    (void) arg;
+    memcpy(g_nack, nack, size);
+    g_nack[size] = '\0';
+    g_nack_count++;
+}
+
+static void fill_message(char *message, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        message[i] = (char) ('a' + (i * 7 + i / 251) % 26);
+    }
+    message[size] = '\0';
+}
+
+// Fragments of 128 bytes (96 of payload), so a message of 1000 bytes has 11 fragments
+static FragmentOptions small_fragments(void) {
+    FragmentOptions options;
+    fragment_default_options(&options);
+    options.fragment_size = FRAGMENT_MIN_SIZE;
+    options.max_message_size = 4096;
+    options.timeout_ms = 50;
+    options.nack_interval_ms = 5;
+    return options;
+}
+
+static Transport *g_sender;
+static Transport *g_receiver;
+
+void setUp(void) {
+    memset(&g_capture, 0, sizeof(g_capture));
+    g_nack_count = 0;
+    register_transport(&capture_transport);     // Already registered after the first test
+
+    FragmentOptions options = small_fragments();
+    g_sender = transport_open("capture", NULL, TRANSPORT_SENDER, "capture://local", NULL, 100);
+    g_receiver = transport_open("capture", NULL, TRANSPORT_RECEIVER, "capture://local", "GRP", 100);
+    TEST_ASSERT_NOT_NULL(g_sender);
+    TEST_ASSERT_NOT_NULL(g_receiver);
+    TEST_ASSERT_EQUAL_INT(0, transport_enable_fragmentation(g_sender, &options));
+    TEST_ASSERT_EQUAL_INT(0, transport_enable_fragmentation(g_receiver, &options));
+    transport_set_nack_handler(g_receiver, save_nack, NULL);
+}
+
+void tearDown(void) {
+    transport_close(g_sender);
+    transport_close(g_receiver);
+}
+
+void test_small_messages_are_not_fragmented(void) {
+    TEST_ASSERT_EQUAL_INT(5, transport_send(g_sender, "GRP", "hello", 5, 0));
+    TEST_ASSERT_EQUAL_size_t(1, g_capture.count);
+    TEST_ASSERT_FALSE(is_fragment(g_capture.data[0], g_capture.sizes[0]));
+
+    char buffer[64];
+    TEST_ASSERT_EQUAL_INT(5, transport_recv(g_receiver, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING("hello", buffer);
+    TEST_ASSERT_EQUAL_UINT64(0, g_sender->fragments->stats.fragmented);
+}
+
+void test_reassembly_out_of_order_with_duplicates(void) {
+    char message[1001];
+    fill_message(message, 1000);
+    TEST_ASSERT_EQUAL_INT(1000, transport_send(g_sender, "GRP", message, 1000, 0));
+    TEST_ASSERT_EQUAL_size_t(11, g_capture.count);
+    TEST_ASSERT_EQUAL_UINT32(11, fragment_count(g_sender->fragments, 1000));
+
+    // Reversed, with a fragment received twice
+    for (size_t i = 0; i < 11 / 2; i++) {
+        char tmp[CAPTURE_SIZE];
+        size_t tmp_size = g_capture.sizes[i];
+        memcpy(tmp, g_capture.data[i], CAPTURE_SIZE);
+        memcpy(g_capture.data[i], g_capture.data[10 - i], CAPTURE_SIZE);
+        g_capture.sizes[i] = g_capture.sizes[10 - i];
+        memcpy(g_capture.data[10 - i], tmp, CAPTURE_SIZE);
+        g_capture.sizes[10 - i] = tmp_size;
+    }
+    capture_duplicate(2, 5);
+
+    char buffer[2048];
+    TEST_ASSERT_EQUAL_INT(1000, transport_recv(g_receiver, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING(message, buffer);
+
+    // A late duplicate does not start a new message
+    capture_duplicate(0, g_capture.count);
+    TEST_ASSERT_EQUAL_INT(-1, transport_recv(g_receiver, buffer, sizeof(buffer), 0));
+    FragmentStats *stats = &g_receiver->fragments->stats;
+    TEST_ASSERT_EQUAL_UINT64(1, stats->reassembled);
+    TEST_ASSERT_EQUAL_UINT64(13, stats->fragments_received);
+    TEST_ASSERT_EQUAL_UINT64(2, stats->duplicates);
+}
+
+void test_nack_resends_only_the_missing_fragments(void) {
+    char message[1001];
+    fill_message(message, 1000);
+    TEST_ASSERT_EQUAL_INT(1000, transport_send(g_sender, "GRP", message, 1000, 0));
+
+    // Fragments 3, 4, 5 and 9 are lost
+    capture_drop(9);
+    capture_drop(5);
+    capture_drop(4);
+    capture_drop(3);
+
+    char buffer[2048];
+    TEST_ASSERT_EQUAL_INT(-1, transport_recv(g_receiver, buffer, sizeof(buffer), 0));
+    long long now_ns = (long long) get_monotonic_time_nanos();
+    TEST_ASSERT_EQUAL_INT(0, fragment_collect(g_receiver->fragments, now_ns + 10 * 1000000LL));
+    TEST_ASSERT_EQUAL_INT(1, g_nack_count);
+
+    char expected[64];
+    snprintf(expected, sizeof(expected), "frag:%08x:0:3-5,9", g_sender->fragments->sender_id);
+    TEST_ASSERT_EQUAL_STRING(expected, g_nack);
+
+    // A NACK for a message that the sender does not know is ignored
+    TEST_ASSERT_EQUAL_INT(-1, fragment_resend(g_sender, "GRP", "frag:00000000:0:1"));
+    TEST_ASSERT_EQUAL_INT(-1, fragment_resend(g_sender, "GRP", "1|2|3"));
+
+    memset(&g_capture, 0, sizeof(g_capture));
+    TEST_ASSERT_EQUAL_INT(4, fragment_resend(g_sender, "GRP", g_nack));
+    TEST_ASSERT_EQUAL_size_t(4, g_capture.count);
+    TEST_ASSERT_EQUAL_UINT64(4, g_sender->fragments->stats.fragments_resent);
+
+    TEST_ASSERT_EQUAL_INT(1000, transport_recv(g_receiver, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING(message, buffer);
+}
+
+void test_incomplete_messages_expire(void) {
+    char message[1001];
+    fill_message(message, 1000);
+    TEST_ASSERT_EQUAL_INT(1000, transport_send(g_sender, "GRP", message, 1000, 0));
+    capture_drop(0);
+
+    char buffer[2048];
+    TEST_ASSERT_EQUAL_INT(-1, transport_recv(g_receiver, buffer, sizeof(buffer), 0));
+    long long now_ns = (long long) get_monotonic_time_nanos();
+    TEST_ASSERT_EQUAL_INT(0, fragment_collect(g_receiver->fragments, now_ns));
+    TEST_ASSERT_EQUAL_INT(1, fragment_collect(g_receiver->fragments, now_ns + 100 * 1000000LL));
+    TEST_ASSERT_EQUAL_UINT64(1, g_receiver->fragments->stats.expired);
+    TEST_ASSERT_FALSE(g_receiver->fragments->slots[0].active);
+}
+
+void test_oversized_messages_are_rejected(void) {
+    char *message = malloc(8193);
+    fill_message(message, 8192);
+    TEST_ASSERT_EQUAL_INT(-1, transport_send(g_sender, "GRP", message, 8192, 0));
+    TEST_ASSERT_EQUAL_size_t(0, g_capture.count);
+    TEST_ASSERT_EQUAL_UINT64(1, g_sender->fragments->stats.oversized);
+    free(message);
+}
+
+void test_rawudp_loopback_large_messages(void) {
+    Transport *receiver = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, RAWUDP_ADDRESS, "GRP", 1000);
+    Transport *sender = transport_open("rawudp", NULL, TRANSPORT_SENDER, RAWUDP_ADDRESS, NULL, 1000);
+    TEST_ASSERT_NOT_NULL(receiver);
+    TEST_ASSERT_NOT_NULL(sender);
+    TEST_ASSERT_EQUAL_INT(0, transport_enable_fragmentation(receiver, NULL));
+    TEST_ASSERT_EQUAL_INT(0, transport_enable_fragmentation(sender, NULL));
+
+    size_t size = 1024 * 1024;
+    char *message = malloc(size + 1);
+    char *buffer = malloc(size + 1);
+    fill_message(message, size);
+
+    // 1 MB in ~760 datagrams, reassembled in the buffer of the caller
+    TEST_ASSERT_EQUAL_INT((int) size, transport_send(sender, "GRP", message, size, 0));
+    TEST_ASSERT_EQUAL_INT((int) size, transport_recv(receiver, buffer, size + 1, 0));
+    TEST_ASSERT_EQUAL_MEMORY(message, buffer, size);
+
+    // Batches: the message points to the reassembly buffer, the small message follows as it is
+    message[0] = 'Z';
+    TEST_ASSERT_EQUAL_INT((int) size, transport_send(sender, "GRP", message, size, 0));
+    TEST_ASSERT_EQUAL_INT(5, transport_send(sender, "GRP", "small", 5, 0));
+    TransportMessage messages[8];
+    int received = 0;
+    char last[8] = "";
+    while (received < 2) {
+        int rc = transport_recv_batch(receiver, messages, 8, 0);
+        TEST_ASSERT_GREATER_THAN(0, rc);
+        for (int i = 0; i < rc; i++, received++) {
+            if (received == 0) {
+                TEST_ASSERT_EQUAL_size_t(size, messages[i].size);
+                TEST_ASSERT_EQUAL_MEMORY(message, messages[i].data, size);
+            } else {
+                memcpy(last, messages[i].data, messages[i].size);
+            }
+        }
+    }
+    TEST_ASSERT_EQUAL_STRING("small", last);
+    TEST_ASSERT_EQUAL_UINT64(2, receiver->fragments->stats.reassembled);
+
+    free(message);
+    free(buffer);
+    transport_close(sender);
+    transport_close(receiver);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_small_messages_are_not_fragmented);
+    RUN_TEST(test_reassembly_out_of_order_with_duplicates);
+    RUN_TEST(test_nack_resends_only_the_missing_fragments);
+    RUN_TEST(test_incomplete_messages_expire);
+    RUN_TEST(test_oversized_messages_are_rejected);
+    RUN_TEST(test_rawudp_loopback_large_messages);
+    return UNITY_END();
+}
@@ -64,10 +64,9 @@ void test_create_stats_path_valid(void) {
     free(path); // Cleanup
 }
 
-void test_save_stats_to_file_null_json(void) {
-    json_object *json = NULL;
-    save_stats_to_file(&json);
-    // Assuming the function should not create a file when JSON data is NULL
+void test_save_stats_to_file_null_records(void) {
+    save_stats_to_file(NULL);
+    // Assuming the function should not create a file when there are no records
     struct stat buffer;
     int exist = stat("tmp/01_01_2021_00_00_00_tcp_0_result.csv", &buffer);
     TEST_ASSERT_EQUAL(-1, exist); // File should not exist
@@ -75,24 +74,29 @@ void test_save_stats_to_file_null_json(void) {
 }
 
 void test_save_stats_to_file_creates_file(void) {
-    json_object *json = json_object_new_array();
-    json_object_array_add(json, json_object_new_string("test_message")); // Adding a test message
+    LatencyRecords records;
+    TEST_ASSERT_EQUAL_INT(0, init_latency_records(&records, 16));
+    LatencyRecord record = {.id = 42, .send_time = 1000, .recv_time = 1250};
+    TEST_ASSERT_TRUE(append_latency_record(&records, &record));
 
     // Creating a temp directory for test
     const char *dirname = "tmp";
     mkdir(dirname, 0700);
 
-    save_stats_to_file(&json);
+    save_stats_to_file(&records);
 
-    // Check if the file has been created
-    struct stat buffer;
-    int exist = stat("tmp/01_01_2021_00_00_00_tcp_0_result.csv", &buffer);
-    TEST_ASSERT_EQUAL(0, exist); // File should exist
-
-    // Optionally: read the file to check if the contents are as expected
+    // Check if the file has been created, with the header and the record (latency in ms)
+    FILE *file = fopen("tmp/01_01_2021_00_00_00_tcp_0_result.csv", "r");
+    TEST_ASSERT_NOT_NULL(file);
+    char line[64];
+    TEST_ASSERT_NOT_NULL(fgets(line, sizeof(line), file));
+    TEST_ASSERT_EQUAL_STRING("id,num,diff\n", line);
+    TEST_ASSERT_NOT_NULL(fgets(line, sizeof(line), file));
+    TEST_ASSERT_EQUAL_STRING("42,1,0.2500\n", line);
+    fclose(file);
 
     // Cleanup
-    json_object_put(json); // free json object
+    release_latency_records(&records);
     remove("tmp/01_01_2021_00_00_00_tcp_0_result.csv"); // delete the created file
 }
 
@@ -101,7 +105,7 @@ void test_save_stats_to_file_creates_file(void) {
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_create_stats_path_valid);
-    RUN_TEST(test_save_stats_to_file_null_json);
+    RUN_TEST(test_save_stats_to_file_null_records);
     RUN_TEST(test_save_stats_to_file_creates_file);
     RUN_TEST(test_file_exists);
     // More RUN_TEST() calls...
@@ -0,0 +1,70 @@
+//  =====================================================================
+//  test_helpers.h
+//
+//  Helpers shared by the unit tests
+//  =====================================================================
+
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "unity.h"
+#include "stats/latency_records.h"
+
+// Temporary directory of the test program, created on the first call
+static inline const char *test_dir(void) {
+    static char dir[] = "/tmp/realmq_test_XXXXXX";
+    static bool created = false;
+    if (!created) {
+        TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+        created = true;
+    }
+    return dir;
+}
+
+// Path of a file of the temporary directory (to free)
+static inline char *test_path(const char *name) {
+    char *path = malloc(256);
+    snprintf(path, 256, "%s/%s", test_dir(), name);
+    return path;
+}
+
+// Path of the stats file of an index (stats_<index><extension>, to free), as path_fn of a stats writer
+static inline char *test_stats_path(int index, void *extension) {
+    char name[64];
+    snprintf(name, sizeof(name), "stats_%d%s", index, extension != NULL ? (const char *) extension : "");
+    return test_path(name);
+}
+
+// Whole content of a file (to free)
+static inline char *test_read_file(const char *path) {
+    FILE *file = fopen(path, "r");
+    TEST_ASSERT_NOT_NULL(file);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char *content = malloc((size_t) size + 1);
+    TEST_ASSERT_EQUAL_size_t((size_t) size, fread(content, 1, (size_t) size, file));
+    content[size] = '\0';
+    fclose(file);
+    return content;
+}
+
+// Whole content of the stats file of an index (to free)
+static inline char *test_read_stats_file(int index, const char *extension) {
+    char *path = test_stats_path(index, (void *) extension);
+    char *content = test_read_file(path);
+    free(path);
+    return content;
+}
+
+// Latency record with the application timestamps only (us)
+static inline LatencyRecord test_make_record(uint64_t id, int64_t send_time, int64_t latency_us) {
+    LatencyRecord record = {.id = id, .send_time = send_time, .recv_time = send_time + latency_us};
+    return record;
+}
+
+#endif //TEST_HELPERS_H
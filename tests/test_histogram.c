@@ -0,0 +1,121 @@
+#include "unity.h"
+#include <stdlib.h>
+#include "stats/histogram.h"
+
+static LatencyHistogram g_histogram;
+static LatencyHistogram g_other;
+
+void setUp(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_histogram(&g_histogram, HISTOGRAM_DEFAULT_SUB_BUCKET_BITS));
+    TEST_ASSERT_EQUAL_INT(0, init_histogram(&g_other, HISTOGRAM_DEFAULT_SUB_BUCKET_BITS));
+}
+
+void tearDown(void) {
+    release_histogram(&g_histogram);
+    release_histogram(&g_other);
+}
+
+void test_percentiles_within_precision(void) {
+    for (uint64_t value = 1; value <= 100000; value++) {
+        histogram_record(&g_histogram, value);
+    }
+    TEST_ASSERT_EQUAL_UINT64(100000, histogram_count(&g_histogram));
+    TEST_ASSERT_EQUAL_UINT64(1, g_histogram.min);
+    TEST_ASSERT_EQUAL_UINT64(100000, histogram_percentile(&g_histogram, 100));
+    TEST_ASSERT_EQUAL_DOUBLE(50000.5, histogram_mean(&g_histogram));
+
+    // Relative error below 2^-(bits-1)
+    double percentiles[] = {50, 90, 99, 99.9};
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        double expected = percentiles[i] * 1000;
+        double value = (double) histogram_percentile(&g_histogram, percentiles[i]);
+        TEST_ASSERT_TRUE(value >= expected);
+        TEST_ASSERT_TRUE(value <= expected * (1 + 1.0 / 64));
+    }
+
+    // The small values are exact, the largest ones are still bucketed
+    histogram_reset(&g_histogram);
+    histogram_record(&g_histogram, 100);
+    TEST_ASSERT_EQUAL_UINT64(100, histogram_percentile(&g_histogram, 50));
+    histogram_record(&g_histogram, UINT64_MAX);
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, histogram_percentile(&g_histogram, 100));
+}
+
+void test_interval_since_previous_tick(void) {
+    LatencyHistogram interval;
+    TEST_ASSERT_EQUAL_INT(0, init_histogram(&interval, HISTOGRAM_DEFAULT_SUB_BUCKET_BITS));
+
+    histogram_record(&g_histogram, 10);
+    histogram_record(&g_histogram, 20);
+    TEST_ASSERT_EQUAL_INT(0, histogram_interval(&interval, &g_histogram, &g_other));
+    TEST_ASSERT_EQUAL_UINT64(2, histogram_count(&interval));
+
+    // Only the new values, with their own bounds
+    histogram_record(&g_histogram, 5000);
+    TEST_ASSERT_EQUAL_INT(0, histogram_interval(&interval, &g_histogram, &g_other));
+    TEST_ASSERT_EQUAL_UINT64(1, histogram_count(&interval));
+    TEST_ASSERT_EQUAL_UINT64(5000, interval.max);
+    TEST_ASSERT_TRUE(interval.min > 4900 && interval.min <= 5000);
+    TEST_ASSERT_EQUAL_DOUBLE(5000.0, histogram_mean(&interval));
+    TEST_ASSERT_EQUAL_UINT64(3, histogram_count(&g_histogram));
+    release_histogram(&interval);
+}
+
+void test_encode_decode_merges(void) {
+    for (uint64_t value = 1; value <= 1000; value++) {
+        histogram_record(&g_histogram, value * 1000);
+    }
+    g_histogram.start_us = 1000;
+    g_histogram.end_us = 2000;
+    histogram_record(&g_other, 7);
+    g_other.start_us = 500;
+    g_other.end_us = 1500;
+
+    // Two encodings back to back, as in a file of several intervals or shards
+    size_t capacity = 2 * histogram_encoded_max_size(&g_histogram);
+    uint8_t *buffer = malloc(capacity);
+    size_t size = histogram_encode(&g_histogram, buffer, capacity);
+    TEST_ASSERT_TRUE(size > 0 && size < 1000 * 3);
+    size_t second = histogram_encode(&g_other, buffer + size, capacity - size);
+    TEST_ASSERT_TRUE(second > 0);
+
+    LatencyHistogram merged;
+    TEST_ASSERT_EQUAL_INT(0, init_histogram(&merged, HISTOGRAM_DEFAULT_SUB_BUCKET_BITS));
+    TEST_ASSERT_EQUAL_INT64((long) size, histogram_decode(&merged, buffer, size + second));
+    TEST_ASSERT_EQUAL_INT64((long) second, histogram_decode(&merged, buffer + size, second));
+    TEST_ASSERT_EQUAL_UINT64(1001, histogram_count(&merged));
+    TEST_ASSERT_EQUAL_UINT64(7, merged.min);
+    TEST_ASSERT_EQUAL_UINT64(1000000, merged.max);
+    TEST_ASSERT_EQUAL_INT64(500, merged.start_us);
+    TEST_ASSERT_EQUAL_INT64(2000, merged.end_us);
+
+    TEST_ASSERT_EQUAL_INT(0, histogram_merge(&g_histogram, &g_other));
+    double percentiles[] = {1, 50, 99.9, 100};
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        TEST_ASSERT_EQUAL_UINT64(histogram_percentile(&g_histogram, percentiles[i]),
+                                 histogram_percentile(&merged, percentiles[i]));
+    }
+
+    // Truncated: rejected without changing the histogram
+    TEST_ASSERT_EQUAL_INT64(-1, histogram_decode(&merged, buffer, size - 1));
+    TEST_ASSERT_EQUAL_UINT64(1001, histogram_count(&merged));
+    free(buffer);
+    release_histogram(&merged);
+}
+
+void test_merge_requires_same_precision(void) {
+    LatencyHistogram coarse;
+    TEST_ASSERT_EQUAL_INT(0, init_histogram(&coarse, 3));
+    TEST_ASSERT_EQUAL_INT(-1, histogram_merge(&g_histogram, &coarse));
+    release_histogram(&coarse);
+    TEST_ASSERT_EQUAL_INT(-1, init_histogram(&coarse, 0));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_percentiles_within_precision);
+    RUN_TEST(test_interval_since_previous_tick);
+    RUN_TEST(test_encode_decode_merges);
+    RUN_TEST(test_merge_requires_same_precision);
+    return UNITY_END();
+}
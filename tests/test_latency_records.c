@@ -0,0 +1,109 @@
+#include "unity.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats/latency_records.h"
+#include "test_helpers.h"
+
+#define THREADS 4
+#define RECORDS_PER_THREAD 10000
+
+static LatencyRecords g_records;
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+    release_latency_records(&g_records);
+}
+
+void test_append_until_full(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_latency_records(&g_records, 4));
+    for (uint64_t id = 1; id <= 4; id++) {
+        LatencyRecord record = test_make_record(id, (int64_t) id * 10, 500);
+        TEST_ASSERT_TRUE(append_latency_record(&g_records, &record));
+    }
+
+    // Full: the record is dropped, the ring is not overwritten
+    LatencyRecord record = test_make_record(5, 50, 500);
+    TEST_ASSERT_FALSE(append_latency_record(&g_records, &record));
+    TEST_ASSERT_EQUAL_UINT64(1, g_records.dropped);
+    TEST_ASSERT_EQUAL_UINT64(4, latency_records_committed(&g_records, 0));
+    TEST_ASSERT_EQUAL_UINT64(1, latency_record_at(&g_records, 0)->id);
+
+    // Released by the exporter: the slots are reused
+    latency_records_release_until(&g_records, 2);
+    TEST_ASSERT_TRUE(append_latency_record(&g_records, &record));
+    TEST_ASSERT_EQUAL_UINT64(5, latency_records_committed(&g_records, 2));
+    TEST_ASSERT_EQUAL_UINT64(5, latency_record_at(&g_records, 4)->id);
+}
+
+static void *append_thread(void *arg) {
+    uint64_t first = (uint64_t) (uintptr_t) arg;
+    for (uint64_t i = 0; i < RECORDS_PER_THREAD; i++) {
+        LatencyRecord record = test_make_record(first + i, (int64_t) (first + i) * 10, 500);
+        append_latency_record(&g_records, &record);
+    }
+    return NULL;
+}
+
+void test_concurrent_appends(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_latency_records(&g_records, THREADS * RECORDS_PER_THREAD));
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, append_thread, (void *) (uintptr_t) (i * RECORDS_PER_THREAD + 1));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Every record is there exactly once
+    TEST_ASSERT_EQUAL_UINT64(THREADS * RECORDS_PER_THREAD, latency_records_committed(&g_records, 0));
+    bool *seen = calloc(THREADS * RECORDS_PER_THREAD + 1, sizeof(bool));
+    for (uint64_t i = 0; i < THREADS * RECORDS_PER_THREAD; i++) {
+        const LatencyRecord *record = latency_record_at(&g_records, i);
+        TEST_ASSERT_FALSE(seen[record->id]);
+        TEST_ASSERT_EQUAL_INT64(record->send_time + 500, record->recv_time);
+        seen[record->id] = true;
+    }
+    free(seen);
+    TEST_ASSERT_EQUAL_UINT64(0, g_records.dropped);
+}
+
+void test_export_csv_and_json(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_latency_records(&g_records, 8));
+    LatencyRecord record = test_make_record(7, 70, 500);
+    record.send_ns = 70000 + 2000;
+    record.kernel_rx_ns = 72000 + 300000;
+    record.recv_ns = 372000 + 128000;
+    TEST_ASSERT_TRUE(append_latency_record(&g_records, &record));
+    record = test_make_record(8, 80, 500);
+    TEST_ASSERT_TRUE(append_latency_record(&g_records, &record));
+
+    char *text = NULL;
+    size_t size = 0;
+    FILE *file = open_memstream(&text, &size);
+    TEST_ASSERT_EQUAL_size_t(2, export_latency_records_csv(&g_records, 0, 2, true, file));
+    fclose(file);
+    TEST_ASSERT_EQUAL_STRING("id,num,diff,queue,wire,stack\n"
+                             "7,1,0.5000,0.002000,0.300000,0.128000\n"
+                             "8,2,0.5000,,,\n", text);
+    free(text);
+
+    file = open_memstream(&text, &size);
+    TEST_ASSERT_EQUAL_size_t(1, export_latency_records_json(&g_records, 1, 2, file));
+    fclose(file);
+    TEST_ASSERT_NOT_NULL(strstr(text, "\"messages\":["));
+    TEST_ASSERT_NOT_NULL(strstr(text, "\"id\":8,"));
+    TEST_ASSERT_NULL(strstr(text, "\"wire_ns\""));
+    free(text);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_append_until_full);
+    RUN_TEST(test_concurrent_appends);
+    RUN_TEST(test_export_csv_and_json);
+    return UNITY_END();
+}
@@ -0,0 +1,124 @@
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "storage/message_log.h"
+#include "test_helpers.h"
+
+// Log directory of the current test, under the temporary directory of the program
+static char *g_directory;
+
+static MessageLogOptions test_options(void) {
+    return (MessageLogOptions) {
+            .directory = g_directory,
+            .segment_size = MESSAGE_LOG_MIN_SEGMENT,
+            .index_interval = 1024,
+            .flush_interval_ms = 10,
+            .flush_messages = 100,
+            .queue_size = 0,
+            .writer_cpu = -1
+    };
+}
+
+void setUp(void) {
+    g_directory = test_path("message_log");
+}
+
+void tearDown(void) {
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf %s", g_directory);
+    TEST_ASSERT_EQUAL_INT(0, system(command));
+    free(g_directory);
+}
+
+static void append_frames(MessageLog *log, uint64_t first_id, int count, size_t size) {
+    char frame[8192];
+    for (int i = 0; i < count; i++) {
+        int written = snprintf(frame, sizeof(frame), "2:%llu|0|", (unsigned long long) (first_id + i));
+        memset(frame + written, 'a' + i % 26, size - (size_t) written);
+        TEST_ASSERT_EQUAL_INT(0, message_log_append(log, 2, first_id + i, frame, size));
+    }
+}
+
+void test_message_log_append_and_read(void) {
+    MessageLog log;
+    MessageLogOptions options = test_options();
+    TEST_ASSERT_EQUAL_INT(0, open_message_log(&log, &options));
+    append_frames(&log, 1, 10, 64);
+    message_log_sync(&log);
+    TEST_ASSERT_EQUAL_UINT64(10, log.durable_offset);
+
+    // Live reader: only the committed records
+    MessageLogReader reader;
+    const MessageLogRecord *record;
+    const char *data;
+    TEST_ASSERT_EQUAL_INT(0, open_log_reader(&reader, g_directory, &log, 0));
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL_INT(1, log_reader_next(&reader, &record, &data));
+        TEST_ASSERT_EQUAL_UINT64(i, record->offset);
+        TEST_ASSERT_EQUAL_UINT64(i + 1, record->msg_id);
+        TEST_ASSERT_EQUAL_UINT16(2, record->topic_id);
+        TEST_ASSERT_EQUAL_UINT32(64, record->size);
+        TEST_ASSERT_EQUAL_INT(i + 1, atoi(data + 2));
+    }
+    TEST_ASSERT_EQUAL_INT(0, log_reader_next(&reader, &record, &data));
+    close_log_reader(&reader);
+    close_message_log(&log);
+}
+
+void test_message_log_rolls_segments_and_seeks_with_the_index(void) {
+    MessageLog log;
+    MessageLogOptions options = test_options();
+    TEST_ASSERT_EQUAL_INT(0, open_message_log(&log, &options));
+
+    // 4 KB records: 15 per segment of 64 KB
+    append_frames(&log, 1000, 100, 4096);
+    close_message_log(&log);
+    TEST_ASSERT_GREATER_THAN(5, log.segments);
+
+    MessageLogReader reader;
+    const MessageLogRecord *record;
+    const char *data;
+    TEST_ASSERT_EQUAL_INT(0, open_log_reader(&reader, g_directory, NULL, 42));
+    for (uint64_t offset = 42; offset < 100; offset++) {
+        TEST_ASSERT_EQUAL_INT(1, log_reader_next(&reader, &record, &data));
+        TEST_ASSERT_EQUAL_UINT64(offset, record->offset);
+        TEST_ASSERT_EQUAL_UINT64(1000 + offset, record->msg_id);
+        TEST_ASSERT_EQUAL_INT('a' + offset % 26, data[4095]);
+    }
+    TEST_ASSERT_EQUAL_INT(0, log_reader_next(&reader, &record, &data));
+    close_log_reader(&reader);
+}
+
+void test_message_log_continues_after_restart(void) {
+    MessageLog log;
+    MessageLogOptions options = test_options();
+    TEST_ASSERT_EQUAL_INT(0, open_message_log(&log, &options));
+    append_frames(&log, 1, 20, 100);
+    close_message_log(&log);
+
+    TEST_ASSERT_EQUAL_INT(0, open_message_log(&log, &options));
+    TEST_ASSERT_EQUAL_UINT64(20, log.next_offset);
+    append_frames(&log, 21, 5, 100);
+    close_message_log(&log);
+
+    MessageLogReader reader;
+    const MessageLogRecord *record;
+    const char *data;
+    TEST_ASSERT_EQUAL_INT(0, open_log_reader(&reader, g_directory, NULL, 0));
+    int count = 0;
+    while (log_reader_next(&reader, &record, &data) == 1) {
+        TEST_ASSERT_EQUAL_UINT64(count + 1, record->msg_id);
+        count++;
+    }
+    TEST_ASSERT_EQUAL_INT(25, count);
+    close_log_reader(&reader);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_message_log_append_and_read);
+    RUN_TEST(test_message_log_rolls_segments_and_seeks_with_the_index);
+    RUN_TEST(test_message_log_continues_after_restart);
+    return UNITY_END();
+}
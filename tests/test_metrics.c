@@ -0,0 +1,120 @@
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "core/counters.h"
+#include "stats/metrics.h"
+
+#define SOCKET_PATH "/tmp/test_metrics.sock"
+
+static LatencyHistogram g_histogram;
+static char g_page[METRICS_BUFFER_SIZE];
+
+static double constant_gauge(void *arg) {
+    return *(double *) arg;
+}
+
+void setUp(void) {
+    counters_reset();
+    TEST_ASSERT_EQUAL_INT(0, init_histogram(&g_histogram, HISTOGRAM_DEFAULT_SUB_BUCKET_BITS));
+}
+
+void tearDown(void) {
+    metrics_set_histogram(NULL);
+    release_histogram(&g_histogram);
+}
+
+void test_counters_and_set_gauges(void) {
+    counter_add(COUNTER_SENT, 42);
+    gauge_set(GAUGE_PHI, 1.5);
+    double depth = 7;
+    gauge_source(GAUGE_STATS_QUEUE, constant_gauge, &depth);
+
+    size_t size = render_metrics(g_page, sizeof(g_page), "client");
+    TEST_ASSERT_EQUAL_size_t(strlen(g_page), size);
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "# TYPE realmq_sent_total counter\n"));
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "realmq_sent_total{role=\"client\"} 42\n"));
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "realmq_phi{role=\"client\"} 1.5\n"));
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "realmq_stats_queue{role=\"client\"} 7\n"));
+
+    // Never set: not exported (instead of a misleading 0)
+    TEST_ASSERT_NULL(strstr(g_page, "realmq_log_queue_bytes"));
+    TEST_ASSERT_NULL(strstr(g_page, "realmq_latency_us"));
+    gauge_source(GAUGE_STATS_QUEUE, NULL, NULL);
+}
+
+void test_latency_buckets_are_cumulative(void) {
+    for (uint64_t value = 1; value <= 1000; value++) {
+        histogram_record(&g_histogram, value * 10);   // 10 us to 10 ms
+    }
+    metrics_set_histogram(&g_histogram);
+    render_metrics(g_page, sizeof(g_page), "server");
+
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "# TYPE realmq_latency_us histogram\n"));
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "realmq_latency_us_bucket{role=\"server\",le=\"10\"} 1\n"));
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "realmq_latency_us_bucket{role=\"server\",le=\"100\"} 10\n"));
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "realmq_latency_us_bucket{role=\"server\",le=\"20000\"} 1000\n"));
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "realmq_latency_us_bucket{role=\"server\",le=\"+Inf\"} 1000\n"));
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "realmq_latency_us_sum{role=\"server\"} 5005000\n"));
+    TEST_ASSERT_NOT_NULL(strstr(g_page, "realmq_latency_us_count{role=\"server\"} 1000\n"));
+
+    // The counts never decrease with the limit
+    unsigned long long previous = 0, count;
+    const char *line = g_page;
+    while ((line = strstr(line, "realmq_latency_us_bucket{")) != NULL) {
+        line = strchr(line, '}');
+        TEST_ASSERT_EQUAL_INT(1, sscanf(line, "} %llu", &count));
+        TEST_ASSERT_TRUE(count >= previous);
+        previous = count;
+    }
+}
+
+void test_scrape_unix_socket(void) {
+    counter_add(COUNTER_RECEIVED, 3);
+    MetricsServer server;
+    TEST_ASSERT_EQUAL_INT(0, start_metrics_server(&server, METRICS_UNIX_PREFIX SOCKET_PATH, "server"));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX, .sun_path = SOCKET_PATH};
+    TEST_ASSERT_EQUAL_INT(0, connect(fd, (struct sockaddr *) &addr, sizeof(addr)));
+    const char *request = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    TEST_ASSERT_EQUAL_INT((int) strlen(request), (int) send(fd, request, strlen(request), 0));
+
+    // Connection: close, so the response ends with the connection
+    char response[METRICS_BUFFER_SIZE];
+    size_t used = 0;
+    ssize_t len;
+    while ((len = recv(fd, response + used, sizeof(response) - 1 - used, 0)) > 0) {
+        used += (size_t) len;
+    }
+    response[used] = '\0';
+    close(fd);
+
+    TEST_ASSERT_EQUAL_INT(0, strncmp(response, "HTTP/1.1 200 OK\r\n", 17));
+    TEST_ASSERT_NOT_NULL(strstr(response, "Content-Type: text/plain; version=0.0.4\r\n"));
+    TEST_ASSERT_NOT_NULL(strstr(response, "\r\n\r\n# HELP "));
+    TEST_ASSERT_NOT_NULL(strstr(response, "realmq_received_total{role=\"server\"} 3\n"));
+
+    stop_metrics_server(&server);
+    TEST_ASSERT_EQUAL_INT(-1, access(SOCKET_PATH, F_OK));
+}
+
+void test_reject_invalid_addresses(void) {
+    MetricsServer server;
+    TEST_ASSERT_EQUAL_INT(-1, start_metrics_server(&server, "127.0.0.1", "client"));
+    TEST_ASSERT_EQUAL_INT(-1, start_metrics_server(&server, "127.0.0.1:70000", "client"));
+    TEST_ASSERT_EQUAL_INT(-1, start_metrics_server(&server, "localhost:9464", "client"));
+    TEST_ASSERT_EQUAL_INT(-1, start_metrics_server(&server, METRICS_UNIX_PREFIX, "client"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_counters_and_set_gauges);
+    RUN_TEST(test_latency_buckets_are_cumulative);
+    RUN_TEST(test_scrape_unix_socket);
+    RUN_TEST(test_reject_invalid_addresses);
+    return UNITY_END();
+}
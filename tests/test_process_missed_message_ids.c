@@ -70,7 +70,7 @@ void tearDown(void) {
 
 void test_buffer_and_get_missed_ids(void) {
     /*
-     * This test is doing what is done in the function `diff_from_arrays` in common/qos/dynamic_array.c
+     * This test is doing what is done with the ACKs of the server in the client (see diff_from_subscriber)
      */
 
     // Initialize the dynamic array
@@ -161,7 +161,7 @@ void print_array(DynamicArray *array, bool print_content) {
 
 void test_client_server_missing_ids(void) {
     /*
-     * This test is doing what is done in the function `diff_from_arrays` in common/qos/dynamic_array.c
+     * This test is doing what is done with the ACKs of the server in the client (see diff_from_subscriber)
      */
 
     // Initialize the dynamic array
@@ -207,7 +207,8 @@ void test_client_server_missing_ids(void) {
     // printf("\n# Messages received: %zu\n", new_array->size);
     // print_array(new_array, false);
 
-    int missed_count = diff_from_arrays(&g_array, new_array, NULL);
+    // A single server (subscriber 0): an acknowledged message is released, a missed one is kept for the resend
+    int missed_count = diff_from_subscriber(&g_array, new_array, 0, 1, NULL);
 
     // printf("\n# Missed count: %d\n", missed_count);
     // print_array(&g_array, true);
@@ -228,7 +229,7 @@ void test_client_server_missing_ids(void) {
 
 void test_big_differences(void) {
     /*
-     * This test is doing what is done in the function `diff_from_arrays` in common/qos/dynamic_array.c
+     * This test is doing what is done with the ACKs of the server in the client (see diff_from_subscriber)
      */
 
     // Initialize the dynamic array
@@ -292,7 +293,8 @@ void test_big_differences(void) {
         return;
     }
 
-    int missed_count = diff_from_arrays(&g_array, new_array, NULL);
+    // A single server (subscriber 0): an acknowledged message is released, a missed one is kept for the resend
+    int missed_count = diff_from_subscriber(&g_array, new_array, 0, 1, NULL);
 
     char *buffer1 = marshal_uint64_array(&g_array);
     // printf("\n The BUFFER1: %s\n", buffer1);
@@ -0,0 +1,130 @@
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "core/topics.h"
+#include "storage/message_log.h"
+#include "storage/replay.h"
+#include "transport/transport.h"
+#include "test_helpers.h"
+
+// The server receives the requests on 5790, the late consumer receives the replay on 5791
+#define REQUEST_ADDRESS "rawudp://127.0.0.1:5790"
+#define CONSUMER_ADDRESS "rawudp://127.0.0.1:5791"
+
+// Log directory of the current test, under the temporary directory of the program
+static char *g_directory;
+static MessageLog g_log;
+
+void setUp(void) {
+    g_directory = test_path("message_log");
+    MessageLogOptions options = {
+            .directory = g_directory,
+            .segment_size = MESSAGE_LOG_MIN_SEGMENT,
+            .index_interval = 512,
+            .flush_interval_ms = 10,
+            .flush_messages = 100,
+            .writer_cpu = -1
+    };
+    TEST_ASSERT_EQUAL_INT(0, open_message_log(&g_log, &options));
+}
+
+void tearDown(void) {
+    close_message_log(&g_log);
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf %s", g_directory);
+    TEST_ASSERT_EQUAL_INT(0, system(command));
+    free(g_directory);
+}
+
+static void append_frames(uint64_t first_id, int count) {
+    char frame[256];
+    for (int i = 0; i < count; i++) {
+        int size = snprintf(frame, sizeof(frame), "2:%llu|0|content of the message",
+                            (unsigned long long) (first_id + i));
+        TEST_ASSERT_EQUAL_INT(0, message_log_append(&g_log, 2, first_id + i, frame, (size_t) size));
+    }
+    message_log_sync(&g_log);
+}
+
+static void expect_frames(Transport *consumer, uint64_t first_id, int count) {
+    char buffer[256];
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT_GREATER_THAN(0, transport_recv(consumer, buffer, sizeof(buffer), 0));
+        TEST_ASSERT_EQUAL_UINT64(first_id + i, strtoull(buffer + 2, NULL, 10));
+    }
+}
+
+void test_parse_replay_request(void) {
+    ReplayRequest request;
+    TEST_ASSERT_EQUAL_INT(0, parse_replay_request("offset:42@127.0.0.1:5600", &request));
+    TEST_ASSERT_EQUAL_INT(REPLAY_REQUEST_OFFSET, request.type);
+    TEST_ASSERT_EQUAL_UINT64(42, request.from);
+    TEST_ASSERT_EQUAL_STRING("127.0.0.1:5600", request.address);
+
+    TEST_ASSERT_EQUAL_INT(0, parse_replay_request("id:1000000001@10.0.0.2:5600", &request));
+    TEST_ASSERT_EQUAL_INT(REPLAY_REQUEST_MSG_ID, request.type);
+    TEST_ASSERT_EQUAL_UINT64(1000000001ULL, request.from);
+
+    TEST_ASSERT_EQUAL_INT(0, parse_replay_request("cancel@127.0.0.1:5600", &request));
+    TEST_ASSERT_EQUAL_INT(REPLAY_REQUEST_CANCEL, request.type);
+
+    TEST_ASSERT_EQUAL_INT(-1, parse_replay_request("offset:42", &request));
+    TEST_ASSERT_EQUAL_INT(-1, parse_replay_request("offset:x@127.0.0.1:5600", &request));
+    TEST_ASSERT_EQUAL_INT(-1, parse_replay_request("from:1@127.0.0.1:5600", &request));
+}
+
+void test_find_msg_id_uses_the_sparse_index(void) {
+    append_frames(100, 200);
+    uint64_t offset;
+    TEST_ASSERT_EQUAL_INT(0, message_log_find_msg_id(g_directory, &g_log, 150, &offset));
+    TEST_ASSERT_EQUAL_UINT64(50, offset);
+    TEST_ASSERT_EQUAL_INT(0, message_log_find_msg_id(g_directory, &g_log, 1, &offset));
+    TEST_ASSERT_EQUAL_UINT64(0, offset);
+    TEST_ASSERT_EQUAL_INT(-1, message_log_find_msg_id(g_directory, &g_log, 1000, &offset));
+}
+
+void test_replay_history_then_live_messages(void) {
+    append_frames(1, 50);
+
+    Transport *consumer = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, CONSUMER_ADDRESS, "GRP", 1000);
+    TEST_ASSERT_NOT_NULL(consumer);
+    ReplayServer server;
+    ReplayOptions options = {
+            .protocol = "rawudp",
+            .request_address = REQUEST_ADDRESS,
+            .log = &g_log,
+            .rate = 10000,
+            .timeout = 100
+    };
+    TEST_ASSERT_EQUAL_INT(0, start_replay_server(&server, &options));
+
+    // The request is sent 3 times, a single session streams the history from message 20
+    TEST_ASSERT_EQUAL_INT(0, request_replay("rawudp", NULL, "127.0.0.1:5790", "id:20", "127.0.0.1:5791"));
+    expect_frames(consumer, 20, 31);
+    for (int i = 0; i < 100 && server.sessions[0].live_offset == 0; i++) {
+        usleep(10000);
+    }
+    TEST_ASSERT_EQUAL_UINT64(50, server.sessions[0].live_offset);
+
+    // Then the live messages, right after the history
+    append_frames(51, 10);
+    expect_frames(consumer, 51, 10);
+
+    // The stop of the server stops the consumer
+    stop_replay_server(&server);
+    char buffer[256];
+    TEST_ASSERT_GREATER_THAN(0, transport_recv(consumer, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING(control_frame(TOPIC_STOP), buffer);
+    TEST_ASSERT_EQUAL_UINT64(41, server.sessions[0].replayed);
+    transport_close(consumer);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_replay_request);
+    RUN_TEST(test_find_msg_id_uses_the_sparse_index);
+    RUN_TEST(test_replay_history_then_live_messages);
+    return UNITY_END();
+}
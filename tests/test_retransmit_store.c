@@ -0,0 +1,150 @@
+#include "unity.h"
+#include "qos/retransmit_store.h"
+#include "qos/dynamic_array.h"
+#include "core/topics.h"
+#include "utils/time_utils.h"
+#include "transport/transport.h"
+
+// The resends of the stores are received on 5796
+#define RESEND_ADDRESS "rawudp://127.0.0.1:5796"
+
+static int g_prices;
+static int g_orders;
+static int g_telemetry;
+
+void setUp(void) {
+    init_topics("prices,orders,telemetry", NULL);
+    init_topic_qos("prices,orders");
+    // The orders must arrive within 10 s, the prices can wait for a minute
+    init_topic_deadlines("orders:10000000", 60000000);
+    g_prices = find_topic("prices");
+    g_orders = find_topic("orders");
+    g_telemetry = find_topic("telemetry");
+    init_retransmit_stores();
+}
+
+void tearDown(void) {
+    release_retransmit_stores();
+    release_topics();
+}
+
+// Track a message of a topic, sent age_ms ago, and return its ID
+static uint64_t track_message(int topic_id, long long age_ms) {
+    Message *msg = create_element("Message");
+    msg->topic_id = (uint16_t) topic_id;
+    msg->timestamp = get_current_time_microseconds() - age_ms * 1000;
+    msg->deadline = msg->timestamp + topic_deadline_us((uint16_t) topic_id);
+    uint64_t id = msg->id;
+    RetransmitStore *store = retransmit_store((uint16_t) topic_id);
+    pthread_mutex_lock(&store->mutex);
+    add_to_dynamic_array(&store->messages, msg);
+    pthread_mutex_unlock(&store->mutex);
+    release_element(msg, sizeof(Message));
+    return id;
+}
+
+void test_only_the_reliable_topics_have_a_store(void) {
+    TEST_ASSERT_NOT_NULL(retransmit_store((uint16_t) g_prices));
+    TEST_ASSERT_NOT_NULL(retransmit_store((uint16_t) g_orders));
+    TEST_ASSERT_NULL(retransmit_store((uint16_t) g_telemetry));
+    TEST_ASSERT_NULL(retransmit_store(TOPIC_HEARTBEAT));
+    TEST_ASSERT_NULL(retransmit_store(MAX_TOPICS));
+    TEST_ASSERT_TRUE(retransmit_store((uint16_t) g_prices) != retransmit_store((uint16_t) g_orders));
+}
+
+void test_ack_is_applied_to_the_store_of_every_topic(void) {
+    uint64_t price_id = track_message(g_prices, 0);
+    uint64_t order_id = track_message(g_orders, 0);
+    track_message(g_orders, 0);
+    TEST_ASSERT_EQUAL_size_t(3, retransmit_stores_pending());
+
+    // One ACK with the IDs of both topics: each message is released from its own store
+    DynamicArray acked;
+    init_dynamic_array(&acked, 4, sizeof(uint64_t));
+    add_to_dynamic_array(&acked, &price_id);
+    add_to_dynamic_array(&acked, &order_id);
+    TEST_ASSERT_EQUAL_INT(0, retransmit_stores_ack(&acked, 0, 1, NULL));
+
+    TEST_ASSERT_EQUAL_size_t(0, retransmit_store((uint16_t) g_prices)->messages.size);
+    TEST_ASSERT_EQUAL_size_t(1, retransmit_store((uint16_t) g_orders)->messages.size);
+    TEST_ASSERT_EQUAL_size_t(1, retransmit_stores_pending());
+    release_dynamic_array(&acked);
+}
+
+void test_missed_messages_are_counted_per_topic(void) {
+    // Only the order is older than the ACK timeout, the price is still in flight
+    track_message(g_prices, 0);
+    track_message(g_orders, ACK_TIMEOUT_MS + 1000);
+    uint64_t missed_prices = topic_stat_get((uint16_t) g_prices, TOPIC_STAT_MISSED);
+    uint64_t missed_orders = topic_stat_get((uint16_t) g_orders, TOPIC_STAT_MISSED);
+
+    DynamicArray acked;
+    init_dynamic_array(&acked, 1, sizeof(uint64_t));
+    TEST_ASSERT_EQUAL_INT(1, retransmit_stores_ack(&acked, 0, 1, NULL));
+    TEST_ASSERT_EQUAL_UINT64(missed_prices, topic_stat_get((uint16_t) g_prices, TOPIC_STAT_MISSED));
+    TEST_ASSERT_EQUAL_UINT64(missed_orders + 1, topic_stat_get((uint16_t) g_orders, TOPIC_STAT_MISSED));
+
+    // Kept for the resend until acknowledged
+    TEST_ASSERT_EQUAL_size_t(2, retransmit_stores_pending());
+    release_dynamic_array(&acked);
+}
+
+void test_release_acked_from_every_store(void) {
+    uint64_t price_id = track_message(g_prices, 0);
+    track_message(g_orders, 0);
+
+    // Acknowledged by subscriber 0 only, held back by subscriber 1 until it is declared dead
+    DynamicArray acked;
+    init_dynamic_array(&acked, 1, sizeof(uint64_t));
+    add_to_dynamic_array(&acked, &price_id);
+    retransmit_stores_ack(&acked, 0, 3, NULL);
+    TEST_ASSERT_EQUAL_size_t(2, retransmit_stores_pending());
+
+    TEST_ASSERT_EQUAL_INT(1, retransmit_stores_release_acked(1));
+    TEST_ASSERT_EQUAL_size_t(0, retransmit_store((uint16_t) g_prices)->messages.size);
+    TEST_ASSERT_EQUAL_size_t(1, retransmit_store((uint16_t) g_orders)->messages.size);
+    release_dynamic_array(&acked);
+}
+
+void test_resends_of_every_topic_go_earliest_deadline_first(void) {
+    Transport *receiver = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, RESEND_ADDRESS, "GRP", 1000);
+    Transport *radio = transport_open("rawudp", NULL, TRANSPORT_SENDER, RESEND_ADDRESS, NULL, 1000);
+    TEST_ASSERT_NOT_NULL(receiver);
+    TEST_ASSERT_NOT_NULL(radio);
+
+    // Both missed: the price was sent first and its store is read first, but the order has the earlier deadline
+    uint64_t price_id = track_message(g_prices, ACK_TIMEOUT_MS + 2000);
+    uint64_t order_id = track_message(g_orders, ACK_TIMEOUT_MS + 1000);
+
+    DynamicArray acked;
+    init_dynamic_array(&acked, 1, sizeof(uint64_t));
+    TEST_ASSERT_EQUAL_INT(2, retransmit_stores_ack(&acked, 0, 1, radio));
+
+    uint64_t expected[] = {order_id, price_id};
+    char buffer[256];
+    for (int i = 0; i < 2; i++) {
+        int size = transport_recv(receiver, buffer, sizeof(buffer) - 1, 0);
+        TEST_ASSERT_GREATER_THAN(0, size);
+        buffer[size] = '\0';
+        Message *msg = unmarshal_message(buffer);
+        TEST_ASSERT_NOT_NULL(msg);
+        TEST_ASSERT_EQUAL_UINT64(expected[i], msg->id);
+        release_element(msg, sizeof(Message));
+    }
+
+    // Resent, still awaiting the ACK
+    TEST_ASSERT_EQUAL_size_t(2, retransmit_stores_pending());
+    release_dynamic_array(&acked);
+    transport_close(radio);
+    transport_close(receiver);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_only_the_reliable_topics_have_a_store);
+    RUN_TEST(test_ack_is_applied_to_the_store_of_every_topic);
+    RUN_TEST(test_missed_messages_are_counted_per_topic);
+    RUN_TEST(test_release_acked_from_every_store);
+    RUN_TEST(test_resends_of_every_topic_go_earliest_deadline_first);
+    return UNITY_END();
+}
@@ -0,0 +1,136 @@
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "stats/stats_writer.h"
+#include "stats/stats_columnar.h"
+#include "test_helpers.h"
+
+#define RECORDS 2500
+
+static LatencyRecords g_records;
+static StatsWriter g_writer;
+
+static LatencyRecord make_record(uint64_t i) {
+    LatencyRecord record = test_make_record(1000 + i, 1700000000000000LL + (int64_t) i * 60, 250 + (int64_t) (i % 7));
+    // Kernel timestamps on some records only, with and without hardware
+    if (i % 3 != 0) {
+        record.send_ns = record.send_time * 1000 + 1500;
+        record.kernel_rx_ns = i % 5 != 0 ? record.send_ns + 200000 : 0;
+        record.recv_ns = record.recv_time * 1000 - 300;
+        record.hardware = i % 2 == 0;
+    }
+    return record;
+}
+
+void setUp(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_latency_records(&g_records, RECORDS));
+}
+
+void tearDown(void) {
+    close_stats_writer(&g_writer);
+    release_latency_records(&g_records);
+}
+
+static void write_file(bool components) {
+    StatsWriterOptions options = {.path_fn = test_stats_path, .path_arg = STATS_COLUMNAR_EXTENSION,
+                                  .format = STATS_FORMAT_COLUMNAR, .components = components,
+                                  .metadata = "protocol=rawudp\nnum_threads=2\n"};
+    TEST_ASSERT_EQUAL_INT(0, open_stats_writer(&g_writer, &options));
+
+    // Two flushes: the second file part starts with a short block
+    for (uint64_t i = 0; i < RECORDS; i++) {
+        LatencyRecord record = make_record(i);
+        TEST_ASSERT_TRUE(append_latency_record(&g_records, &record));
+        if (i == 1500) {
+            TEST_ASSERT_EQUAL_INT64(1501, stats_writer_flush(&g_writer, &g_records));
+        }
+    }
+    TEST_ASSERT_EQUAL_INT64(RECORDS - 1501, stats_writer_flush(&g_writer, &g_records));
+    close_stats_writer(&g_writer);
+}
+
+void test_round_trip_with_components(void) {
+    write_file(true);
+
+    StatsReader reader;
+    char *path = test_stats_path(0, STATS_COLUMNAR_EXTENSION);
+    TEST_ASSERT_EQUAL_INT(0, open_stats_reader(&reader, path));
+    free(path);
+    TEST_ASSERT_EQUAL_UINT32(STATS_COLUMNAR_FLAG_COMPONENTS, reader.header->flags);
+    TEST_ASSERT_EQUAL_INT(0, strncmp("protocol=rawudp\nnum_threads=2\n", reader.metadata,
+                                     reader.header->metadata_size));
+
+    LatencyRecord *records = malloc(STATS_BLOCK_RECORDS * sizeof(LatencyRecord));
+    uint64_t i = 0;
+    int blocks = 0;
+    long count;
+    while ((count = stats_reader_next_block(&reader, records, STATS_BLOCK_RECORDS)) > 0) {
+        blocks++;
+        for (long j = 0; j < count; j++, i++) {
+            LatencyRecord expected = make_record(i);
+            TEST_ASSERT_EQUAL_UINT64(expected.id, records[j].id);
+            TEST_ASSERT_EQUAL_INT64(expected.send_time, records[j].send_time);
+            TEST_ASSERT_EQUAL_INT64(expected.recv_time, records[j].recv_time);
+            TEST_ASSERT_EQUAL_INT64(expected.send_ns, records[j].send_ns);
+            TEST_ASSERT_EQUAL_INT64(expected.kernel_rx_ns, records[j].kernel_rx_ns);
+            TEST_ASSERT_EQUAL_INT64(expected.recv_ns, records[j].recv_ns);
+            TEST_ASSERT_EQUAL_INT(expected.hardware && expected.kernel_rx_ns != 0, records[j].hardware);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT64(0, count);
+    TEST_ASSERT_EQUAL_UINT64(RECORDS, i);
+    TEST_ASSERT_EQUAL_INT(3, blocks);  // 1024 + 477 (end of the first flush) + 999
+
+    // A few bytes per record instead of the ~25 of the CSV row
+    TEST_ASSERT_TRUE(reader.size < RECORDS * 12);
+    close_stats_reader(&reader);
+    free(records);
+}
+
+void test_truncated_file_keeps_complete_blocks(void) {
+    write_file(false);
+
+    char *path = test_stats_path(0, STATS_COLUMNAR_EXTENSION);
+    StatsReader reader;
+    TEST_ASSERT_EQUAL_INT(0, open_stats_reader(&reader, path));
+    size_t size = reader.size;
+    close_stats_reader(&reader);
+    TEST_ASSERT_TRUE(size < RECORDS * 6);
+    TEST_ASSERT_EQUAL_INT(0, truncate(path, (off_t) size - 16));
+
+    TEST_ASSERT_EQUAL_INT(0, open_stats_reader(&reader, path));
+    free(path);
+    LatencyRecord *records = malloc(STATS_BLOCK_RECORDS * sizeof(LatencyRecord));
+    uint64_t total = 0;
+    long count;
+    while ((count = stats_reader_next_block(&reader, records, STATS_BLOCK_RECORDS)) > 0) {
+        // Without the components, only the application timestamps
+        TEST_ASSERT_EQUAL_INT64(0, records[0].send_ns);
+        total += (uint64_t) count;
+    }
+    TEST_ASSERT_EQUAL_INT64(-1, count);
+    TEST_ASSERT_EQUAL_UINT64(1501, total);
+    close_stats_reader(&reader);
+    free(records);
+}
+
+void test_reject_other_files(void) {
+    char *path = test_path("other.csv");
+    FILE *file = fopen(path, "w");
+    fputs("id,num,diff\n1,1,0.2500\n1,1,0.2500\n1,1,0.2500\n", file);
+    fclose(file);
+
+    StatsReader reader;
+    TEST_ASSERT_EQUAL_INT(-1, open_stats_reader(&reader, path));
+    free(path);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip_with_components);
+    RUN_TEST(test_truncated_file_keeps_complete_blocks);
+    RUN_TEST(test_reject_other_files);
+    return UNITY_END();
+}
@@ -0,0 +1,125 @@
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "stats/stats_writer.h"
+#include "test_helpers.h"
+
+static LatencyRecords g_records;
+static StatsWriter g_writer;
+
+static void append(uint64_t first, uint64_t count) {
+    for (uint64_t id = first; id < first + count; id++) {
+        LatencyRecord record = test_make_record(id, 1000, 250);
+        TEST_ASSERT_TRUE(append_latency_record(&g_records, &record));
+    }
+}
+
+void setUp(void) {
+    TEST_ASSERT_EQUAL_INT(0, init_latency_records(&g_records, 16));
+}
+
+void tearDown(void) {
+    close_stats_writer(&g_writer);
+    release_latency_records(&g_records);
+}
+
+void test_flush_appends_only_new_records(void) {
+    StatsWriterOptions options = {.path_fn = test_stats_path, .path_arg = ".csv"};
+    TEST_ASSERT_EQUAL_INT(0, open_stats_writer(&g_writer, &options));
+
+    append(1, 2);
+    TEST_ASSERT_EQUAL_INT64(2, stats_writer_flush(&g_writer, &g_records));
+    // The ring is released: the slots are free for the receive threads
+    TEST_ASSERT_EQUAL_UINT64(2, g_records.tail);
+    TEST_ASSERT_EQUAL_INT64(0, stats_writer_flush(&g_writer, &g_records));
+
+    append(3, 1);
+    TEST_ASSERT_EQUAL_INT64(1, stats_writer_flush(&g_writer, &g_records));
+    char *text = test_read_stats_file(0, ".csv");
+    TEST_ASSERT_EQUAL_STRING("id,num,diff\n1,1,0.2500\n2,2,0.2500\n3,3,0.2500\n", text);
+    free(text);
+    TEST_ASSERT_EQUAL_UINT64(3, g_writer.records);
+}
+
+void test_rotation_by_records(void) {
+    StatsWriterOptions options = {.path_fn = test_stats_path, .path_arg = ".csv", .max_file_records = 2};
+    TEST_ASSERT_EQUAL_INT(0, open_stats_writer(&g_writer, &options));
+
+    append(1, 3);
+    TEST_ASSERT_EQUAL_INT64(3, stats_writer_flush(&g_writer, &g_records));
+    close_stats_writer(&g_writer);
+
+    char *text = test_read_stats_file(0, ".csv");
+    TEST_ASSERT_EQUAL_STRING("id,num,diff\n1,1,0.2500\n2,2,0.2500\n", text);
+    free(text);
+    // The numbering restarts in the new file
+    text = test_read_stats_file(1, ".csv");
+    TEST_ASSERT_EQUAL_STRING("id,num,diff\n3,1,0.2500\n", text);
+    free(text);
+    TEST_ASSERT_EQUAL_UINT64(1, g_writer.rotations);
+}
+
+void test_json_complete_after_close(void) {
+    StatsWriterOptions options = {.path_fn = test_stats_path, .path_arg = ".json", .format = STATS_FORMAT_JSON};
+    TEST_ASSERT_EQUAL_INT(0, open_stats_writer(&g_writer, &options));
+
+    append(1, 1);
+    stats_writer_flush(&g_writer, &g_records);
+    append(2, 1);
+    stats_writer_flush(&g_writer, &g_records);
+    close_stats_writer(&g_writer);
+
+    char *text = test_read_stats_file(0, ".json");
+    TEST_ASSERT_EQUAL_STRING("{\n  \"messages\":[\n"
+                             "    {\"id\":1,\"send_time\":1000,\"recv_time\":1250},\n"
+                             "    {\"id\":2,\"send_time\":1000,\"recv_time\":1250}\n  ]\n}\n", text);
+    free(text);
+}
+
+// Every write fails (ENOSPC)
+static char *full_path(int index, void *arg) {
+    return strdup("/dev/full");
+}
+
+void test_failed_write_keeps_records(void) {
+    StatsWriterOptions options = {.path_fn = full_path, .max_file_records = 2};
+    TEST_ASSERT_EQUAL_INT(0, open_stats_writer(&g_writer, &options));
+
+    // Released in the ring, but kept in the staging buffer
+    append(1, 3);
+    TEST_ASSERT_EQUAL_INT64(-1, stats_writer_flush(&g_writer, &g_records));
+    TEST_ASSERT_EQUAL_UINT64(2, g_records.tail);
+    TEST_ASSERT_TRUE(g_writer.staging_used > 0);
+
+    // The disk has space again: the rotation is completed first
+    char *path = test_stats_path(0, ".csv");
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    free(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    dup2(fd, g_writer.fd);
+    close(fd);
+    options.path_fn = test_stats_path;
+    options.path_arg = ".csv";
+    g_writer.options = options;
+    TEST_ASSERT_EQUAL_INT64(1, stats_writer_flush(&g_writer, &g_records));
+    close_stats_writer(&g_writer);
+
+    char *text = test_read_stats_file(0, ".csv");
+    TEST_ASSERT_EQUAL_STRING("id,num,diff\n1,1,0.2500\n2,2,0.2500\n", text);
+    free(text);
+    text = test_read_stats_file(1, ".csv");
+    TEST_ASSERT_EQUAL_STRING("id,num,diff\n3,1,0.2500\n", text);
+    free(text);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_flush_appends_only_new_records);
+    RUN_TEST(test_rotation_by_records);
+    RUN_TEST(test_json_complete_after_close);
+    RUN_TEST(test_failed_write_keeps_records);
+    return UNITY_END();
+}
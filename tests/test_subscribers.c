@@ -0,0 +1,125 @@
+#include "unity.h"
+#include "qos/subscribers.h"
+#include "qos/dynamic_array.h"
+#include "utils/time_utils.h"
+#include "core/counters.h"
+
+#define ACK_INTERVAL_MS 100
+
+static DynamicArray sent;
+
+void setUp(void) {
+    init_dynamic_array(&sent, 10, sizeof(Message));
+    init_subscribers(2, ACK_INTERVAL_MS);
+}
+
+void tearDown(void) {
+    release_dynamic_array(&sent);
+    release_subscribers();
+}
+
+static void add_messages(int count) {
+    for (int i = 0; i < count; i++) {
+        Message *msg = create_element("Message");
+        add_to_dynamic_array(&sent, msg);
+        release_element(msg, sizeof(Message));
+    }
+}
+
+static uint64_t message_id(size_t index) {
+    return ((Message *) sent.data[index])->id;
+}
+
+void test_parse_ack_header(void) {
+    int subscriber_id = -1;
+    TEST_ASSERT_EQUAL_STRING("1|2|3", parse_ack_header("5#1|2|3", &subscriber_id));
+    TEST_ASSERT_EQUAL_INT(5, subscriber_id);
+
+    // Servers that do not send their ID are subscriber 0
+    TEST_ASSERT_EQUAL_STRING("1|2|3", parse_ack_header("1|2|3", &subscriber_id));
+    TEST_ASSERT_EQUAL_INT(0, subscriber_id);
+
+    TEST_ASSERT_EQUAL_INT(-1, subscriber_ack_received(MAX_SUBSCRIBERS));
+}
+
+void test_message_released_when_all_subscribers_acked(void) {
+    reset_message_id();
+    add_messages(3);
+    uint64_t live_mask = live_subscribers_mask(0);
+    TEST_ASSERT_EQUAL_UINT64(0x3, live_mask);
+
+    // Subscriber 0 acknowledges everything: the messages wait for subscriber 1
+    DynamicArray *acked = unmarshal_uint64_array("1|2|3");
+    TEST_ASSERT_EQUAL_INT(0, diff_from_subscriber(&sent, acked, 0, live_mask, NULL));
+    TEST_ASSERT_EQUAL_size_t(3, sent.size);
+    release_dynamic_array(acked);
+    free(acked);
+
+    // Subscriber 1 acknowledges only the first two messages
+    acked = unmarshal_uint64_array("1|2");
+    TEST_ASSERT_EQUAL_INT(0, diff_from_subscriber(&sent, acked, 1, live_mask, NULL));
+    TEST_ASSERT_EQUAL_size_t(1, sent.size);
+    TEST_ASSERT_EQUAL_UINT64(3, message_id(0));
+    TEST_ASSERT_EQUAL_UINT64(0x1, ((Message *) sent.data[0])->ack_mask);
+    release_dynamic_array(acked);
+    free(acked);
+}
+
+void test_dead_subscriber_does_not_hold_messages(void) {
+    reset_message_id();
+    add_messages(2);
+
+    DynamicArray *acked = unmarshal_uint64_array("1|2");
+    diff_from_subscriber(&sent, acked, 0, live_subscribers_mask(0), NULL);
+    release_dynamic_array(acked);
+    free(acked);
+    TEST_ASSERT_EQUAL_size_t(2, sent.size);
+
+    // Subscriber 0 keeps answering, subscriber 1 never does
+    long long future = get_current_timestamp() + 60 * ACK_INTERVAL_MS;
+    g_subscribers[0].detector->state->timestamp = future;
+    uint64_t live_mask = live_subscribers_mask(future);
+    TEST_ASSERT_EQUAL_UINT64(0x1, live_mask);
+
+    TEST_ASSERT_EQUAL_INT(2, release_acked_messages(&sent, live_mask));
+    TEST_ASSERT_EQUAL_size_t(0, sent.size);
+}
+
+void test_expired_message_dropped_instead_of_resent(void) {
+    reset_message_id();
+    counters_reset();
+    add_messages(2);
+    Message *stale = (Message *) sent.data[0];
+    stale->deadline = stale->timestamp + 1000;
+
+    // Neither message is acknowledged by subscriber 0 within the timeout (both subscribers still live)
+    uint64_t live_mask = live_subscribers_mask(0);
+    fake_time = get_current_time_microseconds() + 3000000;
+    DynamicArray *acked = unmarshal_uint64_array("");
+    TEST_ASSERT_EQUAL_INT(2, diff_from_subscriber(&sent, acked, 0, live_mask, NULL));
+    fake_time = 0;
+    release_dynamic_array(acked);
+    free(acked);
+
+    // The message past its deadline is dropped, the other one is kept for the resend
+    TEST_ASSERT_EQUAL_size_t(1, sent.size);
+    TEST_ASSERT_EQUAL_UINT64(2, message_id(0));
+    TEST_ASSERT_EQUAL_UINT64(1, counter_get(COUNTER_DEADLINE_MISSED));
+}
+
+void test_unknown_subscriber_is_registered(void) {
+    TEST_ASSERT_FALSE(g_subscribers[7].registered);
+    TEST_ASSERT_EQUAL_INT(0, subscriber_ack_received(7));
+    TEST_ASSERT_TRUE(g_subscribers[7].registered);
+    TEST_ASSERT_EQUAL_UINT64(0x83, live_subscribers_mask(0));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_ack_header);
+    RUN_TEST(test_message_released_when_all_subscribers_acked);
+    RUN_TEST(test_dead_subscriber_does_not_hold_messages);
+    RUN_TEST(test_expired_message_dropped_instead_of_resent);
+    RUN_TEST(test_unknown_subscriber_is_registered);
+    return UNITY_END();
+}
@@ -0,0 +1,183 @@
+#include "unity.h"
+#include <string.h>
+#include "core/topics.h"
+#include "qos/dynamic_array.h"
+
+static int g_handled[MAX_TOPICS];
+static int g_filtered = 0;
+
+void setUp(void) {
+    memset(g_handled, 0, sizeof(g_handled));
+    g_filtered = 0;
+    init_topics("prices, orders,news", "prices,news");
+}
+
+void tearDown(void) {
+    release_topics();
+}
+
+static int count_frame(uint16_t topic_id, const char *frame, size_t size, void *arg) {
+    (void) frame;
+    (void) size;
+    (void) arg;
+    g_handled[topic_id]++;
+    return topic_id == TOPIC_STOP ? TOPIC_STOP_RECEIVING : TOPIC_CONTINUE;
+}
+
+static int count_filtered(uint16_t topic_id, const char *frame, size_t size, void *arg) {
+    (void) topic_id;
+    (void) frame;
+    (void) size;
+    (void) arg;
+    g_filtered++;
+    return TOPIC_CONTINUE;
+}
+
+void test_topic_ids_follow_configuration_order(void) {
+    TEST_ASSERT_EQUAL_INT(3, user_topic_count());
+    TEST_ASSERT_EQUAL_INT(TOPIC_FIRST_USER, find_topic("prices"));
+    TEST_ASSERT_EQUAL_INT(TOPIC_FIRST_USER + 1, find_topic("orders"));
+    TEST_ASSERT_EQUAL_INT(TOPIC_FIRST_USER + 2, find_topic("news"));
+    TEST_ASSERT_EQUAL_INT(-1, find_topic("weather"));
+    TEST_ASSERT_EQUAL_INT(TOPIC_FIRST_USER + 1, register_topic("orders"));
+
+    TEST_ASSERT_TRUE(g_topics[find_topic("prices")].joined);
+    TEST_ASSERT_FALSE(g_topics[find_topic("orders")].joined);
+
+    TEST_ASSERT_EQUAL_UINT16(TOPIC_FIRST_USER, topic_for_thread(0));
+    TEST_ASSERT_EQUAL_UINT16(TOPIC_FIRST_USER, topic_for_thread(3));
+}
+
+void test_parse_topic(void) {
+    uint16_t topic_id;
+    TEST_ASSERT_EQUAL_STRING("7|100|hello", parse_topic("3:7|100|hello", &topic_id));
+    TEST_ASSERT_EQUAL_UINT16(3, topic_id);
+
+    // Frames without a topic (old format) are on the default topic
+    TEST_ASSERT_EQUAL_STRING("7|100|hello", parse_topic("7|100|hello", &topic_id));
+    TEST_ASSERT_EQUAL_UINT16(TOPIC_DEFAULT, topic_id);
+
+    TEST_ASSERT_EQUAL_STRING("", parse_topic(control_frame(TOPIC_HEARTBEAT), &topic_id));
+    TEST_ASSERT_EQUAL_UINT16(TOPIC_HEARTBEAT, topic_id);
+    TEST_ASSERT_NULL(control_frame(TOPIC_FIRST_USER));
+}
+
+void test_dispatch_by_topic(void) {
+    for (uint16_t i = 0; i < MAX_TOPICS; i++) {
+        set_topic_handler(i, count_frame);
+    }
+    set_filtered_topic_handler(count_filtered);
+
+    TEST_ASSERT_EQUAL_INT(TOPIC_CONTINUE, dispatch_topic("2:1|0|a", 7, NULL));
+    TEST_ASSERT_EQUAL_INT(TOPIC_CONTINUE, dispatch_topic("4:2|0|b", 7, NULL));
+    TEST_ASSERT_EQUAL_INT(TOPIC_CONTINUE, dispatch_topic(control_frame(TOPIC_HEARTBEAT), 2, NULL));
+    TEST_ASSERT_EQUAL_INT(TOPIC_STOP_RECEIVING, dispatch_topic(control_frame(TOPIC_STOP), 2, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, dispatch_topic("9:3|0|c", 7, NULL));
+
+    TEST_ASSERT_EQUAL_INT(1, g_handled[2]);
+    TEST_ASSERT_EQUAL_INT(1, g_handled[4]);
+    TEST_ASSERT_EQUAL_INT(1, g_handled[TOPIC_HEARTBEAT]);
+    TEST_ASSERT_EQUAL_INT(1, g_handled[TOPIC_STOP]);
+
+    // orders (3) is not joined: filtered and counted, never passed to its handler
+    TEST_ASSERT_EQUAL_INT(TOPIC_CONTINUE, dispatch_topic("3:5|0|d", 7, NULL));
+    TEST_ASSERT_EQUAL_INT(0, g_handled[3]);
+    TEST_ASSERT_EQUAL_INT(1, g_filtered);
+    TEST_ASSERT_EQUAL_UINT64(1, topic_stat_get(3, TOPIC_STAT_FILTERED));
+}
+
+void test_message_keeps_topic(void) {
+    Message *msg = create_element("payload");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_EQUAL_UINT16(TOPIC_DEFAULT, msg->topic_id);
+    msg->topic_id = (uint16_t) find_topic("news");
+
+    const char *buffer = marshal_message(msg);
+    TEST_ASSERT_NOT_NULL(buffer);
+    Message *copy = unmarshal_message(buffer);
+    TEST_ASSERT_NOT_NULL(copy);
+    TEST_ASSERT_EQUAL_UINT16(msg->topic_id, copy->topic_id);
+    TEST_ASSERT_EQUAL_UINT64(msg->id, copy->id);
+    TEST_ASSERT_EQUAL_STRING("payload", copy->content);
+
+    free((void *) buffer);
+    release_element(copy, sizeof(Message));
+    release_element(msg, sizeof(Message));
+}
+
+void test_qos_class_of_topics_and_frames(void) {
+    // All reliable by default (and with "*")
+    TEST_ASSERT_EQUAL_INT(QOS_RELIABLE, topic_qos((uint16_t) find_topic("news")));
+    init_topic_qos("orders");
+    TEST_ASSERT_EQUAL_INT(QOS_RELIABLE, topic_qos((uint16_t) find_topic("orders")));
+    TEST_ASSERT_EQUAL_INT(QOS_BEST_EFFORT, topic_qos((uint16_t) find_topic("news")));
+    TEST_ASSERT_EQUAL_INT(QOS_RELIABLE, topic_qos(TOPIC_HEARTBEAT));
+
+    uint16_t topic_id;
+    QosClass qos;
+    TEST_ASSERT_EQUAL_STRING("7|100|hello", parse_topic_qos("4;7|100|hello", &topic_id, &qos));
+    TEST_ASSERT_EQUAL_UINT16(4, topic_id);
+    TEST_ASSERT_EQUAL_INT(QOS_BEST_EFFORT, qos);
+    TEST_ASSERT_EQUAL_STRING("7|100|hello", parse_topic_qos("3:7|100|hello", &topic_id, &qos));
+    TEST_ASSERT_EQUAL_INT(QOS_RELIABLE, qos);
+    TEST_ASSERT_EQUAL_STRING("7|100|hello", parse_topic_qos("7|100|hello", &topic_id, &qos));
+    TEST_ASSERT_EQUAL_UINT16(TOPIC_DEFAULT, topic_id);
+    TEST_ASSERT_EQUAL_INT(QOS_RELIABLE, qos);
+
+    // A best-effort message is dispatched to the handler of its topic like the reliable ones
+    set_topic_handler(4, count_frame);
+    TEST_ASSERT_EQUAL_INT(TOPIC_CONTINUE, dispatch_topic("4;1|0|a", 7, NULL));
+    TEST_ASSERT_EQUAL_INT(1, g_handled[4]);
+}
+
+void test_message_keeps_qos_class(void) {
+    Message *msg = create_element("payload");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_EQUAL_INT(QOS_RELIABLE, msg->qos);
+    msg->topic_id = (uint16_t) find_topic("news");
+    msg->qos = QOS_BEST_EFFORT;
+
+    const char *buffer = marshal_message(msg);
+    TEST_ASSERT_NOT_NULL(buffer);
+    TEST_ASSERT_EQUAL_INT(TOPIC_SEPARATOR_BEST_EFFORT, buffer[1]);
+    Message *copy = unmarshal_message(buffer);
+    TEST_ASSERT_NOT_NULL(copy);
+    TEST_ASSERT_EQUAL_INT(QOS_BEST_EFFORT, copy->qos);
+    TEST_ASSERT_EQUAL_UINT16(msg->topic_id, copy->topic_id);
+    TEST_ASSERT_EQUAL_UINT64(msg->id, copy->id);
+    TEST_ASSERT_EQUAL_STRING("payload", copy->content);
+
+    free((void *) buffer);
+    release_element(copy, sizeof(Message));
+    release_element(msg, sizeof(Message));
+}
+
+void test_topic_deadlines(void) {
+    // No deadline by default
+    TEST_ASSERT_EQUAL_INT64(0, topic_deadline_us((uint16_t) find_topic("prices")));
+
+    // The listed topics override the default, the others keep it
+    TEST_ASSERT_EQUAL_INT(0, init_topic_deadlines("prices:500, news : 20000", 1000000));
+    TEST_ASSERT_EQUAL_INT64(500, topic_deadline_us((uint16_t) find_topic("prices")));
+    TEST_ASSERT_EQUAL_INT64(20000, topic_deadline_us((uint16_t) find_topic("news")));
+    TEST_ASSERT_EQUAL_INT64(1000000, topic_deadline_us((uint16_t) find_topic("orders")));
+    TEST_ASSERT_EQUAL_INT64(0, topic_deadline_us(TOPIC_HEARTBEAT));
+
+    // Unknown topics and invalid deadlines are rejected, the valid entries are still set
+    TEST_ASSERT_EQUAL_INT(-1, init_topic_deadlines("prices:700,unknown:10,orders:x", 0));
+    TEST_ASSERT_EQUAL_INT64(700, topic_deadline_us((uint16_t) find_topic("prices")));
+    TEST_ASSERT_EQUAL_INT64(0, topic_deadline_us((uint16_t) find_topic("orders")));
+    TEST_ASSERT_EQUAL_INT(-1, init_topic_deadlines("prices", 0));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_topic_ids_follow_configuration_order);
+    RUN_TEST(test_parse_topic);
+    RUN_TEST(test_dispatch_by_topic);
+    RUN_TEST(test_message_keeps_topic);
+    RUN_TEST(test_qos_class_of_topics_and_frames);
+    RUN_TEST(test_message_keeps_qos_class);
+    RUN_TEST(test_topic_deadlines);
+    return UNITY_END();
+}
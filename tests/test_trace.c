@@ -0,0 +1,144 @@
+#include "unity.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "core/trace.h"
+#include "test_helpers.h"
+
+#define THREADS 4
+#define THREAD_EVENTS 1000
+
+static char g_path[256];
+
+static int count_occurrences(const char *text, const char *pattern) {
+    int count = 0;
+    for (const char *p = strstr(text, pattern); p != NULL; p = strstr(p + 1, pattern)) {
+        count++;
+    }
+    return count;
+}
+
+void setUp(void) {
+    snprintf(g_path, sizeof(g_path), "%s/trace.json", test_dir());
+}
+
+void tearDown(void) {
+    stop_tracer();
+}
+
+void test_not_started(void) {
+    trace_event(TRACE_SEND, TRACE_PHASE_INSTANT, 1);
+    TEST_ASSERT_NULL(t_trace_ring);
+    TEST_ASSERT_EQUAL_INT64(-1, trace_dump(g_path));
+}
+
+void test_spans_of_a_thread(void) {
+    TEST_ASSERT_EQUAL_INT(0, start_tracer(1000, NULL, "test"));
+    trace_set_thread_name("sender");
+    for (uint64_t i = 0; i < 10; i++) {
+        trace_event(TRACE_MARSHAL, TRACE_PHASE_BEGIN, i);
+        trace_event(TRACE_MARSHAL, TRACE_PHASE_END, i);
+    }
+    TEST_ASSERT_EQUAL_UINT64(1023, t_trace_ring->mask);
+    TEST_ASSERT_EQUAL_INT64(20, trace_dump(g_path));
+
+    char *json = test_read_file(g_path);
+    TEST_ASSERT_EQUAL_INT(0, strncmp(json, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 39));
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"args\":{\"name\":\"sender\"}"));
+    TEST_ASSERT_EQUAL_INT(10, count_occurrences(json, "\"name\":\"marshal\",\"cat\":\"realmq\",\"ph\":\"B\""));
+    TEST_ASSERT_EQUAL_INT(10, count_occurrences(json, "\"name\":\"marshal\",\"cat\":\"realmq\",\"ph\":\"E\""));
+
+    // Timestamps in us, in order
+    double previous = 0, ts;
+    for (const char *p = strstr(json, "\"ts\":"); p != NULL; p = strstr(p + 1, "\"ts\":")) {
+        TEST_ASSERT_EQUAL_INT(1, sscanf(p, "\"ts\":%lf", &ts));
+        TEST_ASSERT_TRUE(ts >= previous);
+        previous = ts;
+    }
+    free(json);
+}
+
+void test_ring_keeps_the_last_events(void) {
+    TEST_ASSERT_EQUAL_INT(0, start_tracer(16, NULL, "test"));
+
+    // The begin of the span is overwritten: its end is left out
+    trace_event(TRACE_ACK_DIFF, TRACE_PHASE_BEGIN, 0);
+    for (uint64_t i = 0; i < 100; i++) {
+        trace_event(TRACE_RECEIVE, TRACE_PHASE_INSTANT, i);
+    }
+    trace_event(TRACE_ACK_DIFF, TRACE_PHASE_END, 0);
+    // The oldest slot may be the one being written: a dump keeps capacity - 1 events
+    TEST_ASSERT_EQUAL_INT64(14, trace_dump(g_path));
+
+    char *json = test_read_file(g_path);
+    TEST_ASSERT_NULL(strstr(json, "\"arg\":85}"));
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"arg\":86}"));
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"arg\":99}"));
+    TEST_ASSERT_NULL(strstr(json, "ack_diff"));
+    free(json);
+}
+
+static void *traced_thread(void *arg) {
+    char name[TRACE_THREAD_NAME_SIZE];
+    snprintf(name, sizeof(name), "worker-%d", *(int *) arg);
+    trace_set_thread_name(name);
+    for (uint64_t i = 0; i < THREAD_EVENTS; i++) {
+        trace_event(TRACE_SEND, TRACE_PHASE_INSTANT, i);
+    }
+    return NULL;
+}
+
+void test_one_ring_per_thread(void) {
+    TEST_ASSERT_EQUAL_INT(0, start_tracer(THREAD_EVENTS, NULL, "test"));
+    pthread_t threads[THREADS];
+    int ids[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, traced_thread, &ids[i]);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    TEST_ASSERT_EQUAL_INT64(THREADS * THREAD_EVENTS, trace_dump(g_path));
+
+    char *json = test_read_file(g_path);
+    TEST_ASSERT_EQUAL_INT(THREADS, count_occurrences(json, "\"name\":\"thread_name\""));
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"args\":{\"name\":\"worker-3\"}"));
+    free(json);
+}
+
+void test_dump_on_signal(void) {
+    char prefix[256];
+    snprintf(prefix, sizeof(prefix), "%s/run", test_dir());
+    TEST_ASSERT_EQUAL_INT(0, start_tracer(64, prefix, "client"));
+    trace_event(TRACE_HEARTBEAT, TRACE_PHASE_INSTANT, 0);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s_client_0.json", prefix);
+    raise(SIGUSR1);
+    for (int i = 0; i < 200 && access(path, F_OK) != 0; i++) {
+        usleep(10000);
+    }
+    TEST_ASSERT_EQUAL_INT(0, access(path, F_OK));
+
+    // The stop writes a last dump
+    stop_tracer();
+    snprintf(path, sizeof(path), "%s_client_1.json", prefix);
+    TEST_ASSERT_EQUAL_INT(0, access(path, F_OK));
+    char *json = test_read_file(path);
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"name\":\"heartbeat\""));
+    free(json);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_not_started);
+    RUN_TEST(test_spans_of_a_thread);
+    RUN_TEST(test_ring_keeps_the_last_events);
+    RUN_TEST(test_one_ring_per_thread);
+    RUN_TEST(test_dump_on_signal);
+    return UNITY_END();
+}
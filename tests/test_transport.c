@@ -0,0 +1,430 @@
+#include "unity.h"
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "transport/transport.h"
+#include "transport/rawudp.h"
+#include "transport/shm_ring.h"
+
+// ------------------------------------------ In-memory backend (for tests) --------------------------------------------
+// Small FIFO queue shared by all the transports of the backend, it implements only the mandatory operations
+
+#define LOOPBACK_QUEUE_SIZE 8
+
+typedef struct {
+    char messages[LOOPBACK_QUEUE_SIZE][64];
+    size_t head;
+    size_t tail;
+    int open_count;
+    int close_count;
+} LoopbackState;
+
+static LoopbackState g_loopback;
+
+static int loopback_open(Transport *transport, const char *address) {
+    (void) address;
+    transport->handle = &g_loopback;
+    g_loopback.open_count++;
+    return 0;
+}
+
+static int loopback_send(Transport *transport, const char *group, const char *data, size_t size, int flags) {
+    (void) group;
+    (void) flags;
+    LoopbackState *state = (LoopbackState *) transport->handle;
+    if (state->tail - state->head == LOOPBACK_QUEUE_SIZE || size >= sizeof(state->messages[0])) {
+        return -1;
+    }
+    memcpy(state->messages[state->tail % LOOPBACK_QUEUE_SIZE], data, size);
+    state->messages[state->tail % LOOPBACK_QUEUE_SIZE][size] = '\0';
+    state->tail++;
+    return (int) size;
+}
+
+static int loopback_recv(Transport *transport, char *buffer, size_t buffer_size, int flags) {
+    (void) flags;
+    LoopbackState *state = (LoopbackState *) transport->handle;
+    if (state->head == state->tail) {
+        return -1;
+    }
+    const char *message = state->messages[state->head % LOOPBACK_QUEUE_SIZE];
+    size_t size = strlen(message);
+    if (size > buffer_size - 1) size = buffer_size - 1;
+    memcpy(buffer, message, size);
+    buffer[size] = '\0';
+    state->head++;
+    return (int) size;
+}
+
+static void loopback_close(Transport *transport) {
+    ((LoopbackState *) transport->handle)->close_count++;
+}
+
+static const TransportOps loopback_transport = {
+        .name = "loopback",
+        .open = loopback_open,
+        .send = loopback_send,
+        .recv = loopback_recv,
+        .close = loopback_close
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void setUp(void) {
+    memset(&g_loopback, 0, sizeof(g_loopback));
+}
+
+void tearDown(void) {
+}
+
+void test_find_builtin_transports(void) {
+    TEST_ASSERT_EQUAL_PTR(&zmq_tcp_transport, find_transport("tcp"));
+    TEST_ASSERT_EQUAL_PTR(&zmq_udp_transport, find_transport("udp"));
+    TEST_ASSERT_EQUAL_PTR(&zmq_inproc_transport, find_transport("inproc"));
+    TEST_ASSERT_EQUAL_PTR(&rawudp_transport, find_transport("rawudp"));
+    TEST_ASSERT_EQUAL_PTR(&uring_transport, find_transport("uring"));
+    TEST_ASSERT_EQUAL_PTR(&shm_transport, find_transport("shm"));
+    TEST_ASSERT_NULL(find_transport("carrier-pigeon"));
+    TEST_ASSERT_NULL(find_transport(NULL));
+    TEST_ASSERT_NULL(transport_open("carrier-pigeon", NULL, TRANSPORT_SENDER, "x://127.0.0.1:1", NULL, 100));
+}
+
+void test_register_transport(void) {
+    TEST_ASSERT_EQUAL_INT(0, register_transport(&loopback_transport));
+    TEST_ASSERT_EQUAL_INT(-1, register_transport(&loopback_transport));     // Name already used
+    TEST_ASSERT_EQUAL_INT(-1, register_transport(&zmq_udp_transport));      // Built-in name
+    TEST_ASSERT_EQUAL_PTR(&loopback_transport, find_transport("loopback"));
+}
+
+void test_batch_fallbacks(void) {
+    Transport *transport = transport_open("loopback", NULL, TRANSPORT_RECEIVER, "loopback://0", "GRP", 100);
+    TEST_ASSERT_NOT_NULL(transport);
+    TEST_ASSERT_EQUAL_INT(1, g_loopback.open_count);
+    TEST_ASSERT_EQUAL_STRING("GRP", transport->group);
+    TEST_ASSERT_FALSE(transport_supports_batch(transport));
+    TEST_ASSERT_EQUAL_INT(-1, transport_poll_fd(transport));
+
+    // send_batch falls back to one send per message
+    const char *messages[] = {"first", "second", "third"};
+    size_t sizes[] = {5, 6, 5};
+    TEST_ASSERT_EQUAL_INT(3, transport_send_batch(transport, "GRP", messages, sizes, 3));
+
+    // recv_batch falls back to one message per call
+    TransportMessage received[4];
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_INT(1, transport_recv_batch(transport, received, 4, 0));
+        TEST_ASSERT_EQUAL_size_t(sizes[i], received[0].size);
+        TEST_ASSERT_EQUAL_STRING(messages[i], received[0].data);
+        TEST_ASSERT_EQUAL_STRING("GRP", received[0].group);
+    }
+    TEST_ASSERT_EQUAL_INT(-1, transport_recv_batch(transport, received, 4, TRANSPORT_DONTWAIT));
+
+    transport_close(transport);
+    TEST_ASSERT_EQUAL_INT(1, g_loopback.close_count);
+}
+
+static int g_freed = 0;
+
+static void count_free(void *data, void *hint) {
+    (void) data;
+    (void) hint;
+    g_freed++;
+}
+
+void test_zero_copy_fallback(void) {
+    Transport *transport = transport_open("loopback", NULL, TRANSPORT_SENDER, "loopback://0", NULL, 100);
+    TEST_ASSERT_NOT_NULL(transport);
+
+    char payload[] = "zero-copy";
+    TEST_ASSERT_EQUAL_INT((int) strlen(payload),
+                          transport_send_zero_copy(transport, "GRP", payload, strlen(payload), count_free, NULL));
+    TEST_ASSERT_EQUAL_INT(1, g_freed);  // The buffer is released once the backend copied it
+
+    char buffer[32];
+    TEST_ASSERT_EQUAL_INT((int) strlen(payload), transport_recv(transport, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING(payload, buffer);
+
+    transport_close(transport);
+}
+
+void test_rawudp_batch_roundtrip(void) {
+    Transport *receiver = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, "rawudp://127.0.0.1:5757", "GRP", 500);
+    Transport *sender = transport_open("rawudp", NULL, TRANSPORT_SENDER, "rawudp://127.0.0.1:5757", NULL, 500);
+    TEST_ASSERT_NOT_NULL(receiver);
+    TEST_ASSERT_NOT_NULL(sender);
+    TEST_ASSERT_TRUE(transport_supports_batch(sender));
+    TEST_ASSERT_TRUE(transport_poll_fd(receiver) >= 0);
+
+    // Datagrams of other groups are dropped by the receiver
+    TEST_ASSERT_TRUE(transport_send(sender, "OTHER", "ignored", 7, 0) >= 0);
+
+    const char *messages[] = {"one", "two", "three", "four"};
+    size_t sizes[] = {3, 3, 5, 4};
+    TEST_ASSERT_EQUAL_INT(4, transport_send_batch(sender, "GRP", messages, sizes, 4));
+
+    // The received messages are valid until the next receive, so they are checked batch by batch
+    TransportMessage received[8];
+    int count = 0;
+    while (count < 4) {
+        int rc = transport_recv_batch(receiver, received, 8, 0);
+        TEST_ASSERT_TRUE(rc > 0);
+        for (int i = 0; i < rc; i++, count++) {
+            TEST_ASSERT_EQUAL_size_t(sizes[count], received[i].size);
+            TEST_ASSERT_EQUAL_MEMORY(messages[count], received[i].data, sizes[count]);
+            TEST_ASSERT_EQUAL_STRING("GRP", received[i].group);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(4, count);
+
+    transport_close(sender);
+    transport_close(receiver);
+}
+
+void test_rawudp_batch_size_is_bounded(void) {
+    // The send arrays of a batch are on the stack: a huge batch size is reduced, the batches are split
+    RawUdpSocket *sender = rawudp_create("rawudp://127.0.0.1:5763", 500, NULL, 1 << 20);
+    TEST_ASSERT_NOT_NULL(sender);
+    TEST_ASSERT_EQUAL_size_t(RAWUDP_MAX_BATCH_SIZE, sender->batch_size);
+
+    const char *messages[RAWUDP_MAX_BATCH_SIZE + 1];
+    size_t sizes[RAWUDP_MAX_BATCH_SIZE + 1];
+    for (int i = 0; i <= RAWUDP_MAX_BATCH_SIZE; i++) {
+        messages[i] = "x";
+        sizes[i] = 1;
+    }
+    TEST_ASSERT_EQUAL_INT(RAWUDP_MAX_BATCH_SIZE + 1,
+                          rawudp_send_batch(sender, "GRP", messages, sizes, RAWUDP_MAX_BATCH_SIZE + 1));
+    rawudp_close(sender);
+}
+
+void test_rawudp_batch_errors(void) {
+    // No receiver: the ICMP port unreachable of a batch is reported on the next one, that is retried
+    RawUdpSocket *sender = rawudp_create("rawudp://127.0.0.1:5764", 500, NULL, 0);
+    TEST_ASSERT_NOT_NULL(sender);
+    const char *messages[] = {"one", "two"};
+    size_t sizes[] = {3, 3};
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_INT(2, rawudp_send_batch(sender, "GRP", messages, sizes, 2));
+        usleep(10000);
+    }
+
+    // A message larger than a datagram fails the batch before anything is sent
+    size_t large_sizes[] = {3, RAWUDP_MAX_FRAME_SIZE};
+    uint64_t syscalls = sender->syscalls;
+    TEST_ASSERT_EQUAL_INT(-1, rawudp_send_batch(sender, "GRP", messages, large_sizes, 2));
+    TEST_ASSERT_EQUAL_INT(EMSGSIZE, errno);
+    TEST_ASSERT_EQUAL_UINT64(syscalls, sender->syscalls);
+    rawudp_close(sender);
+}
+
+void test_uring_interoperates_with_rawudp(void) {
+    // Without io_uring support the backend falls back to rawudp, the wire format is the same in both cases
+    Transport *receiver = transport_open("uring", NULL, TRANSPORT_RECEIVER, "uring://127.0.0.1:5758", "GRP", 500);
+    Transport *sender = transport_open("rawudp", NULL, TRANSPORT_SENDER, "rawudp://127.0.0.1:5758", NULL, 500);
+    TEST_ASSERT_NOT_NULL(receiver);
+    TEST_ASSERT_NOT_NULL(sender);
+    TEST_ASSERT_TRUE(transport_syscall_count(receiver) >= 0);
+
+    const char *messages[] = {"alpha", "beta", "gamma"};
+    size_t sizes[] = {5, 4, 5};
+    TEST_ASSERT_EQUAL_INT(3, transport_send_batch(sender, "GRP", messages, sizes, 3));
+
+    char buffer[64];
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_INT((int) sizes[i], transport_recv(receiver, buffer, sizeof(buffer), 0));
+        TEST_ASSERT_EQUAL_STRING(messages[i], buffer);
+    }
+
+    transport_close(sender);
+    transport_close(receiver);
+}
+
+void test_rawudp_multicast_fanout(void) {
+    // Two subscribers of the same multicast group receive the single send of the client
+    Transport *first = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, "rawudp://239.255.0.1:5761", "GRP", 500);
+    Transport *second = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, "rawudp://239.255.0.1:5761", "GRP", 500);
+    Transport *sender = transport_open("rawudp", NULL, TRANSPORT_SENDER, "rawudp://239.255.0.1:5761", NULL, 500);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_NOT_NULL(sender);
+
+    TEST_ASSERT_EQUAL_INT(9, transport_send(sender, "GRP", "multicast", 9, 0));
+
+    char buffer[64];
+    TEST_ASSERT_EQUAL_INT(9, transport_recv(first, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING("multicast", buffer);
+    TEST_ASSERT_EQUAL_INT(9, transport_recv(second, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING("multicast", buffer);
+
+    transport_close(sender);
+    transport_close(second);
+    transport_close(first);
+}
+
+void test_rawudp_kernel_timestamps(void) {
+    Transport *receiver = transport_open("rawudp", NULL, TRANSPORT_RECEIVER, "rawudp://127.0.0.1:5762", "GRP", 500);
+    Transport *sender = transport_open("rawudp", NULL, TRANSPORT_SENDER, "rawudp://127.0.0.1:5762", NULL, 500);
+    TEST_ASSERT_NOT_NULL(receiver);
+    TEST_ASSERT_NOT_NULL(sender);
+
+    // Without timestamping only the send time of the header is known
+    TransportTimestamps timestamps;
+    TEST_ASSERT_EQUAL_INT(-1, transport_recv_timestamps(receiver, &timestamps));
+    TEST_ASSERT_EQUAL_INT(0, transport_enable_timestamping(receiver));
+    TEST_ASSERT_EQUAL_INT(0, transport_enable_timestamping(sender));
+
+    TEST_ASSERT_EQUAL_INT(5, transport_send(sender, "GRP", "stamp", 5, 0));
+    char buffer[64];
+    TEST_ASSERT_EQUAL_INT(5, transport_recv(receiver, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_INT(0, transport_recv_timestamps(receiver, &timestamps));
+
+    // Send call <= kernel receive <= application receive (same host, same clock)
+    TEST_ASSERT_TRUE(timestamps.send_ns > 0);
+    TEST_ASSERT_TRUE(timestamps.kernel_rx_ns >= timestamps.send_ns);
+    TEST_ASSERT_TRUE(timestamps.user_rx_ns >= timestamps.kernel_rx_ns);
+
+    // The kernel send timestamp is queued by the time the datagram is received
+    RawUdpSocket *socket = (RawUdpSocket *) sender->handle;
+    rawudp_collect_tx_timestamps(socket);
+    TEST_ASSERT_EQUAL_UINT64(1, socket->tx_timestamps);
+
+    // The zmq backends do not support it
+    Transport zmq = {.ops = &zmq_udp_transport};
+    TEST_ASSERT_EQUAL_INT(-1, transport_enable_timestamping(&zmq));
+
+    transport_close(sender);
+    transport_close(receiver);
+}
+
+void test_shm_roundtrip(void) {
+    // The sender opens first: both sides can create the ring
+    Transport *sender = transport_open("shm", NULL, TRANSPORT_SENDER, "shm://127.0.0.1:5759", NULL, 100);
+    Transport *receiver = transport_open("shm", NULL, TRANSPORT_RECEIVER, "shm://127.0.0.1:5759", "GRP", 100);
+    TEST_ASSERT_NOT_NULL(sender);
+    TEST_ASSERT_NOT_NULL(receiver);
+    TEST_ASSERT_TRUE(transport_supports_batch(sender));
+
+    char buffer[64];
+    TEST_ASSERT_EQUAL_INT(-1, transport_recv(receiver, buffer, sizeof(buffer), TRANSPORT_DONTWAIT));
+
+    // Messages of other groups are dropped by the receiver
+    TEST_ASSERT_EQUAL_INT(7, transport_send(sender, "OTHER", "ignored", 7, 0));
+    TEST_ASSERT_EQUAL_INT(5, transport_send(sender, "GRP", "hello", 5, 0));
+    TEST_ASSERT_EQUAL_INT(5, transport_recv(receiver, buffer, sizeof(buffer), 0));
+    TEST_ASSERT_EQUAL_STRING("hello", buffer);
+
+    const char *messages[] = {"one", "two", "three"};
+    size_t sizes[] = {3, 3, 5};
+    TEST_ASSERT_EQUAL_INT(3, transport_send_batch(sender, "GRP", messages, sizes, 3));
+    TransportMessage received[8];
+    TEST_ASSERT_EQUAL_INT(3, transport_recv_batch(receiver, received, 8, 0));
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_size_t(sizes[i], received[i].size);
+        TEST_ASSERT_EQUAL_MEMORY(messages[i], received[i].data, sizes[i]);
+        TEST_ASSERT_EQUAL_STRING("GRP", received[i].group);
+    }
+
+    // Messages bigger than a slot are refused
+    static char big[SHM_RING_SLOT_SIZE];
+    TEST_ASSERT_EQUAL_INT(-1, transport_send(sender, "GRP", big, sizeof(big), 0));
+
+    transport_close(sender);
+    transport_close(receiver);
+}
+
+void test_shm_full_ring_and_wraparound(void) {
+    Transport *receiver = transport_open("shm", NULL, TRANSPORT_RECEIVER, "shm://127.0.0.1:5760", "GRP", 100);
+    Transport *sender = transport_open("shm", NULL, TRANSPORT_SENDER, "shm://127.0.0.1:5760", NULL, 0);
+    TEST_ASSERT_NOT_NULL(receiver);
+    TEST_ASSERT_NOT_NULL(sender);
+
+    // Fill the ring: the next send fails instead of overwriting unread messages
+    char message[16];
+    for (int i = 0; i < SHM_RING_SLOT_COUNT; i++) {
+        int size = snprintf(message, sizeof(message), "%d", i);
+        TEST_ASSERT_EQUAL_INT(size, transport_send(sender, "GRP", message, (size_t) size, TRANSPORT_DONTWAIT));
+    }
+    TEST_ASSERT_EQUAL_INT(-1, transport_send(sender, "GRP", "full", 4, TRANSPORT_DONTWAIT));
+
+    // Drain half of the ring, then write across the end of the slots
+    char buffer[16];
+    for (int i = 0; i < SHM_RING_SLOT_COUNT / 2; i++) {
+        TEST_ASSERT_TRUE(transport_recv(receiver, buffer, sizeof(buffer), 0) > 0);
+        TEST_ASSERT_EQUAL_INT(i, atoi(buffer));
+    }
+    for (int i = SHM_RING_SLOT_COUNT; i < SHM_RING_SLOT_COUNT + SHM_RING_SLOT_COUNT / 2; i++) {
+        int size = snprintf(message, sizeof(message), "%d", i);
+        TEST_ASSERT_EQUAL_INT(size, transport_send(sender, "GRP", message, (size_t) size, TRANSPORT_DONTWAIT));
+    }
+    for (int i = SHM_RING_SLOT_COUNT / 2; i < SHM_RING_SLOT_COUNT + SHM_RING_SLOT_COUNT / 2; i++) {
+        TEST_ASSERT_TRUE(transport_recv(receiver, buffer, sizeof(buffer), 0) > 0);
+        TEST_ASSERT_EQUAL_INT(i, atoi(buffer));
+    }
+
+    transport_close(sender);
+    transport_close(receiver);
+}
+
+#define SHM_LARGE_BATCH (SHM_RING_SLOT_COUNT + SHM_RING_SLOT_COUNT / 2)
+
+static void *drain_ring(void *arg) {
+    ShmRing *consumer = arg;
+    RawUdpDatagram datagrams[64];
+    int received = 0;
+    while (received < SHM_LARGE_BATCH) {
+        int count = shm_ring_receive_batch(consumer, datagrams, 64, -1);
+        for (int i = 0; i < count; i++, received++) {
+            TEST_ASSERT_EQUAL_INT(received, atoi(datagrams[i].data));
+        }
+    }
+    shm_ring_release(consumer);
+    return NULL;
+}
+
+void test_shm_batch_larger_than_ring(void) {
+    ShmRing *consumer = shm_ring_open("shm://127.0.0.1:5761", "GRP");
+    ShmRing *producer = shm_ring_open("shm://127.0.0.1:5761", NULL);
+    TEST_ASSERT_NOT_NULL(consumer);
+    TEST_ASSERT_NOT_NULL(producer);
+
+    // The consumer is asleep on the futex (no timeout) before the batch fills the ring
+    pthread_t thread;
+    pthread_create(&thread, NULL, drain_ring, consumer);
+    usleep(50000);
+
+    static char messages[SHM_LARGE_BATCH][8];
+    static const char *msgs[SHM_LARGE_BATCH];
+    static size_t sizes[SHM_LARGE_BATCH];
+    for (int i = 0; i < SHM_LARGE_BATCH; i++) {
+        sizes[i] = (size_t) snprintf(messages[i], sizeof(messages[i]), "%d", i) + 1;
+        msgs[i] = messages[i];
+    }
+    alarm(10);      // A lost wakeup hangs both sides: fail the run instead
+    TEST_ASSERT_EQUAL_INT(SHM_LARGE_BATCH, shm_ring_send_batch(producer, "GRP", msgs, sizes, SHM_LARGE_BATCH, -1));
+    pthread_join(thread, NULL);
+    alarm(0);
+
+    shm_ring_close(producer);
+    shm_ring_close(consumer);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_find_builtin_transports);
+    RUN_TEST(test_register_transport);
+    RUN_TEST(test_batch_fallbacks);
+    RUN_TEST(test_zero_copy_fallback);
+    RUN_TEST(test_rawudp_batch_roundtrip);
+    RUN_TEST(test_rawudp_batch_size_is_bounded);
+    RUN_TEST(test_rawudp_batch_errors);
+    RUN_TEST(test_uring_interoperates_with_rawudp);
+    RUN_TEST(test_rawudp_multicast_fanout);
+    RUN_TEST(test_rawudp_kernel_timestamps);
+    RUN_TEST(test_shm_roundtrip);
+    RUN_TEST(test_shm_full_ring_and_wraparound);
+    RUN_TEST(test_shm_batch_larger_than_ring);
+    return UNITY_END();
+}